@@ -0,0 +1,137 @@
+/**
+ * @file allocshim.cpp Library that counts the allocations made by each thread
+ * of the benchmarks.
+ *
+ * This is built as a shared library of its own, not into the test binary. See
+ * allocshim.h for how it is used.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "allocshim.h"
+
+// glibc's own allocator entry points. Calling these (rather than looking up
+// the next malloc with dlsym) avoids recursing into the shim while it starts
+// up, as dlsym itself allocates.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t nmemb, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+// Per-thread counters. These are plain thread-locals (rather than shared
+// atomics) so that counting doesn't add contention to the multi-threaded
+// benchmarks. The initial-exec model means reading them never allocates.
+#define THREAD_COUNTER static __thread __attribute__((tls_model("initial-exec"))) uint64_t
+
+THREAD_COUNTER allocations = 0;
+THREAD_COUNTER allocated_bytes = 0;
+THREAD_COUNTER freed_bytes = 0;
+
+static inline void count_allocation(void* ptr)
+{
+  if (ptr != NULL)
+  {
+    ++allocations;
+    allocated_bytes += malloc_usable_size(ptr);
+  }
+}
+
+static inline void count_free(void* ptr)
+{
+  if (ptr != NULL)
+  {
+    freed_bytes += malloc_usable_size(ptr);
+  }
+}
+
+extern "C"
+{
+
+void* malloc(size_t size)
+{
+  void* ptr = __libc_malloc(size);
+  count_allocation(ptr);
+  return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+  void* ptr = __libc_calloc(nmemb, size);
+  count_allocation(ptr);
+  return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  count_free(ptr);
+  void* new_ptr = __libc_realloc(ptr, size);
+
+  if ((new_ptr == NULL) && (size != 0))
+  {
+    // The original block is still allocated.
+    allocated_bytes += malloc_usable_size(ptr);
+  }
+
+  count_allocation(new_ptr);
+  return new_ptr;
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  void* ptr = __libc_memalign(alignment, size);
+  count_allocation(ptr);
+  return ptr;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+  void* ptr = __libc_memalign(alignment, size);
+
+  if (ptr == NULL)
+  {
+    return ENOMEM;
+  }
+
+  count_allocation(ptr);
+  *memptr = ptr;
+  return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  return memalign(alignment, size);
+}
+
+void free(void* ptr)
+{
+  count_free(ptr);
+  __libc_free(ptr);
+}
+
+uint64_t allocshim_thread_allocations()
+{
+  return allocations;
+}
+
+uint64_t allocshim_thread_allocated_bytes()
+{
+  return allocated_bytes;
+}
+
+uint64_t allocshim_thread_freed_bytes()
+{
+  return freed_bytes;
+}
+
+}
@@ -0,0 +1,34 @@
+/**
+ * @file allocshim.h Interface between the allocation counting shim library
+ * and the benchmarks that read it.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef ALLOCSHIM_H__
+#define ALLOCSHIM_H__
+
+/// The allocation shim is a library that `make bench` preloads (with
+/// LD_PRELOAD) into the test binary. It wraps malloc and friends - and so
+/// operator new, which is built on malloc - and counts the allocations and
+/// frees each thread makes. The functional tests and valgrind runs don't load
+/// it, so they use the normal allocator untouched.
+///
+/// The benchmarks find the counters by looking up these functions at run
+/// time, and see zero counts if the shim isn't loaded.
+namespace AllocShim
+{
+  /// The names of the functions that return the calling thread's counts: the
+  /// number of allocations, the usable size of the memory they returned, and
+  /// the usable size of the memory it has freed.
+  static const char* const ALLOCATIONS_FN = "allocshim_thread_allocations";
+  static const char* const ALLOCATED_BYTES_FN = "allocshim_thread_allocated_bytes";
+  static const char* const FREED_BYTES_FN = "allocshim_thread_freed_bytes";
+}
+
+#endif
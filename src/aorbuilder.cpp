@@ -0,0 +1,76 @@
+/**
+ * @file aorbuilder.cpp Helpers for building realistic AoRs in tests and
+ * benchmarks.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "aorbuilder.h"
+#include "astaire_aor_store.h"
+
+#include <time.h>
+
+AoR* build_aor(const std::string& aor_id,
+               int num_bindings,
+               int num_subscriptions,
+               int expiry)
+{
+  AoR* aor = new AoR(aor_id);
+  int expires = time(nullptr) + expiry;
+
+  for (int ii = 0; ii < num_bindings; ++ii)
+  {
+    std::string index = std::to_string(ii);
+    std::string binding_id = "<urn:uuid:00000000-0000-0000-0000-b665231f1" +
+                             std::to_string(100 + ii) + ">:1";
+
+    Binding* b = new Binding(aor_id);
+    b->_uri = "sip:6505550231@192.91.191." + std::to_string(ii % 256) +
+              ":59934;transport=tcp;ob";
+    b->_cid = "gfYHoZGaFaRNxhlV0WIwoS-f91NoJ2gq" + index;
+    b->_cseq = 17038 + ii;
+    b->_expires = expires;
+    b->_priority = 0;
+    b->_path_headers.push_back("<sip:abcdefgh@bono-1.cw-ngv.com;lr>");
+    b->_path_uris.push_back("sip:abcdefgh@bono-1.cw-ngv.com;lr");
+    b->_params["+sip.instance"] = "\"<urn:uuid:00000000-0000-0000-0000-b4dd32817622>\"";
+    b->_params["reg-id"] = "1";
+    b->_params["+sip.ice"] = "";
+    b->_private_id = "6505550231@cw-ngv.com";
+    b->_emergency_registration = false;
+    aor->_bindings[binding_id] = b;
+  }
+
+  for (int ii = 0; ii < num_subscriptions; ++ii)
+  {
+    std::string index = std::to_string(ii);
+
+    Subscription* s = new Subscription();
+    s->_req_uri = "sip:5102175698@192.91.191.29:59934;transport=tcp";
+    s->_from_uri = "<" + aor_id + ">";
+    s->_from_tag = "4321" + index;
+    s->_to_uri = "<" + aor_id + ">";
+    s->_to_tag = "1234" + index;
+    s->_cid = "xyzabc@192.91.191.29-" + index;
+    s->_route_uris.push_back("sip:abcdefgh@bono-1.cw-ngv.com;lr");
+    s->_expires = expires;
+    aor->_subscriptions["subscription" + index] = s;
+  }
+
+  aor->_notify_cseq = 1;
+  aor->_scscf_uri = "sip:scscf.sprout.homedomain:5058;transport=TCP";
+
+  return aor;
+}
+
+
+std::string aor_to_json(AoR* aor)
+{
+  AstaireAoRStore::JsonSerializerDeserializer serializer;
+  return serializer.serialize_aor(aor);
+}
@@ -0,0 +1,40 @@
+/**
+ * @file aorbuilder.h Helpers for building realistic AoRs in tests and
+ * benchmarks.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef AORBUILDER_H__
+#define AORBUILDER_H__
+
+#include <string>
+
+#include "aor.h"
+
+/// Build an AoR with the specified number of bindings and subscriptions. Each
+/// binding and subscription is populated with the sort of values a real
+/// S-CSCF would store (contact URIs with parameters, path headers, route sets
+/// etc.) so that the serialized size is representative of production.
+///
+/// @param [in] aor_id            - The AoR ID (IMPU).
+/// @param [in] num_bindings      - The number of bindings to add.
+/// @param [in] num_subscriptions - The number of subscriptions to add.
+/// @param [in] expiry            - The number of seconds from now at which the
+///                                 bindings and subscriptions should expire.
+///
+/// @return The new AoR. The caller is responsible for freeing it.
+AoR* build_aor(const std::string& aor_id,
+               int num_bindings,
+               int num_subscriptions = 0,
+               int expiry = 3600);
+
+/// Serialize an AoR to JSON, in the format AstaireAoRStore writes to memcached.
+std::string aor_to_json(AoR* aor);
+
+#endif
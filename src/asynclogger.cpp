@@ -0,0 +1,304 @@
+/**
+ * @file asynclogger.cpp Logger that hands log lines off to a background
+ * thread.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+
+#include "asynclogger.h"
+
+/// Single-producer/single-consumer ring buffer of log lines. Each line is
+/// stored as a 4 byte length, the time it was written, and the line itself.
+/// The head and tail are byte counts that only ever increase; their difference
+/// is the number of bytes in use.
+class AsyncLogger::Ring
+{
+public:
+  Ring(size_t size) : _buffer(size), _head(0), _tail(0), retired(false) {}
+
+  /// Add a line. Only called by the owning thread.
+  void push(const struct timespec& ts, const char* data, uint32_t len)
+  {
+    // A line that could never fit is truncated rather than blocking forever.
+    len = std::min(len, (uint32_t)(_buffer.size() / 2));
+    size_t needed = sizeof(len) + sizeof(ts) + len;
+    size_t head = _head.load(std::memory_order_relaxed);
+
+    while (_buffer.size() - (head - _tail.load(std::memory_order_acquire)) < needed)
+    {
+      // The buffer is full. Wait for the background thread to empty it.
+      std::this_thread::yield();
+    }
+
+    copy_in(head, &len, sizeof(len));
+    copy_in(head + sizeof(len), &ts, sizeof(ts));
+    copy_in(head + sizeof(len) + sizeof(ts), data, len);
+    _head.store(head + needed, std::memory_order_release);
+  }
+
+  /// Take the oldest line. Only called by the thread draining the buffers.
+  ///
+  /// @return false if the buffer was empty.
+  bool pop(struct timespec& ts, std::string& line)
+  {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail == _head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    uint32_t len;
+    copy_out(tail, &len, sizeof(len));
+    copy_out(tail + sizeof(len), &ts, sizeof(ts));
+    line.resize(len);
+    copy_out(tail + sizeof(len) + sizeof(ts), &line[0], len);
+    _tail.store(tail + sizeof(len) + sizeof(ts) + len,
+                std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const
+  {
+    return (_tail.load(std::memory_order_acquire) ==
+            _head.load(std::memory_order_acquire));
+  }
+
+private:
+  void copy_in(size_t pos, const void* src, size_t len)
+  {
+    size_t offset = pos % _buffer.size();
+    size_t first = std::min(len, _buffer.size() - offset);
+    memcpy(&_buffer[offset], src, first);
+    memcpy(&_buffer[0], (const char*)src + first, len - first);
+  }
+
+  void copy_out(size_t pos, void* dst, size_t len) const
+  {
+    size_t offset = pos % _buffer.size();
+    size_t first = std::min(len, _buffer.size() - offset);
+    memcpy(dst, &_buffer[offset], first);
+    memcpy((char*)dst + first, &_buffer[0], len - first);
+  }
+
+  std::vector<char> _buffer;
+  std::atomic<size_t> _head;
+  std::atomic<size_t> _tail;
+
+public:
+  /// Set when the owning thread exits. Once a retired buffer is empty it can
+  /// be discarded.
+  std::atomic<bool> retired;
+};
+
+/// The calling thread's buffer, and the ID of the logger it belongs to.
+struct ThreadRing
+{
+  uint64_t logger_id = 0;
+  std::shared_ptr<AsyncLogger::Ring> ring;
+
+  ~ThreadRing()
+  {
+    if (ring)
+    {
+      ring->retired = true;
+    }
+  }
+};
+
+static thread_local ThreadRing _thread_ring;
+static std::atomic<uint64_t> _next_logger_id(1);
+
+/// Prefix a line with the time it was written, in the same format the sink
+/// would use if it timestamped the line itself.
+static void add_timestamp(const struct timespec& ts,
+                          const char* data,
+                          std::string& out)
+{
+  struct tm dt;
+  gmtime_r(&ts.tv_sec, &dt);
+
+  char timestamp[64];
+  snprintf(timestamp, sizeof(timestamp),
+           "%2.2d-%2.2d-%4.4d %2.2d:%2.2d:%2.2d.%3.3d UTC ",
+           dt.tm_mday, (dt.tm_mon + 1), (dt.tm_year + 1900),
+           dt.tm_hour, dt.tm_min, dt.tm_sec, (int)(ts.tv_nsec / 1000000));
+
+  out = timestamp;
+  out += data;
+}
+
+AsyncLogger::AsyncLogger(Logger* sink, size_t buffer_size) :
+  Logger(),
+  _id(_next_logger_id++),
+  _sink(sink),
+  _buffer_size(buffer_size),
+  _writers(0),
+  _stopping(false)
+{
+  // Lines are timestamped when they are written, not when the sink gets them,
+  // so take over timestamping from the sink (if it does it at all).
+  _sink_flags = _sink->get_flags();
+  _sink->set_flags(_sink_flags & ~Logger::ADD_TIMESTAMPS);
+
+  _thread = std::thread(&AsyncLogger::run, this);
+}
+
+
+AsyncLogger::~AsyncLogger()
+{
+  // Stop new lines going into the buffers, then wait for any writer that got
+  // in first. The background thread keeps draining meanwhile, so a writer
+  // waiting for space in a full buffer can finish.
+  _stopping = true;
+
+  while (_writers > 0)
+  {
+    std::this_thread::yield();
+  }
+
+  _thread.join();
+
+  // Pass on anything written since the background thread last looked.
+  flush();
+
+  _sink->set_flags(_sink_flags);
+}
+
+
+AsyncLogger::Ring* AsyncLogger::get_ring()
+{
+  if (_thread_ring.logger_id != _id)
+  {
+    if (_thread_ring.ring)
+    {
+      // The thread has a buffer from a previous logger. Let that logger
+      // discard it.
+      _thread_ring.ring->retired = true;
+    }
+
+    _thread_ring.logger_id = _id;
+    _thread_ring.ring = std::make_shared<Ring>(_buffer_size);
+
+    std::lock_guard<std::mutex> lock(_rings_lock);
+    _rings.push_back(_thread_ring.ring);
+  }
+
+  return _thread_ring.ring.get();
+}
+
+
+void AsyncLogger::write(const char* data)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  // Register as a writer before checking whether we are stopping. The
+  // destructor does the reverse - sets _stopping, then waits for the writers -
+  // so either this thread sees _stopping, or the destructor waits for this
+  // line to be buffered before it does the final drain.
+  ++_writers;
+
+  if (_stopping)
+  {
+    --_writers;
+
+    // The background thread is going away, so write the line directly.
+    std::lock_guard<std::mutex> lock(_drain_lock);
+    write_to_sink(ts, data);
+    return;
+  }
+
+  get_ring()->push(ts, data, strlen(data));
+  --_writers;
+}
+
+
+void AsyncLogger::write_to_sink(const struct timespec& ts, const char* data)
+{
+  if (_sink_flags & Logger::ADD_TIMESTAMPS)
+  {
+    std::string line;
+    add_timestamp(ts, data, line);
+    _sink->write(line.c_str());
+  }
+  else
+  {
+    _sink->write(data);
+  }
+}
+
+
+void AsyncLogger::flush()
+{
+  drain();
+  _sink->flush();
+}
+
+
+bool AsyncLogger::drain()
+{
+  std::lock_guard<std::mutex> drain_lock(_drain_lock);
+
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock(_rings_lock);
+    rings = _rings;
+  }
+
+  bool found = false;
+  struct timespec ts;
+  std::string line;
+
+  for (const std::shared_ptr<Ring>& ring : rings)
+  {
+    while (ring->pop(ts, line))
+    {
+      write_to_sink(ts, line.c_str());
+      found = true;
+    }
+  }
+
+  // Discard the buffers of threads that have exited, once they are empty.
+  // Check the retired flag first - once it is set the thread can't write any
+  // more lines.
+  std::lock_guard<std::mutex> lock(_rings_lock);
+  _rings.erase(std::remove_if(_rings.begin(),
+                              _rings.end(),
+                              [](const std::shared_ptr<Ring>& ring)
+                              {
+                                return ring->retired && ring->empty();
+                              }),
+               _rings.end());
+
+  return found;
+}
+
+
+void AsyncLogger::run()
+{
+  while (!_stopping)
+  {
+    if (drain())
+    {
+      _sink->flush();
+    }
+    else
+    {
+      // Nothing to do. Poll again shortly rather than have writers signal us,
+      // which would put a system call back on their path.
+      usleep(1000);
+    }
+  }
+}
@@ -0,0 +1,113 @@
+/**
+ * @file asynclogger.h Logger that hands log lines off to a background thread.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef ASYNCLOGGER_H__
+#define ASYNCLOGGER_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <time.h>
+
+#include "logger.h"
+
+/// Logger that takes log lines from the threads that write them and passes
+/// them to another ("sink") logger on a background thread.
+///
+/// Each writing thread gets its own single-producer/single-consumer ring
+/// buffer, so writing a line is a copy into memory that only that thread
+/// writes to - there is no lock and no I/O on the caller's thread. The time is
+/// read on the caller's thread and stored with the line, so lines carry the
+/// time they were written rather than the time they reached the sink. The rest
+/// of the work (formatting the timestamp, locking and writing the line out)
+/// happens on the background thread.
+///
+/// The async logger turns off the sink's own timestamps for as long as it
+/// wraps it, and adds its own instead if the sink had them turned on.
+///
+/// Lines from a single thread are passed to the sink in order. Lines from
+/// different threads may be interleaved differently from the order they were
+/// written in. No lines are dropped - if a thread fills its buffer it waits for
+/// the background thread to make space.
+class AsyncLogger : public Logger
+{
+public:
+  /// The size of each thread's buffer, in bytes.
+  static const size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+
+  /// Constructor.
+  ///
+  /// @param [in] sink        - The logger to pass lines to. This is not owned
+  ///                           by the async logger, and must outlive it.
+  /// @param [in] buffer_size - The size of each thread's buffer.
+  AsyncLogger(Logger* sink, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+
+  /// Destructor. Any lines still buffered are passed to the sink first.
+  virtual ~AsyncLogger();
+
+  /// Buffer a log line. Called by Log on the thread writing the log.
+  virtual void write(const char* data);
+
+  /// Pass all lines written so far to the sink, then flush the sink.
+  virtual void flush();
+
+  /// A buffer owned by one writing thread.
+  class Ring;
+
+private:
+  /// Returns the calling thread's buffer, creating it if necessary.
+  Ring* get_ring();
+
+  /// Pass a line to the sink, timestamped with the time it was written.
+  void write_to_sink(const struct timespec& ts, const char* data);
+
+  /// Pass everything in the buffers to the sink.
+  ///
+  /// @return Whether there was anything to pass on.
+  bool drain();
+
+  /// Background thread function.
+  void run();
+
+  /// Unique ID of this logger. Threads use this to tell whether the buffer
+  /// they have belongs to this logger or to an earlier one.
+  uint64_t _id;
+
+  Logger* _sink;
+  size_t _buffer_size;
+
+  /// The sink's flags before the async logger took over its timestamping.
+  int _sink_flags;
+
+  /// All the thread buffers. The lock is only needed to add a buffer (once per
+  /// writing thread) or to take a copy of the list - not to write to a buffer.
+  /// The buffers are shared with the threads that own them, so that a buffer
+  /// stays valid for as long as either side needs it.
+  std::mutex _rings_lock;
+  std::vector<std::shared_ptr<Ring>> _rings;
+
+  /// Each buffer must only have one reader at a time. Normally this is the
+  /// background thread, but flush() also drains the buffers.
+  std::mutex _drain_lock;
+
+  /// The number of threads part way through write(). The destructor waits for
+  /// this to reach 0 after setting _stopping, so that no line is added to a
+  /// buffer after the final drain.
+  std::atomic<int> _writers;
+
+  std::atomic<bool> _stopping;
+  std::thread _thread;
+};
+
+#endif
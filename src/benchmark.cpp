@@ -0,0 +1,237 @@
+/**
+ * @file benchmark.cpp Helpers for timing operations and reporting results in
+ * the FV benchmarks.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "benchmark.h"
+#include "allocshim.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/// The allocation shim's counter functions (see allocshim.h). These are NULL
+/// unless the shim is preloaded, which `make bench` does.
+typedef uint64_t (*CounterFn)();
+
+static CounterFn _allocations_fn =
+  (CounterFn)dlsym(RTLD_DEFAULT, AllocShim::ALLOCATIONS_FN);
+static CounterFn _allocated_bytes_fn =
+  (CounterFn)dlsym(RTLD_DEFAULT, AllocShim::ALLOCATED_BYTES_FN);
+static CounterFn _freed_bytes_fn =
+  (CounterFn)dlsym(RTLD_DEFAULT, AllocShim::FREED_BYTES_FN);
+
+static uint64_t read_counter(CounterFn fn)
+{
+  return (fn != NULL) ? fn() : 0;
+}
+
+namespace Benchmark
+{
+
+uint64_t now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+
+uint64_t thread_cpu_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+
+uint64_t thread_allocations()
+{
+  return read_counter(_allocations_fn);
+}
+
+
+uint64_t thread_allocated_bytes()
+{
+  return read_counter(_allocated_bytes_fn);
+}
+
+
+uint64_t thread_freed_bytes()
+{
+  return read_counter(_freed_bytes_fn);
+}
+
+
+uint64_t thread_voluntary_switches()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_THREAD, &usage);
+  return usage.ru_nvcsw;
+}
+
+
+int env_int(const std::string& name, int default_value)
+{
+  char* val = getenv(name.c_str());
+  return (val != NULL) ? atoi(val) : default_value;
+}
+
+
+void LatencyRecorder::record(uint64_t sample_us)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _samples.push_back(sample_us);
+  _sorted = false;
+}
+
+
+void LatencyRecorder::merge(const LatencyRecorder& other)
+{
+  std::vector<uint64_t> samples;
+  {
+    std::lock_guard<std::mutex> lock(other._lock);
+    samples = other._samples;
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _samples.insert(_samples.end(), samples.begin(), samples.end());
+  _sorted = false;
+}
+
+
+void LatencyRecorder::clear()
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _samples.clear();
+  _sorted = true;
+}
+
+
+size_t LatencyRecorder::count() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _samples.size();
+}
+
+
+uint64_t LatencyRecorder::total() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  uint64_t total = 0;
+  for (uint64_t sample : _samples)
+  {
+    total += sample;
+  }
+  return total;
+}
+
+
+double LatencyRecorder::mean() const
+{
+  size_t samples = count();
+  return (samples == 0) ? 0.0 : (double)total() / samples;
+}
+
+
+uint64_t LatencyRecorder::max() const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return _samples.empty() ? 0 : *std::max_element(_samples.begin(), _samples.end());
+}
+
+
+uint64_t LatencyRecorder::percentile(double pct) const
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (_samples.empty())
+  {
+    return 0;
+  }
+
+  if (!_sorted)
+  {
+    std::sort(_samples.begin(), _samples.end());
+    _sorted = true;
+  }
+
+  // Use the nearest-rank method, so that the 100th percentile is the maximum
+  // and small sample sets don't interpolate between values.
+  size_t rank = (size_t)((pct / 100.0) * _samples.size() + 0.5);
+  rank = std::min(std::max(rank, (size_t)1), _samples.size());
+  return _samples[rank - 1];
+}
+
+
+void LatencyRecorder::report(const std::string& name) const
+{
+  Benchmark::report(name + "_count", (uint64_t)count());
+  Benchmark::report(name + "_mean_us", mean());
+  Benchmark::report(name + "_p50_us", percentile(50));
+  Benchmark::report(name + "_p99_us", percentile(99));
+  Benchmark::report(name + "_p999_us", percentile(99.9));
+  Benchmark::report(name + "_max_us", max());
+}
+
+
+void CostRecorder::report(const std::string& name) const
+{
+  size_t ops = _latency.count();
+
+  _latency.report(name);
+  Benchmark::report(name + "_cpu_mean_us", _cpu.mean());
+  Benchmark::report(name + "_cpu_p99_us", _cpu.percentile(99));
+  Benchmark::report(name + "_allocations_per_op",
+                    (ops == 0) ? 0.0 : (double)_allocations / ops);
+  Benchmark::report(name + "_allocated_bytes_per_op",
+                    (ops == 0) ? 0.0 : (double)_allocated_bytes / ops);
+}
+
+
+void report(const std::string& name, const std::string& value)
+{
+  printf("[ BENCHMARK] %s = %s\n", name.c_str(), value.c_str());
+
+  // gtest writes properties out as XML attributes, so only allow characters
+  // that are valid in an attribute name.
+  std::string key = name;
+  for (char& c : key)
+  {
+    if (!isalnum(c))
+    {
+      c = '_';
+    }
+  }
+  ::testing::Test::RecordProperty(key, value);
+}
+
+
+void report(const std::string& name, uint64_t value)
+{
+  report(name, std::to_string(value));
+}
+
+
+void report(const std::string& name, double value)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.2f", value);
+  report(name, std::string(buf));
+}
+
+}
@@ -0,0 +1,143 @@
+/**
+ * @file benchmark.h Helpers for timing operations and reporting results in the
+ * FV benchmarks.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef BENCHMARK_H__
+#define BENCHMARK_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+/// Benchmarks are ordinary gtest testcases whose fixture name contains
+/// "Benchmark". They are excluded from `make test` (and from the valgrind run)
+/// and are run with `make bench` instead.
+namespace Benchmark
+{
+  /// Returns the current time from a monotonic clock, in microseconds.
+  uint64_t now_us();
+
+  /// Returns the CPU time used by the calling thread, in microseconds.
+  uint64_t thread_cpu_us();
+
+  /// Returns the number of allocations made by the calling thread, the total
+  /// size of the memory they returned, and the total size of the memory the
+  /// thread has freed. These are counted by the allocation shim (see
+  /// allocshim.h), which only `make bench` loads - without it they are all 0.
+  uint64_t thread_allocations();
+  uint64_t thread_allocated_bytes();
+  uint64_t thread_freed_bytes();
+
+  /// Returns the number of times the calling thread has given up the CPU
+  /// voluntarily - e.g. to wait for a lock held by another thread. Comparing
+  /// this across thread counts gives an indication of lock contention.
+  uint64_t thread_voluntary_switches();
+
+  /// Returns the value of the given environment variable as an integer, or
+  /// the default if the variable is not set. This allows the size of a
+  /// benchmark run to be scaled without recompiling.
+  int env_int(const std::string& name, int default_value);
+
+  /// Simple stopwatch that starts timing when constructed.
+  class Stopwatch
+  {
+  public:
+    Stopwatch() : _start_us(now_us()) {}
+
+    /// Restart the stopwatch.
+    void restart() { _start_us = now_us(); }
+
+    /// Returns the number of microseconds since the stopwatch was started.
+    uint64_t elapsed_us() const { return now_us() - _start_us; }
+
+  private:
+    uint64_t _start_us;
+  };
+
+  /// Collects latency samples and calculates summary statistics over them.
+  /// Samples may be recorded from multiple threads at once.
+  class LatencyRecorder
+  {
+  public:
+    /// Record a single sample, in microseconds.
+    void record(uint64_t sample_us);
+
+    /// Add all the samples from another recorder to this one.
+    void merge(const LatencyRecorder& other);
+
+    /// Discard all samples.
+    void clear();
+
+    size_t count() const;
+    uint64_t total() const;
+    double mean() const;
+    uint64_t max() const;
+
+    /// Returns the sample at the given percentile (0-100).
+    uint64_t percentile(double pct) const;
+
+    /// Report the summary statistics for this recorder under the given name.
+    void report(const std::string& name) const;
+
+  private:
+    mutable std::mutex _lock;
+    mutable std::vector<uint64_t> _samples;
+    mutable bool _sorted = true;
+  };
+
+  /// Records the latency, CPU time and allocations of each of a series of
+  /// operations run on the calling thread.
+  class CostRecorder
+  {
+  public:
+    CostRecorder() : _allocations(0), _allocated_bytes(0) {}
+
+    /// Run and measure a single operation.
+    template <class F> void measure(F fn)
+    {
+      uint64_t allocations = thread_allocations();
+      uint64_t allocated_bytes = thread_allocated_bytes();
+      uint64_t cpu_us = thread_cpu_us();
+      uint64_t start_us = now_us();
+
+      fn();
+
+      // Take all the readings before recording any of them, as recording
+      // can itself allocate.
+      uint64_t end_us = now_us();
+      uint64_t end_cpu_us = thread_cpu_us();
+      _allocations += thread_allocations() - allocations;
+      _allocated_bytes += thread_allocated_bytes() - allocated_bytes;
+      _latency.record(end_us - start_us);
+      _cpu.record(end_cpu_us - cpu_us);
+    }
+
+    /// Report the latency and CPU time distributions, and the mean number of
+    /// allocations and bytes allocated per operation.
+    void report(const std::string& name) const;
+
+  private:
+    LatencyRecorder _latency;
+    LatencyRecorder _cpu;
+    uint64_t _allocations;
+    uint64_t _allocated_bytes;
+  };
+
+  /// Report a single benchmark result. Results are printed to stdout and
+  /// recorded as properties of the running test, so that they also appear in
+  /// the gtest XML output.
+  void report(const std::string& name, const std::string& value);
+  void report(const std::string& name, uint64_t value);
+  void report(const std::string& name, double value);
+}
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * @file binaryaorserializer.cpp Compact binary encoding for AoRs.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "log.h"
+#include "binaryaorserializer.h"
+
+const std::string BinaryAoRSerializer::MARKER("\0CWB", 4);
+const uint8_t BinaryAoRSerializer::VERSION;
+
+namespace
+{
+
+/// Helper for writing the binary format.
+class Encoder
+{
+public:
+  Encoder(std::string& out) : _out(out) {}
+
+  void add_uint(uint64_t value)
+  {
+    while (value >= 0x80)
+    {
+      _out.push_back((char)((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+
+    _out.push_back((char)value);
+  }
+
+  void add_int(int64_t value)
+  {
+    add_uint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+  }
+
+  void add_bool(bool value)
+  {
+    _out.push_back(value ? 1 : 0);
+  }
+
+  void add_string(const std::string& value)
+  {
+    add_uint(value.size());
+    _out.append(value);
+  }
+
+  template <class T> void add_strings(const T& values)
+  {
+    add_uint(values.size());
+
+    for (const std::string& value : values)
+    {
+      add_string(value);
+    }
+  }
+
+  void add_string_map(const std::map<std::string, std::string>& values)
+  {
+    add_uint(values.size());
+
+    for (const std::pair<const std::string, std::string>& value : values)
+    {
+      add_string(value.first);
+      add_string(value.second);
+    }
+  }
+
+private:
+  std::string& _out;
+};
+
+/// Helper for reading the binary format. Each method returns false if the
+/// data runs out or is malformed.
+class Decoder
+{
+public:
+  Decoder(const std::string& in, size_t offset) : _in(in), _pos(offset) {}
+
+  bool get_uint(uint64_t& value)
+  {
+    value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (_pos >= _in.size())
+      {
+        return false;
+      }
+
+      uint8_t byte = _in[_pos++];
+      value |= (uint64_t)(byte & 0x7f) << shift;
+
+      if ((byte & 0x80) == 0)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  template <class T> bool get_int(T& value)
+  {
+    uint64_t raw;
+
+    if (!get_uint(raw))
+    {
+      return false;
+    }
+
+    value = (T)((int64_t)(raw >> 1) ^ -(int64_t)(raw & 1));
+    return true;
+  }
+
+  bool get_bool(bool& value)
+  {
+    if (_pos >= _in.size())
+    {
+      return false;
+    }
+
+    value = (_in[_pos++] != 0);
+    return true;
+  }
+
+  bool get_string(std::string& value)
+  {
+    uint64_t len;
+
+    if ((!get_uint(len)) || (len > _in.size() - _pos))
+    {
+      return false;
+    }
+
+    value.assign(_in, _pos, len);
+    _pos += len;
+    return true;
+  }
+
+  template <class T> bool get_strings(T& values)
+  {
+    uint64_t count;
+
+    if (!get_uint(count))
+    {
+      return false;
+    }
+
+    for (uint64_t ii = 0; ii < count; ++ii)
+    {
+      std::string value;
+
+      if (!get_string(value))
+      {
+        return false;
+      }
+
+      values.push_back(value);
+    }
+
+    return true;
+  }
+
+  bool get_string_map(std::map<std::string, std::string>& values)
+  {
+    uint64_t count;
+
+    if (!get_uint(count))
+    {
+      return false;
+    }
+
+    for (uint64_t ii = 0; ii < count; ++ii)
+    {
+      std::string key;
+      std::string value;
+
+      if ((!get_string(key)) || (!get_string(value)))
+      {
+        return false;
+      }
+
+      values[key] = value;
+    }
+
+    return true;
+  }
+
+  bool at_end() const { return (_pos == _in.size()); }
+
+private:
+  const std::string& _in;
+  size_t _pos;
+};
+
+}
+
+
+std::string BinaryAoRSerializer::serialize_aor(AoR* aor_data)
+{
+  std::string out = MARKER;
+  out.push_back((char)VERSION);
+  Encoder enc(out);
+
+  enc.add_int(aor_data->_notify_cseq);
+  enc.add_string(aor_data->_timer_id);
+  enc.add_string(aor_data->_scscf_uri);
+
+  enc.add_uint(aor_data->_bindings.size());
+
+  for (const std::pair<const std::string, Binding*>& item : aor_data->_bindings)
+  {
+    Binding* b = item.second;
+    enc.add_string(item.first);
+    enc.add_string(b->_uri);
+    enc.add_string(b->_cid);
+    enc.add_int(b->_cseq);
+    enc.add_int(b->_expires);
+    enc.add_int(b->_priority);
+    enc.add_string_map(b->_params);
+    enc.add_strings(b->_path_headers);
+    enc.add_strings(b->_path_uris);
+    enc.add_string(b->_private_id);
+    enc.add_bool(b->_emergency_registration);
+  }
+
+  enc.add_uint(aor_data->_subscriptions.size());
+
+  for (const std::pair<const std::string, Subscription*>& item : aor_data->_subscriptions)
+  {
+    Subscription* sub = item.second;
+    enc.add_string(item.first);
+    enc.add_string(sub->_req_uri);
+    enc.add_string(sub->_from_uri);
+    enc.add_string(sub->_from_tag);
+    enc.add_string(sub->_to_uri);
+    enc.add_string(sub->_to_tag);
+    enc.add_string(sub->_cid);
+    enc.add_strings(sub->_route_uris);
+    enc.add_int(sub->_expires);
+  }
+
+  std::vector<std::string> uris = aor_data->_associated_uris.get_all_uris();
+  enc.add_uint(uris.size());
+
+  for (const std::string& uri : uris)
+  {
+    enc.add_string(uri);
+    enc.add_bool(aor_data->_associated_uris.is_impu_barred(uri));
+  }
+
+  enc.add_string_map(aor_data->_associated_uris._distinct_to_wildcard);
+
+  return out;
+}
+
+
+AoR* BinaryAoRSerializer::deserialize_aor(const std::string& aor_id,
+                                          const std::string& s)
+{
+  if (!is_binary(s))
+  {
+    return _json.deserialize_aor(aor_id, s);
+  }
+
+  if ((uint8_t)s[MARKER.size()] != VERSION)
+  {
+    TRC_DEBUG("Unsupported binary AoR version %d", (uint8_t)s[MARKER.size()]);
+    return NULL;
+  }
+
+  Decoder dec(s, MARKER.size() + 1);
+  AoR* aor = new AoR(aor_id);
+  bool ok = (dec.get_int(aor->_notify_cseq) &&
+             dec.get_string(aor->_timer_id) &&
+             dec.get_string(aor->_scscf_uri));
+
+  uint64_t count = 0;
+  ok = ok && dec.get_uint(count);
+
+  for (uint64_t ii = 0; ok && (ii < count); ++ii)
+  {
+    std::string id;
+    Binding* b = new Binding(aor_id);
+    ok = (dec.get_string(id) &&
+          dec.get_string(b->_uri) &&
+          dec.get_string(b->_cid) &&
+          dec.get_int(b->_cseq) &&
+          dec.get_int(b->_expires) &&
+          dec.get_int(b->_priority) &&
+          dec.get_string_map(b->_params) &&
+          dec.get_strings(b->_path_headers) &&
+          dec.get_strings(b->_path_uris) &&
+          dec.get_string(b->_private_id) &&
+          dec.get_bool(b->_emergency_registration));
+
+    // The AoR owns the binding from here, so it is freed even if decoding
+    // fails.
+    delete aor->_bindings[id];
+    aor->_bindings[id] = b;
+  }
+
+  ok = ok && dec.get_uint(count);
+
+  for (uint64_t ii = 0; ok && (ii < count); ++ii)
+  {
+    std::string id;
+    Subscription* sub = new Subscription();
+    ok = (dec.get_string(id) &&
+          dec.get_string(sub->_req_uri) &&
+          dec.get_string(sub->_from_uri) &&
+          dec.get_string(sub->_from_tag) &&
+          dec.get_string(sub->_to_uri) &&
+          dec.get_string(sub->_to_tag) &&
+          dec.get_string(sub->_cid) &&
+          dec.get_strings(sub->_route_uris) &&
+          dec.get_int(sub->_expires));
+
+    delete aor->_subscriptions[id];
+    aor->_subscriptions[id] = sub;
+  }
+
+  ok = ok && dec.get_uint(count);
+
+  for (uint64_t ii = 0; ok && (ii < count); ++ii)
+  {
+    std::string uri;
+    bool barred;
+    ok = (dec.get_string(uri) && dec.get_bool(barred));
+
+    if (ok)
+    {
+      aor->_associated_uris.add_uri(uri, barred);
+    }
+  }
+
+  std::map<std::string, std::string> wildcards;
+  ok = ok && dec.get_string_map(wildcards);
+
+  for (const std::pair<const std::string, std::string>& item : wildcards)
+  {
+    aor->_associated_uris.add_wildcard_mapping(item.second, item.first);
+  }
+
+  if ((!ok) || (!dec.at_end()))
+  {
+    TRC_DEBUG("Failed to deserialize binary AoR for %s", aor_id.c_str());
+    delete aor; aor = NULL;
+  }
+
+  return aor;
+}
+
+
+bool BinaryAoRSerializer::is_binary(const std::string& s)
+{
+  return ((s.size() > MARKER.size()) &&
+          (s.compare(0, MARKER.size(), MARKER) == 0));
+}
@@ -0,0 +1,63 @@
+/**
+ * @file binaryaorserializer.h Compact binary encoding for AoRs.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef BINARYAORSERIALIZER_H__
+#define BINARYAORSERIALIZER_H__
+
+#include <string>
+#include <stdint.h>
+
+#include "aor.h"
+#include "astaire_aor_store.h"
+
+/// Serializes AoRs to a compact binary format, as an alternative to the JSON
+/// written by AstaireAoRStore::JsonSerializerDeserializer. It has the same
+/// interface as the JSON serializer, so the two can be swapped.
+///
+/// Binary values are written as:
+///
+///   <MARKER (4 bytes)> <version (1 byte)> <fields>
+///
+/// Integers are written as varints (zigzag encoded if they can be negative),
+/// and strings and lists as a varint length followed by their contents.
+///
+/// The marker begins with a NUL byte, which never appears at the start of a
+/// JSON value. Values without the marker are deserialized as JSON, so AoRs
+/// written before the binary format was enabled (or by a node with it
+/// disabled) can still be read.
+class BinaryAoRSerializer
+{
+public:
+  static const std::string MARKER;
+
+  /// The version of the format that this serializer writes. Values written
+  /// with a different version are rejected.
+  static const uint8_t VERSION = 1;
+
+  /// Serialize an AoR.
+  std::string serialize_aor(AoR* aor_data);
+
+  /// Deserialize an AoR, in either the binary or the JSON format.
+  ///
+  /// @return The AoR, or NULL if the value couldn't be deserialized. The
+  ///         caller is responsible for freeing it.
+  AoR* deserialize_aor(const std::string& aor_id, const std::string& s);
+
+  std::string name() { return "BINARY"; }
+
+  /// Returns whether a value is in the binary format.
+  static bool is_binary(const std::string& s);
+
+private:
+  AstaireAoRStore::JsonSerializerDeserializer _json;
+};
+
+#endif
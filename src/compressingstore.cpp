@@ -0,0 +1,162 @@
+/**
+ * @file compressingstore.cpp Store that transparently compresses large values.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <arpa/inet.h>
+#include <cstring>
+
+#include "log.h"
+#include "compressingstore.h"
+
+const size_t CompressingStore::DEFAULT_THRESHOLD;
+const size_t CompressingStore::MAX_DECODED_LEN;
+const std::string CompressingStore::MARKER("\0CWZ", 4);
+
+/// Length of the header written before the compressed data.
+static const size_t HEADER_LEN = 8;
+
+CompressingStore::CompressingStore(Store* store, size_t threshold, int level) :
+  bytes_in(0),
+  bytes_stored(0),
+  _store(store),
+  _threshold(threshold),
+  _level(level)
+{
+}
+
+
+std::string CompressingStore::encode(const std::string& data)
+{
+  if ((data.size() < _threshold) || (data.size() > MAX_DECODED_LEN))
+  {
+    return data;
+  }
+
+  uLongf compressed_len = compressBound(data.size());
+  std::string encoded(HEADER_LEN + compressed_len, '\0');
+
+  int rc = compress2((Bytef*)&encoded[HEADER_LEN],
+                     &compressed_len,
+                     (const Bytef*)data.data(),
+                     data.size(),
+                     _level);
+
+  if ((rc != Z_OK) || (HEADER_LEN + compressed_len >= data.size()))
+  {
+    // Either compression failed (which shouldn't happen as we sized the buffer
+    // with compressBound) or it didn't save anything. Either way just store
+    // the value uncompressed.
+    TRC_DEBUG("Not compressing %zu byte value (rc = %d)", data.size(), rc);
+    return data;
+  }
+
+  uint32_t len = htonl(data.size());
+  memcpy(&encoded[0], MARKER.data(), MARKER.size());
+  memcpy(&encoded[MARKER.size()], &len, sizeof(len));
+  encoded.resize(HEADER_LEN + compressed_len);
+
+  TRC_DEBUG("Compressed %zu byte value to %zu bytes", data.size(), encoded.size());
+  return encoded;
+}
+
+
+bool CompressingStore::decode(const std::string& stored, std::string& data)
+{
+  if ((stored.size() < HEADER_LEN) ||
+      (stored.compare(0, MARKER.size(), MARKER) != 0))
+  {
+    // Not a compressed value.
+    data = stored;
+    return true;
+  }
+
+  uint32_t len;
+  memcpy(&len, &stored[MARKER.size()], sizeof(len));
+  uLongf uncompressed_len = ntohl(len);
+
+  if (uncompressed_len > MAX_DECODED_LEN)
+  {
+    // Don't trust the header enough to allocate this much.
+    TRC_ERROR("Compressed value claims to be %lu bytes, over the limit of %zu",
+              uncompressed_len,
+              MAX_DECODED_LEN);
+    return false;
+  }
+
+  std::string uncompressed(uncompressed_len, '\0');
+  int rc = uncompress((Bytef*)&uncompressed[0],
+                      &uncompressed_len,
+                      (const Bytef*)&stored[HEADER_LEN],
+                      stored.size() - HEADER_LEN);
+
+  if ((rc != Z_OK) || (uncompressed_len != ntohl(len)))
+  {
+    TRC_ERROR("Failed to decompress %zu byte value (rc = %d)", stored.size(), rc);
+    return false;
+  }
+
+  data.swap(uncompressed);
+  return true;
+}
+
+
+Store::Status CompressingStore::get_data(const std::string& table,
+                                         const std::string& key,
+                                         std::string& data,
+                                         uint64_t& cas,
+                                         SAS::TrailId trail)
+{
+  std::string stored;
+  Store::Status status = _store->get_data(table, key, stored, cas, trail);
+
+  if ((status == Store::Status::OK) && !decode(stored, data))
+  {
+    status = Store::Status::ERROR;
+  }
+
+  return status;
+}
+
+
+Store::Status CompressingStore::set_data(const std::string& table,
+                                         const std::string& key,
+                                         const std::string& data,
+                                         uint64_t cas,
+                                         int expiry,
+                                         SAS::TrailId trail)
+{
+  std::string encoded = encode(data);
+  bytes_in += data.size();
+  bytes_stored += encoded.size();
+
+  return _store->set_data(table, key, encoded, cas, expiry, trail);
+}
+
+
+Store::Status CompressingStore::set_data_without_cas(const std::string& table,
+                                                     const std::string& key,
+                                                     const std::string& data,
+                                                     int expiry,
+                                                     SAS::TrailId trail)
+{
+  std::string encoded = encode(data);
+  bytes_in += data.size();
+  bytes_stored += encoded.size();
+
+  return _store->set_data_without_cas(table, key, encoded, expiry, trail);
+}
+
+
+Store::Status CompressingStore::delete_data(const std::string& table,
+                                            const std::string& key,
+                                            SAS::TrailId trail)
+{
+  return _store->delete_data(table, key, trail);
+}
@@ -0,0 +1,109 @@
+/**
+ * @file compressingstore.h Store that transparently compresses large values.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef COMPRESSINGSTORE_H__
+#define COMPRESSINGSTORE_H__
+
+#include <string>
+#include <atomic>
+#include <zlib.h>
+
+#include "store.h"
+
+/// Store that sits in front of another store (typically a
+/// TopologyNeutralMemcachedStore) and compresses values above a size
+/// threshold before writing them.
+///
+/// Compressed values are written with a format marker:
+///
+///   <MARKER (4 bytes)> <uncompressed length (4 bytes, network order)> <zlib data>
+///
+/// The marker begins with a NUL byte, which never appears at the start of the
+/// JSON or plain text values written by existing code. Values without the
+/// marker are returned unchanged, so data written before compression was
+/// enabled (or by a node with it disabled) can still be read.
+class CompressingStore : public Store
+{
+public:
+  /// Values smaller than this are not worth compressing - the zlib header and
+  /// our marker eat most of the saving.
+  static const size_t DEFAULT_THRESHOLD = 512;
+
+  /// The largest value that is compressed, and so the largest length that
+  /// decode will accept from a header. This is well above the largest value
+  /// memcached stores by default (1MB), and stops a corrupt header making
+  /// decode allocate up to 4GB.
+  static const size_t MAX_DECODED_LEN = 16 * 1024 * 1024;
+
+  /// Constructor.
+  ///
+  /// @param [in] store     - The underlying store. This is not owned by the
+  ///                         compressing store.
+  /// @param [in] threshold - Values at least this many bytes long are
+  ///                         compressed.
+  /// @param [in] level     - The zlib compression level to use.
+  CompressingStore(Store* store,
+                   size_t threshold = DEFAULT_THRESHOLD,
+                   int level = Z_DEFAULT_COMPRESSION);
+  virtual ~CompressingStore() {}
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+  bool has_servers() { return _store->has_servers(); }
+
+  /// Encode a value for writing to the underlying store. This compresses the
+  /// value if it is over the threshold (and no more than MAX_DECODED_LEN) and
+  /// compression actually saves space.
+  std::string encode(const std::string& data);
+
+  /// Decode a value read from the underlying store.
+  ///
+  /// @return Whether the value could be decoded. This is always true for
+  ///         uncompressed values, and false for compressed values whose
+  ///         header gives a length over MAX_DECODED_LEN.
+  bool decode(const std::string& stored, std::string& data);
+
+  /// Counts of the bytes passed to set_data and the bytes actually written to
+  /// the underlying store. Benchmarks use these to calculate the compression
+  /// ratio.
+  std::atomic<uint64_t> bytes_in;
+  std::atomic<uint64_t> bytes_stored;
+
+  static const std::string MARKER;
+
+private:
+  Store* _store;
+  size_t _threshold;
+  int _level;
+};
+
+#endif
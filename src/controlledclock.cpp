@@ -0,0 +1,94 @@
+/**
+ * @file controlledclock.cpp Controls the time seen by processes the tests
+ * spawn.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <boost/filesystem.hpp>
+
+#include "controlledclock.h"
+
+// The shim is built into the same directory as the test binary, which is run
+// from the src directory.
+const std::string ControlledClock::SHIM_LIBRARY = "../build/bin/libtimeshim.so";
+
+ControlledClock::ControlledClock(const std::string& file) :
+  _file(file),
+  _state(NULL)
+{
+  int fd = open(_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (fd < 0)
+  {
+    perror("open");
+    return;
+  }
+
+  if (ftruncate(fd, sizeof(TimeShim::State)) == 0)
+  {
+    void* mem = mmap(NULL,
+                     sizeof(TimeShim::State),
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED,
+                     fd,
+                     0);
+
+    if (mem != MAP_FAILED)
+    {
+      _state = (TimeShim::State*)mem;
+      _state->offset_ns = 0;
+    }
+    else
+    {
+      perror("mmap");
+    }
+  }
+  else
+  {
+    perror("ftruncate");
+  }
+
+  close(fd);
+}
+
+ControlledClock::~ControlledClock()
+{
+  if (_state != NULL)
+  {
+    munmap(_state, sizeof(TimeShim::State));
+    _state = NULL;
+  }
+
+  unlink(_file.c_str());
+}
+
+void ControlledClock::advance_time_ms(uint64_t ms)
+{
+  if (_state != NULL)
+  {
+    _state->offset_ns += ms * 1000000;
+  }
+}
+
+uint64_t ControlledClock::offset_ms() const
+{
+  return (_state != NULL) ? _state->offset_ns / 1000000 : 0;
+}
+
+void ControlledClock::set_process_env() const
+{
+  // The process may change directory, so use absolute paths.
+  setenv("LD_PRELOAD", boost::filesystem::absolute(SHIM_LIBRARY).c_str(), 1);
+  setenv(TimeShim::FILE_ENV_VAR, boost::filesystem::absolute(_file).c_str(), 1);
+}
@@ -0,0 +1,55 @@
+/**
+ * @file controlledclock.h Controls the time seen by processes the tests spawn.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef CONTROLLEDCLOCK_H__
+#define CONTROLLEDCLOCK_H__
+
+#include <string>
+#include <stdint.h>
+
+#include "timeshim.h"
+
+/// A clock that processes run with the time shim (see timeshim.h) follow. The
+/// clock runs at the normal rate, but the test can move it forward at any
+/// time - e.g. to make hours' worth of timers pop straight away.
+///
+/// A process follows the clock if it is started with the environment set up
+/// by set_process_env. This is the analogue, for spawned processes, of
+/// cwtest_advance_time_ms in the test process.
+class ControlledClock
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] file - The state file to create. Processes following the
+  ///                    clock map this file.
+  ControlledClock(const std::string& file);
+  virtual ~ControlledClock();
+
+  /// Move the clock forward.
+  void advance_time_ms(uint64_t ms);
+
+  /// Returns how far the clock has been moved forward.
+  uint64_t offset_ms() const;
+
+  /// Set up the environment of a child process (between fork and exec) so
+  /// that the process follows this clock.
+  void set_process_env() const;
+
+  /// The path of the time shim library.
+  static const std::string SHIM_LIBRARY;
+
+private:
+  std::string _file;
+  TimeShim::State* _state;
+};
+
+#endif
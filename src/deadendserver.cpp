@@ -0,0 +1,119 @@
+/**
+ * @file deadendserver.cpp Server that accepts connections and closes them
+ * straight away.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "deadendserver.h"
+#include "benchmark.h"
+
+DeadEndServer::DeadEndServer(const std::string& ip, int port) :
+  _ip(ip),
+  _port(port),
+  _listen_fd(-1),
+  _stopping(false),
+  _connections(0)
+{
+}
+
+
+DeadEndServer::~DeadEndServer()
+{
+  stop();
+}
+
+
+bool DeadEndServer::start()
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  inet_pton(AF_INET, _ip.c_str(), &addr.sin_addr);
+
+  _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if ((bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (listen(_listen_fd, 16) != 0))
+  {
+    perror("bind");
+    close(_listen_fd);
+    _listen_fd = -1;
+    return false;
+  }
+
+  _stopping = false;
+  _thread = std::thread(&DeadEndServer::run, this);
+  return true;
+}
+
+
+void DeadEndServer::stop()
+{
+  _stopping = true;
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  if (_listen_fd != -1)
+  {
+    close(_listen_fd);
+    _listen_fd = -1;
+  }
+}
+
+
+uint64_t DeadEndServer::connections_since(uint64_t time_us)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  return std::count_if(_connection_times_us.begin(),
+                       _connection_times_us.end(),
+                       [time_us](uint64_t t) { return t >= time_us; });
+}
+
+
+void DeadEndServer::run()
+{
+  struct pollfd fd;
+  fd.fd = _listen_fd;
+  fd.events = POLLIN;
+
+  while (!_stopping)
+  {
+    // Use a short timeout so that we notice promptly when we are stopped.
+    if (poll(&fd, 1, 100) <= 0)
+    {
+      continue;
+    }
+
+    int client_fd = accept(_listen_fd, NULL, NULL);
+
+    if (client_fd != -1)
+    {
+      close(client_fd);
+      _connections++;
+
+      std::lock_guard<std::mutex> lock(_lock);
+      _connection_times_us.push_back(Benchmark::now_us());
+    }
+  }
+}
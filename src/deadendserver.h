@@ -0,0 +1,63 @@
+/**
+ * @file deadendserver.h Server that accepts connections and closes them
+ * straight away.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DEADENDSERVER_H__
+#define DEADENDSERVER_H__
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+/// Stands in for a failed process. It listens on the failed process's address
+/// and closes every connection as soon as it is accepted, so clients see the
+/// process as broken - but unlike a closed port, each attempt to use it is
+/// counted. This lets tests measure how often clients keep trying a failed
+/// target.
+class DeadEndServer
+{
+public:
+  DeadEndServer(const std::string& ip, int port);
+  virtual ~DeadEndServer();
+
+  /// Start listening for connections.
+  ///
+  /// @return Whether the server started successfully.
+  bool start();
+
+  /// Stop listening.
+  void stop();
+
+  /// The number of connections accepted so far.
+  uint64_t connections() const { return _connections; }
+
+  /// The number of connections accepted at or after the given time (as
+  /// returned by Benchmark::now_us).
+  uint64_t connections_since(uint64_t time_us);
+
+private:
+  void run();
+
+  std::string _ip;
+  int _port;
+  int _listen_fd;
+  std::thread _thread;
+  std::atomic<bool> _stopping;
+  std::atomic<uint64_t> _connections;
+
+  std::mutex _lock;
+  std::vector<uint64_t> _connection_times_us;
+};
+
+#endif
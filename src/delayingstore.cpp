@@ -0,0 +1,68 @@
+/**
+ * @file delayingstore.cpp Store that delays every operation on another store,
+ * to simulate a slow network link to it.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+
+#include "delayingstore.h"
+
+void DelayingStore::delay()
+{
+  int delay_ms = _delay_ms;
+
+  if (delay_ms > 0)
+  {
+    usleep(delay_ms * 1000);
+  }
+}
+
+
+Store::Status DelayingStore::get_data(const std::string& table,
+                                      const std::string& key,
+                                      std::string& data,
+                                      uint64_t& cas,
+                                      SAS::TrailId trail)
+{
+  delay();
+  return _store->get_data(table, key, data, cas, trail);
+}
+
+
+Store::Status DelayingStore::set_data(const std::string& table,
+                                      const std::string& key,
+                                      const std::string& data,
+                                      uint64_t cas,
+                                      int expiry,
+                                      SAS::TrailId trail)
+{
+  delay();
+  return _store->set_data(table, key, data, cas, expiry, trail);
+}
+
+
+Store::Status DelayingStore::set_data_without_cas(const std::string& table,
+                                                  const std::string& key,
+                                                  const std::string& data,
+                                                  int expiry,
+                                                  SAS::TrailId trail)
+{
+  delay();
+  return _store->set_data_without_cas(table, key, data, expiry, trail);
+}
+
+
+Store::Status DelayingStore::delete_data(const std::string& table,
+                                         const std::string& key,
+                                         SAS::TrailId trail)
+{
+  delay();
+  return _store->delete_data(table, key, trail);
+}
@@ -0,0 +1,74 @@
+/**
+ * @file delayingstore.h Store that delays every operation on another store,
+ * to simulate a slow network link to it.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DELAYINGSTORE_H__
+#define DELAYINGSTORE_H__
+
+#include <string>
+#include <atomic>
+
+#include "store.h"
+
+/// Store that sits in front of another store and adds a fixed delay to every
+/// operation passed through to it. Tests put this in front of the stores in
+/// remote sites to simulate the round trip time over the WAN, without needing
+/// to change the network configuration of the machine.
+class DelayingStore : public Store
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] store    - The underlying store. This is not owned by the
+  ///                        delaying store.
+  /// @param [in] delay_ms - The delay to add to each operation. This is the
+  ///                        round trip time, so is added once per operation.
+  DelayingStore(Store* store, int delay_ms = 0) : _store(store), _delay_ms(delay_ms) {}
+  virtual ~DelayingStore() {}
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+  bool has_servers() { return _store->has_servers(); }
+
+  /// Change the delay. This takes effect for operations that start after it
+  /// is called.
+  void set_delay_ms(int delay_ms) { _delay_ms = delay_ms; }
+
+private:
+  /// Sleep for the configured delay.
+  void delay();
+
+  Store* _store;
+  std::atomic<int> _delay_ms;
+};
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file deployment.cpp Helper class for spinning up a geo-redundant
+ * deployment of several sites.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <boost/filesystem.hpp>
+
+#include "log.h"
+
+#include "deployment.h"
+
+
+std::map<std::string, Site::Topology> Deployment::build_topology(int num_sites)
+{
+  std::map<std::string, Site::Topology> topology;
+
+  for (int ii = 1; ii <= num_sites; ++ii)
+  {
+    std::string name = site_name(ii);
+    topology.emplace(name,
+                     Site::Topology("127.0." + std::to_string(ii) + ".")
+                       .with_chronos("chronos." + name)
+                       .with_rogers("rogers." + name));
+  }
+
+  return topology;
+}
+
+
+std::string Deployment::site_name(int index)
+{
+  return "site" + std::to_string(index);
+}
+
+
+Deployment::Deployment(int num_sites,
+                       const std::string& dir,
+                       int num_memcached,
+                       int num_rogers,
+                       int num_chronos) :
+  _topology(build_topology(num_sites))
+{
+  boost::filesystem::create_directories(dir);
+
+  for (int ii = 1; ii <= num_sites; ++ii)
+  {
+    std::string name = site_name(ii);
+    _sites.emplace_back(new Site(ii,
+                                 name,
+                                 dir + "/" + name,
+                                 _topology,
+                                 num_memcached,
+                                 num_rogers,
+                                 num_chronos));
+  }
+}
+
+
+Deployment::~Deployment()
+{
+  _sites.clear();
+}
+
+
+std::map<std::string, std::vector<std::string>> Deployment::a_records()
+{
+  std::map<std::string, std::vector<std::string>> records;
+
+  for (int ii = 1; ii <= num_sites(); ++ii)
+  {
+    const Site::Topology& tplg = _topology.at(site_name(ii));
+    records[tplg.rogers_domain] = site(ii)->get_rogers_ips();
+    records[tplg.chronos_domain] = site(ii)->get_chronos_ips();
+  }
+
+  return records;
+}
+
+
+void Deployment::use_controlled_clock(const ControlledClock* clock)
+{
+  for (const std::shared_ptr<Site>& site : _sites)
+  {
+    site->use_controlled_clock(clock);
+  }
+}
+
+
+void Deployment::start()
+{
+  for (int ii = 1; ii <= num_sites(); ++ii)
+  {
+    site(ii)->start();
+    TRC_DEBUG("Started %s", site_name(ii).c_str());
+  }
+}
+
+
+bool Deployment::wait_for_instances()
+{
+  for (const std::shared_ptr<Site>& site : _sites)
+  {
+    if (!site->wait_for_instances())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
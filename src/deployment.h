@@ -0,0 +1,94 @@
+/**
+ * @file deployment.h Helper class for spinning up a geo-redundant deployment
+ * of several sites.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DEPLOYMENT_H__
+#define DEPLOYMENT_H__
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <map>
+
+#include "site.h"
+
+/// Class controlling all the sites in a deployment.
+///
+/// Site N is called "siteN", uses the IP address range 127.0.N.0/24, and
+/// serves Chronos and Rogers at "chronos.siteN" and "rogers.siteN". Every site
+/// has the same number of each type of process.
+class Deployment
+{
+public:
+  /// Build the topology of a deployment with the given number of sites. This
+  /// is separate from the constructor so that tests can create objects that
+  /// need the topology (such as S4) without creating the sites themselves.
+  static std::map<std::string, Site::Topology> build_topology(int num_sites);
+
+  /// Returns the name of the site with the given (1-based) index.
+  static std::string site_name(int index);
+
+  /// Constructor
+  ///
+  /// @param [in] num_sites     - The number of sites. This must be between 1
+  ///                             and 254.
+  /// @param [in] dir           - A directory that the sites may create
+  ///                             subdirectories of to store any temporary
+  ///                             files they require.
+  /// @param [in] num_memcached - The number of memcached instances per site.
+  /// @param [in] num_rogers    - The number of rogers instances per site.
+  /// @param [in] num_chronos   - The number of chronos instances per site.
+  Deployment(int num_sites,
+             const std::string& dir,
+             int num_memcached,
+             int num_rogers,
+             int num_chronos);
+  virtual ~Deployment();
+
+  /// Returns the number of sites in the deployment.
+  int num_sites() const { return _sites.size(); }
+
+  /// Returns the topology of the deployment.
+  const std::map<std::string, Site::Topology>& topology() const { return _topology; }
+
+  /// Returns the site with the given (1-based) index.
+  std::shared_ptr<Site> site(int index) const { return _sites.at(index - 1); }
+
+  /// Returns all the sites, in index order.
+  const std::vector<std::shared_ptr<Site>>& sites() const { return _sites; }
+
+  /// Returns the DNS A records needed to find the Rogers and Chronos
+  /// instances in every site.
+  std::map<std::string, std::vector<std::string>> a_records();
+
+  /// Have all the chronos processes in the deployment follow the given clock.
+  /// This takes effect when they are next started.
+  void use_controlled_clock(const ControlledClock* clock);
+
+  /// Start all processes in all sites.
+  ///
+  /// @warning This does not wait for the instances to come up. Call
+  /// wait_for_instances before using the deployment.
+  void start();
+
+  /// Wait for all instances in all sites to be started.
+  ///
+  /// @return Whether the processes have all started successfully.
+  bool wait_for_instances();
+
+private:
+  std::map<std::string, Site::Topology> _topology;
+
+  /// Use shared pointers so that tests can keep hold of individual sites.
+  std::vector<std::shared_ptr<Site>> _sites;
+};
+
+#endif
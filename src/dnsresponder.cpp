@@ -0,0 +1,648 @@
+/**
+ * @file dnsresponder.cpp In-process DNS server for the FV tests.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <iterator>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "dnsresponder.h"
+
+// DNS constants, from RFC 1035 and RFC 2782.
+static const int TYPE_A = 1;
+static const int TYPE_SOA = 6;
+static const int TYPE_AAAA = 28;
+static const int TYPE_SRV = 33;
+static const int CLASS_IN = 1;
+static const int RCODE_SERVFAIL = 2;
+static const int RCODE_NXDOMAIN = 3;
+static const size_t HEADER_LEN = 12;
+
+static uint64_t now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static std::string lower(const std::string& str)
+{
+  std::string result = str;
+  std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+  return result;
+}
+
+static uint16_t get16(const std::string& msg, size_t pos)
+{
+  return ((uint8_t)msg[pos] << 8) | (uint8_t)msg[pos + 1];
+}
+
+static void put16(std::string& msg, uint16_t value)
+{
+  msg.push_back((char)(value >> 8));
+  msg.push_back((char)(value & 0xff));
+}
+
+static void put32(std::string& msg, uint32_t value)
+{
+  put16(msg, value >> 16);
+  put16(msg, value & 0xffff);
+}
+
+/// Append a domain name in DNS label format.
+static void put_name(std::string& msg, const std::string& name)
+{
+  size_t start = 0;
+
+  while (start < name.size())
+  {
+    size_t end = name.find('.', start);
+    end = (end == std::string::npos) ? name.size() : end;
+
+    if (end > start)
+    {
+      msg.push_back((char)(end - start));
+      msg.append(name, start, end - start);
+    }
+
+    start = end + 1;
+  }
+
+  msg.push_back(0);
+}
+
+/// Parse a domain name in DNS label format. Queries don't use compression, so
+/// this doesn't support it.
+static bool get_name(const std::string& msg, size_t& pos, std::string& name)
+{
+  while (pos < msg.size())
+  {
+    uint8_t len = msg[pos++];
+
+    if (len == 0)
+    {
+      return true;
+    }
+
+    if (((len & 0xc0) != 0) || (pos + len > msg.size()))
+    {
+      return false;
+    }
+
+    if (!name.empty())
+    {
+      name += ".";
+    }
+
+    name.append(msg, pos, len);
+    pos += len;
+  }
+
+  return false;
+}
+
+/// Append the start of a resource record whose owner is the name in the
+/// question (which always starts straight after the header).
+static void put_rr_header(std::string& msg, int type, int ttl, size_t rdlength)
+{
+  put16(msg, 0xc000 | HEADER_LEN);
+  put16(msg, type);
+  put16(msg, CLASS_IN);
+  put32(msg, ttl);
+  put16(msg, rdlength);
+}
+
+DnsResponder::DnsResponder(const std::string& ip,
+                           int port,
+                           std::map<std::string, std::vector<std::string>> a_records,
+                           std::map<std::string, std::vector<SrvRecord>> srv_records,
+                           int ttl) :
+  _ip(ip),
+  _port(port),
+  _ttl(ttl),
+  _negative_ttl(ttl),
+  _delay_ms(0),
+  _fault(NONE),
+  _fault_count(0),
+  _udp_fd(-1),
+  _tcp_fd(-1),
+  _running(false),
+  _stopping(false)
+{
+  for (auto i: a_records)
+  {
+    _a_records[lower(i.first)] = i.second;
+  }
+
+  for (auto i: srv_records)
+  {
+    _srv_records[lower(i.first)] = i.second;
+  }
+}
+
+
+DnsResponder::~DnsResponder()
+{
+  kill_instance();
+}
+
+
+bool DnsResponder::start_instance()
+{
+  if (_running)
+  {
+    return true;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  inet_pton(AF_INET, _ip.c_str(), &addr.sin_addr);
+
+  _udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+  _tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(_udp_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  setsockopt(_tcp_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if ((bind(_udp_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (bind(_tcp_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (listen(_tcp_fd, 16) != 0))
+  {
+    perror("bind");
+    close(_udp_fd); _udp_fd = -1;
+    close(_tcp_fd); _tcp_fd = -1;
+    return false;
+  }
+
+  _stopping = false;
+  _running = true;
+  _thread = std::thread(&DnsResponder::run, this);
+  return true;
+}
+
+
+bool DnsResponder::kill_instance()
+{
+  if (!_running)
+  {
+    return true;
+  }
+
+  _stopping = true;
+  _thread.join();
+
+  for (auto client: _tcp_clients)
+  {
+    close(client.first);
+  }
+
+  _tcp_clients.clear();
+  _delayed_responses.clear();
+  close(_udp_fd); _udp_fd = -1;
+  close(_tcp_fd); _tcp_fd = -1;
+  _running = false;
+  return true;
+}
+
+
+bool DnsResponder::restart_instance()
+{
+  return kill_instance() && start_instance();
+}
+
+
+int DnsResponder::query_count(const std::string& domain, const std::string& type)
+{
+  int qtype = (type == "A") ? TYPE_A :
+              (type == "AAAA") ? TYPE_AAAA :
+              (type == "SRV") ? TYPE_SRV : 0;
+
+  std::lock_guard<std::mutex> lock(_lock);
+  auto it = _query_counts.find(std::make_pair(lower(domain), qtype));
+  return (it != _query_counts.end()) ? it->second : 0;
+}
+
+
+bool DnsResponder::set_a_records(const std::string& domain,
+                                 const std::vector<std::string>& ips)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (ips.empty())
+  {
+    _a_records.erase(lower(domain));
+  }
+  else
+  {
+    _a_records[lower(domain)] = ips;
+  }
+
+  return true;
+}
+
+
+bool DnsResponder::add_a_record(const std::string& domain, const std::string& ip)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _a_records[lower(domain)].push_back(ip);
+  return true;
+}
+
+
+bool DnsResponder::remove_a_record(const std::string& domain, const std::string& ip)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  std::vector<std::string>& ips = _a_records[lower(domain)];
+  ips.erase(std::remove(ips.begin(), ips.end(), ip), ips.end());
+
+  if (ips.empty())
+  {
+    _a_records.erase(lower(domain));
+  }
+
+  return true;
+}
+
+
+bool DnsResponder::set_srv_records(const std::string& domain,
+                                   const std::vector<SrvRecord>& records)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+
+  if (records.empty())
+  {
+    _srv_records.erase(lower(domain));
+  }
+  else
+  {
+    _srv_records[lower(domain)] = records;
+  }
+
+  return true;
+}
+
+
+void DnsResponder::set_negative_ttl(int ttl)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _negative_ttl = ttl;
+}
+
+
+void DnsResponder::set_delay_ms(int delay_ms)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _delay_ms = delay_ms;
+}
+
+
+void DnsResponder::inject_fault(Fault fault, int num_queries)
+{
+  std::lock_guard<std::mutex> lock(_lock);
+  _fault = fault;
+  _fault_count = num_queries;
+}
+
+
+void DnsResponder::run()
+{
+  std::vector<struct pollfd> fds;
+
+  while (!_stopping)
+  {
+    fds.clear();
+    fds.push_back({_udp_fd, POLLIN, 0});
+    fds.push_back({_tcp_fd, POLLIN, 0});
+
+    for (auto client: _tcp_clients)
+    {
+      fds.push_back({client.first, POLLIN, 0});
+    }
+
+    // Wake up in time to send the next delayed response, and often enough to
+    // notice promptly when we are stopped.
+    int timeout_ms = send_due_responses();
+    timeout_ms = ((timeout_ms == -1) || (timeout_ms > 100)) ? 100 : timeout_ms;
+
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0)
+    {
+      continue;
+    }
+
+    if (fds[0].revents & POLLIN)
+    {
+      handle_udp();
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      accept_tcp();
+    }
+
+    for (size_t ii = 2; ii < fds.size(); ++ii)
+    {
+      if ((fds[ii].revents != 0) && (!handle_tcp(fds[ii].fd)))
+      {
+        // The client has gone away. Throw away anything still to be sent to
+        // it, as its fd number may be reused.
+        close(fds[ii].fd);
+        _tcp_clients.erase(fds[ii].fd);
+
+        for (auto it = _delayed_responses.begin(); it != _delayed_responses.end();)
+        {
+          it = (it->second.fd == fds[ii].fd) ? _delayed_responses.erase(it) : std::next(it);
+        }
+      }
+    }
+  }
+}
+
+
+void DnsResponder::handle_udp()
+{
+  char buf[4096];
+  Response response;
+  socklen_t addr_len = sizeof(response.addr);
+  ssize_t len = recvfrom(_udp_fd,
+                         buf,
+                         sizeof(buf),
+                         0,
+                         (struct sockaddr*)&response.addr,
+                         &addr_len);
+  int delay_ms;
+
+  if ((len > 0) &&
+      (handle_query(std::string(buf, len), false, response.data, delay_ms)))
+  {
+    response.fd = _udp_fd;
+    response.tcp = false;
+    queue_response(response, delay_ms);
+  }
+}
+
+
+void DnsResponder::accept_tcp()
+{
+  int fd = accept(_tcp_fd, NULL, NULL);
+
+  if (fd != -1)
+  {
+    _tcp_clients[fd] = "";
+  }
+}
+
+
+bool DnsResponder::handle_tcp(int fd)
+{
+  char buf[4096];
+  ssize_t len = recv(fd, buf, sizeof(buf), 0);
+
+  if (len <= 0)
+  {
+    return false;
+  }
+
+  // Over TCP each message is preceded by its length. Handle every complete
+  // message we have.
+  std::string& buffer = _tcp_clients[fd];
+  buffer.append(buf, len);
+
+  while ((buffer.size() >= 2) && (buffer.size() >= 2u + get16(buffer, 0)))
+  {
+    size_t msg_len = get16(buffer, 0);
+    Response response;
+    int delay_ms;
+
+    if (handle_query(buffer.substr(2, msg_len), true, response.data, delay_ms))
+    {
+      std::string length;
+      put16(length, response.data.size());
+      response.data.insert(0, length);
+      response.fd = fd;
+      response.tcp = true;
+      queue_response(response, delay_ms);
+    }
+
+    buffer.erase(0, 2 + msg_len);
+  }
+
+  return true;
+}
+
+
+bool DnsResponder::handle_query(const std::string& query,
+                                bool tcp,
+                                std::string& response,
+                                int& delay_ms)
+{
+  if ((query.size() < HEADER_LEN) || (get16(query, 4) != 1))
+  {
+    // Not a query we understand.
+    return false;
+  }
+
+  uint16_t id = get16(query, 0);
+  uint16_t flags = get16(query, 2);
+  size_t pos = HEADER_LEN;
+  std::string domain;
+
+  if ((!get_name(query, pos, domain)) || (pos + 4 > query.size()))
+  {
+    return false;
+  }
+
+  int qtype = get16(query, pos);
+  pos += 4;
+  domain = lower(domain);
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _query_counts[std::make_pair(domain, qtype)]++;
+  delay_ms = _delay_ms;
+  Fault fault = next_fault(tcp);
+
+  if (fault == DROP)
+  {
+    return false;
+  }
+
+  std::string records;
+  int ancount = 0;
+  int nscount = 0;
+  int rcode = 0;
+
+  if (fault == SERVFAIL)
+  {
+    rcode = RCODE_SERVFAIL;
+  }
+  else if (fault == NONE)
+  {
+    build_answer(domain, qtype, records, ancount, nscount, rcode);
+  }
+
+  // Set QR, AA and RA, and copy the opcode and RD from the query.
+  response.clear();
+  put16(response, id);
+  put16(response, 0x8000 |
+                  (flags & 0x7800) |
+                  0x0400 |
+                  ((fault == TRUNCATE) ? 0x0200 : 0) |
+                  (flags & 0x0100) |
+                  0x0080 |
+                  rcode);
+  put16(response, 1);
+  put16(response, ancount);
+  put16(response, nscount);
+  put16(response, 0);
+  response.append(query, HEADER_LEN, pos - HEADER_LEN);
+  response.append(records);
+  return true;
+}
+
+
+void DnsResponder::build_answer(const std::string& domain,
+                                int qtype,
+                                std::string& records,
+                                int& ancount,
+                                int& nscount,
+                                int& rcode)
+{
+  auto a_it = _a_records.find(domain);
+  auto srv_it = _srv_records.find(domain);
+
+  if ((qtype == TYPE_A) && (a_it != _a_records.end()))
+  {
+    for (const std::string& ip: a_it->second)
+    {
+      struct in_addr addr;
+      inet_pton(AF_INET, ip.c_str(), &addr);
+      put_rr_header(records, TYPE_A, _ttl, sizeof(addr));
+      records.append((const char*)&addr, sizeof(addr));
+      ancount++;
+    }
+  }
+  else if ((qtype == TYPE_SRV) && (srv_it != _srv_records.end()))
+  {
+    for (const SrvRecord& srv: srv_it->second)
+    {
+      std::string rdata;
+      put16(rdata, srv.priority);
+      put16(rdata, srv.weight);
+      put16(rdata, srv.port);
+      put_name(rdata, srv.target);
+      put_rr_header(records, TYPE_SRV, _ttl, rdata.size());
+      records.append(rdata);
+      ancount++;
+    }
+  }
+
+  if (ancount == 0)
+  {
+    // A negative answer. If we have no records at all for the name it doesn't
+    // exist. Either way, add an SOA record to say how long to cache this for.
+    if ((a_it == _a_records.end()) && (srv_it == _srv_records.end()))
+    {
+      rcode = RCODE_NXDOMAIN;
+    }
+
+    std::string rdata;
+    put_name(rdata, "ns.fvtest.invalid");
+    put_name(rdata, "hostmaster.fvtest.invalid");
+    put32(rdata, 1);        // Serial
+    put32(rdata, 3600);     // Refresh
+    put32(rdata, 600);      // Retry
+    put32(rdata, 86400);    // Expire
+    put32(rdata, _negative_ttl);
+    put_rr_header(records, TYPE_SOA, _negative_ttl, rdata.size());
+    records.append(rdata);
+    nscount++;
+  }
+}
+
+
+DnsResponder::Fault DnsResponder::next_fault(bool tcp)
+{
+  if ((_fault == NONE) || (tcp && (_fault == TRUNCATE)))
+  {
+    // Truncation only applies to UDP - the point of it is to make the
+    // resolver retry over TCP.
+    return NONE;
+  }
+
+  Fault fault = _fault;
+
+  if ((_fault_count > 0) && (--_fault_count == 0))
+  {
+    _fault = NONE;
+  }
+
+  return fault;
+}
+
+
+void DnsResponder::queue_response(const Response& response, int delay_ms)
+{
+  if (delay_ms == 0)
+  {
+    send_response(response);
+  }
+  else
+  {
+    _delayed_responses.insert(std::make_pair(now_us() + (uint64_t)delay_ms * 1000,
+                                             response));
+  }
+}
+
+
+void DnsResponder::send_response(const Response& response)
+{
+  if (response.tcp)
+  {
+    send(response.fd, response.data.data(), response.data.size(), MSG_NOSIGNAL);
+  }
+  else
+  {
+    sendto(response.fd,
+           response.data.data(),
+           response.data.size(),
+           0,
+           (const struct sockaddr*)&response.addr,
+           sizeof(response.addr));
+  }
+}
+
+
+int DnsResponder::send_due_responses()
+{
+  uint64_t now = now_us();
+
+  while ((!_delayed_responses.empty()) &&
+         (_delayed_responses.begin()->first <= now))
+  {
+    send_response(_delayed_responses.begin()->second);
+    _delayed_responses.erase(_delayed_responses.begin());
+  }
+
+  if (_delayed_responses.empty())
+  {
+    return -1;
+  }
+
+  // Round up, so we don't wake up just before the response is due.
+  return (_delayed_responses.begin()->first - now + 999) / 1000;
+}
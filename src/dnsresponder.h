@@ -0,0 +1,171 @@
+/**
+ * @file dnsresponder.h In-process DNS server for the FV tests.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef DNSRESPONDER_H__
+#define DNSRESPONDER_H__
+
+#include <string>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "processinstance.h"
+
+/// A DNS server that runs on a thread in the test process, rather than as a
+/// separate dnsmasq process. It starts instantly, and has the same interface
+/// as DnsmasqInstance so it can be used in its place.
+///
+/// The responder is authoritative for every name: names it has no records for
+/// get NXDOMAIN, and names that only have records of other types get an empty
+/// answer. Negative answers include an SOA record, so resolvers can cache them.
+///
+/// It listens on both UDP and TCP, and can inject faults into its answers to
+/// test how resolvers handle them:
+/// -  A delay before every answer.
+/// -  SERVFAIL answers.
+/// -  Truncated UDP answers (with the TC bit set, and no records), which should
+///    make the resolver retry over TCP.
+/// -  Dropped queries, which should make the resolver time out.
+class DnsResponder
+{
+public:
+  typedef DnsmasqInstance::SrvRecord SrvRecord;
+
+  enum Fault
+  {
+    NONE,
+    SERVFAIL,
+    TRUNCATE,
+    DROP
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] a_records   - Map of domain name to the IPs it resolves to.
+  /// @param [in] srv_records - Map of domain name to its SRV records.
+  /// @param [in] ttl         - The TTL of the records.
+  DnsResponder(const std::string& ip,
+               int port,
+               std::map<std::string, std::vector<std::string>> a_records,
+               std::map<std::string, std::vector<SrvRecord>> srv_records = {},
+               int ttl = 0);
+  virtual ~DnsResponder();
+
+  /// Start and stop answering queries. Once start_instance has returned the
+  /// responder is ready, so wait_for_instance doesn't need to wait.
+  bool start_instance();
+  bool kill_instance();
+  bool restart_instance();
+  bool wait_for_instance() { return _running; }
+
+  std::string ip() const { return _ip; }
+  int port() const { return _port; }
+
+  /// Returns the number of queries of the given type the responder has
+  /// received for a domain, over UDP and TCP.
+  int query_count(const std::string& domain, const std::string& type = "A");
+
+  /// Change the records. Changes take effect immediately.
+  bool set_a_records(const std::string& domain, const std::vector<std::string>& ips);
+  bool add_a_record(const std::string& domain, const std::string& ip);
+  bool remove_a_record(const std::string& domain, const std::string& ip);
+  bool set_srv_records(const std::string& domain, const std::vector<SrvRecord>& records);
+
+  /// Set the TTL of negative answers (the SOA minimum). By default this is
+  /// the same as the TTL of the records.
+  void set_negative_ttl(int ttl);
+
+  /// Delay every answer by the given time.
+  void set_delay_ms(int delay_ms);
+
+  /// Apply a fault to the next num_queries queries, or to all queries from
+  /// now on if num_queries is -1. Replaces any fault already set.
+  void inject_fault(Fault fault, int num_queries = -1);
+
+private:
+  /// An answer waiting to be sent.
+  struct Response
+  {
+    int fd;
+    bool tcp;
+    struct sockaddr_in addr;
+    std::string data;
+  };
+
+  void run();
+  void handle_udp();
+  void accept_tcp();
+  bool handle_tcp(int fd);
+
+  /// Build the answer to a query.
+  ///
+  /// @param [in]  query    - The query message.
+  /// @param [in]  tcp      - Whether the query came in over TCP.
+  /// @param [out] response - The response message.
+  /// @param [out] delay_ms - How long to wait before sending the response.
+  ///
+  /// @return false if the query should be dropped.
+  bool handle_query(const std::string& query,
+                    bool tcp,
+                    std::string& response,
+                    int& delay_ms);
+
+  /// Add the answer records for a query to a response, and work out the
+  /// response code. Must be called with the lock held.
+  void build_answer(const std::string& domain,
+                    int qtype,
+                    std::string& records,
+                    int& ancount,
+                    int& nscount,
+                    int& rcode);
+
+  /// Returns the fault to apply to the next query, and uses it up. Must be
+  /// called with the lock held.
+  Fault next_fault(bool tcp);
+
+  void queue_response(const Response& response, int delay_ms);
+  void send_response(const Response& response);
+
+  /// Send any delayed responses that are due, and return how long until the
+  /// next one is (or -1 if there are none).
+  int send_due_responses();
+
+  std::string _ip;
+  int _port;
+
+  /// Protects the records, query counts and faults, which the test can change
+  /// while the responder is running.
+  std::mutex _lock;
+  std::map<std::string, std::vector<std::string>> _a_records;
+  std::map<std::string, std::vector<SrvRecord>> _srv_records;
+  std::map<std::pair<std::string, int>, int> _query_counts;
+  int _ttl;
+  int _negative_ttl;
+  int _delay_ms;
+  Fault _fault;
+  int _fault_count;
+
+  /// State used only by the responder's thread.
+  int _udp_fd;
+  int _tcp_fd;
+  std::map<int, std::string> _tcp_clients;
+  std::multimap<uint64_t, Response> _delayed_responses;
+
+  bool _running;
+  std::atomic<bool> _stopping;
+  std::thread _thread;
+};
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * @file ipcounterindex.cpp Time based counts for a large number of IP
+ * addresses.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <time.h>
+
+#include "ipcounterindex.h"
+
+static const uint64_t FIVE_SECONDS_MS = 5 * 1000;
+static const uint64_t FIVE_MINUTES_MS = 5 * 60 * 1000;
+
+/// The current time in milliseconds, from the same clock as the SNMP tables
+/// (so tests can control it in the same way).
+static uint64_t now_ms()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+
+void IPCounterIndex::PeriodCounts::roll(uint64_t now_period)
+{
+  if (period != now_period)
+  {
+    previous = (period + 1 == now_period) ? current : 0;
+    current = 0;
+    period = now_period;
+  }
+}
+
+
+IPCounterIndex::IPCounterIndex(size_t num_stripes) :
+  _stripes(std::max(num_stripes, (size_t)1))
+{
+}
+
+
+IPCounterIndex::Stripe& IPCounterIndex::stripe(const std::string& ip)
+{
+  return _stripes[_hash(ip) % _stripes.size()];
+}
+
+
+void IPCounterIndex::roll(Row& row)
+{
+  uint64_t now = now_ms();
+  row.five_second.roll(now / FIVE_SECONDS_MS);
+  row.five_minute.roll(now / FIVE_MINUTES_MS);
+}
+
+
+bool IPCounterIndex::add_ip(const std::string& ip)
+{
+  Stripe& s = stripe(ip);
+  std::lock_guard<std::mutex> lock(s.lock);
+  std::unordered_map<std::string, Row>::iterator it = s.rows.find(ip);
+
+  if (it == s.rows.end())
+  {
+    Row row = {0, false, {0, 0, 0}, {0, 0, 0}};
+    it = s.rows.emplace(ip, row).first;
+  }
+
+  if (it->second.refcount++ > 0)
+  {
+    return false;
+  }
+
+  // The IP may still be here from when it was last tracked, waiting for its
+  // rows to be removed. Its counts start again from zero either way.
+  it->second.five_second = {0, 0, 0};
+  it->second.five_minute = {0, 0, 0};
+  roll(it->second);
+  return true;
+}
+
+
+bool IPCounterIndex::remove_ip(const std::string& ip)
+{
+  Stripe& s = stripe(ip);
+  std::lock_guard<std::mutex> lock(s.lock);
+  std::unordered_map<std::string, Row>::iterator it = s.rows.find(ip);
+
+  return ((it != s.rows.end()) &&
+          (it->second.refcount > 0) &&
+          (--it->second.refcount == 0));
+}
+
+
+IPCounterIndex::RowChange IPCounterIndex::update_rows(const std::string& ip)
+{
+  Stripe& s = stripe(ip);
+  std::lock_guard<std::mutex> lock(s.lock);
+  std::unordered_map<std::string, Row>::iterator it = s.rows.find(ip);
+
+  if (it == s.rows.end())
+  {
+    return RowChange::NONE;
+  }
+
+  if ((it->second.refcount > 0) && (!it->second.has_rows))
+  {
+    it->second.has_rows = true;
+    return RowChange::ADD;
+  }
+
+  if (it->second.refcount == 0)
+  {
+    bool had_rows = it->second.has_rows;
+    s.rows.erase(it);
+    return had_rows ? RowChange::REMOVE : RowChange::NONE;
+  }
+
+  return RowChange::NONE;
+}
+
+
+void IPCounterIndex::increment(const std::string& ip)
+{
+  Stripe& s = stripe(ip);
+  std::lock_guard<std::mutex> lock(s.lock);
+  std::unordered_map<std::string, Row>::iterator it = s.rows.find(ip);
+
+  if ((it != s.rows.end()) && (it->second.refcount > 0))
+  {
+    roll(it->second);
+    it->second.five_second.current++;
+    it->second.five_minute.current++;
+  }
+}
+
+
+bool IPCounterIndex::get(const std::string& ip, Counts& counts)
+{
+  Stripe& s = stripe(ip);
+  std::lock_guard<std::mutex> lock(s.lock);
+  std::unordered_map<std::string, Row>::iterator it = s.rows.find(ip);
+
+  if ((it == s.rows.end()) || (it->second.refcount == 0))
+  {
+    return false;
+  }
+
+  roll(it->second);
+  counts.previous_5s = it->second.five_second.previous;
+  counts.current_5m = it->second.five_minute.current;
+  counts.previous_5m = it->second.five_minute.previous;
+
+  return true;
+}
+
+
+size_t IPCounterIndex::size()
+{
+  size_t total = 0;
+
+  for (Stripe& s : _stripes)
+  {
+    std::lock_guard<std::mutex> lock(s.lock);
+
+    for (const std::pair<const std::string, Row>& row : s.rows)
+    {
+      if (row.second.refcount > 0)
+      {
+        total++;
+      }
+    }
+  }
+
+  return total;
+}
+
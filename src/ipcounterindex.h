@@ -0,0 +1,125 @@
+/**
+ * @file ipcounterindex.h Time based counts for a large number of IP addresses.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef IPCOUNTERINDEX_H__
+#define IPCOUNTERINDEX_H__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+/// Counts events for each of a set of IP addresses, over the same time periods
+/// as SNMP::IPTimeBasedCounterTable (previous 5s, current 5m and previous 5m),
+/// and with the same reference counting of IPs. This is the index behind
+/// SNMP::IndexedIPTimeBasedCounterTable, which is built for tracking many
+/// thousands of peers:
+/// -  IPs are found through a hash index, so increment takes the same time
+///    however many IPs there are.
+/// -  The index is split into stripes, each with its own lock, so threads
+///    working on different IPs rarely contend.
+/// -  Each IP's counts are only rolled over to a new time period when that IP
+///    is next counted or read, so the end of a period doesn't touch every IP.
+class IPCounterIndex
+{
+public:
+  /// The counts for an IP, as the table reports them.
+  struct Counts
+  {
+    uint64_t previous_5s;
+    uint64_t current_5m;
+    uint64_t previous_5m;
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] num_stripes - The number of independently locked stripes
+  ///                           to split the index into.
+  IPCounterIndex(size_t num_stripes = 64);
+
+  /// What the owner of the index needs to do to the rows it reports for an
+  /// IP.
+  enum struct RowChange { NONE, ADD, REMOVE };
+
+  /// Start tracking an IP, or take another reference to it if it is already
+  /// tracked. This only takes the lock on the IP's stripe.
+  ///
+  /// @return Whether the IP is newly tracked, in which case the caller must
+  ///         call update_rows.
+  bool add_ip(const std::string& ip);
+
+  /// Release a reference to an IP. The IP stops being tracked when the last
+  /// reference is released. This only takes the lock on the IP's stripe.
+  ///
+  /// @return Whether the IP has stopped being tracked, in which case the
+  ///         caller must call update_rows.
+  bool remove_ip(const std::string& ip);
+
+  /// Find out whether rows need adding or removing for an IP, to match whether
+  /// it is now tracked, and record that they have been. An IP that has stopped
+  /// being tracked stays in the index until this is called, so the decision is
+  /// always made against the IP's latest state. Callers must serialize calls
+  /// to this, and make each change before the next call.
+  RowChange update_rows(const std::string& ip);
+
+  /// Count an event for an IP. Events for IPs that aren't tracked are
+  /// ignored, as they are by SNMP::IPTimeBasedCounterTable.
+  void increment(const std::string& ip);
+
+  /// Get the counts for an IP.
+  ///
+  /// @return Whether the IP is tracked.
+  bool get(const std::string& ip, Counts& counts);
+
+  /// The number of IPs tracked.
+  size_t size();
+
+private:
+  /// The counts for one time period length (5s or 5m). These are for the
+  /// period the IP was last counted or read in, and the period before.
+  struct PeriodCounts
+  {
+    uint64_t period;
+    uint64_t current;
+    uint64_t previous;
+
+    /// Move on to the given period, if it has started.
+    void roll(uint64_t now_period);
+  };
+
+  struct Row
+  {
+    int refcount;
+
+    /// Whether the owner of the index has rows for this IP.
+    bool has_rows;
+
+    PeriodCounts five_second;
+    PeriodCounts five_minute;
+  };
+
+  struct Stripe
+  {
+    std::mutex lock;
+    std::unordered_map<std::string, Row> rows;
+  };
+
+  Stripe& stripe(const std::string& ip);
+
+  /// Roll a row's counts on to the current time periods.
+  static void roll(Row& row);
+
+  std::vector<Stripe> _stripes;
+  std::hash<std::string> _hash;
+};
+
+#endif
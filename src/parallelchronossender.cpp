@@ -0,0 +1,183 @@
+/**
+ * @file parallelchronossender.cpp Sends many Chronos timer operations at
+ * once.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <map>
+#include <algorithm>
+
+#include "parallelchronossender.h"
+
+ParallelChronosSender::ParallelChronosSender(ChronosConnection* connection,
+                                             int num_threads) :
+  _connection(connection),
+  _sent(0),
+  _outstanding(0),
+  _trail(0),
+  _terminating(false)
+{
+  for (int ii = 0; ii < std::max(num_threads, 1); ++ii)
+  {
+    _workers.emplace_back(&ParallelChronosSender::worker_thread, this);
+  }
+}
+
+
+ParallelChronosSender::~ParallelChronosSender()
+{
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _terminating = true;
+  }
+
+  _work_cond.notify_all();
+
+  for (std::thread& worker : _workers)
+  {
+    worker.join();
+  }
+}
+
+
+size_t ParallelChronosSender::add_set(uint32_t interval_s,
+                                      uint32_t repeat_for_s,
+                                      const std::string& callback_uri,
+                                      const std::string& opaque_data)
+{
+  return add_timer(Op::SET, "", interval_s, repeat_for_s, callback_uri, opaque_data);
+}
+
+
+size_t ParallelChronosSender::add_update(const std::string& timer_id,
+                                         uint32_t interval_s,
+                                         uint32_t repeat_for_s,
+                                         const std::string& callback_uri,
+                                         const std::string& opaque_data)
+{
+  return add_timer(Op::UPDATE, timer_id, interval_s, repeat_for_s, callback_uri, opaque_data);
+}
+
+
+size_t ParallelChronosSender::add_delete(const std::string& timer_id)
+{
+  return add_timer(Op::DELETE, timer_id, 0, 0, "", "");
+}
+
+
+size_t ParallelChronosSender::add_timer(Op op,
+                                        const std::string& timer_id,
+                                        uint32_t interval_s,
+                                        uint32_t repeat_for_s,
+                                        const std::string& callback_uri,
+                                        const std::string& opaque_data)
+{
+  Timer timer;
+  timer.op = op;
+  timer.timer_id = timer_id;
+  timer.interval_s = interval_s;
+  timer.repeat_for_s = repeat_for_s;
+  timer.callback_uri = callback_uri;
+  timer.opaque_data = opaque_data;
+  timer.rc = 0;
+  _timers.push_back(timer);
+
+  return _timers.size() - 1;
+}
+
+
+int ParallelChronosSender::send(SAS::TrailId trail)
+{
+  size_t first = _sent;
+  size_t last = _timers.size();
+
+  {
+    std::unique_lock<std::mutex> lock(_lock);
+    _trail = trail;
+
+    for (size_t ii = first; ii < last; ++ii)
+    {
+      _queue.push_back(ii);
+    }
+
+    _outstanding += last - first;
+    _work_cond.notify_all();
+
+    _done_cond.wait(lock, [this]() { return _outstanding == 0; });
+  }
+
+  _sent = last;
+
+  return std::count_if(_timers.begin() + first,
+                       _timers.end(),
+                       [](const Timer& timer) { return timer.rc != HTTP_OK; });
+}
+
+
+void ParallelChronosSender::worker_thread()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (true)
+  {
+    _work_cond.wait(lock, [this]() { return _terminating || !_queue.empty(); });
+
+    if (_queue.empty())
+    {
+      // Terminating, and there's nothing left to send.
+      break;
+    }
+
+    size_t index = _queue.front();
+    _queue.pop_front();
+    SAS::TrailId trail = _trail;
+
+    // The timers aren't added to or removed while a send is in progress, so
+    // this timer can be updated without holding the lock.
+    lock.unlock();
+    send_timer(_timers[index], trail);
+    lock.lock();
+
+    if (--_outstanding == 0)
+    {
+      _done_cond.notify_all();
+    }
+  }
+}
+
+
+void ParallelChronosSender::send_timer(Timer& timer, SAS::TrailId trail)
+{
+  switch (timer.op)
+  {
+  case Op::SET:
+    timer.rc = _connection->send_post(timer.timer_id,
+                                      timer.interval_s,
+                                      timer.repeat_for_s,
+                                      timer.callback_uri,
+                                      timer.opaque_data,
+                                      trail,
+                                      std::map<std::string, uint32_t>());
+    break;
+
+  case Op::UPDATE:
+    timer.rc = _connection->send_put(timer.timer_id,
+                                     timer.interval_s,
+                                     timer.repeat_for_s,
+                                     timer.callback_uri,
+                                     timer.opaque_data,
+                                     trail,
+                                     std::map<std::string, uint32_t>());
+    break;
+
+  case Op::DELETE:
+    timer.rc = _connection->send_delete(timer.timer_id, trail);
+    break;
+  }
+}
@@ -0,0 +1,145 @@
+/**
+ * @file parallelchronossender.h Sends many Chronos timer operations at once.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PARALLELCHRONOSSENDER_H__
+#define PARALLELCHRONOSSENDER_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "chronosconnection.h"
+
+/// Sets, updates and deletes a list of Chronos timers, with a result for each
+/// timer.
+///
+/// Chronos only accepts one timer per request, so each timer is still a
+/// separate request. The sender has a pool of worker threads that send the
+/// requests over several connections at once, so a list of timers takes about
+/// as long as its slowest few requests rather than all of them in turn. The
+/// workers are started with the sender and reused for every send.
+///
+/// Timers can only be added while no send is in progress.
+class ParallelChronosSender
+{
+public:
+  /// The operation to carry out on a timer.
+  enum struct Op
+  {
+    SET,
+    UPDATE,
+    DELETE
+  };
+
+  /// A timer to send, and its result.
+  struct Timer
+  {
+    Op op;
+
+    /// The timer's ID. For SET this is filled in when the timer is sent.
+    std::string timer_id;
+
+    uint32_t interval_s;
+    uint32_t repeat_for_s;
+    std::string callback_uri;
+    std::string opaque_data;
+
+    /// The result of the operation, or 0 if it hasn't been sent.
+    HTTPCode rc;
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] connection  - The connection to send the timers on. This is
+  ///                           not owned by the sender.
+  /// @param [in] num_threads - The number of worker threads, which is the most
+  ///                           requests in flight at once.
+  ParallelChronosSender(ChronosConnection* connection, int num_threads = 8);
+
+  /// Destructor. Stops the worker threads.
+  ~ParallelChronosSender();
+
+  /// Add a new timer.
+  ///
+  /// @return The index of the timer.
+  size_t add_set(uint32_t interval_s,
+                 uint32_t repeat_for_s,
+                 const std::string& callback_uri,
+                 const std::string& opaque_data);
+
+  /// Add a change to an existing timer.
+  ///
+  /// @return The index of the timer.
+  size_t add_update(const std::string& timer_id,
+                    uint32_t interval_s,
+                    uint32_t repeat_for_s,
+                    const std::string& callback_uri,
+                    const std::string& opaque_data);
+
+  /// Add the deletion of an existing timer.
+  ///
+  /// @return The index of the timer.
+  size_t add_delete(const std::string& timer_id);
+
+  /// Send all the timers that haven't been sent yet, and wait for their
+  /// results.
+  ///
+  /// @return The number of timers that failed.
+  int send(SAS::TrailId trail);
+
+  /// The timers, in the order they were added.
+  const std::vector<Timer>& timers() const { return _timers; }
+  const Timer& timer(size_t index) const { return _timers.at(index); }
+  size_t size() const { return _timers.size(); }
+
+  /// Remove all the timers, so the sender can be reused.
+  void clear() { _timers.clear(); _sent = 0; }
+
+private:
+  /// Add a timer to the end of the list.
+  size_t add_timer(Op op,
+                   const std::string& timer_id,
+                   uint32_t interval_s,
+                   uint32_t repeat_for_s,
+                   const std::string& callback_uri,
+                   const std::string& opaque_data);
+
+  /// Send a single timer, and record its result.
+  void send_timer(Timer& timer, SAS::TrailId trail);
+
+  /// Worker thread function. Sends queued timers until the sender is
+  /// destroyed.
+  void worker_thread();
+
+  ChronosConnection* _connection;
+  std::vector<Timer> _timers;
+
+  /// The number of timers (from the start of the list) already sent.
+  size_t _sent;
+
+  /// The indexes of the timers waiting for a worker, the number queued or in
+  /// progress, and the trail to send them on. Protected by _lock.
+  std::mutex _lock;
+  std::condition_variable _work_cond;
+  std::condition_variable _done_cond;
+  std::deque<size_t> _queue;
+  size_t _outstanding;
+  SAS::TrailId _trail;
+  bool _terminating;
+
+  std::vector<std::thread> _workers;
+};
+
+#endif
@@ -0,0 +1,329 @@
+/**
+ * @file parallelremotes4.cpp S4 that replicates to several remote sites at
+ * once.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <chrono>
+
+#include "parallelremotes4.h"
+
+const int ParallelRemoteS4::RETRY_INTERVAL_MS;
+
+ParallelRemoteS4::ParallelRemoteS4(const std::string& id,
+                                   const std::vector<S4*>& remote_s4s,
+                                   Wait wait) :
+  S4(id, nullptr),
+  _remote_s4s(remote_s4s),
+  _wait(wait),
+  _queues(remote_s4s.size()),
+  _retrying(remote_s4s.size(), false),
+  _outstanding(0),
+  _terminating(false)
+{
+  for (size_t ii = 0; ii < _remote_s4s.size(); ++ii)
+  {
+    _workers.emplace_back(&ParallelRemoteS4::worker_thread, this, ii);
+  }
+}
+
+
+ParallelRemoteS4::~ParallelRemoteS4()
+{
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _terminating = true;
+  }
+
+  _cond.notify_all();
+
+  for (std::thread& worker : _workers)
+  {
+    worker.join();
+  }
+}
+
+
+HTTPCode ParallelRemoteS4::handle_get(const std::string& id,
+                                      AoR** aor,
+                                      uint64_t& version,
+                                      SAS::TrailId trail)
+{
+  HTTPCode rc = HTTP_NOT_FOUND;
+
+  for (S4* s4 : _remote_s4s)
+  {
+    rc = s4->handle_get(id, aor, version, trail);
+
+    if (rc == HTTP_OK)
+    {
+      break;
+    }
+  }
+
+  return rc;
+}
+
+
+HTTPCode ParallelRemoteS4::handle_put(const std::string& id,
+                                      const AoR& aor,
+                                      SAS::TrailId trail)
+{
+  // The put may carry on after this returns, so take a copy of the AoR for
+  // the sites to share.
+  std::shared_ptr<AoR> aor_copy(new AoR(aor));
+
+  return fan_out([this, id, aor_copy, trail](size_t index) {
+                   return _remote_s4s[index]->handle_put(id, *aor_copy, trail);
+                 },
+                 sites_to_wait_for());
+}
+
+
+HTTPCode ParallelRemoteS4::handle_patch(const std::string& id,
+                                        const PatchObject& patch_object,
+                                        AoR** aor,
+                                        SAS::TrailId trail)
+{
+  std::vector<AoR*> aors(_remote_s4s.size(), nullptr);
+
+  HTTPCode rc = fan_out([&](size_t index) {
+                          return _remote_s4s[index]->handle_patch(id,
+                                                                  patch_object,
+                                                                  &aors[index],
+                                                                  trail);
+                        },
+                        _remote_s4s.size());
+
+  // Return the AoR from the first site that has one.
+  *aor = nullptr;
+
+  for (AoR* site_aor : aors)
+  {
+    if (*aor == nullptr)
+    {
+      *aor = site_aor;
+    }
+    else
+    {
+      delete site_aor;
+    }
+  }
+
+  return rc;
+}
+
+
+HTTPCode ParallelRemoteS4::handle_delete(const std::string& id,
+                                         uint64_t version,
+                                         SAS::TrailId trail)
+{
+  return fan_out([this, id, version, trail](size_t index) {
+                   return _remote_s4s[index]->handle_delete(id, version, trail);
+                 },
+                 sites_to_wait_for());
+}
+
+
+HTTPCode ParallelRemoteS4::resync(const std::string& id,
+                                  const AoR& aor,
+                                  SAS::TrailId trail)
+{
+  std::shared_ptr<AoR> aor_copy(new AoR(aor));
+
+  return fan_out([this, id, aor_copy, trail](size_t index) {
+                   // A put only creates AoRs, so only put to the sites that
+                   // don't have it.
+                   AoR* site_aor = nullptr;
+                   uint64_t version;
+                   HTTPCode rc = _remote_s4s[index]->handle_get(id,
+                                                                &site_aor,
+                                                                version,
+                                                                trail);
+                   delete site_aor; site_aor = nullptr;
+
+                   if (rc == HTTP_NOT_FOUND)
+                   {
+                     rc = _remote_s4s[index]->handle_put(id, *aor_copy, trail);
+                   }
+
+                   return rc;
+                 },
+                 _remote_s4s.size());
+}
+
+
+void ParallelRemoteS4::wait_for_idle()
+{
+  std::unique_lock<std::mutex> lock(_lock);
+  _idle_cond.wait(lock, [this]() { return _outstanding == 0; });
+}
+
+
+HTTPCode ParallelRemoteS4::fan_out(std::function<HTTPCode(size_t)> fn, size_t wait_for)
+{
+  std::shared_ptr<Result> result(new Result());
+
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    for (size_t ii = 0; ii < _queues.size(); ++ii)
+    {
+      // Only the first attempt at each site is reported to the caller.
+      std::shared_ptr<bool> reported(new bool(false));
+
+      _queues[ii].push_back([fn, result, ii, reported](Action action) {
+        HTTPCode rc = (action == Action::RUN) ? fn(ii) : HTTP_SERVER_UNAVAILABLE;
+
+        if (!*reported)
+        {
+          *reported = true;
+          std::lock_guard<std::mutex> result_guard(result->lock);
+
+          if (rc == HTTP_OK)
+          {
+            ++result->succeeded;
+          }
+          else if (result->first_failure == HTTP_OK)
+          {
+            result->first_failure = rc;
+          }
+
+          ++result->completed;
+          result->cond.notify_all();
+        }
+
+        // Retry if the site couldn't be reached, rather than if it rejected
+        // the write.
+        return (action == Action::DEFER) ||
+               ((action == Action::RUN) && (rc >= HTTP_SERVER_ERROR));
+      });
+
+      if (_retrying[ii])
+      {
+        // Don't hold the caller up behind the site's retries.
+        _queues[ii].back()(Action::DEFER);
+      }
+    }
+
+    _outstanding += _queues.size();
+  }
+
+  _cond.notify_all();
+
+  size_t num_sites = _queues.size();
+  std::unique_lock<std::mutex> lock(result->lock);
+  result->cond.wait(lock, [&]() {
+    return (result->succeeded >= wait_for) || (result->completed == num_sites);
+  });
+
+  return (result->succeeded >= wait_for) ? HTTP_OK : result->first_failure;
+}
+
+
+size_t ParallelRemoteS4::abandon_queued_writes()
+{
+  std::vector<Task> abandoned;
+
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    for (std::deque<Task>& queue : _queues)
+    {
+      abandoned.insert(abandoned.end(), queue.begin(), queue.end());
+      queue.clear();
+    }
+  }
+
+  // Fail the writes, so that any caller waiting on them sees the failure.
+  for (Task& task : abandoned)
+  {
+    task(Action::ABANDON);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(_lock);
+    _outstanding -= abandoned.size();
+  }
+
+  _idle_cond.notify_all();
+
+  return abandoned.size();
+}
+
+
+size_t ParallelRemoteS4::sites_to_wait_for() const
+{
+  size_t num_remote_sites = _remote_s4s.size();
+
+  switch (_wait)
+  {
+  case Wait::ALL:
+    return num_remote_sites;
+
+  case Wait::QUORUM:
+    // A majority of all the sites is (num_remote_sites + 1) / 2 + 1. The local
+    // site is one of them.
+    return (num_remote_sites + 1) / 2;
+
+  case Wait::NONE:
+  default:
+    return 0;
+  }
+}
+
+
+void ParallelRemoteS4::worker_thread(size_t index)
+{
+  std::unique_lock<std::mutex> lock(_lock);
+
+  while (true)
+  {
+    _cond.wait(lock, [&]() { return _terminating || !_queues[index].empty(); });
+
+    if (_queues[index].empty())
+    {
+      // Terminating, and there's nothing left to do for this site.
+      break;
+    }
+
+    Task task = _queues[index].front();
+    _queues[index].pop_front();
+
+    lock.unlock();
+    bool retry = task(Action::RUN);
+    lock.lock();
+
+    if (retry && !_terminating)
+    {
+      // Put the write back at the head of the queue, so later writes still
+      // reach the site after it. Tell the callers of the writes queued behind
+      // it not to wait, and wait before trying again.
+      if (!_retrying[index])
+      {
+        _retrying[index] = true;
+
+        for (Task& queued : _queues[index])
+        {
+          queued(Action::DEFER);
+        }
+      }
+
+      _queues[index].push_front(task);
+      _cond.wait_for(lock,
+                     std::chrono::milliseconds(RETRY_INTERVAL_MS),
+                     [this]() { return _terminating; });
+      continue;
+    }
+
+    _retrying[index] = false;
+    --_outstanding;
+    _idle_cond.notify_all();
+  }
+}
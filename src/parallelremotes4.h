@@ -0,0 +1,186 @@
+/**
+ * @file parallelremotes4.h S4 that replicates to several remote sites at once.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef PARALLELREMOTES4_H__
+#define PARALLELREMOTES4_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "s4.h"
+
+/// A local S4 replicates each write to its remote S4s one after another, so
+/// every remote site's latency is added to the write. This stands in for all
+/// the remote S4s as a single remote S4, and passes each write on to all of
+/// them at once.
+///
+/// Each remote site has its own worker thread, so writes reach each site in
+/// the order they were made. How many sites a write waits for is set by the
+/// Wait policy. A site that fails doesn't count towards this, so a write only
+/// fails if it can't reach enough sites.
+///
+/// A write that fails at a site because the site can't be reached (a 5xx
+/// result) stays at the head of that site's queue, and is retried until it
+/// succeeds. The caller only sees the first attempt's result, but the site
+/// converges with the others once it is reachable again. While a site is
+/// being retried, later writes queue behind the retry so they still reach the
+/// site in order, but their callers are told at once that the site is
+/// unavailable rather than waiting for it.
+class ParallelRemoteS4 : public S4
+{
+public:
+  /// How many remote sites a write waits for before returning.
+  enum struct Wait
+  {
+    /// Wait for every remote site.
+    ALL,
+
+    /// Wait for enough remote sites that, with the local site, a majority of
+    /// sites have the write.
+    QUORUM,
+
+    /// Don't wait for any remote sites. The write carries on in the
+    /// background.
+    NONE
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] id         - The ID of this S4, for logging.
+  /// @param [in] remote_s4s - The S4s for each remote site. These are not
+  ///                          owned by this object.
+  /// @param [in] wait       - How many remote sites to wait for.
+  ParallelRemoteS4(const std::string& id,
+                   const std::vector<S4*>& remote_s4s,
+                   Wait wait);
+
+  /// Destructor. This waits for any writes still in progress to finish.
+  virtual ~ParallelRemoteS4();
+
+  /// Read from each remote site in turn, until one has the AoR.
+  HTTPCode handle_get(const std::string& id,
+                      AoR** aor,
+                      uint64_t& version,
+                      SAS::TrailId trail);
+
+  HTTPCode handle_put(const std::string& id,
+                      const AoR& aor,
+                      SAS::TrailId trail);
+
+  /// Patches always wait for every remote site, whatever the Wait policy, as
+  /// the patch object can't be safely copied to outlive the call. They are
+  /// still made to all the sites at once.
+  HTTPCode handle_patch(const std::string& id,
+                        const PatchObject& patch_object,
+                        AoR** aor,
+                        SAS::TrailId trail);
+
+  HTTPCode handle_delete(const std::string& id,
+                         uint64_t version,
+                         SAS::TrailId trail);
+
+  /// Push an AoR the local site holds to every remote site that doesn't have
+  /// it, waiting for all of them. This resyncs the remote sites after the
+  /// local site has lost writes it hadn't replicated yet (see
+  /// abandon_queued_writes). Sites that already have the AoR are left as they
+  /// are.
+  HTTPCode resync(const std::string& id,
+                  const AoR& aor,
+                  SAS::TrailId trail);
+
+  /// Wait until every write made so far has reached every remote site. This
+  /// includes writes being retried, so it doesn't return while a remote site
+  /// with writes queued for it is down.
+  void wait_for_idle();
+
+  /// Drop the writes that are queued for remote sites but haven't started, as
+  /// happens when the local site fails before it can replicate them. Writes
+  /// already in progress carry on. Any caller waiting on a dropped write sees
+  /// it fail.
+  ///
+  /// @return The number of writes dropped, counting each remote site
+  ///         separately.
+  size_t abandon_queued_writes();
+
+private:
+  /// Tracks the results of a write to each remote site.
+  struct Result
+  {
+    std::mutex lock;
+    std::condition_variable cond;
+    size_t completed = 0;
+    size_t succeeded = 0;
+    HTTPCode first_failure = HTTP_OK;
+  };
+
+  /// Run an operation on every remote site, and wait for it to succeed on the
+  /// given number of them, or to finish on all of them.
+  ///
+  /// @param [in] fn       - The operation. This is passed the index of the
+  ///                        remote site to run on.
+  /// @param [in] wait_for - The number of sites to wait for.
+  ///
+  /// @return HTTP_OK if the operation succeeded on enough sites, or else the
+  ///         first failure.
+  HTTPCode fan_out(std::function<HTTPCode(size_t)> fn, size_t wait_for);
+
+  /// The number of remote sites a write waits for under the Wait policy.
+  size_t sites_to_wait_for() const;
+
+  /// What to do with an operation queued for a remote site.
+  enum struct Action
+  {
+    /// Run the operation.
+    RUN,
+
+    /// Tell the caller the site is unavailable, but keep the operation queued
+    /// to run later.
+    DEFER,
+
+    /// Tell the caller the site is unavailable, and drop the operation.
+    ABANDON
+  };
+
+  /// An operation queued for one remote site. It returns whether it should
+  /// stay queued to be run (again) later.
+  typedef std::function<bool(Action)> Task;
+
+  /// How long a site's worker waits before retrying a write that failed.
+  static const int RETRY_INTERVAL_MS = 100;
+
+  /// Runs the operations queued for one remote site.
+  void worker_thread(size_t index);
+
+  std::vector<S4*> _remote_s4s;
+  Wait _wait;
+
+  /// Operations queued for each remote site, and the number queued or in
+  /// progress across all the sites. Protected by _lock.
+  std::mutex _lock;
+  std::condition_variable _cond;
+  std::condition_variable _idle_cond;
+  std::vector<std::deque<Task>> _queues;
+
+  /// Whether each remote site has a write waiting to be retried.
+  std::vector<bool> _retrying;
+  size_t _outstanding;
+  bool _terminating;
+
+  std::vector<std::thread> _workers;
+};
+
+#endif
@@ -11,16 +11,21 @@
  */
 
 #include "processinstance.h"
+#include "controlledclock.h"
 
 #include <unistd.h>
 #include <signal.h>
 #include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <netdb.h>
+#include <arpa/inet.h>
 #include <cstring>
 #include <fstream>
+#include <algorithm>
+#include <sstream>
 #include <boost/filesystem.hpp>
 
 /// Start this instance.
@@ -39,7 +44,13 @@ bool ProcessInstance::start_instance()
   }
   else if (pid == 0)
   {
-    // This is the new process, so execute the process.
+    // This is the new process. Don't pass on anything preloaded into the test
+    // binary (such as the allocation counting shim that make bench uses).
+    // Processes that need a preload, like a Chronos on a controlled clock, set
+    // their own in execute_process.
+    unsetenv("LD_PRELOAD");
+
+    // Execute the process.
     success = execute_process();
   }
   else
@@ -79,6 +90,118 @@ bool ProcessInstance::kill_instance()
   }
 }
 
+/// Send a signal to this instance.
+bool ProcessInstance::signal_instance(int sig)
+{
+  if (!_running)
+  {
+    return false;
+  }
+
+  if (kill(_pid, sig) != 0)
+  {
+    perror("kill");
+    return false;
+  }
+
+  return true;
+}
+
+/// Count the connections to this instance.
+int ProcessInstance::established_connections()
+{
+  // Each line of /proc/net/tcp describes a socket. The local address is the
+  // second field, formatted as the IPv4 address and port in hex, and the
+  // state is the fourth field. The address is printed as the raw 32 bit value
+  // (so is byte swapped on little endian machines) and the port in host order.
+  struct in_addr addr;
+  inet_pton(AF_INET, _ip.c_str(), &addr);
+  char local_address[16];
+  snprintf(local_address, sizeof(local_address), "%08X:%04X", addr.s_addr, _port);
+
+  const std::string TCP_ESTABLISHED = "01";
+  std::ifstream ifs("/proc/net/tcp");
+  std::string line;
+  int count = 0;
+
+  // Skip the header line.
+  std::getline(ifs, line);
+
+  while (std::getline(ifs, line))
+  {
+    std::istringstream iss(line);
+    std::string slot, local, remote, state;
+    iss >> slot >> local >> remote >> state;
+
+    if ((local == local_address) && (state == TCP_ESTABLISHED))
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+/// Get the CPU time used by this instance.
+uint64_t ProcessInstance::cpu_time_us()
+{
+  if (!_running)
+  {
+    return 0;
+  }
+
+  std::ifstream ifs("/proc/" + std::to_string(_pid) + "/stat");
+  std::string stat;
+  std::getline(ifs, stat);
+
+  // The second field is the command name in brackets, which may contain
+  // spaces, so start parsing after the closing bracket. The user and system
+  // times (in clock ticks) are then the 12th and 13th fields.
+  size_t end_of_name = stat.rfind(')');
+
+  if (end_of_name == std::string::npos)
+  {
+    return 0;
+  }
+
+  std::istringstream iss(stat.substr(end_of_name + 1));
+  std::string field;
+
+  for (int ii = 0; ii < 11; ++ii)
+  {
+    iss >> field;
+  }
+
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  iss >> utime >> stime;
+
+  return (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+/// Get the resident memory of this instance.
+uint64_t ProcessInstance::rss_bytes()
+{
+  if (!_running)
+  {
+    return 0;
+  }
+
+  // The resident memory is reported as "VmRSS:    1234 kB".
+  std::ifstream ifs("/proc/" + std::to_string(_pid) + "/status");
+  std::string line;
+
+  while (std::getline(ifs, line))
+  {
+    if (line.compare(0, 6, "VmRSS:") == 0)
+    {
+      return std::stoull(line.substr(6)) * 1024;
+    }
+  }
+
+  return 0;
+}
+
 /// Restart this instance.
 bool ProcessInstance::restart_instance()
 {
@@ -149,6 +272,84 @@ bool MemcachedInstance::execute_process()
   return false;
 }
 
+bool MemcachedInstance::get_stats(std::map<std::string, std::string>& stats)
+{
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(ip().c_str(), std::to_string(port()).c_str(), &hints, &res) != 0)
+  {
+    return false;
+  }
+
+  int sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+
+  if ((sockfd == -1) || (connect(sockfd, res->ai_addr, res->ai_addrlen) != 0))
+  {
+    perror("connect");
+    if (sockfd != -1)
+    {
+      close(sockfd);
+    }
+    freeaddrinfo(res);
+    return false;
+  }
+
+  freeaddrinfo(res);
+
+  // Use the text protocol to request the stats. The response is a series of
+  // "STAT <name> <value>" lines terminated by "END".
+  const std::string request = "stats\r\n";
+  bool ok = (send(sockfd, request.data(), request.size(), 0) == (ssize_t)request.size());
+  std::string response;
+
+  while (ok && (response.find("END\r\n") == std::string::npos))
+  {
+    char buf[4096];
+    ssize_t len = recv(sockfd, buf, sizeof(buf), 0);
+
+    if (len <= 0)
+    {
+      ok = false;
+    }
+    else
+    {
+      response.append(buf, len);
+    }
+  }
+
+  close(sockfd);
+
+  if (ok)
+  {
+    std::istringstream iss(response);
+    std::string line;
+
+    while (std::getline(iss, line))
+    {
+      std::istringstream line_stream(line);
+      std::string type, name, value;
+      line_stream >> type >> name >> value;
+
+      if (type == "STAT")
+      {
+        stats[name] = value;
+      }
+    }
+  }
+
+  return ok;
+}
+
+uint64_t MemcachedInstance::get_bytes_used()
+{
+  std::map<std::string, std::string> stats;
+  return (get_stats(stats) && (stats.count("bytes") != 0)) ?
+           strtoull(stats["bytes"].c_str(), NULL, 10) : 0;
+}
+
 std::string get_log_level()
 {
   // Work out the log level of the tests by parsing the NOISY=t:?
@@ -188,25 +389,177 @@ bool RogersInstance::execute_process()
   return false;
 }
 
-void DnsmasqInstance::write_config(std::map<std::string, std::vector<std::string>> a_records)
+DnsmasqInstance::DnsmasqInstance(std::string ip,
+                                 int port,
+                                 std::map<std::string, std::vector<std::string>> a_records,
+                                 const std::vector<std::string>& local_domains,
+                                 int ttl) :
+  ProcessInstance(ip, port),
+  _a_records(a_records),
+  _local_domains(local_domains),
+  _ttl(ttl)
+{
+  std::string file_prefix = ip + "_" + std::to_string(port) + "_";
+  _cfgfile = file_prefix + "_dnsmasq.cfg";
+
+  // dnsmasq changes directory to / when it starts, so the files it reads
+  // after that need absolute paths.
+  _hostsfile = boost::filesystem::absolute(file_prefix + "dnsmasq.hosts").string();
+  _logfile = boost::filesystem::absolute(file_prefix + "dnsmasq.log").string();
+  std::remove(_logfile.c_str());
+
+  write_hosts();
+  write_config();
+}
+
+DnsmasqInstance::~DnsmasqInstance()
 {
-  _cfgfile = _ip + "_" + std::to_string(_port) + "_" + "_dnsmasq.cfg";
+  std::remove(_cfgfile.c_str());
+  std::remove(_hostsfile.c_str());
+  std::remove(_logfile.c_str());
+}
 
+void DnsmasqInstance::write_config()
+{
   std::ofstream ofs(_cfgfile, std::ios::trunc);
   ofs << "listen-address=" << _ip << "\n";
   ofs << "port=" << _port << "\n";
 
-  for (auto i: a_records)
+  // Log every query, so that tests can check how many queries reach us.
+  ofs << "log-queries\n";
+  ofs << "log-facility=" << _logfile << "\n";
+
+  // Serve A records from our own hosts file, so that they can be changed
+  // without restarting dnsmasq.
+  ofs << "addn-hosts=" << _hostsfile << "\n";
+
+  for (auto i: _srv_records)
+  {
+    for (auto srv: i.second)
+    {
+      ofs << "srv-host=" << i.first << "," << srv.target << "," << srv.port
+          << "," << srv.priority << "," << srv.weight << "\n";
+    }
+  }
+
+  for (auto domain: _local_domains)
+  {
+    ofs << "local=/" << domain << "/\n";
+  }
+
+  if (_ttl != 0)
+  {
+    ofs << "local-ttl=" << _ttl << "\n";
+  }
+
+  ofs.close();
+}
+
+void DnsmasqInstance::write_hosts()
+{
+  std::ofstream ofs(_hostsfile, std::ios::trunc);
+
+  for (auto i: _a_records)
   {
     for (auto ip: i.second)
     {
-      ofs << "host-record=" << i.first << "," << ip << "\n";
+      ofs << ip << " " << i.first << "\n";
     }
   }
 
   ofs.close();
 }
 
+bool DnsmasqInstance::reload_hosts()
+{
+  write_hosts();
+
+  // If dnsmasq isn't running it picks up the new records when it starts.
+  // Otherwise SIGHUP makes it clear its cache and re-read its hosts files.
+  return (!running() || signal_instance(SIGHUP));
+}
+
+bool DnsmasqInstance::set_a_records(const std::string& domain,
+                                    const std::vector<std::string>& ips)
+{
+  if (ips.empty())
+  {
+    _a_records.erase(domain);
+  }
+  else
+  {
+    _a_records[domain] = ips;
+  }
+
+  return reload_hosts();
+}
+
+bool DnsmasqInstance::add_a_record(const std::string& domain, const std::string& ip)
+{
+  _a_records[domain].push_back(ip);
+  return reload_hosts();
+}
+
+bool DnsmasqInstance::remove_a_record(const std::string& domain, const std::string& ip)
+{
+  std::vector<std::string>& ips = _a_records[domain];
+  ips.erase(std::remove(ips.begin(), ips.end(), ip), ips.end());
+
+  if (ips.empty())
+  {
+    _a_records.erase(domain);
+  }
+
+  return reload_hosts();
+}
+
+bool DnsmasqInstance::set_srv_records(const std::string& domain,
+                                      const std::vector<SrvRecord>& records)
+{
+  if (records.empty())
+  {
+    _srv_records.erase(domain);
+  }
+  else
+  {
+    _srv_records[domain] = records;
+  }
+
+  write_config();
+
+  return (!running() || (restart_instance() && wait_for_instance()));
+}
+
+int DnsmasqInstance::query_count(const std::string& domain, const std::string& type)
+{
+  // Queries are logged as "query[<type>] <domain> from <ip>".
+  const std::string query = "query[" + type + "] " + domain + " ";
+  int count = -1;
+  int stable_polls = 0;
+
+  // Re-read the log every 10ms until the count has been the same for 100ms.
+  for (int poll = 0; (poll < 100) && (stable_polls < 10); ++poll)
+  {
+    std::ifstream ifs(_logfile);
+    std::string line;
+    int new_count = 0;
+
+    while (std::getline(ifs, line))
+    {
+      if (line.find(query) != std::string::npos)
+      {
+        new_count++;
+      }
+    }
+
+    stable_polls = (new_count == count) ? stable_polls + 1 : 0;
+    count = new_count;
+    usleep(10000);
+  }
+
+  return count;
+}
+
 bool DnsmasqInstance::execute_process()
 {
   // Start dnsmasq. execlp only returns if an error has occurred, in which
@@ -230,6 +583,7 @@ ChronosInstance::ChronosInstance(const std::string& ip,
                                  const std::string& dns_ip,
                                  int dns_port) :
   ProcessInstance(ip, port),
+  _clock(NULL),
   _instance_dir(instance_dir),
   _log_dir(_instance_dir + "/log"),
   _conf_dir(_instance_dir + "/conf"),
@@ -278,6 +632,11 @@ bool ChronosInstance::execute_process()
   freopen(out_file.c_str(), "a", stdout);
   freopen(err_file.c_str(), "a", stderr);
 
+  if (_clock != NULL)
+  {
+    _clock->set_process_env();
+  }
+
   // Start Chronos. execlp only returns if an error has occurred, in which case
   // return false.
   execlp("../modules/chronos/build/bin/chronos",
@@ -10,9 +10,15 @@
  * Metaswitch Networks in a separate written agreement.
  */
 
+#ifndef PROCESSINSTANCE_H__
+#define PROCESSINSTANCE_H__
+
 #include <string>
 #include <map>
 #include <vector>
+#include <stdint.h>
+
+class ControlledClock;
 
 class ProcessInstance
 {
@@ -26,8 +32,24 @@ public:
   bool restart_instance();
   bool wait_for_instance();
 
+  /// Send a signal to this instance.
+  bool signal_instance(int sig);
+
   std::string ip() const { return _ip; }
   int port() const { return _port; }
+  bool running() const { return _running; }
+
+  /// Returns the number of TCP connections currently established to this
+  /// instance's IP and port, as listed in /proc/net/tcp.
+  int established_connections();
+
+  /// Returns the CPU time (user and system) this instance has used, in
+  /// microseconds, or 0 if it isn't running.
+  uint64_t cpu_time_us();
+
+  /// Returns the resident memory of this instance, in bytes, or 0 if it isn't
+  /// running.
+  uint64_t rss_bytes();
 
 private:
   virtual bool execute_process() = 0;
@@ -43,6 +65,18 @@ class MemcachedInstance : public ProcessInstance
 public:
   MemcachedInstance(const std::string& ip, int port) : ProcessInstance(ip, port) {};
   virtual bool execute_process();
+
+  /// Get the general-purpose statistics from this memcached (the output of
+  /// the "stats" command).
+  ///
+  /// @param [out] stats - Map of stat name to value.
+  ///
+  /// @return Whether the stats were retrieved successfully.
+  bool get_stats(std::map<std::string, std::string>& stats);
+
+  /// Returns the number of bytes this memcached is currently using to store
+  /// items, or 0 if this could not be determined.
+  uint64_t get_bytes_used();
 };
 
 class RogersInstance : public ProcessInstance
@@ -58,17 +92,82 @@ private:
   std::string _cluster_settings_file;
 };
 
+/// A dnsmasq DNS server.
+///
+/// A records are served from a hosts file, which dnsmasq re-reads when sent
+/// SIGHUP, so they can be changed while dnsmasq is running. SRV records are
+/// part of dnsmasq's configuration, which it only reads when it starts, so
+/// changing them restarts dnsmasq.
 class DnsmasqInstance : public ProcessInstance
 {
 public:
-  DnsmasqInstance(std::string ip, int port, std::map<std::string, std::vector<std::string>> a_records) :
-    ProcessInstance(ip, port) { write_config(a_records); };
-  ~DnsmasqInstance() { std::remove(_cfgfile.c_str()); };
+  /// An SRV record target.
+  struct SrvRecord
+  {
+    std::string target;
+    int port;
+    int priority;
+    int weight;
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] a_records     - Map of domain name to the IPs it resolves to.
+  /// @param [in] local_domains - Domains that dnsmasq is authoritative for.
+  ///                             Names in these domains without an A record
+  ///                             get an immediate NXDOMAIN, rather than being
+  ///                             forwarded to the system's DNS servers.
+  /// @param [in] ttl           - The TTL of the records. By default dnsmasq
+  ///                             gives its records a TTL of 0, so they are
+  ///                             never cached.
+  DnsmasqInstance(std::string ip,
+                  int port,
+                  std::map<std::string, std::vector<std::string>> a_records,
+                  const std::vector<std::string>& local_domains = {},
+                  int ttl = 0);
+  ~DnsmasqInstance();
 
   bool execute_process();
+
+  /// Returns the number of queries of the given type this dnsmasq has
+  /// received for a domain, by counting them in its query log. dnsmasq writes
+  /// its log asynchronously, so this waits (for up to a second) until the
+  /// count has stopped changing. Tests that need exact counts should use a
+  /// DnsResponder, which counts queries as it receives them.
+  int query_count(const std::string& domain, const std::string& type = "A");
+
+  /// Replace the A records for a domain. An empty list of IPs removes the
+  /// domain. If dnsmasq is running it reloads the records straight away.
+  ///
+  /// @return Whether the change was made successfully.
+  bool set_a_records(const std::string& domain, const std::vector<std::string>& ips);
+
+  /// Add or remove a single A record for a domain.
+  bool add_a_record(const std::string& domain, const std::string& ip);
+  bool remove_a_record(const std::string& domain, const std::string& ip);
+
+  /// Replace the SRV records for a domain (e.g. "_http._tcp.chronos.site1").
+  /// An empty list removes the domain. If dnsmasq is running it is restarted
+  /// to pick up the change, and this waits for it to come back.
+  ///
+  /// @return Whether the change was made successfully.
+  bool set_srv_records(const std::string& domain, const std::vector<SrvRecord>& records);
+
 private:
-  void write_config(std::map<std::string, std::vector<std::string>> a_records);
+  void write_config();
+  void write_hosts();
+
+  /// Have a running dnsmasq re-read its hosts file.
+  bool reload_hosts();
+
+  std::map<std::string, std::vector<std::string>> _a_records;
+  std::map<std::string, std::vector<SrvRecord>> _srv_records;
+  std::vector<std::string> _local_domains;
+  int _ttl;
+
   std::string _cfgfile;
+  std::string _hostsfile;
+  std::string _logfile;
 };
 
 class ChronosInstance : public ProcessInstance
@@ -84,7 +183,12 @@ public:
   virtual ~ChronosInstance();
   bool execute_process();
 
+  /// Have this instance follow the given clock, rather than the real time,
+  /// from the next time it is started. Pass NULL to go back to the real time.
+  void use_clock(const ControlledClock* clock) { _clock = clock; }
+
 private:
+  const ControlledClock* _clock;
   std::string _instance_dir;
   std::string _log_dir;
   std::string _conf_dir;
@@ -92,3 +196,5 @@ private:
   std::string _cluster_conf_file;
   std::string _shared_conf_file;
 };
+
+#endif
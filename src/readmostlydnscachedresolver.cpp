@@ -0,0 +1,489 @@
+/**
+ * @file readmostlydnscachedresolver.cpp DNS resolver whose cache hits don't
+ * need an exclusive lock.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+#include "readmostlydnscachedresolver.h"
+
+ReadMostlyDnsCachedResolver::ReadMostlyDnsCachedResolver(const std::string& dns_server,
+                                                         int timeout,
+                                                         const std::string& filename,
+                                                         int port,
+                                                         int refresh_ahead) :
+  DnsCachedResolver(dns_server, timeout, filename, port),
+  _timeout_ms(timeout),
+  _refresh_ahead(refresh_ahead),
+  _misses(0),
+  _refreshes(0),
+  _negative_hits(0),
+  _negative_caching(false),
+  _terminating(false)
+{
+  memset(&_server_addr, 0, sizeof(_server_addr));
+  _server_addr.sin_family = AF_INET;
+  _server_addr.sin_port = htons(port);
+  _negative_caching = (inet_pton(AF_INET,
+                                 dns_server.c_str(),
+                                 &_server_addr.sin_addr) == 1);
+
+  void* shards = NULL;
+
+  if (posix_memalign(&shards, alignof(Shard), NUM_SHARDS * sizeof(Shard)) != 0)
+  {
+    throw std::bad_alloc();
+  }
+
+  _shards = (Shard*)shards;
+
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    new (&_shards[ii]) Shard();
+    pthread_rwlock_init(&_shards[ii].lock, NULL);
+  }
+
+  if (_refresh_ahead > 0)
+  {
+    _refresh_thread = std::thread(&ReadMostlyDnsCachedResolver::refresh_thread, this);
+  }
+}
+
+
+ReadMostlyDnsCachedResolver::~ReadMostlyDnsCachedResolver()
+{
+  if (_refresh_thread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(_refresh_lock);
+      _terminating = true;
+    }
+    _refresh_cond.notify_one();
+    _refresh_thread.join();
+  }
+
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    clear_shard(_shards[ii]);
+    pthread_rwlock_destroy(&_shards[ii].lock);
+    _shards[ii].~Shard();
+  }
+
+  free(_shards); _shards = NULL;
+}
+
+
+void ReadMostlyDnsCachedResolver::add_to_cache(const std::string& domain,
+                                               int dnstype,
+                                               std::vector<DnsRRecord*>& records)
+{
+  DnsCachedResolver::add_to_cache(domain, dnstype, records);
+
+  // Drop the front cache's copy, so the next query fetches the new records
+  // from the underlying cache.
+  Shard& shard = get_shard(domain);
+  pthread_rwlock_wrlock(&shard.lock);
+  auto domain_it = shard.entries.find(domain);
+
+  if (domain_it != shard.entries.end())
+  {
+    auto type_it = domain_it->second.find(dnstype);
+
+    if (type_it != domain_it->second.end())
+    {
+      delete type_it->second;
+      domain_it->second.erase(type_it);
+    }
+  }
+
+  pthread_rwlock_unlock(&shard.lock);
+}
+
+
+void ReadMostlyDnsCachedResolver::clear()
+{
+  DnsCachedResolver::clear();
+
+  for (int ii = 0; ii < NUM_SHARDS; ++ii)
+  {
+    pthread_rwlock_wrlock(&_shards[ii].lock);
+    clear_shard(_shards[ii]);
+    pthread_rwlock_unlock(&_shards[ii].lock);
+  }
+}
+
+
+DnsResult ReadMostlyDnsCachedResolver::dns_query(const std::string& domain,
+                                                 int dnstype,
+                                                 SAS::TrailId trail)
+{
+  Shard& shard = get_shard(domain);
+  time_t current_time = now();
+
+  bool expired_negative = false;
+
+  pthread_rwlock_rdlock(&shard.lock);
+
+  auto domain_it = shard.entries.find(domain);
+
+  if (domain_it != shard.entries.end())
+  {
+    auto type_it = domain_it->second.find(dnstype);
+
+    if (type_it != domain_it->second.end())
+    {
+      Entry* entry = type_it->second;
+      time_t remaining = entry->expires - current_time;
+
+      // Serve the entry if it hasn't expired, or if it has but a refresh is
+      // on its way.
+      if ((remaining > 0) || (entry->refreshing))
+      {
+        if ((_refresh_ahead > 0) &&
+            (remaining <= _refresh_ahead) &&
+            (!entry->refreshing.exchange(true)))
+        {
+          // The entry is about to expire, and we're the first to notice.
+          // Refresh it now, while the old answer can still be served.
+          schedule_refresh(domain, dnstype, entry->expires - _refresh_ahead);
+        }
+
+        if (entry->result.records().empty())
+        {
+          _negative_hits++;
+        }
+
+        // Return a copy of the answer with the TTL that remains.
+        DnsResult result(domain,
+                         dnstype,
+                         entry->result.records(),
+                         (remaining > 0) ? remaining : 0);
+        pthread_rwlock_unlock(&shard.lock);
+        return result;
+      }
+
+      expired_negative = entry->result.records().empty();
+    }
+  }
+
+  pthread_rwlock_unlock(&shard.lock);
+
+  // Not in the cache, or expired. If another thread is already asking the
+  // underlying resolver for this record, wait for its answer rather than
+  // asking again.
+  std::pair<std::string, int> key(domain, dnstype);
+  std::shared_ptr<PendingQuery> pending;
+  bool first = false;
+
+  {
+    std::lock_guard<std::mutex> lock(_pending_lock);
+    std::shared_ptr<PendingQuery>& slot = _pending[key];
+
+    if (!slot)
+    {
+      slot = std::make_shared<PendingQuery>();
+      first = true;
+    }
+
+    pending = slot;
+  }
+
+  if (!first)
+  {
+    std::unique_lock<std::mutex> lock(pending->lock);
+    pending->cond.wait(lock, [&pending]() { return pending->done; });
+    return DnsResult(*pending->result);
+  }
+
+  // Ask the underlying resolver, and cache its answer unless it says not to.
+  _misses++;
+  int ttl = 0;
+  DnsResult result = query(domain, dnstype, trail, expired_negative, ttl);
+
+  if (ttl > 0)
+  {
+    pthread_rwlock_wrlock(&shard.lock);
+    Entry*& entry = shard.entries[domain][dnstype];
+    delete entry;
+    entry = new Entry(DnsResult(domain, dnstype, result.records(), ttl),
+                      current_time + ttl);
+    pthread_rwlock_unlock(&shard.lock);
+  }
+
+  // Hand the answer to any threads waiting for it. Later misses find it in the
+  // cache (or query again, if it couldn't be cached).
+  {
+    std::lock_guard<std::mutex> lock(_pending_lock);
+    _pending.erase(key);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(pending->lock);
+    pending->result.reset(new DnsResult(result));
+    pending->done = true;
+  }
+
+  pending->cond.notify_all();
+
+  return result;
+}
+
+
+void ReadMostlyDnsCachedResolver::schedule_refresh(const std::string& domain,
+                                                   int dnstype,
+                                                   time_t due)
+{
+  {
+    std::lock_guard<std::mutex> lock(_refresh_lock);
+    _refresh_queue.insert(std::make_pair(due, std::make_pair(domain, dnstype)));
+  }
+  _refresh_cond.notify_one();
+}
+
+
+void ReadMostlyDnsCachedResolver::refresh(const std::string& domain, int dnstype)
+{
+  int ttl = 0;
+  DnsResult result = query(domain, dnstype, 0, false, ttl);
+  time_t current_time = now();
+  Shard& shard = get_shard(domain);
+
+  pthread_rwlock_wrlock(&shard.lock);
+  auto domain_it = shard.entries.find(domain);
+  std::map<int, Entry*>::iterator type_it;
+
+  if ((domain_it == shard.entries.end()) ||
+      ((type_it = domain_it->second.find(dnstype)) == domain_it->second.end()))
+  {
+    // The entry has been removed since the refresh was scheduled, so there's
+    // nothing to refresh.
+    pthread_rwlock_unlock(&shard.lock);
+    return;
+  }
+
+  std::map<int, Entry*>& types = domain_it->second;
+  Entry* entry = type_it->second;
+
+  if ((ttl > 0) &&
+      (current_time + ttl <= entry->expires))
+  {
+    // The underlying resolver returned its own copy of the old answer, which
+    // hasn't expired yet. Try again when it has, and carry on serving the old
+    // answer until then.
+    pthread_rwlock_unlock(&shard.lock);
+    schedule_refresh(domain, dnstype, current_time + std::max(ttl, 1));
+    return;
+  }
+
+  delete entry;
+
+  if (ttl > 0)
+  {
+    type_it->second = new Entry(DnsResult(domain, dnstype, result.records(), ttl),
+                                current_time + ttl);
+  }
+  else
+  {
+    // The new answer mustn't be cached, so nor should the old one.
+    types.erase(type_it);
+
+    if (types.empty())
+    {
+      shard.entries.erase(domain_it);
+    }
+  }
+
+  pthread_rwlock_unlock(&shard.lock);
+  _refreshes++;
+}
+
+
+void ReadMostlyDnsCachedResolver::refresh_thread()
+{
+  std::unique_lock<std::mutex> lock(_refresh_lock);
+
+  while (!_terminating)
+  {
+    if (_refresh_queue.empty())
+    {
+      _refresh_cond.wait(lock);
+      continue;
+    }
+
+    auto next = _refresh_queue.begin();
+    time_t current_time = now();
+
+    if (next->first > current_time)
+    {
+      _refresh_cond.wait_for(lock, std::chrono::seconds(next->first - current_time));
+      continue;
+    }
+
+    std::pair<std::string, int> key = next->second;
+    _refresh_queue.erase(next);
+
+    lock.unlock();
+    refresh(key.first, key.second);
+    lock.lock();
+  }
+}
+
+
+DnsResult ReadMostlyDnsCachedResolver::query(const std::string& domain,
+                                             int dnstype,
+                                             SAS::TrailId trail,
+                                             bool expect_negative,
+                                             int& ttl)
+{
+  if (expect_negative)
+  {
+    // The answer was negative last time. Ask the server directly whether it
+    // still is, which gives the negative TTL in the same round trip. Only go
+    // to the underlying resolver if the domain has records now, or the server
+    // didn't give a negative answer.
+    ttl = negative_ttl(domain, dnstype);
+
+    if (ttl > 0)
+    {
+      return DnsResult(domain, dnstype, std::vector<DnsRRecord*>(), ttl);
+    }
+  }
+
+  uint64_t start_ms = now_ms();
+  DnsResult result = DnsCachedResolver::dns_query(domain, dnstype, trail);
+
+  if (!result.records().empty())
+  {
+    ttl = result.ttl();
+  }
+  else if (now_ms() - start_ms < (uint64_t)_timeout_ms)
+  {
+    // The underlying resolver doesn't say why there were no records, so ask
+    // the server directly whether this is a negative answer. Skip this if the
+    // query timed out, as the server isn't answering.
+    ttl = negative_ttl(domain, dnstype);
+  }
+  else
+  {
+    ttl = 0;
+  }
+
+  return result;
+}
+
+
+int ReadMostlyDnsCachedResolver::negative_ttl(const std::string& domain,
+                                              int dnstype)
+{
+  if (!_negative_caching)
+  {
+    return 0;
+  }
+
+  struct __res_state res;
+  memset(&res, 0, sizeof(res));
+
+  if (res_ninit(&res) != 0)
+  {
+    return 0;
+  }
+
+  res.nsaddr_list[0] = _server_addr;
+  res.nscount = 1;
+  res.retrans = 1;
+  res.retry = 1;
+
+  unsigned char query[NS_PACKETSZ];
+  unsigned char answer[NS_PACKETSZ];
+  int query_len = res_nmkquery(&res, ns_o_query, domain.c_str(), ns_c_in,
+                               dnstype, NULL, 0, NULL, query, sizeof(query));
+  int answer_len = (query_len > 0) ?
+                     res_nsend(&res, query, query_len, answer, sizeof(answer)) :
+                     -1;
+  res_nclose(&res);
+
+  ns_msg msg;
+
+  if ((answer_len <= 0) || (ns_initparse(answer, answer_len, &msg) != 0))
+  {
+    return 0;
+  }
+
+  // Only NXDOMAIN, or a successful answer with no records, is negative. Any
+  // other failure (such as SERVFAIL) is left uncached so it is retried.
+  int rcode = ns_msg_getflag(msg, ns_f_rcode);
+
+  if ((rcode != ns_r_nxdomain) &&
+      ((rcode != ns_r_noerror) || (ns_msg_count(msg, ns_s_an) != 0)))
+  {
+    return 0;
+  }
+
+  // The negative TTL comes from the SOA in the authority section. Its minimum
+  // field is the last 4 bytes of the record data.
+  for (int ii = 0; ii < ns_msg_count(msg, ns_s_ns); ++ii)
+  {
+    ns_rr rr;
+
+    if ((ns_parserr(&msg, ns_s_ns, ii, &rr) == 0) &&
+        (ns_rr_type(rr) == ns_t_soa) &&
+        (ns_rr_rdlen(rr) >= 20))
+    {
+      int minimum = ns_get32(ns_rr_rdata(rr) + ns_rr_rdlen(rr) - 4);
+      return std::min((int)ns_rr_ttl(rr), minimum);
+    }
+  }
+
+  return 0;
+}
+
+
+ReadMostlyDnsCachedResolver::Shard& ReadMostlyDnsCachedResolver::get_shard(const std::string& domain)
+{
+  return _shards[std::hash<std::string>()(domain) % NUM_SHARDS];
+}
+
+
+void ReadMostlyDnsCachedResolver::clear_shard(Shard& shard)
+{
+  for (auto& domain : shard.entries)
+  {
+    for (auto& type : domain.second)
+    {
+      delete type.second;
+    }
+  }
+
+  shard.entries.clear();
+}
+
+
+time_t ReadMostlyDnsCachedResolver::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+
+uint64_t ReadMostlyDnsCachedResolver::now_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
@@ -0,0 +1,223 @@
+/**
+ * @file readmostlydnscachedresolver.h DNS resolver whose cache hits don't need
+ * an exclusive lock.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef READMOSTLYDNSCACHEDRESOLVER_H__
+#define READMOSTLYDNSCACHEDRESOLVER_H__
+
+#include <string>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "dnscachedresolver.h"
+
+/// DnsCachedResolver with an extra, read-mostly cache in front of it.
+///
+/// The cache is split into shards by domain, each protected by a
+/// reader-writer lock. A cache hit only takes the read lock on one shard, so
+/// any number of threads can be served from the cache at once. Misses and
+/// expired entries are passed to the underlying DnsCachedResolver, and the
+/// answer it returns is cached for its TTL. Concurrent misses for the same
+/// record are coalesced: the first thread queries, and the others wait for its
+/// answer.
+///
+/// The resolver can also refresh entries ahead of their expiry. When an entry
+/// that is within the refresh window of expiring is read, it is re-queried on
+/// a background thread straight away. Until the new answer arrives the old one
+/// continues to be served (even if it expires in the meantime), so no caller
+/// ever waits for a refresh. Entries that aren't read in the refresh window
+/// expire as normal. The underlying resolver keeps its own copy of each
+/// answer, and returns that until it expires, so a refresh that gets the old
+/// answer back tries again when the underlying copy expires.
+///
+/// Negative answers (NXDOMAIN, or no records of the requested type) are cached
+/// too, for the negative TTL from the SOA record the server sends with them
+/// (the lower of the SOA's own TTL and its minimum field, as in RFC 2308).
+/// While a negative entry is live, queries for the domain fail straight from
+/// the cache, so a store pointed at an unresolvable domain fails fast rather
+/// than waiting on DNS for every operation. The underlying resolver doesn't
+/// expose the response code or SOA record, so the first time a record has no
+/// answer the resolver repeats the query itself to read them. That second
+/// round trip is skipped if the underlying query timed out, so a dead server
+/// costs no more than before. When a negative entry expires, the resolver
+/// asks the server directly first, so renewing a negative answer that still
+/// holds takes a single round trip.
+///
+/// add_to_cache and clear invalidate the front cache as well as updating the
+/// underlying resolver's, so the next query sees the change. (They are not
+/// virtual in DnsCachedResolver, so this only works when they are called
+/// through a ReadMostlyDnsCachedResolver.)
+///
+/// Queries answered from the front cache don't reach the underlying resolver,
+/// so they log no SAS events - only misses and refreshes show up in SAS.
+///
+/// The dns_query API is unchanged, so this can be used anywhere a
+/// DnsCachedResolver is.
+class ReadMostlyDnsCachedResolver : public DnsCachedResolver
+{
+public:
+  static const int NUM_SHARDS = 64;
+
+  /// Constructor.
+  ///
+  /// @param [in] refresh_ahead - Entries read within this many seconds of
+  ///                             their expiry are refreshed in the background.
+  ///                             0 disables refreshing.
+  ReadMostlyDnsCachedResolver(const std::string& dns_server,
+                              int timeout,
+                              const std::string& filename,
+                              int port,
+                              int refresh_ahead = 0);
+  virtual ~ReadMostlyDnsCachedResolver();
+
+  using DnsCachedResolver::dns_query;
+
+  /// Query the given domain, answering from the cache if possible.
+  virtual DnsResult dns_query(const std::string& domain,
+                              int dnstype,
+                              SAS::TrailId trail);
+
+  /// Add or replace an entry in the underlying resolver's cache, and drop any
+  /// copy of it from the front cache.
+  void add_to_cache(const std::string& domain,
+                    int dnstype,
+                    std::vector<DnsRRecord*>& records);
+
+  /// Clear both caches.
+  void clear();
+
+  /// The number of queries passed to the underlying resolver because the
+  /// answer wasn't cached. Queries that waited for another thread's query to
+  /// the same record aren't counted.
+  uint64_t misses() const { return _misses; }
+
+  /// The number of background refreshes that have completed.
+  uint64_t refreshes() const { return _refreshes; }
+
+  /// The number of queries answered from a cached negative answer.
+  uint64_t negative_hits() const { return _negative_hits; }
+
+private:
+  struct Entry
+  {
+    Entry(const DnsResult& result, time_t expires) :
+      result(result), expires(expires), refreshing(false) {}
+
+    DnsResult result;
+    time_t expires;
+
+    /// Whether a refresh of this entry has been queued. Only the reader that
+    /// sets this queues the refresh.
+    std::atomic<bool> refreshing;
+  };
+
+  /// A query to the underlying resolver that other threads are waiting on.
+  struct PendingQuery
+  {
+    PendingQuery() : done(false) {}
+
+    std::mutex lock;
+    std::condition_variable cond;
+    bool done;
+    std::unique_ptr<DnsResult> result;
+  };
+
+  /// Each shard starts on its own cache line, so that taking one shard's lock
+  /// doesn't invalidate the cache line holding its neighbour's.
+  struct alignas(64) Shard
+  {
+    pthread_rwlock_t lock;
+
+    /// Map of domain to DNS type to entry. Keyed on the domain first so that
+    /// lookups don't need to build a key.
+    std::unordered_map<std::string, std::map<int, Entry*>> entries;
+  };
+
+  Shard& get_shard(const std::string& domain);
+
+  /// Delete all the entries in a shard. Must be called with the shard's write
+  /// lock held.
+  static void clear_shard(Shard& shard);
+
+  /// Query a record that isn't cached, and work out how long to cache the
+  /// answer for (0 if it mustn't be cached). Answers with records are cached
+  /// for their TTL. Answers without are cached for the negative TTL, if the
+  /// server confirms that the domain has no such records.
+  ///
+  /// @param [in]  expect_negative - Whether the last answer was negative, in
+  ///                                which case the server is asked directly
+  ///                                first.
+  /// @param [out] ttl             - How long to cache the answer for.
+  DnsResult query(const std::string& domain,
+                  int dnstype,
+                  SAS::TrailId trail,
+                  bool expect_negative,
+                  int& ttl);
+
+  /// Query the DNS server directly and return the negative TTL from its
+  /// answer, or 0 if the answer isn't a negative one with an SOA record.
+  int negative_ttl(const std::string& domain, int dnstype);
+
+  /// Returns the current time in seconds from a monotonic clock.
+  static time_t now();
+
+  /// Returns the current time in milliseconds from a monotonic clock.
+  static uint64_t now_ms();
+
+  /// Queue a refresh of an entry, to run at the given time.
+  void schedule_refresh(const std::string& domain, int dnstype, time_t due);
+
+  /// Re-query an entry and replace it with the new answer.
+  void refresh(const std::string& domain, int dnstype);
+
+  /// Background thread function. Runs refreshes as they fall due.
+  void refresh_thread();
+
+  /// The shards. These are allocated separately, with the alignment they
+  /// need - operator new on the resolver wouldn't align them.
+  Shard* _shards;
+
+  /// The underlying resolver's query timeout, in milliseconds.
+  int _timeout_ms;
+
+  int _refresh_ahead;
+  std::atomic<uint64_t> _misses;
+  std::atomic<uint64_t> _refreshes;
+  std::atomic<uint64_t> _negative_hits;
+
+  /// The DNS server to ask for negative TTLs. If the server address can't be
+  /// parsed, negative answers aren't cached.
+  struct sockaddr_in _server_addr;
+  bool _negative_caching;
+
+  /// Misses that are being queried, keyed on domain and DNS type.
+  std::mutex _pending_lock;
+  std::map<std::pair<std::string, int>, std::shared_ptr<PendingQuery>> _pending;
+
+  /// Queue of refreshes to run, ordered by when they are due. This is only
+  /// used when entries are near expiry, so it doesn't need to be lock-free.
+  std::mutex _refresh_lock;
+  std::condition_variable _refresh_cond;
+  std::multimap<time_t, std::pair<std::string, int>> _refresh_queue;
+  bool _terminating;
+  std::thread _refresh_thread;
+};
+
+#endif
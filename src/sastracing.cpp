@@ -0,0 +1,168 @@
+/**
+ * @file sastracing.cpp Helpers for exercising SAS logging in the FV tests.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sastracing.h"
+
+FakeSasServer::FakeSasServer(const std::string& ip) :
+  _ip(ip),
+  _listen_fd(-1),
+  _stopping(false),
+  _bytes_received(0)
+{
+}
+
+
+FakeSasServer::~FakeSasServer()
+{
+  stop();
+}
+
+
+bool FakeSasServer::start()
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(SAS_PORT);
+  inet_pton(AF_INET, _ip.c_str(), &addr.sin_addr);
+
+  _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if ((bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (listen(_listen_fd, 16) != 0))
+  {
+    perror("bind");
+    close(_listen_fd);
+    _listen_fd = -1;
+    return false;
+  }
+
+  _stopping = false;
+  _thread = std::thread(&FakeSasServer::run, this);
+  return true;
+}
+
+
+void FakeSasServer::stop()
+{
+  _stopping = true;
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  if (_listen_fd != -1)
+  {
+    close(_listen_fd);
+    _listen_fd = -1;
+  }
+}
+
+
+void FakeSasServer::run()
+{
+  std::vector<struct pollfd> fds(1);
+  fds[0].fd = _listen_fd;
+  fds[0].events = POLLIN;
+
+  while (!_stopping)
+  {
+    // Use a short timeout so that we notice promptly when we are stopped.
+    if (poll(fds.data(), fds.size(), 100) <= 0)
+    {
+      continue;
+    }
+
+    for (size_t ii = 1; ii < fds.size(); ++ii)
+    {
+      if (fds[ii].revents != 0)
+      {
+        char buf[16384];
+        ssize_t len = recv(fds[ii].fd, buf, sizeof(buf), 0);
+
+        if (len > 0)
+        {
+          _bytes_received += len;
+        }
+        else
+        {
+          // The client has gone away. Mark the entry for removal below.
+          close(fds[ii].fd);
+          fds[ii].fd = -1;
+        }
+      }
+    }
+
+    if (fds[0].revents & POLLIN)
+    {
+      int fd = accept(_listen_fd, NULL, NULL);
+
+      if (fd != -1)
+      {
+        struct pollfd client;
+        client.fd = fd;
+        client.events = POLLIN;
+        client.revents = 0;
+        fds.push_back(client);
+      }
+    }
+
+    for (std::vector<struct pollfd>::iterator it = fds.begin() + 1; it != fds.end();)
+    {
+      it = (it->fd == -1) ? fds.erase(it) : it + 1;
+    }
+  }
+
+  for (size_t ii = 1; ii < fds.size(); ++ii)
+  {
+    close(fds[ii].fd);
+  }
+}
+
+
+bool start_sas_logging(const std::string& sas_ip)
+{
+  int rc = SAS::init("fvtest",
+                     "fvtest",
+                     "org.projectclearwater.fvtest",
+                     sas_ip,
+                     SAS::discard_logs);
+  return (rc == SAS_INIT_RC_OK);
+}
+
+
+void stop_sas_logging()
+{
+  SAS::term();
+}
+
+
+SAS::TrailId TrailSampler::next_trail()
+{
+  if ((_sample_rate == 0) || ((_count++ % _sample_rate) != 0))
+  {
+    return 0;
+  }
+
+  return SAS::new_trail(0);
+}
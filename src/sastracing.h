@@ -0,0 +1,93 @@
+/**
+ * @file sastracing.h Helpers for exercising SAS logging in the FV tests.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SASTRACING_H__
+#define SASTRACING_H__
+
+#include <string>
+#include <atomic>
+#include <thread>
+
+#include "sas.h"
+
+/// A SAS server that accepts connections from the SAS client library and
+/// throws away everything it is sent (apart from counting it). This lets the
+/// tests run with SAS logging fully enabled - i.e. with events being built,
+/// queued and sent over the network - without needing a real SAS.
+class FakeSasServer
+{
+public:
+  /// The port SAS listens on. The SAS client always connects to this port.
+  static const int SAS_PORT = 6761;
+
+  FakeSasServer(const std::string& ip);
+  virtual ~FakeSasServer();
+
+  /// Start listening for connections.
+  ///
+  /// @return Whether the server started successfully.
+  bool start();
+
+  /// Stop the server and close any connections.
+  void stop();
+
+  std::string ip() const { return _ip; }
+
+  /// The total number of bytes received from SAS clients.
+  uint64_t bytes_received() const { return _bytes_received; }
+
+private:
+  void run();
+
+  std::string _ip;
+  int _listen_fd;
+  std::thread _thread;
+  std::atomic<bool> _stopping;
+  std::atomic<uint64_t> _bytes_received;
+};
+
+/// Initialize the SAS client library so that it connects to the given SAS
+/// server. Until this is called the library builds events but has nowhere to
+/// send them.
+///
+/// @return Whether SAS initialized successfully.
+bool start_sas_logging(const std::string& sas_ip);
+
+/// Terminate the SAS client library.
+void stop_sas_logging();
+
+/// Hands out SAS trails for operations, creating a real trail for only one in
+/// every N operations. The remaining operations get trail 0 (no trail). This
+/// is the low-cost tracing mode: if nobody is watching most operations there
+/// is no need to pay for tracing them.
+///
+/// Note that this only saves the cost of the trail itself. The code under test
+/// still builds (and then discards) its SAS events for operations on trail 0,
+/// so an unsampled operation is cheaper than a traced one but not free.
+class TrailSampler
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] sample_rate - A real trail is created for one in every
+  ///                           sample_rate operations. 1 traces everything and
+  ///                           0 traces nothing.
+  TrailSampler(int sample_rate) : _sample_rate(sample_rate), _count(0) {}
+
+  /// Returns the trail to use for the next operation.
+  SAS::TrailId next_trail();
+
+private:
+  int _sample_rate;
+  std::atomic<uint64_t> _count;
+};
+
+#endif
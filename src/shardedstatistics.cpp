@@ -0,0 +1,193 @@
+/**
+ * @file shardedstatistics.cpp Counters and accumulators split into per-thread
+ * shards.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+
+#include "shardedstatistics.h"
+
+namespace
+{
+
+std::atomic<size_t> next_thread_index(0);
+thread_local size_t thread_index = SIZE_MAX;
+
+/// Allocate and construct an array of shards. new doesn't honour the shards'
+/// alignment (before C++17), so they are allocated with posix_memalign.
+template <class S> S* allocate_shards(size_t num_shards)
+{
+  void* mem = nullptr;
+
+  if (posix_memalign(&mem, alignof(S), num_shards * sizeof(S)) != 0)
+  {
+    throw std::bad_alloc();
+  }
+
+  S* shards = static_cast<S*>(mem);
+
+  for (size_t ii = 0; ii < num_shards; ++ii)
+  {
+    new (&shards[ii]) S();
+  }
+
+  return shards;
+}
+
+/// Destroy and free an array of shards allocated by allocate_shards.
+template <class S> void free_shards(S* shards, size_t num_shards)
+{
+  for (size_t ii = 0; ii < num_shards; ++ii)
+  {
+    shards[ii].~S();
+  }
+
+  free(shards);
+}
+
+}
+
+size_t this_thread_shard(size_t num_shards)
+{
+  if (thread_index == SIZE_MAX)
+  {
+    thread_index = next_thread_index++;
+  }
+
+  return thread_index % num_shards;
+}
+
+
+ShardedCounter::ShardedCounter(size_t num_shards) :
+  _num_shards(std::max(num_shards, (size_t)1))
+{
+  _shards = allocate_shards<Shard>(_num_shards);
+}
+
+
+ShardedCounter::~ShardedCounter()
+{
+  free_shards(_shards, _num_shards); _shards = nullptr;
+}
+
+
+uint64_t ShardedCounter::value() const
+{
+  uint64_t total = 0;
+
+  for (size_t ii = 0; ii < _num_shards; ++ii)
+  {
+    const Shard& shard = _shards[ii];
+    total += shard.count.load(std::memory_order_relaxed);
+  }
+
+  return total;
+}
+
+
+uint64_t ShardedCounter::read_and_reset()
+{
+  uint64_t total = 0;
+
+  for (size_t ii = 0; ii < _num_shards; ++ii)
+  {
+    Shard& shard = _shards[ii];
+    total += shard.count.exchange(0, std::memory_order_relaxed);
+  }
+
+  return total;
+}
+
+
+uint64_t ShardedAccumulator::Totals::mean() const
+{
+  return (count > 0) ? sum / count : 0;
+}
+
+
+uint64_t ShardedAccumulator::Totals::variance() const
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  uint64_t m = mean();
+  uint64_t sqmean = sqsum / count;
+  return (sqmean > m * m) ? sqmean - m * m : 0;
+}
+
+
+void ShardedAccumulator::Totals::merge(const Totals& other)
+{
+  count += other.count;
+  sum += other.sum;
+  sqsum += other.sqsum;
+  hwm = std::max(hwm, other.hwm);
+  lwm = std::min(lwm, other.lwm);
+}
+
+
+ShardedAccumulator::ShardedAccumulator(size_t num_shards) :
+  _num_shards(std::max(num_shards, (size_t)1))
+{
+  _shards = allocate_shards<Shard>(_num_shards);
+}
+
+
+ShardedAccumulator::~ShardedAccumulator()
+{
+  free_shards(_shards, _num_shards); _shards = nullptr;
+}
+
+
+void ShardedAccumulator::accumulate(uint64_t sample)
+{
+  Shard& shard = _shards[this_thread_shard(_num_shards)];
+  std::lock_guard<std::mutex> lock(shard.lock);
+  shard.totals.count++;
+  shard.totals.sum += sample;
+  shard.totals.sqsum += sample * sample;
+  shard.totals.hwm = std::max(shard.totals.hwm, sample);
+  shard.totals.lwm = std::min(shard.totals.lwm, sample);
+}
+
+
+ShardedAccumulator::Totals ShardedAccumulator::totals() const
+{
+  Totals totals;
+
+  for (size_t ii = 0; ii < _num_shards; ++ii)
+  {
+    const Shard& shard = _shards[ii];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    totals.merge(shard.totals);
+  }
+
+  return totals;
+}
+
+
+ShardedAccumulator::Totals ShardedAccumulator::read_and_reset()
+{
+  Totals totals;
+
+  for (size_t ii = 0; ii < _num_shards; ++ii)
+  {
+    Shard& shard = _shards[ii];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    totals.merge(shard.totals);
+    shard.totals = Totals();
+  }
+
+  return totals;
+}
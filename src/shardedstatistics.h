@@ -0,0 +1,142 @@
+/**
+ * @file shardedstatistics.h Counters and accumulators split into per-thread
+ * shards.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SHARDEDSTATISTICS_H__
+#define SHARDEDSTATISTICS_H__
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+/// The size of a cache line. Shards are aligned to this, so that threads
+/// updating different shards don't contend for the same line.
+static const size_t CACHE_LINE_SIZE = 64;
+
+/// Returns the shard (from 0 to num_shards - 1) the calling thread should
+/// use. Each thread is given the next shard in turn the first time it asks,
+/// so up to num_shards threads each have a shard to themselves.
+size_t this_thread_shard(size_t num_shards);
+
+/// A count that many threads increment at once. Each thread increments its
+/// own shard, and the shards are only added up when the count is read, as it
+/// is when an SNMP table is read or a time period rolls over.
+///
+/// This is an alternative to the single count SNMP::CounterTable keeps for
+/// each time period.
+class ShardedCounter
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] num_shards - The number of shards. Threads beyond this many
+  ///                          share shards.
+  ShardedCounter(size_t num_shards = 64);
+
+  ~ShardedCounter();
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  void increment(uint64_t count = 1)
+  {
+    _shards[this_thread_shard(_num_shards)].count.fetch_add(count,
+                                                           std::memory_order_relaxed);
+  }
+
+  /// The total of all the shards.
+  uint64_t value() const;
+
+  /// Return the total, and start counting from zero again, as at the end of
+  /// a time period.
+  uint64_t read_and_reset();
+
+private:
+  struct alignas(CACHE_LINE_SIZE) Shard
+  {
+    Shard() : count(0) {}
+
+    std::atomic<uint64_t> count;
+  };
+
+  /// The shards, allocated on cache line boundaries.
+  Shard* _shards;
+  size_t _num_shards;
+};
+
+/// Statistics about a series of samples (e.g. latencies) that many threads
+/// add to at once. Each thread adds to its own shard, and the shards are only
+/// merged when the statistics are read.
+///
+/// This is an alternative to the single accumulator SNMP::EventAccumulatorTable
+/// keeps for each time period. The merged statistics are identical to those
+/// from adding all the samples to one accumulator.
+class ShardedAccumulator
+{
+public:
+  /// The statistics of a set of samples.
+  struct Totals
+  {
+    Totals() : count(0), sum(0), sqsum(0), hwm(0), lwm(UINT64_MAX) {}
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t sqsum;
+    uint64_t hwm;
+
+    /// The lowest sample, or UINT64_MAX if there are no samples.
+    uint64_t lwm;
+
+    /// The mean and variance, calculated with integer arithmetic in the same
+    /// way as the SNMP tables (so 0 if there are no samples).
+    uint64_t mean() const;
+    uint64_t variance() const;
+
+    /// Add the samples from another set of totals to these.
+    void merge(const Totals& other);
+  };
+
+  /// Constructor.
+  ///
+  /// @param [in] num_shards - The number of shards. Threads beyond this many
+  ///                          share shards.
+  ShardedAccumulator(size_t num_shards = 64);
+
+  ~ShardedAccumulator();
+
+  ShardedAccumulator(const ShardedAccumulator&) = delete;
+  ShardedAccumulator& operator=(const ShardedAccumulator&) = delete;
+
+  void accumulate(uint64_t sample);
+
+  /// The merged statistics of all the shards.
+  Totals totals() const;
+
+  /// Return the merged statistics, and start accumulating from scratch again,
+  /// as at the end of a time period.
+  Totals read_and_reset();
+
+private:
+  /// Each shard has its own lock, so that a read sees each shard's totals as
+  /// a consistent set. The lock is only contended when the shard is read, or
+  /// when there are more threads than shards.
+  struct alignas(CACHE_LINE_SIZE) Shard
+  {
+    mutable std::mutex lock;
+    Totals totals;
+  };
+
+  /// The shards, allocated on cache line boundaries.
+  Shard* _shards;
+  size_t _num_shards;
+};
+
+#endif
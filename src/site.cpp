@@ -11,6 +11,7 @@
  */
 
 #include <fstream>
+#include <signal.h>
 #include <boost/filesystem.hpp>
 
 #include "log.h"
@@ -34,7 +35,9 @@ Site::Site(int index,
   _site_name(name),
   _site_dir(dir),
   _ip_addr_prefix(deployment_topology.at(name).ip_addr_prefix),
-  _deployment_topology(deployment_topology)
+  _deployment_topology(deployment_topology),
+  _next_chronos_index(1),
+  _chronos_clock(NULL)
 {
   boost::filesystem::create_directory(_site_dir);
   create_memcached_instances(num_memcached);
@@ -98,15 +101,15 @@ void Site::create_rogers_instances(int count)
 void Site::create_chronos_instances(int count)
 {
   // Create directory to hold chronos config and logs.
-  std::string chronos_dir = _site_dir + "/chronos";
-  boost::filesystem::create_directory(chronos_dir);
+  _chronos_dir = _site_dir + "/chronos";
+  boost::filesystem::create_directory(_chronos_dir);
 
   // Create a shared config file. There is no harm in doing this even we haven't
   // been told the deployment topology - in that case the file will just be
   // empty.
-  std::string shared_conf_file = chronos_dir + "/chronos_shared.conf";
+  _chronos_shared_conf_file = _chronos_dir + "/chronos_shared.conf";
   std::ofstream shared_conf;
-  shared_conf.open(shared_conf_file);
+  shared_conf.open(_chronos_shared_conf_file);
 
   if (!_deployment_topology.empty())
   {
@@ -130,34 +133,127 @@ void Site::create_chronos_instances(int count)
 
   shared_conf.close();
 
-  // Create the chronos config that is common across all nodes in the cluster,
-  // as well as the individual instances.
-  std::string cluster_conf_file = chronos_dir + "/chronos_cluster.conf";
-  std::ofstream cluster_conf;
-  cluster_conf.open(cluster_conf_file);
-  cluster_conf << "[cluster]\n";
+  // Create the individual instances, and the chronos config that is common
+  // across all nodes in the cluster.
+  _chronos_cluster_conf_file = _chronos_dir + "/chronos_cluster.conf";
+
+  for (int ii = 0; ii < count; ++ii)
+  {
+    create_chronos_instance("node");
+  }
 
+  write_chronos_cluster_conf();
+}
+
+
+std::shared_ptr<ChronosInstance> Site::create_chronos_instance(const std::string& state)
+{
   Site::Topology& this_site = _deployment_topology.at(_site_name);
+  int index = _next_chronos_index++;
+  std::string ip = site_ip(index);
+  std::string dir = _chronos_dir + "/instance" + std::to_string(index);
+
+  std::shared_ptr<ChronosInstance> instance(new ChronosInstance(ip,
+                                                                CHRONOS_PORT,
+                                                                dir,
+                                                                _chronos_cluster_conf_file,
+                                                                _chronos_shared_conf_file,
+                                                                this_site.dns_ip,
+                                                                this_site.dns_port));
+  instance->use_clock(_chronos_clock);
+  _chronos_instances.push_back(instance);
+  _chronos_states[ip] = state;
+
+  return instance;
+}
 
-  for (int ii = 0; ii < count; ++ii)
+
+void Site::write_chronos_cluster_conf()
+{
+  std::ofstream cluster_conf;
+  cluster_conf.open(_chronos_cluster_conf_file);
+  cluster_conf << "[cluster]\n";
+
+  for (const std::shared_ptr<ChronosInstance>& instance : _chronos_instances)
   {
-    std::string ip = site_ip(ii + 1);
-    cluster_conf << "node = " << ip << ":" << std::to_string(CHRONOS_PORT) << "\n";
-
-    std::string dir = chronos_dir + "/instance" + std::to_string(ii + 1);
-    _chronos_instances.emplace_back(new ChronosInstance(ip,
-                                                        CHRONOS_PORT,
-                                                        dir,
-                                                        cluster_conf_file,
-                                                        shared_conf_file,
-                                                        this_site.dns_ip,
-                                                        this_site.dns_port));
+    cluster_conf << _chronos_states.at(instance->ip()) << " = "
+                 << instance->ip() << ":" << std::to_string(CHRONOS_PORT) << "\n";
   }
 
   cluster_conf.close();
 }
 
 
+std::shared_ptr<ChronosInstance> Site::add_chronos_instance()
+{
+  std::shared_ptr<ChronosInstance> instance = create_chronos_instance("joining");
+  write_chronos_cluster_conf();
+  return instance;
+}
+
+
+void Site::remove_chronos_instance(const std::shared_ptr<ChronosInstance>& instance)
+{
+  _chronos_states.at(instance->ip()) = "leaving";
+  write_chronos_cluster_conf();
+}
+
+
+bool Site::finish_chronos_scaling()
+{
+  std::vector<std::shared_ptr<ChronosInstance>> remaining;
+
+  for (const std::shared_ptr<ChronosInstance>& instance : _chronos_instances)
+  {
+    std::string& state = _chronos_states.at(instance->ip());
+
+    if (state == "leaving")
+    {
+      instance->kill_instance();
+      _chronos_states.erase(instance->ip());
+    }
+    else
+    {
+      state = "node";
+      remaining.push_back(instance);
+    }
+  }
+
+  _chronos_instances = remaining;
+  write_chronos_cluster_conf();
+
+  return reload_chronos_config();
+}
+
+
+bool Site::reload_chronos_config()
+{
+  return signal_chronos_instances(SIGHUP);
+}
+
+
+bool Site::resync_chronos()
+{
+  return signal_chronos_instances(SIGUSR1);
+}
+
+
+bool Site::signal_chronos_instances(int sig)
+{
+  bool ok = true;
+
+  for (const std::shared_ptr<ChronosInstance>& instance : _chronos_instances)
+  {
+    if (instance->running() && !instance->signal_instance(sig))
+    {
+      ok = false;
+    }
+  }
+
+  return ok;
+}
+
+
 void Site::for_each_instance(std::function<void(std::shared_ptr<ProcessInstance>)> fn)
 {
   for (const std::shared_ptr<MemcachedInstance>& inst : _memcached_instances)
@@ -177,6 +273,17 @@ void Site::for_each_instance(std::function<void(std::shared_ptr<ProcessInstance>
 }
 
 
+void Site::use_controlled_clock(const ControlledClock* clock)
+{
+  _chronos_clock = clock;
+
+  for (const std::shared_ptr<ChronosInstance>& inst : _chronos_instances)
+  {
+    inst->use_clock(clock);
+  }
+}
+
+
 void Site::start()
 {
   for_each_instance([](std::shared_ptr<ProcessInstance> inst)
@@ -262,6 +369,24 @@ std::shared_ptr<MemcachedInstance> Site::get_first_memcached()
 }
 
 
+const std::vector<std::shared_ptr<MemcachedInstance>>& Site::get_memcached_instances()
+{
+  return _memcached_instances;
+}
+
+
+const std::vector<std::shared_ptr<RogersInstance>>& Site::get_rogers_instances()
+{
+  return _rogers_instances;
+}
+
+
+const std::vector<std::shared_ptr<ChronosInstance>>& Site::get_chronos_instances()
+{
+  return _chronos_instances;
+}
+
+
 Site::Topology::Topology(const std::string& ip_addr_prefix_arg) :
   ip_addr_prefix(ip_addr_prefix_arg),
   dns_ip("127.0.0.1"),
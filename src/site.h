@@ -15,6 +15,10 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <map>
+#include <functional>
+
+#include "processinstance.h"
 
 /// Class controlling the processes running in a site.
 class Site
@@ -96,6 +100,52 @@ public:
   /// Returns a pointer to the first memcached instance in this site.
   std::shared_ptr<MemcachedInstance> get_first_memcached();
 
+  /// Returns all the memcached instances in this site.
+  const std::vector<std::shared_ptr<MemcachedInstance>>& get_memcached_instances();
+
+  /// Returns all the rogers instances in this site.
+  const std::vector<std::shared_ptr<RogersInstance>>& get_rogers_instances();
+
+  /// Returns all the chronos instances in this site.
+  const std::vector<std::shared_ptr<ChronosInstance>>& get_chronos_instances();
+
+  /// Have all the chronos processes in the site follow the given clock,
+  /// rather than the real time. This takes effect when they are next started.
+  void use_controlled_clock(const ControlledClock* clock);
+
+  /// Add a chronos node to the site's cluster, as a joining node. This
+  /// updates the cluster config, but doesn't start the new node or tell the
+  /// existing nodes - call start_instance on the new node, then
+  /// reload_chronos_config and resync_chronos.
+  ///
+  /// @return The new node.
+  std::shared_ptr<ChronosInstance> add_chronos_instance();
+
+  /// Mark a chronos node as leaving the site's cluster. This updates the
+  /// cluster config, but doesn't tell the nodes - call reload_chronos_config
+  /// and resync_chronos. The node keeps running until finish_chronos_scaling
+  /// is called.
+  void remove_chronos_instance(const std::shared_ptr<ChronosInstance>& instance);
+
+  /// Finish scaling the chronos cluster, once the nodes have resynchronised.
+  /// Joining nodes become full members of the cluster, and leaving nodes are
+  /// removed from the cluster and stopped. The remaining nodes are told to
+  /// reload the cluster config.
+  ///
+  /// @return Whether all the nodes were told to reload.
+  bool finish_chronos_scaling();
+
+  /// Have all the running chronos nodes re-read the cluster config (SIGHUP).
+  ///
+  /// @return Whether all the nodes were signalled successfully.
+  bool reload_chronos_config();
+
+  /// Have all the running chronos nodes resynchronise their timers with the
+  /// rest of the cluster (SIGUSR1), as they must after the cluster changes.
+  ///
+  /// @return Whether all the nodes were signalled successfully.
+  bool resync_chronos();
+
   /// Start all processes in the site.
   ///
   /// @warning This does not wait for the instances to come up. This is so that
@@ -132,6 +182,16 @@ private:
   /// @param [in] count - The number of instances to create.
   void create_chronos_instances(int count);
 
+  /// Helper function to create a single chronos instance, on the next unused
+  /// IP address, with the given state in the cluster.
+  std::shared_ptr<ChronosInstance> create_chronos_instance(const std::string& state);
+
+  /// Write out the chronos cluster config, listing each node with its state.
+  void write_chronos_cluster_conf();
+
+  /// Send a signal to all the running chronos instances.
+  bool signal_chronos_instances(int sig);
+
   /// Utility function that does the same thing to each process in the site.
   ///
   /// @param [in] fn - A function that will be called on each process instance
@@ -162,6 +222,20 @@ private:
   std::vector<std::shared_ptr<MemcachedInstance>> _memcached_instances;
   std::vector<std::shared_ptr<RogersInstance>> _rogers_instances;
   std::vector<std::shared_ptr<ChronosInstance>> _chronos_instances;
+
+  /// The state of each chronos node in the cluster ("joining", "node" or
+  /// "leaving", as in the cluster config), by IP address.
+  std::map<std::string, std::string> _chronos_states;
+
+  /// The index of the IP address the next chronos node will use.
+  int _next_chronos_index;
+
+  /// The clock new chronos nodes follow, or NULL to follow the real time.
+  const ControlledClock* _chronos_clock;
+
+  std::string _chronos_dir;
+  std::string _chronos_cluster_conf_file;
+  std::string _chronos_shared_conf_file;
 };
 
 #endif
@@ -0,0 +1,189 @@
+/**
+ * @file snmp_indexed_ip_time_based_counter_table.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "snmp_internal/snmp_includes.h"
+#include "snmp_internal/snmp_time_period_table.h"
+#include "snmp_ip_row.h"
+#include "snmp_indexed_ip_time_based_counter_table.h"
+#include "ipcounterindex.h"
+
+#include <mutex>
+#include <utility>
+#include <arpa/inet.h>
+
+namespace SNMP
+{
+
+// Rows are keyed on the IP and the time period they report.
+typedef std::pair<std::string, int> IPPeriodKey;
+
+// A row reporting one time period's count for an IP. The count itself is kept
+// in the table's IPCounterIndex, and is looked up when the row is read.
+class IndexedIPTimeBasedCounterRow: public IPRow
+{
+public:
+  IndexedIPTimeBasedCounterRow(struct in_addr addr,
+                               const IPPeriodKey& key,
+                               IPCounterIndex* index) :
+    IPRow(addr),
+    _ip(key.first),
+    _time_period(key.second),
+    _index(index)
+  {
+    netsnmp_tdata_row_add_index(_row, ASN_INTEGER, &_time_period, sizeof(int));
+  };
+
+  IndexedIPTimeBasedCounterRow(struct in6_addr addr,
+                               const IPPeriodKey& key,
+                               IPCounterIndex* index) :
+    IPRow(addr),
+    _ip(key.first),
+    _time_period(key.second),
+    _index(index)
+  {
+    netsnmp_tdata_row_add_index(_row, ASN_INTEGER, &_time_period, sizeof(int));
+  };
+
+  ColumnData get_columns()
+  {
+    IPCounterIndex::Counts counts = {0, 0, 0};
+    _index->get(_ip, counts);
+    uint64_t count = 0;
+
+    switch (_time_period)
+    {
+      case TimePeriodIndexes::scopePrevious5SecondPeriod:
+        count = counts.previous_5s;
+        break;
+      case TimePeriodIndexes::scopeCurrent5MinutePeriod:
+        count = counts.current_5m;
+        break;
+      case TimePeriodIndexes::scopePrevious5MinutePeriod:
+        count = counts.previous_5m;
+        break;
+    }
+
+    ColumnData ret;
+    ret[4] = Value::uint(count);
+    return ret;
+  }
+
+private:
+  std::string _ip;
+  int _time_period;
+  IPCounterIndex* _index;
+};
+
+class IndexedIPTimeBasedCounterTableImpl: public ManagedTable<IndexedIPTimeBasedCounterRow, IPPeriodKey>, public IndexedIPTimeBasedCounterTable
+{
+public:
+  IndexedIPTimeBasedCounterTableImpl(std::string name,
+                                     std::string tbl_oid):
+    ManagedTable<IndexedIPTimeBasedCounterRow, IPPeriodKey>(name,
+                                                            tbl_oid,
+                                                            4,
+                                                            4, // Only column 4 should be visible
+                                                            { ASN_INTEGER, ASN_OCTET_STR, ASN_INTEGER })
+  {}
+
+  void add_ip(const std::string& ip)
+  {
+    struct in6_addr addr;
+
+    if ((inet_pton(AF_INET, ip.c_str(), &addr) != 1) &&
+        (inet_pton(AF_INET6, ip.c_str(), &addr) != 1))
+    {
+      // The row index is the address, so IPs that can't be parsed can't be
+      // tracked.
+      return;
+    }
+
+    // Taking another reference to a tracked IP only takes the lock on the
+    // IP's stripe of the index. The rows only need adding if it wasn't.
+    if (_index.add_ip(ip))
+    {
+      update_rows(ip);
+    }
+  }
+
+  void remove_ip(const std::string& ip)
+  {
+    if (_index.remove_ip(ip))
+    {
+      update_rows(ip);
+    }
+  }
+
+  void increment(const std::string& ip)
+  {
+    // This only takes the lock on the IP's stripe of the index, not
+    // _rows_lock.
+    _index.increment(ip);
+  }
+
+private:
+  /// Add or remove an IP's rows after it has started or stopped being
+  /// tracked. The index decides which under _rows_lock, against the IP's
+  /// latest state, so if another thread adds or removes the IP in the meantime
+  /// the rows still end up matching it.
+  void update_rows(const std::string& ip)
+  {
+    std::lock_guard<std::mutex> lock(_rows_lock);
+
+    switch (_index.update_rows(ip))
+    {
+    case IPCounterIndex::RowChange::ADD:
+      add(IPPeriodKey(ip, TimePeriodIndexes::scopePrevious5SecondPeriod));
+      add(IPPeriodKey(ip, TimePeriodIndexes::scopeCurrent5MinutePeriod));
+      add(IPPeriodKey(ip, TimePeriodIndexes::scopePrevious5MinutePeriod));
+      break;
+
+    case IPCounterIndex::RowChange::REMOVE:
+      remove(IPPeriodKey(ip, TimePeriodIndexes::scopePrevious5SecondPeriod));
+      remove(IPPeriodKey(ip, TimePeriodIndexes::scopeCurrent5MinutePeriod));
+      remove(IPPeriodKey(ip, TimePeriodIndexes::scopePrevious5MinutePeriod));
+      break;
+
+    case IPCounterIndex::RowChange::NONE:
+      break;
+    }
+  }
+
+  IndexedIPTimeBasedCounterRow* new_row(IPPeriodKey key)
+  {
+    struct in_addr v4;
+    struct in6_addr v6;
+
+    if (inet_pton(AF_INET, key.first.c_str(), &v4) == 1)
+    {
+      return new IndexedIPTimeBasedCounterRow(v4, key, &_index);
+    }
+    else
+    {
+      // add_ip has already checked this is a valid IPv4 or IPv6 address.
+      inet_pton(AF_INET6, key.first.c_str(), &v6);
+      return new IndexedIPTimeBasedCounterRow(v6, key, &_index);
+    }
+  }
+
+  // Serializes adding and removing rows. This is only taken when an IP starts
+  // or stops being tracked, not for every reference to it.
+  std::mutex _rows_lock;
+  IPCounterIndex _index;
+};
+
+IndexedIPTimeBasedCounterTable* IndexedIPTimeBasedCounterTable::create(std::string name,
+                                                                       std::string oid)
+{
+  return new IndexedIPTimeBasedCounterTableImpl(name, oid);
+}
+
+}
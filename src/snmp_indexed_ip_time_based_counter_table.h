@@ -0,0 +1,54 @@
+/**
+ * @file snmp_indexed_ip_time_based_counter_table.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+
+#ifndef SNMP_INDEXED_IP_TIME_BASED_COUNTER_TABLE_H
+#define SNMP_INDEXED_IP_TIME_BASED_COUNTER_TABLE_H
+
+// This file contains the interface for tables which:
+//   - are indexed by IP address and time period
+//   - count events for each IP in each period
+//   - reference count the IPs, so an IP is only removed when every user of it
+//     has removed it
+//
+// It reports exactly the same rows and columns as IPTimeBasedCounterTable
+// (column 4 of the previous 5s, current 5m and previous 5m rows for each IP),
+// and is intended for tracking many thousands of peers. The counts are kept in
+// an IPCounterIndex, so:
+//   - increment finds its IP through a hash index, and only locks the stripe
+//     of the index the IP is in, so its cost doesn't grow with the number of
+//     IPs and threads counting different IPs rarely contend
+//   - each IP's counts are only rolled over to a new time period when that IP
+//     is next counted or read, so the end of a period doesn't touch every IP.
+// Adding and removing IPs changes the table's rows, so these are serialized.
+
+namespace SNMP
+{
+
+class IndexedIPTimeBasedCounterTable
+{
+public:
+  virtual ~IndexedIPTimeBasedCounterTable() {};
+
+  static IndexedIPTimeBasedCounterTable* create(std::string name, std::string oid);
+
+  virtual void add_ip(const std::string& ip) = 0;
+  virtual void remove_ip(const std::string& ip) = 0;
+  virtual void increment(const std::string& ip) = 0;
+
+protected:
+  IndexedIPTimeBasedCounterTable() {};
+};
+
+}
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * @file snmp_percentile_table.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "snmp_internal/snmp_includes.h"
+#include "snmp_internal/snmp_time_period_table.h"
+#include "snmp_percentile_table.h"
+
+#include <atomic>
+#include <cmath>
+#include <algorithm>
+
+namespace SNMP
+{
+
+// The number of bits of each sample (after its leading one) that pick its
+// bucket. Each power of two range is split into 2^SUB_BUCKET_BITS buckets.
+static const int SUB_BUCKET_BITS = 4;
+static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+// Samples below SUB_BUCKETS each have their own bucket. Each power of two
+// range above that (up to 2^32) has SUB_BUCKETS buckets.
+static const int NUM_BUCKETS = SUB_BUCKETS + (32 - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+// Returns the bucket a sample is counted in.
+static inline int bucket_for_sample(uint32_t sample)
+{
+  if (sample < SUB_BUCKETS)
+  {
+    return sample;
+  }
+
+  int msb = 31 - __builtin_clz(sample);
+  int shift = msb - SUB_BUCKET_BITS;
+  return SUB_BUCKETS + shift * SUB_BUCKETS + ((sample >> shift) - SUB_BUCKETS);
+}
+
+// Returns the highest sample that is counted in a bucket.
+static uint32_t bucket_upper_bound(int bucket)
+{
+  if (bucket < (int)SUB_BUCKETS)
+  {
+    return bucket;
+  }
+
+  int shift = (bucket - SUB_BUCKETS) / SUB_BUCKETS;
+  uint64_t lower = (uint64_t)(SUB_BUCKETS + (bucket - SUB_BUCKETS) % SUB_BUCKETS) << shift;
+  return (uint32_t)(lower + ((uint64_t)1 << shift) - 1);
+}
+
+// A histogram of the samples in a time period. This is reset at the start of
+// each period by CurrentAndPrevious.
+//
+// There is no separate count of samples, as every sample would then update a
+// second atomic shared by all threads. The count is the total of the buckets,
+// which is worked out when the table is read.
+struct HistogramStatistics
+{
+  std::atomic_uint_fast64_t buckets[NUM_BUCKETS];
+
+  void reset(uint64_t periodstart, HistogramStatistics* previous = NULL)
+  {
+    for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+    {
+      buckets[ii].store(0);
+    }
+  }
+
+  void accumulate(uint32_t sample)
+  {
+    buckets[bucket_for_sample(sample)]++;
+  }
+
+  // Copies the buckets, and returns the number of samples in the copy. The
+  // count and percentiles are all worked out from one copy, so they are
+  // consistent with each other even if samples are being added.
+  uint64_t copy_buckets(uint64_t counts[NUM_BUCKETS]) const
+  {
+    uint64_t total = 0;
+
+    for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+    {
+      counts[ii] = buckets[ii].load();
+      total += counts[ii];
+    }
+
+    return total;
+  }
+
+  // Returns the given percentile of a copy of the buckets holding total
+  // samples, or 0 if there are none.
+  static uint32_t percentile(const uint64_t counts[NUM_BUCKETS],
+                             uint64_t total,
+                             double pct)
+  {
+    if (total == 0)
+    {
+      return 0;
+    }
+
+    // The rank of the sample at this percentile, from 1 to total. The small
+    // adjustment stops floating point error pushing an exact rank up by one.
+    uint64_t rank = (uint64_t)std::ceil(pct * total / 100 - 1e-9);
+    rank = std::max(rank, (uint64_t)1);
+    uint64_t seen = 0;
+
+    for (int ii = 0; ii < NUM_BUCKETS; ++ii)
+    {
+      seen += counts[ii];
+
+      if (seen >= rank)
+      {
+        return bucket_upper_bound(ii);
+      }
+    }
+
+    return bucket_upper_bound(NUM_BUCKETS - 1);
+  }
+};
+
+// A TimeBasedRow that reports the count and percentiles of its histogram.
+class PercentileRow: public TimeBasedRow<HistogramStatistics>
+{
+public:
+  PercentileRow(int index, View* view, const std::vector<double>& percentiles) :
+    TimeBasedRow<HistogramStatistics>(index, view),
+    _percentiles(percentiles)
+  {};
+
+  ColumnData get_columns()
+  {
+    HistogramStatistics* histogram = _view->get_data();
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total = histogram->copy_buckets(counts);
+
+    ColumnData ret;
+    ret[1] = Value::integer(this->index);
+    ret[2] = Value::uint(total);
+
+    for (size_t ii = 0; ii < _percentiles.size(); ++ii)
+    {
+      ret[3 + ii] = Value::uint(HistogramStatistics::percentile(counts,
+                                                                total,
+                                                                _percentiles[ii]));
+    }
+
+    return ret;
+  }
+
+private:
+  const std::vector<double>& _percentiles;
+};
+
+class PercentileTableImpl: public ManagedTable<PercentileRow, int>, public PercentileTable
+{
+public:
+  PercentileTableImpl(std::string name,
+                      std::string tbl_oid,
+                      std::vector<double> percentiles):
+    ManagedTable<PercentileRow, int>(name,
+                                     tbl_oid,
+                                     2,
+                                     2 + percentiles.size(), // Count, then each percentile
+                                     { ASN_INTEGER }), // Type of the index column
+    _percentiles(percentiles),
+    five_second(5),
+    five_minute(300)
+  {
+    // We have a fixed number of rows, so create them in the constructor.
+    add(TimePeriodIndexes::scopePrevious5SecondPeriod);
+    add(TimePeriodIndexes::scopeCurrent5MinutePeriod);
+    add(TimePeriodIndexes::scopePrevious5MinutePeriod);
+  }
+
+  void accumulate(uint32_t sample)
+  {
+    // Update each underlying set of data.
+    five_second.get_current()->accumulate(sample);
+    five_minute.get_current()->accumulate(sample);
+  }
+
+private:
+  // Map row indexes to the view of the underlying data they should expose
+  PercentileRow* new_row(int index)
+  {
+    PercentileRow::View* view = NULL;
+
+    switch (index)
+    {
+      case TimePeriodIndexes::scopePrevious5SecondPeriod:
+        view = new PercentileRow::PreviousView(&five_second);
+        break;
+      case TimePeriodIndexes::scopeCurrent5MinutePeriod:
+        view = new PercentileRow::CurrentView(&five_minute);
+        break;
+      case TimePeriodIndexes::scopePrevious5MinutePeriod:
+        view = new PercentileRow::PreviousView(&five_minute);
+        break;
+    }
+
+    return new PercentileRow(index, view, _percentiles);
+  }
+
+  std::vector<double> _percentiles;
+  CurrentAndPrevious<HistogramStatistics> five_second;
+  CurrentAndPrevious<HistogramStatistics> five_minute;
+};
+
+PercentileTable* PercentileTable::create(std::string name,
+                                         std::string oid,
+                                         std::vector<double> percentiles)
+{
+  return new PercentileTableImpl(name, oid, percentiles);
+}
+
+}
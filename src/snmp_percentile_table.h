@@ -0,0 +1,62 @@
+/**
+ * @file snmp_percentile_table.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#ifndef SNMP_PERCENTILE_TABLE_H
+#define SNMP_PERCENTILE_TABLE_H
+
+// This file contains the interface for tables which:
+//   - are indexed by time period
+//   - accumulate samples (e.g. latencies) into a histogram for each period
+//   - report the count of samples, and the given percentiles of them
+//
+// It is similar to EventAccumulatorTable, but reports percentiles rather than
+// the mean, variance, HWM and LWM. The table has a row for each time period
+// (previous 5s, current 5m and previous 5m). Column 2 is the number of
+// samples, and columns 3 onwards are the percentiles, in the order they were
+// given when the table was created.
+//
+// Samples are counted in logarithmic buckets, so the table uses a fixed
+// amount of memory however many samples it is given. Samples below 16 are
+// counted exactly. Larger samples share a bucket with others within 1/16 of
+// their value, and each percentile is reported as the highest value in its
+// bucket, so it is never below the true percentile and never more than 6.25%
+// above it.
+
+namespace SNMP
+{
+
+class PercentileTable
+{
+public:
+  virtual ~PercentileTable() {};
+
+  /// Create a table.
+  ///
+  /// @param [in] name        - The name of the table.
+  /// @param [in] oid         - The OID of the table.
+  /// @param [in] percentiles - The percentiles (between 0 and 100) to report.
+  static PercentileTable* create(std::string name,
+                                 std::string oid,
+                                 std::vector<double> percentiles = {50, 90, 99, 99.9});
+
+  virtual void accumulate(uint32_t sample) = 0;
+
+protected:
+  PercentileTable() {};
+};
+
+}
+
+#endif
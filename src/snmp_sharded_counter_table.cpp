@@ -0,0 +1,109 @@
+/**
+ * @file snmp_sharded_counter_table.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "snmp_internal/snmp_includes.h"
+#include "snmp_internal/snmp_time_period_table.h"
+#include "snmp_sharded_counter_table.h"
+#include "shardedstatistics.h"
+
+namespace SNMP
+{
+
+// The count of events in a time period. This is reset at the start of each
+// period by CurrentAndPrevious.
+struct ShardedCountStatistics
+{
+  ShardedCounter counter;
+
+  void reset(uint64_t periodstart, ShardedCountStatistics* previous = NULL)
+  {
+    counter.read_and_reset();
+  }
+};
+
+// A TimeBasedRow that reports the total of its sharded count.
+class ShardedCounterRow: public TimeBasedRow<ShardedCountStatistics>
+{
+public:
+  ShardedCounterRow(int index, View* view) :
+    TimeBasedRow<ShardedCountStatistics>(index, view)
+  {};
+
+  ColumnData get_columns()
+  {
+    ShardedCountStatistics* counts = _view->get_data();
+
+    ColumnData ret;
+    ret[1] = Value::integer(this->index);
+    ret[2] = Value::uint(counts->counter.value());
+    return ret;
+  }
+};
+
+class ShardedCounterTableImpl: public ManagedTable<ShardedCounterRow, int>, public ShardedCounterTable
+{
+public:
+  ShardedCounterTableImpl(std::string name,
+                          std::string tbl_oid):
+    ManagedTable<ShardedCounterRow, int>(name,
+                                         tbl_oid,
+                                         2,
+                                         2, // Only column 2 should be visible
+                                         { ASN_INTEGER }), // Type of the index column
+    five_second(5),
+    five_minute(300)
+  {
+    // We have a fixed number of rows, so create them in the constructor.
+    add(TimePeriodIndexes::scopePrevious5SecondPeriod);
+    add(TimePeriodIndexes::scopeCurrent5MinutePeriod);
+    add(TimePeriodIndexes::scopePrevious5MinutePeriod);
+  }
+
+  void increment()
+  {
+    // Update each underlying set of data.
+    five_second.get_current()->counter.increment();
+    five_minute.get_current()->counter.increment();
+  }
+
+private:
+  // Map row indexes to the view of the underlying data they should expose
+  ShardedCounterRow* new_row(int index)
+  {
+    ShardedCounterRow::View* view = NULL;
+
+    switch (index)
+    {
+      case TimePeriodIndexes::scopePrevious5SecondPeriod:
+        view = new ShardedCounterRow::PreviousView(&five_second);
+        break;
+      case TimePeriodIndexes::scopeCurrent5MinutePeriod:
+        view = new ShardedCounterRow::CurrentView(&five_minute);
+        break;
+      case TimePeriodIndexes::scopePrevious5MinutePeriod:
+        view = new ShardedCounterRow::PreviousView(&five_minute);
+        break;
+    }
+
+    return new ShardedCounterRow(index, view);
+  }
+
+  CurrentAndPrevious<ShardedCountStatistics> five_second;
+  CurrentAndPrevious<ShardedCountStatistics> five_minute;
+};
+
+ShardedCounterTable* ShardedCounterTable::create(std::string name,
+                                                 std::string oid)
+{
+  return new ShardedCounterTableImpl(name, oid);
+}
+
+}
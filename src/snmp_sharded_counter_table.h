@@ -0,0 +1,45 @@
+/**
+ * @file snmp_sharded_counter_table.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+
+#ifndef SNMP_SHARDED_COUNTER_TABLE_H
+#define SNMP_SHARDED_COUNTER_TABLE_H
+
+// This file contains the interface for tables which:
+//   - are indexed by time period
+//   - increment a count of events for each period
+//
+// It reports exactly the same rows and columns as CounterTable (column 2 of
+// the previous 5s, current 5m and previous 5m rows), but each period's count
+// is a ShardedCounter. Each thread increments its own shard, so threads
+// incrementing the table at once don't contend for one cache line. The shards
+// are added up when the table is read.
+
+namespace SNMP
+{
+
+class ShardedCounterTable
+{
+public:
+  virtual ~ShardedCounterTable() {};
+
+  static ShardedCounterTable* create(std::string name, std::string oid);
+
+  virtual void increment() = 0;
+
+protected:
+  ShardedCounterTable() {};
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file snmp_sharded_event_accumulator_table.cpp
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "snmp_internal/snmp_includes.h"
+#include "snmp_internal/snmp_time_period_table.h"
+#include "snmp_sharded_event_accumulator_table.h"
+#include "shardedstatistics.h"
+
+namespace SNMP
+{
+
+// The samples in a time period. This is reset at the start of each period by
+// CurrentAndPrevious.
+struct ShardedEventStatistics
+{
+  ShardedAccumulator accumulator;
+
+  void reset(uint64_t periodstart, ShardedEventStatistics* previous = NULL)
+  {
+    accumulator.read_and_reset();
+  }
+};
+
+// A TimeBasedRow that reports the merged statistics of its sharded
+// accumulator.
+class ShardedEventAccumulatorRow: public TimeBasedRow<ShardedEventStatistics>
+{
+public:
+  ShardedEventAccumulatorRow(int index, View* view) :
+    TimeBasedRow<ShardedEventStatistics>(index, view)
+  {};
+
+  ColumnData get_columns()
+  {
+    ShardedAccumulator::Totals totals = _view->get_data()->accumulator.totals();
+
+    // The LWM is only meaningful if there are samples. Report 0 otherwise, as
+    // EventAccumulatorTable does.
+    uint64_t lwm = (totals.count > 0) ? totals.lwm : 0;
+
+    ColumnData ret;
+    ret[1] = Value::integer(this->index);
+    ret[2] = Value::uint(totals.mean());
+    ret[3] = Value::uint(totals.variance());
+    ret[4] = Value::uint(totals.hwm);
+    ret[5] = Value::uint(lwm);
+    ret[6] = Value::uint(totals.count);
+    return ret;
+  }
+};
+
+class ShardedEventAccumulatorTableImpl: public ManagedTable<ShardedEventAccumulatorRow, int>, public ShardedEventAccumulatorTable
+{
+public:
+  ShardedEventAccumulatorTableImpl(std::string name,
+                                   std::string tbl_oid):
+    ManagedTable<ShardedEventAccumulatorRow, int>(name,
+                                                  tbl_oid,
+                                                  2,
+                                                  6, // Mean, variance, HWM, LWM and count
+                                                  { ASN_INTEGER }), // Type of the index column
+    five_second(5),
+    five_minute(300)
+  {
+    // We have a fixed number of rows, so create them in the constructor.
+    add(TimePeriodIndexes::scopePrevious5SecondPeriod);
+    add(TimePeriodIndexes::scopeCurrent5MinutePeriod);
+    add(TimePeriodIndexes::scopePrevious5MinutePeriod);
+  }
+
+  void accumulate(uint32_t sample)
+  {
+    // Update each underlying set of data.
+    five_second.get_current()->accumulator.accumulate(sample);
+    five_minute.get_current()->accumulator.accumulate(sample);
+  }
+
+private:
+  // Map row indexes to the view of the underlying data they should expose
+  ShardedEventAccumulatorRow* new_row(int index)
+  {
+    ShardedEventAccumulatorRow::View* view = NULL;
+
+    switch (index)
+    {
+      case TimePeriodIndexes::scopePrevious5SecondPeriod:
+        view = new ShardedEventAccumulatorRow::PreviousView(&five_second);
+        break;
+      case TimePeriodIndexes::scopeCurrent5MinutePeriod:
+        view = new ShardedEventAccumulatorRow::CurrentView(&five_minute);
+        break;
+      case TimePeriodIndexes::scopePrevious5MinutePeriod:
+        view = new ShardedEventAccumulatorRow::PreviousView(&five_minute);
+        break;
+    }
+
+    return new ShardedEventAccumulatorRow(index, view);
+  }
+
+  CurrentAndPrevious<ShardedEventStatistics> five_second;
+  CurrentAndPrevious<ShardedEventStatistics> five_minute;
+};
+
+ShardedEventAccumulatorTable* ShardedEventAccumulatorTable::create(std::string name,
+                                                                   std::string oid)
+{
+  return new ShardedEventAccumulatorTableImpl(name, oid);
+}
+
+}
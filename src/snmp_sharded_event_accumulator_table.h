@@ -0,0 +1,46 @@
+/**
+ * @file snmp_sharded_event_accumulator_table.h
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <string>
+#include <stdint.h>
+
+#ifndef SNMP_SHARDED_EVENT_ACCUMULATOR_TABLE_H
+#define SNMP_SHARDED_EVENT_ACCUMULATOR_TABLE_H
+
+// This file contains the interface for tables which:
+//   - are indexed by time period
+//   - accumulate samples (e.g. latencies) for each period
+//   - report the mean, variance, HWM, LWM and count of the samples
+//
+// It reports exactly the same rows and columns as EventAccumulatorTable
+// (columns 2 to 6 of the previous 5s, current 5m and previous 5m rows), but
+// each period's samples are added to a ShardedAccumulator. Each thread adds to
+// its own shard, and the shards are merged when the table is read.
+
+namespace SNMP
+{
+
+class ShardedEventAccumulatorTable
+{
+public:
+  virtual ~ShardedEventAccumulatorTable() {};
+
+  static ShardedEventAccumulatorTable* create(std::string name, std::string oid);
+
+  virtual void accumulate(uint32_t sample) = 0;
+
+protected:
+  ShardedEventAccumulatorTable() {};
+};
+
+}
+
+#endif
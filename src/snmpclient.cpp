@@ -0,0 +1,262 @@
+/**
+ * @file snmpclient.cpp In-process client for querying an SNMP agent.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "snmpclient.h"
+
+/// Parse a numeric OID, such as ".1.2.2.0".
+///
+/// @return Whether the OID was valid.
+static bool parse_oid(const std::string& str, oid* name, size_t* name_length)
+{
+  size_t max_length = *name_length;
+  const char* p = str.c_str();
+  *name_length = 0;
+
+  if (*p == '.')
+  {
+    p++;
+  }
+
+  while (*p != '\0')
+  {
+    char* end;
+    unsigned long subid = strtoul(p, &end, 10);
+
+    if ((end == p) || (*name_length == max_length) ||
+        ((*end != '.') && (*end != '\0')))
+    {
+      return false;
+    }
+
+    name[(*name_length)++] = subid;
+    p = (*end == '.') ? end + 1 : end;
+  }
+
+  return (*name_length > 0);
+}
+
+
+/// Format an OID as a numeric string, with a leading dot.
+static std::string format_oid(const oid* name, size_t name_length)
+{
+  std::string str;
+
+  for (size_t ii = 0; ii < name_length; ++ii)
+  {
+    str += "." + std::to_string((unsigned long)name[ii]);
+  }
+
+  return str;
+}
+
+
+/// Format a value as the net-snmp command line tools do with the -OQ option.
+static std::string format_value(const netsnmp_variable_list* var)
+{
+  switch (var->type)
+  {
+  case ASN_INTEGER:
+    return std::to_string(*var->val.integer);
+
+  case ASN_COUNTER:
+  case ASN_GAUGE:
+  case ASN_TIMETICKS:
+  case ASN_UINTEGER:
+    return std::to_string((unsigned long)*var->val.integer & 0xffffffff);
+
+  case ASN_COUNTER64:
+    return std::to_string(((uint64_t)var->val.counter64->high << 32) |
+                          var->val.counter64->low);
+
+  case ASN_OCTET_STR:
+    return "\"" + std::string((const char*)var->val.string, var->val_len) + "\"";
+
+  case ASN_IPADDRESS:
+    return std::to_string(var->val.string[0]) + "." +
+           std::to_string(var->val.string[1]) + "." +
+           std::to_string(var->val.string[2]) + "." +
+           std::to_string(var->val.string[3]);
+
+  case ASN_OBJECT_ID:
+    return format_oid(var->val.objid, var->val_len / sizeof(oid));
+
+  default:
+    {
+      char buf[1024];
+      snprint_value(buf, sizeof(buf), var->name, var->name_length, var);
+      return buf;
+    }
+  }
+}
+
+
+/// Whether a value is one of the exceptions an agent returns instead of a
+/// value, e.g. because the OID doesn't exist.
+static bool is_exception(const netsnmp_variable_list* var)
+{
+  return ((var->type == SNMP_NOSUCHOBJECT) ||
+          (var->type == SNMP_NOSUCHINSTANCE) ||
+          (var->type == SNMP_ENDOFMIBVIEW));
+}
+
+
+SnmpClient::SnmpClient(const std::string& peer, const std::string& community) :
+  _session(NULL),
+  _requests(0)
+{
+  netsnmp_session session;
+  snmp_sess_init(&session);
+  session.version = SNMP_VERSION_2c;
+  session.peername = (char*)peer.c_str();
+  session.community = (u_char*)community.c_str();
+  session.community_len = community.length();
+  session.timeout = 1000000;
+  session.retries = 2;
+
+  // This copies everything it needs from the session structure.
+  _session = snmp_sess_open(&session);
+
+  if (_session == NULL)
+  {
+    TRC_ERROR("Failed to open SNMP session to %s", peer.c_str());
+  }
+}
+
+
+SnmpClient::~SnmpClient()
+{
+  if (_session != NULL)
+  {
+    snmp_sess_close(_session);
+    _session = NULL;
+  }
+}
+
+
+bool SnmpClient::get(const std::string& oid_str, std::string& value)
+{
+  oid name[MAX_OID_LEN];
+  size_t name_length = MAX_OID_LEN;
+
+  if ((_session == NULL) || !parse_oid(oid_str, name, &name_length))
+  {
+    return false;
+  }
+
+  netsnmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_GET);
+  snmp_add_null_var(pdu, name, name_length);
+
+  std::lock_guard<std::mutex> lock(_lock);
+  netsnmp_pdu* response = NULL;
+  int status = snmp_sess_synch_response(_session, pdu, &response);
+  _requests++;
+  bool ok = false;
+
+  if ((status == STAT_SUCCESS) &&
+      (response->errstat == SNMP_ERR_NOERROR) &&
+      (response->variables != NULL) &&
+      (!is_exception(response->variables)))
+  {
+    value = format_value(response->variables);
+    ok = true;
+  }
+
+  if (response != NULL)
+  {
+    snmp_free_pdu(response);
+  }
+
+  return ok;
+}
+
+
+uint64_t SnmpClient::get_uint(const std::string& oid_str)
+{
+  std::string value;
+  return get(oid_str, value) ? strtoull(value.c_str(), NULL, 10) : 0;
+}
+
+
+std::vector<std::string> SnmpClient::walk(const std::string& oid_str,
+                                          int max_repetitions)
+{
+  std::vector<std::string> entries;
+  oid root[MAX_OID_LEN];
+  size_t root_length = MAX_OID_LEN;
+
+  if ((_session == NULL) || !parse_oid(oid_str, root, &root_length))
+  {
+    return entries;
+  }
+
+  oid name[MAX_OID_LEN];
+  size_t name_length = root_length;
+  memcpy(name, root, root_length * sizeof(oid));
+
+  std::lock_guard<std::mutex> lock(_lock);
+  bool done = false;
+
+  while (!done)
+  {
+    netsnmp_pdu* pdu = snmp_pdu_create(SNMP_MSG_GETBULK);
+    pdu->non_repeaters = 0;
+    pdu->max_repetitions = max_repetitions;
+    snmp_add_null_var(pdu, name, name_length);
+
+    netsnmp_pdu* response = NULL;
+    int status = snmp_sess_synch_response(_session, pdu, &response);
+    _requests++;
+
+    if ((status != STAT_SUCCESS) ||
+        (response->errstat != SNMP_ERR_NOERROR) ||
+        (response->variables == NULL))
+    {
+      done = true;
+    }
+    else
+    {
+      for (netsnmp_variable_list* var = response->variables;
+           var != NULL;
+           var = var->next_variable)
+      {
+        // Stop at the end of the subtree, or if the agent doesn't move on
+        // (which would otherwise loop forever).
+        if (is_exception(var) ||
+            (var->name_length < root_length) ||
+            (memcmp(var->name, root, root_length * sizeof(oid)) != 0) ||
+            (snmp_oid_compare(var->name, var->name_length, name, name_length) <= 0))
+        {
+          done = true;
+          break;
+        }
+
+        entries.push_back(format_oid(var->name, var->name_length) + " = " +
+                          format_value(var));
+        memcpy(name, var->name, var->name_length * sizeof(oid));
+        name_length = var->name_length;
+      }
+    }
+
+    if (response != NULL)
+    {
+      snmp_free_pdu(response);
+    }
+  }
+
+  return entries;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file snmpclient.h In-process client for querying an SNMP agent.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef SNMPCLIENT_H__
+#define SNMPCLIENT_H__
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+/// Queries an SNMP agent over a single net-snmp session, which is opened once
+/// and reused for every query. This is much cheaper than running snmpget or
+/// snmpwalk for each query, so it can be used to poll statistics while a
+/// benchmark runs.
+///
+/// The net-snmp headers are kept out of this file, so that including it
+/// doesn't pollute the namespace of the tests. The net-snmp library must
+/// already have been initialised (as SNMPTest does when it starts its agent).
+class SnmpClient
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] peer      - The agent to query, as "host:port".
+  /// @param [in] community - The SNMPv2c community to use.
+  SnmpClient(const std::string& peer = "127.0.0.1:16161",
+             const std::string& community = "clearwater");
+  virtual ~SnmpClient();
+
+  /// Whether the session was opened successfully.
+  bool connected() const { return (_session != NULL); }
+
+  /// Get a single value, formatted as snmpget -Oqv would.
+  ///
+  /// @param [in]  oid   - The numeric OID to get, e.g. ".1.2.2.0".
+  /// @param [out] value - The value.
+  ///
+  /// @return Whether the OID exists and was read successfully.
+  bool get(const std::string& oid, std::string& value);
+
+  /// Get a single integer value.
+  ///
+  /// @return The value, or 0 if it couldn't be read.
+  uint64_t get_uint(const std::string& oid);
+
+  /// Walk the subtree under an OID, using GETBULK requests.
+  ///
+  /// @param [in] oid             - The numeric OID of the subtree.
+  /// @param [in] max_repetitions - The most values to ask for in each request.
+  ///
+  /// @return Each value in the subtree, in order, formatted as
+  ///         snmpwalk -OQn would - e.g. ".1.2.2.1.2.1 = 0".
+  std::vector<std::string> walk(const std::string& oid, int max_repetitions = 50);
+
+  /// The number of requests sent to the agent so far.
+  uint64_t requests() const { return _requests; }
+
+private:
+  /// The net-snmp single session handle.
+  void* _session;
+
+  /// net-snmp single sessions must only be used by one thread at a time.
+  std::mutex _lock;
+
+  uint64_t _requests;
+};
+
+#endif
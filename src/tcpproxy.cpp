@@ -0,0 +1,361 @@
+/**
+ * @file tcpproxy.cpp TCP proxy that can delay traffic and counts connections.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "tcpproxy.h"
+#include "benchmark.h"
+
+/// Each connection has four threads - a reader and a writer in each
+/// direction.
+static const int THREADS_PER_CONNECTION = 4;
+
+TcpProxy::TcpProxy(const std::string& ip,
+                   int port,
+                   const std::vector<std::string>& target_ips,
+                   int target_port) :
+  _ip(ip),
+  _port(port),
+  _target_ips(target_ips),
+  _target_port(target_port),
+  _next_target(0),
+  _listen_fd(-1),
+  _stopping(false),
+  _delay_ms(0),
+  _connections(0),
+  _open_connections(0),
+  _upstream_bytes(0),
+  _downstream_bytes(0),
+  _upstream_writes(0),
+  _last_upstream_write_us(0)
+{
+}
+
+
+TcpProxy::~TcpProxy()
+{
+  stop();
+}
+
+
+bool TcpProxy::start()
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  inet_pton(AF_INET, _ip.c_str(), &addr.sin_addr);
+
+  _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  if ((bind(_listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (listen(_listen_fd, 64) != 0))
+  {
+    perror("bind");
+    close(_listen_fd);
+    _listen_fd = -1;
+    return false;
+  }
+
+  _stopping = false;
+  _thread = std::thread(&TcpProxy::run, this);
+  return true;
+}
+
+
+void TcpProxy::stop()
+{
+  _stopping = true;
+
+  if (_thread.joinable())
+  {
+    _thread.join();
+  }
+
+  if (_listen_fd != -1)
+  {
+    close(_listen_fd);
+    _listen_fd = -1;
+  }
+
+  // Shut down the sockets, so that the readers see the connections close.
+  std::vector<std::shared_ptr<Connection>> connections;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    connections.swap(_active_connections);
+  }
+
+  for (const std::shared_ptr<Connection>& connection : connections)
+  {
+    shutdown(connection->client_fd, SHUT_RDWR);
+    shutdown(connection->target_fd, SHUT_RDWR);
+  }
+
+  for (const std::shared_ptr<Connection>& connection : connections)
+  {
+    close_connection(connection);
+  }
+}
+
+
+void TcpProxy::run()
+{
+  struct pollfd fd;
+  fd.fd = _listen_fd;
+  fd.events = POLLIN;
+
+  while (!_stopping)
+  {
+    reap_connections();
+
+    // Use a short timeout so that we notice promptly when we are stopped.
+    if (poll(&fd, 1, 100) <= 0)
+    {
+      continue;
+    }
+
+    int client_fd = accept(_listen_fd, NULL, NULL);
+
+    if (client_fd == -1)
+    {
+      continue;
+    }
+
+    _connections++;
+    int target_fd = connect_to_target();
+
+    if (target_fd == -1)
+    {
+      // Behave like the target - refuse the connection.
+      close(client_fd);
+      continue;
+    }
+
+    start_connection(client_fd, target_fd);
+  }
+}
+
+
+int TcpProxy::connect_to_target()
+{
+  for (size_t ii = 0; ii < _target_ips.size(); ++ii)
+  {
+    const std::string& target_ip = _target_ips[_next_target];
+    _next_target = (_next_target + 1) % _target_ips.size();
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(_target_port);
+    inet_pton(AF_INET, target_ip.c_str(), &addr.sin_addr);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+    {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+
+void TcpProxy::start_connection(int client_fd, int target_fd)
+{
+  // Forward data as soon as it arrives, as the delay is added separately.
+  int nodelay = 1;
+  setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  setsockopt(target_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  std::shared_ptr<Connection> connection(new Connection());
+  connection->client_fd = client_fd;
+  connection->target_fd = target_fd;
+  connection->finished_pipes = 0;
+  connection->upstream.from_fd = client_fd;
+  connection->upstream.to_fd = target_fd;
+  connection->upstream.upstream = true;
+  connection->downstream.from_fd = target_fd;
+  connection->downstream.to_fd = client_fd;
+  connection->downstream.upstream = false;
+
+  _open_connections++;
+
+  for (Pipe* pipe : {&connection->upstream, &connection->downstream})
+  {
+    pipe->reader = std::thread(&TcpProxy::read_pipe, this, connection.get(), pipe);
+    pipe->writer = std::thread(&TcpProxy::write_pipe, this, connection.get(), pipe);
+  }
+
+  std::lock_guard<std::mutex> lock(_lock);
+  _active_connections.push_back(connection);
+}
+
+
+void TcpProxy::read_pipe(Connection* connection, Pipe* pipe)
+{
+  char buf[16384];
+
+  while (true)
+  {
+    ssize_t len = recv(pipe->from_fd, buf, sizeof(buf), 0);
+
+    Chunk chunk;
+    chunk.deliver_at_us = Benchmark::now_us() + (uint64_t)_delay_ms * 1000;
+
+    if (len > 0)
+    {
+      chunk.data.assign(buf, len);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pipe->lock);
+      pipe->chunks.push_back(chunk);
+    }
+
+    pipe->cond.notify_one();
+
+    if (len <= 0)
+    {
+      break;
+    }
+  }
+
+  if (++connection->finished_pipes == THREADS_PER_CONNECTION)
+  {
+    _open_connections--;
+  }
+}
+
+
+void TcpProxy::write_pipe(Connection* connection, Pipe* pipe)
+{
+  while (true)
+  {
+    Chunk chunk;
+
+    {
+      std::unique_lock<std::mutex> lock(pipe->lock);
+      pipe->cond.wait(lock, [pipe]() { return !pipe->chunks.empty(); });
+      chunk = pipe->chunks.front();
+      pipe->chunks.pop_front();
+    }
+
+    if (chunk.data.empty())
+    {
+      // The other side has closed, so pass that on.
+      shutdown(pipe->to_fd, SHUT_WR);
+      break;
+    }
+
+    uint64_t now_us = Benchmark::now_us();
+
+    if ((!_stopping) && (chunk.deliver_at_us > now_us))
+    {
+      usleep(chunk.deliver_at_us - now_us);
+    }
+
+    size_t sent = 0;
+
+    while (sent < chunk.data.size())
+    {
+      ssize_t len = send(pipe->to_fd,
+                         chunk.data.data() + sent,
+                         chunk.data.size() - sent,
+                         MSG_NOSIGNAL);
+
+      if (len <= 0)
+      {
+        break;
+      }
+
+      sent += len;
+    }
+
+    if (sent < chunk.data.size())
+    {
+      // The side we're writing to has gone, so stop reading from the other
+      // side. The reader then queues the end of the data, which ends this
+      // loop.
+      shutdown(pipe->from_fd, SHUT_RD);
+      continue;
+    }
+
+    if (pipe->upstream)
+    {
+      _upstream_bytes += sent;
+      _upstream_writes++;
+      _last_upstream_write_us = Benchmark::now_us();
+    }
+    else
+    {
+      _downstream_bytes += sent;
+    }
+  }
+
+  if (++connection->finished_pipes == THREADS_PER_CONNECTION)
+  {
+    _open_connections--;
+  }
+}
+
+
+void TcpProxy::close_connection(const std::shared_ptr<Connection>& connection)
+{
+  for (Pipe* pipe : {&connection->upstream, &connection->downstream})
+  {
+    pipe->reader.join();
+    pipe->writer.join();
+  }
+
+  close(connection->client_fd);
+  close(connection->target_fd);
+}
+
+
+void TcpProxy::reap_connections()
+{
+  std::vector<std::shared_ptr<Connection>> finished;
+
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+
+    for (auto it = _active_connections.begin(); it != _active_connections.end();)
+    {
+      if ((*it)->finished_pipes == THREADS_PER_CONNECTION)
+      {
+        finished.push_back(*it);
+        it = _active_connections.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+
+  for (const std::shared_ptr<Connection>& connection : finished)
+  {
+    close_connection(connection);
+  }
+}
@@ -0,0 +1,148 @@
+/**
+ * @file tcpproxy.h TCP proxy that can delay traffic and counts connections.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TCPPROXY_H__
+#define TCPPROXY_H__
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdint.h>
+
+/// Listens on an address and forwards each connection to one of a set of
+/// targets, in turn. Tests put this between two processes to emulate a WAN
+/// link between them (by delaying the traffic in each direction), and to see
+/// how the processes use their connections.
+class TcpProxy
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] ip          - The address to listen on.
+  /// @param [in] port        - The port to listen on.
+  /// @param [in] target_ips  - The addresses to forward connections to.
+  /// @param [in] target_port - The port to forward connections to.
+  TcpProxy(const std::string& ip,
+           int port,
+           const std::vector<std::string>& target_ips,
+           int target_port);
+  virtual ~TcpProxy();
+
+  /// Start listening for connections.
+  ///
+  /// @return Whether the proxy started successfully.
+  bool start();
+
+  /// Stop listening, and close all the connections.
+  void stop();
+
+  std::string ip() const { return _ip; }
+
+  /// Delay the traffic in each direction by the given time, so the round trip
+  /// time through the proxy goes up by twice this. This applies to data the
+  /// proxy receives after it is called.
+  void set_delay_ms(int delay_ms) { _delay_ms = delay_ms; }
+
+  /// The number of connections accepted so far, and the number still open.
+  uint64_t connections() const { return _connections; }
+  int open_connections() const { return _open_connections; }
+
+  /// The number of bytes forwarded to the targets, and back from them.
+  uint64_t upstream_bytes() const { return _upstream_bytes; }
+  uint64_t downstream_bytes() const { return _downstream_bytes; }
+
+  /// The number of times the proxy has forwarded data to a target, and the
+  /// time (from Benchmark::now_us) it last did so.
+  uint64_t upstream_writes() const { return _upstream_writes; }
+  uint64_t last_upstream_write_us() const { return _last_upstream_write_us; }
+
+private:
+  /// Data read from one side of a connection, waiting to be written to the
+  /// other. Empty data means the side it was read from has closed.
+  struct Chunk
+  {
+    uint64_t deliver_at_us;
+    std::string data;
+  };
+
+  /// One direction of a proxied connection.
+  struct Pipe
+  {
+    int from_fd;
+    int to_fd;
+    bool upstream;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<Chunk> chunks;
+    std::thread reader;
+    std::thread writer;
+  };
+
+  /// A proxied connection.
+  struct Connection
+  {
+    int client_fd;
+    int target_fd;
+    Pipe upstream;
+    Pipe downstream;
+    std::atomic<int> finished_pipes;
+  };
+
+  void run();
+
+  /// Connect to the next target.
+  ///
+  /// @return The connected socket, or -1 on failure.
+  int connect_to_target();
+
+  /// Start forwarding a new connection.
+  void start_connection(int client_fd, int target_fd);
+
+  /// Read from one side of a connection, and queue the data to be written to
+  /// the other.
+  void read_pipe(Connection* connection, Pipe* pipe);
+
+  /// Write data queued for one side of a connection, once it is due.
+  void write_pipe(Connection* connection, Pipe* pipe);
+
+  /// Wait for a connection's threads to finish, and close its sockets.
+  void close_connection(const std::shared_ptr<Connection>& connection);
+
+  /// Tidy up the connections that have finished.
+  void reap_connections();
+
+  std::string _ip;
+  int _port;
+  std::vector<std::string> _target_ips;
+  int _target_port;
+  size_t _next_target;
+  int _listen_fd;
+  std::thread _thread;
+  std::atomic<bool> _stopping;
+  std::atomic<int> _delay_ms;
+
+  std::atomic<uint64_t> _connections;
+  std::atomic<int> _open_connections;
+  std::atomic<uint64_t> _upstream_bytes;
+  std::atomic<uint64_t> _downstream_bytes;
+  std::atomic<uint64_t> _upstream_writes;
+  std::atomic<uint64_t> _last_upstream_write_us;
+
+  std::mutex _lock;
+  std::vector<std::shared_ptr<Connection>> _active_connections;
+};
+
+#endif
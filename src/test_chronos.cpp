@@ -0,0 +1,1465 @@
+/**
+ * @file test_chronos.cpp FV tests and benchmarks for Chronos.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "gtest/gtest.h"
+
+#include "processinstance.h"
+#include "site.h"
+#include "deployment.h"
+
+#include "httpstack.h"
+#include "httpclient.h"
+#include "httpconnection.h"
+#include "httpresolver.h"
+#include "chronosconnection.h"
+#include "dnscachedresolver.h"
+#include "benchmark.h"
+#include "dnsresponder.h"
+#include "controlledclock.h"
+#include "tcpproxy.h"
+#include "parallelchronossender.h"
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include <signal.h>
+#include <unistd.h>
+
+static const SAS::TrailId FAKE_TRAIL_ID = 0x12345678;
+
+/// Receives timer pops from Chronos on an HTTP stack, in the same way as
+/// S4Site does.
+///
+/// The opaque data of each timer must be its index (from 0 to num_timers - 1).
+/// The receiver records when each timer first popped, and how many times
+/// timers popped again.
+class TimerPopReceiver : public HttpStack::HandlerInterface
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] ip          - The address to listen for pops on. The pops are
+  ///                           sent to "/timers" on port 8088.
+  /// @param [in] num_timers  - The number of timers that will pop.
+  /// @param [in] num_threads - The number of HTTP stack threads.
+  TimerPopReceiver(const std::string& ip, int num_timers, int num_threads = 1) :
+    _pop_times_us(num_timers, 0),
+    _pops(0),
+    _duplicate_pops(0),
+    _unexpected_pops(0)
+  {
+    _http_stack = new HttpStack(num_threads, nullptr);
+    _http_stack->initialize();
+    _http_stack->register_handler("^/timers$", this);
+    _http_stack->bind_tcp_socket(ip, 8088);
+    _http_stack->start(nullptr);
+  }
+
+  virtual ~TimerPopReceiver()
+  {
+    _http_stack->stop();
+    _http_stack->wait_stopped();
+    delete _http_stack; _http_stack = nullptr;
+  }
+
+  void process_request(HttpStack::Request& req, SAS::TrailId trail)
+  {
+    uint64_t now_us = Benchmark::now_us();
+    int index = atoi(req.get_rx_body().c_str());
+
+    {
+      std::lock_guard<std::mutex> lock(_lock);
+
+      if ((index < 0) || (index >= (int)_pop_times_us.size()))
+      {
+        _unexpected_pops++;
+      }
+      else if (_pop_times_us[index] != 0)
+      {
+        _duplicate_pops++;
+      }
+      else
+      {
+        _pop_times_us[index] = now_us;
+        _pops++;
+      }
+    }
+
+    req.send_reply(HTTP_OK, trail);
+  }
+
+  /// Wait until the given number of timers have popped, or the timeout passes.
+  ///
+  /// @return Whether the timers all popped.
+  bool wait_for_pops(int num_pops, int timeout_ms)
+  {
+    Benchmark::Stopwatch sw;
+
+    while ((_pops < num_pops) && (sw.elapsed_us() < (uint64_t)timeout_ms * 1000))
+    {
+      usleep(10000);
+    }
+
+    return (_pops >= num_pops);
+  }
+
+  /// Returns the time (from Benchmark::now_us) each timer first popped, or 0
+  /// if it hasn't.
+  std::vector<uint64_t> pop_times_us()
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _pop_times_us;
+  }
+
+  /// Returns the time (from Benchmark::now_us) the given timer first popped,
+  /// or 0 if it hasn't.
+  uint64_t pop_time_us(int index)
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    return _pop_times_us.at(index);
+  }
+
+  int pops() const { return _pops; }
+  int duplicate_pops() const { return _duplicate_pops; }
+  int unexpected_pops() const { return _unexpected_pops; }
+
+private:
+  HttpStack* _http_stack;
+
+  std::mutex _lock;
+  std::vector<uint64_t> _pop_times_us;
+  std::atomic<int> _pops;
+  std::atomic<int> _duplicate_pops;
+  std::atomic<int> _unexpected_pops;
+};
+
+/// Everything needed to send requests to Chronos.
+class ChronosClient
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] chronos_domain - The domain name of the Chronos cluster.
+  /// @param [in] local_ip       - The address to send requests from. Timers
+  ///                              pop to this address, on port 8088.
+  ChronosClient(const std::string& chronos_domain, const std::string& local_ip)
+  {
+    _dns_client = new DnsCachedResolver("127.0.0.1",
+                                        DnsCachedResolver::DEFAULT_TIMEOUT,
+                                        DnsCachedResolver::NO_DNS_FILE,
+                                        5353);
+    _http_resolver = new HttpResolver(_dns_client,
+                                      AF_INET,
+                                      HttpResolver::DEFAULT_BLACKLIST_DURATION);
+    _http_client = new HttpClient(false,
+                                  _http_resolver,
+                                  nullptr,
+                                  nullptr,
+                                  SASEvent::HttpLogLevel::DETAIL,
+                                  nullptr,
+                                  false,
+                                  false,
+                                  -1,
+                                  false,
+                                  "",
+                                  local_ip);
+    _http_connection = new HttpConnection(chronos_domain + ":7253", _http_client);
+    connection = new ChronosConnection(local_ip + ":8088", _http_connection);
+  }
+
+  virtual ~ChronosClient()
+  {
+    delete connection; connection = nullptr;
+    delete _http_connection; _http_connection = nullptr;
+    delete _http_client; _http_client = nullptr;
+    delete _http_resolver; _http_resolver = nullptr;
+    delete _dns_client; _dns_client = nullptr;
+  }
+
+  ChronosConnection* connection;
+
+private:
+  DnsCachedResolver* _dns_client;
+  HttpResolver* _http_resolver;
+  HttpClient* _http_client;
+  HttpConnection* _http_connection;
+};
+
+/// Fixture for Chronos tests.
+class BaseChronosTest : public ::testing::Test
+{
+public:
+  static void signal_handler(int signal);
+
+  static void SetUpTestCase()
+  {
+    signal(SIGSEGV, signal_handler);
+    signal(SIGINT, signal_handler);
+
+    boost::filesystem::create_directory("tmp");
+
+    _deployment_topology.emplace("site1",
+                                 Site::Topology("127.0.1.")
+                                  .with_chronos("chronos.site1"));
+  }
+
+  static void TearDownTestCase()
+  {
+    _dns_server.reset();
+    _site.reset();
+    _clock.reset();
+    _deployment_topology.clear();
+
+    boost::filesystem::remove_all("tmp");
+
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+  }
+
+  virtual void SetUp()
+  {
+    EXPECT_TRUE(_site->wait_for_instances());
+  }
+
+  /// Creates and starts a site with a cluster of three Chronos nodes, and a
+  /// DNS server that resolves the cluster's domain name.
+  ///
+  /// @param [in] controlled_clock - Whether the Chronos nodes should follow
+  ///                                _clock rather than the real time.
+  static void create_and_start_site(bool controlled_clock = false)
+  {
+    _site = std::shared_ptr<Site>(new Site(1,
+                                           "site1",
+                                           "tmp/site1",
+                                           _deployment_topology,
+                                           0,
+                                           0,
+                                           3));
+
+    if (controlled_clock)
+    {
+      _clock = std::shared_ptr<ControlledClock>(new ControlledClock("tmp/chronos_clock"));
+      _site->use_controlled_clock(_clock.get());
+    }
+
+    _site->start();
+
+    _dns_server = std::shared_ptr<DnsResponder>(
+      new DnsResponder("127.0.0.1",
+                       5353,
+                       {{"chronos.site1", _site->get_chronos_ips()}}));
+    _dns_server->start_instance();
+  }
+
+  /// The address that timers pop to.
+  static const std::string CALLBACK_IP;
+
+  static std::shared_ptr<DnsResponder> _dns_server;
+  static std::map<std::string, Site::Topology> _deployment_topology;
+  static std::shared_ptr<Site> _site;
+  static std::shared_ptr<ControlledClock> _clock;
+};
+
+const std::string BaseChronosTest::CALLBACK_IP = "127.0.1.100";
+std::shared_ptr<DnsResponder> BaseChronosTest::_dns_server;
+std::map<std::string, Site::Topology> BaseChronosTest::_deployment_topology;
+std::shared_ptr<Site> BaseChronosTest::_site;
+std::shared_ptr<ControlledClock> BaseChronosTest::_clock;
+
+void BaseChronosTest::signal_handler(int sig)
+{
+  // Clean up the testcase.
+  TearDownTestCase();
+
+  // Re-raise to signal to cause the script to exit.
+  raise(sig);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// ChronosControlledTimeTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Test fixture where the Chronos nodes follow a controlled clock, so the
+/// tests can make long timers pop without waiting for them.
+class ChronosControlledTimeTest : public BaseChronosTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    BaseChronosTest::SetUpTestCase();
+    create_and_start_site(true);
+  }
+
+  /// Returns the time on the controlled clock, in milliseconds. This has the
+  /// same base as Benchmark::now_us.
+  static uint64_t clock_now_ms()
+  {
+    return Benchmark::now_us() / 1000 + _clock->offset_ms();
+  }
+
+  /// Move the controlled clock forward to the given time (as returned by
+  /// clock_now_ms).
+  static void advance_clock_to_ms(uint64_t target_ms)
+  {
+    uint64_t now_ms = clock_now_ms();
+
+    if (target_ms > now_ms)
+    {
+      _clock->advance_time_ms(target_ms - now_ms);
+    }
+  }
+};
+
+/// Set an hour long timer, and check it pops as soon as the clock is moved
+/// past its due time (but not before).
+///
+/// Chronos replicates each timer to backup nodes, which pop it a few seconds
+/// after it is due if the primary hasn't. To avoid duplicate pops, the tests
+/// move the clock to just after a timer is due, rather than far past it.
+TEST_F(ChronosControlledTimeTest, TimerPopsWhenClockAdvanced)
+{
+  TimerPopReceiver receiver(CALLBACK_IP, 1);
+  ChronosClient client("chronos.site1", CALLBACK_IP);
+
+  std::string timer_id;
+  uint64_t due_ms = clock_now_ms() + 3600 * 1000;
+  HTTPCode rc = client.connection->send_post(timer_id,
+                                             3600,
+                                             3600,
+                                             "/timers",
+                                             "0",
+                                             FAKE_TRAIL_ID,
+                                             std::map<std::string, uint32_t>());
+  ASSERT_EQ(HTTP_OK, rc);
+
+  advance_clock_to_ms(due_ms - 2000);
+  EXPECT_FALSE(receiver.wait_for_pops(1, 500));
+
+  advance_clock_to_ms(due_ms + 500);
+  EXPECT_TRUE(receiver.wait_for_pops(1, 2000));
+
+  sleep(1);
+  EXPECT_EQ(0, receiver.duplicate_pops());
+}
+
+/// Set timers ranging from a minute to a day long, which Chronos stores in
+/// different parts of its timer wheel. Move the clock forward past each in
+/// turn, and check that each pops when it should.
+TEST_F(ChronosControlledTimeTest, LongTimersPopInOrder)
+{
+  const std::vector<uint32_t> intervals_s = {60, 600, 3600, 6 * 3600, 24 * 3600};
+  TimerPopReceiver receiver(CALLBACK_IP, intervals_s.size());
+  ChronosClient client("chronos.site1", CALLBACK_IP);
+  std::vector<uint64_t> due_ms;
+
+  for (size_t ii = 0; ii < intervals_s.size(); ++ii)
+  {
+    std::string timer_id;
+    due_ms.push_back(clock_now_ms() + intervals_s[ii] * 1000);
+    HTTPCode rc = client.connection->send_post(timer_id,
+                                               intervals_s[ii],
+                                               intervals_s[ii],
+                                               "/timers",
+                                               std::to_string(ii),
+                                               FAKE_TRAIL_ID,
+                                               std::map<std::string, uint32_t>());
+    ASSERT_EQ(HTTP_OK, rc);
+  }
+
+  for (size_t ii = 0; ii < intervals_s.size(); ++ii)
+  {
+    SCOPED_TRACE(intervals_s[ii]);
+
+    // Nothing more should pop until the next timer is due.
+    advance_clock_to_ms(due_ms[ii] - 2000);
+    EXPECT_FALSE(receiver.wait_for_pops(ii + 1, 500));
+
+    advance_clock_to_ms(due_ms[ii] + 500);
+    EXPECT_TRUE(receiver.wait_for_pops(ii + 1, 2000));
+    EXPECT_NE(0u, receiver.pop_times_us()[ii]);
+  }
+
+  sleep(1);
+  EXPECT_EQ(0, receiver.duplicate_pops());
+  EXPECT_EQ(0, receiver.unexpected_pops());
+}
+
+/// Set timers both one at a time and in parallel, and check the ones sent in
+/// parallel pop exactly like the others. Also check that timers updated and
+/// deleted in parallel are changed as they would be individually.
+TEST_F(ChronosControlledTimeTest, ParallelSentTimersPopLikeSingleTimers)
+{
+  const int num_timers = 20;
+  const int num_changed = 10;
+
+  // Timers 0 to num_timers - 1 are set one at a time, the next num_timers are
+  // set in parallel, the next num_changed are updated in parallel, and the
+  // last num_changed are deleted in parallel.
+  const int first_parallel = num_timers;
+  const int first_updated = 2 * num_timers;
+  const int first_deleted = first_updated + num_changed;
+  const int expected_pops = first_deleted;
+
+  TimerPopReceiver receiver(CALLBACK_IP, first_deleted + num_changed);
+  ChronosClient client("chronos.site1", CALLBACK_IP);
+  ParallelChronosSender sender(client.connection);
+
+  for (int ii = 0; ii < num_timers; ++ii)
+  {
+    std::string timer_id;
+    HTTPCode rc = client.connection->send_post(timer_id,
+                                               3600,
+                                               3600,
+                                               "/timers",
+                                               std::to_string(ii),
+                                               FAKE_TRAIL_ID,
+                                               std::map<std::string, uint32_t>());
+    ASSERT_EQ(HTTP_OK, rc);
+  }
+
+  for (int ii = first_parallel; ii < first_deleted + num_changed; ++ii)
+  {
+    // The timers that will be updated start off popping after a minute.
+    uint32_t interval_s = ((ii >= first_updated) && (ii < first_deleted)) ? 60 : 3600;
+    sender.add_set(interval_s, interval_s, "/timers", std::to_string(ii));
+  }
+
+  ASSERT_EQ(0, sender.send(FAKE_TRAIL_ID));
+
+  for (size_t ii = 0; ii < sender.size(); ++ii)
+  {
+    EXPECT_EQ(HTTP_OK, sender.timer(ii).rc);
+    EXPECT_FALSE(sender.timer(ii).timer_id.empty());
+  }
+
+  // Push the minute long timers back to an hour, and delete the last few.
+  ParallelChronosSender changes(client.connection);
+
+  for (int ii = first_updated; ii < first_deleted; ++ii)
+  {
+    changes.add_update(sender.timer(ii - first_parallel).timer_id,
+                       3600,
+                       3600,
+                       "/timers",
+                       std::to_string(ii));
+  }
+
+  for (int ii = first_deleted; ii < first_deleted + num_changed; ++ii)
+  {
+    changes.add_delete(sender.timer(ii - first_parallel).timer_id);
+  }
+
+  uint64_t due_ms = clock_now_ms() + 3600 * 1000;
+  ASSERT_EQ(0, changes.send(FAKE_TRAIL_ID));
+
+  // The updated timers no longer pop after a minute.
+  advance_clock_to_ms(clock_now_ms() + 60 * 1000 + 500);
+  EXPECT_FALSE(receiver.wait_for_pops(1, 500));
+
+  advance_clock_to_ms(due_ms - 2000);
+  EXPECT_FALSE(receiver.wait_for_pops(1, 500));
+
+  advance_clock_to_ms(due_ms + 500);
+  EXPECT_TRUE(receiver.wait_for_pops(expected_pops, 2000));
+
+  sleep(1);
+  std::vector<uint64_t> pop_times_us = receiver.pop_times_us();
+
+  for (int ii = 0; ii < first_deleted + num_changed; ++ii)
+  {
+    SCOPED_TRACE(ii);
+
+    if (ii < first_deleted)
+    {
+      EXPECT_NE(0u, pop_times_us[ii]);
+    }
+    else
+    {
+      EXPECT_EQ(0u, pop_times_us[ii]);
+    }
+  }
+
+  EXPECT_EQ(expected_pops, receiver.pops());
+  EXPECT_EQ(0, receiver.duplicate_pops());
+  EXPECT_EQ(0, receiver.unexpected_pops());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// Chronos benchmarks start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+class ChronosBenchmark : public BaseChronosTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    BaseChronosTest::SetUpTestCase();
+    create_and_start_site();
+  }
+};
+
+/// Set many timers on the Chronos cluster, and wait for them all to pop. The
+/// timers are spread evenly over a ten second window, which starts ten seconds
+/// after the first timer is set. Reports:
+/// -  The rate at which timers can be set, and the latency of setting them.
+/// -  How late the timers pop, compared to when they were due. Chronos starts
+///    each timer when it receives the request, so this includes the time taken
+///    to send the request.
+/// -  The rate at which timers pop.
+/// -  The CPU time and memory used by the Chronos cluster for each timer.
+///
+/// Set BENCHMARK_TIMERS to change the number of timers.
+TEST_F(ChronosBenchmark, TimerThroughput)
+{
+  const int num_timers = Benchmark::env_int("BENCHMARK_TIMERS", 10000);
+  const int num_client_threads = 8;
+  const int first_pop_s = 10;
+  const int pop_window_s = 10;
+
+  const std::vector<std::shared_ptr<ChronosInstance>>& chronos = _site->get_chronos_instances();
+  uint64_t cpu_before_us = 0;
+  uint64_t rss_before = 0;
+
+  for (const std::shared_ptr<ChronosInstance>& instance : chronos)
+  {
+    cpu_before_us += instance->cpu_time_us();
+    rss_before += instance->rss_bytes();
+  }
+
+  TimerPopReceiver receiver(CALLBACK_IP, num_timers, 4);
+  ChronosClient client("chronos.site1", CALLBACK_IP);
+
+  // Each client thread sets the next timer that hasn't been set yet. Timer ii
+  // is due at (first_pop_s + ii * pop_window_s / num_timers) seconds after the
+  // start of the run. Chronos timers have a resolution of a second, so each
+  // timer's interval is rounded up and its due time calculated from that.
+  std::vector<uint64_t> due_times_us(num_timers, 0);
+  Benchmark::LatencyRecorder set_latency;
+  std::atomic<int> next_timer(0);
+  std::atomic<int> rejected(0);
+  uint64_t start_us = Benchmark::now_us();
+
+  auto set_timers = [&]() {
+    int ii;
+
+    while ((ii = next_timer++) < num_timers)
+    {
+      uint64_t target_us = start_us + first_pop_s * 1000000 +
+                           (uint64_t)ii * pop_window_s * 1000000 / num_timers;
+      uint64_t now_us = Benchmark::now_us();
+      uint32_t interval_s = (target_us > now_us) ?
+                              (target_us - now_us + 999999) / 1000000 : 1;
+      std::string timer_id;
+
+      due_times_us[ii] = now_us + (uint64_t)interval_s * 1000000;
+      HTTPCode rc = client.connection->send_post(timer_id,
+                                                 interval_s,
+                                                 interval_s,
+                                                 "/timers",
+                                                 std::to_string(ii),
+                                                 FAKE_TRAIL_ID,
+                                                 std::map<std::string, uint32_t>());
+      set_latency.record(Benchmark::now_us() - now_us);
+
+      if (rc != HTTP_OK)
+      {
+        rejected++;
+        due_times_us[ii] = 0;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+
+  for (int ii = 0; ii < num_client_threads; ++ii)
+  {
+    threads.emplace_back(set_timers);
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  uint64_t set_elapsed_us = Benchmark::now_us() - start_us;
+
+  // All the timers are now in Chronos, so this is when its memory usage is
+  // highest.
+  uint64_t rss_after = 0;
+
+  for (const std::shared_ptr<ChronosInstance>& instance : chronos)
+  {
+    rss_after += instance->rss_bytes();
+  }
+
+  int expected_pops = num_timers - rejected;
+  EXPECT_TRUE(receiver.wait_for_pops(expected_pops,
+                                     (first_pop_s + pop_window_s + 30) * 1000 +
+                                       set_elapsed_us / 1000));
+
+  // Give Chronos a moment to send any duplicate pops.
+  sleep(1);
+
+  uint64_t cpu_after_us = 0;
+
+  for (const std::shared_ptr<ChronosInstance>& instance : chronos)
+  {
+    cpu_after_us += instance->cpu_time_us();
+  }
+
+  // Work out how late each timer popped, and the rate of pops.
+  std::vector<uint64_t> pop_times_us = receiver.pop_times_us();
+  Benchmark::LatencyRecorder lateness;
+  uint64_t first_pop_us = std::numeric_limits<uint64_t>::max();
+  uint64_t last_pop_us = 0;
+  int early_pops = 0;
+
+  for (int ii = 0; ii < num_timers; ++ii)
+  {
+    if ((due_times_us[ii] == 0) || (pop_times_us[ii] == 0))
+    {
+      continue;
+    }
+
+    if (pop_times_us[ii] < due_times_us[ii])
+    {
+      early_pops++;
+      lateness.record(0);
+    }
+    else
+    {
+      lateness.record(pop_times_us[ii] - due_times_us[ii]);
+    }
+
+    first_pop_us = std::min(first_pop_us, pop_times_us[ii]);
+    last_pop_us = std::max(last_pop_us, pop_times_us[ii]);
+  }
+
+  EXPECT_EQ(expected_pops, receiver.pops());
+  EXPECT_EQ(0, receiver.unexpected_pops());
+
+  Benchmark::report("timers", (uint64_t)num_timers);
+  Benchmark::report("timers_set_per_sec", (double)num_timers * 1000000 / set_elapsed_us);
+  set_latency.report("timer_set");
+  Benchmark::report("timers_rejected", (uint64_t)rejected.load());
+  lateness.report("pop_lateness");
+  Benchmark::report("early_pops", (uint64_t)early_pops);
+  Benchmark::report("missed_pops", (uint64_t)(expected_pops - receiver.pops()));
+  Benchmark::report("duplicate_pops", (uint64_t)receiver.duplicate_pops());
+
+  if (last_pop_us > first_pop_us)
+  {
+    Benchmark::report("pops_per_sec",
+                      (double)(receiver.pops() - 1) * 1000000 / (last_pop_us - first_pop_us));
+  }
+
+  Benchmark::report("chronos_cpu_us_per_timer",
+                    (double)(cpu_after_us - cpu_before_us) / num_timers);
+  Benchmark::report("chronos_rss_bytes_per_timer",
+                    ((double)rss_after - (double)rss_before) / num_timers);
+}
+
+/// Set and then delete timers from a single client thread, as S4 would for a
+/// storm of registrations, handing ParallelChronosSender more timers at a time
+/// so that more requests are in flight at once. Each timer is still its own
+/// request to Chronos. Reports, for each number of timers per send:
+/// -  The rate at which timers are set and deleted.
+/// -  The latency of each send, and of each timer in it.
+/// -  The CPU time used by the Chronos cluster for each timer.
+///
+/// Set BENCHMARK_TIMERS to change the number of timers.
+TEST_F(ChronosBenchmark, ParallelTimerSends)
+{
+  const int num_timers = Benchmark::env_int("BENCHMARK_TIMERS", 10000);
+  const std::vector<std::shared_ptr<ChronosInstance>>& chronos = _site->get_chronos_instances();
+  ChronosClient client("chronos.site1", CALLBACK_IP);
+  ParallelChronosSender sender(client.connection);
+
+  for (int timers_per_send : {1, 10, 100})
+  {
+    std::string name = "per_send_" + std::to_string(timers_per_send);
+    SCOPED_TRACE(name);
+
+    uint64_t cpu_before_us = 0;
+
+    for (const std::shared_ptr<ChronosInstance>& instance : chronos)
+    {
+      cpu_before_us += instance->cpu_time_us();
+    }
+
+    Benchmark::LatencyRecorder send_latency;
+    std::vector<std::string> timer_ids;
+    int failures = 0;
+    Benchmark::Stopwatch sw;
+
+    // Set the timers, then delete them, so none of them pop.
+    for (bool set : {true, false})
+    {
+      for (int ii = 0; ii < num_timers; ii += timers_per_send)
+      {
+        sender.clear();
+
+        for (int jj = ii; jj < std::min(ii + timers_per_send, num_timers); ++jj)
+        {
+          if (set)
+          {
+            sender.add_set(3600, 3600, "/timers", std::to_string(jj));
+          }
+          else
+          {
+            sender.add_delete(timer_ids[jj]);
+          }
+        }
+
+        Benchmark::Stopwatch send_sw;
+        failures += sender.send(FAKE_TRAIL_ID);
+        send_latency.record(send_sw.elapsed_us());
+
+        if (set)
+        {
+          for (const ParallelChronosSender::Timer& timer : sender.timers())
+          {
+            timer_ids.push_back(timer.timer_id);
+          }
+        }
+      }
+    }
+
+    uint64_t elapsed_us = sw.elapsed_us();
+    uint64_t cpu_after_us = 0;
+
+    for (const std::shared_ptr<ChronosInstance>& instance : chronos)
+    {
+      cpu_after_us += instance->cpu_time_us();
+    }
+
+    EXPECT_EQ(0, failures);
+
+    send_latency.report(name + "_send_latency");
+    Benchmark::report(name + "_timer_latency_us",
+                      send_latency.mean() / timers_per_send);
+    Benchmark::report(name + "_timer_ops_per_sec",
+                      (double)2 * num_timers * 1000000 / elapsed_us);
+    Benchmark::report(name + "_chronos_cpu_us_per_timer_op",
+                      (double)(cpu_after_us - cpu_before_us) / (2 * num_timers));
+  }
+}
+
+/// Benchmark fixture for scaling the Chronos cluster. The nodes follow a
+/// controlled clock, so that the timers set before scaling can be made to pop
+/// as soon as scaling has finished.
+class ChronosScalingBenchmark : public ChronosControlledTimeTest
+{
+public:
+  /// Returns the total CPU time used by the chronos nodes.
+  static uint64_t chronos_cpu_us()
+  {
+    uint64_t cpu_us = 0;
+
+    for (const std::shared_ptr<ChronosInstance>& instance : _site->get_chronos_instances())
+    {
+      cpu_us += instance->cpu_time_us();
+    }
+
+    return cpu_us;
+  }
+
+  /// Wait for the chronos nodes to finish resynchronising. There's no direct
+  /// way to tell from outside, so this waits until together they have used
+  /// less than 5ms of CPU time in each of three consecutive 100ms intervals.
+  ///
+  /// @return The time (from Benchmark::now_us) the nodes went idle, or 0 if
+  ///         they didn't before the timeout.
+  static uint64_t wait_for_chronos_idle(int timeout_s)
+  {
+    Benchmark::Stopwatch sw;
+    uint64_t cpu_us = chronos_cpu_us();
+    uint64_t idle_since_us = 0;
+    int idle_intervals = 0;
+
+    while (sw.elapsed_us() < (uint64_t)timeout_s * 1000000)
+    {
+      uint64_t interval_start_us = Benchmark::now_us();
+      usleep(100000);
+      uint64_t new_cpu_us = chronos_cpu_us();
+
+      if ((new_cpu_us >= cpu_us) && (new_cpu_us - cpu_us < 5000))
+      {
+        if (idle_intervals++ == 0)
+        {
+          idle_since_us = interval_start_us;
+        }
+
+        if (idle_intervals == 3)
+        {
+          return idle_since_us;
+        }
+      }
+      else
+      {
+        idle_intervals = 0;
+      }
+
+      cpu_us = new_cpu_us;
+    }
+
+    return 0;
+  }
+
+  /// Set timers from several client threads. The opaque data of each timer is
+  /// its index, starting from first_index.
+  ///
+  /// @param [in] intervals_s - The interval of each timer.
+  ///
+  /// @return The time on the controlled clock each timer is due, or 0 for
+  ///         timers Chronos rejected.
+  static std::vector<uint64_t> set_timers(ChronosClient& client,
+                                          int first_index,
+                                          const std::vector<uint32_t>& intervals_s)
+  {
+    const int num_client_threads = 8;
+    std::vector<uint64_t> due_ms(intervals_s.size(), 0);
+    std::atomic<size_t> next_timer(0);
+
+    auto set = [&]() {
+      size_t ii;
+
+      while ((ii = next_timer++) < intervals_s.size())
+      {
+        std::string timer_id;
+        uint64_t now_ms = clock_now_ms();
+        HTTPCode rc = client.connection->send_post(timer_id,
+                                                   intervals_s[ii],
+                                                   intervals_s[ii],
+                                                   "/timers",
+                                                   std::to_string(first_index + ii),
+                                                   FAKE_TRAIL_ID,
+                                                   std::map<std::string, uint32_t>());
+
+        if (rc == HTTP_OK)
+        {
+          due_ms[ii] = now_ms + (uint64_t)intervals_s[ii] * 1000;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int ii = 0; ii < num_client_threads; ++ii)
+    {
+      threads.emplace_back(set);
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    return due_ms;
+  }
+
+  /// Pop probe timers one at a time, by moving the clock to just after each
+  /// is due, and record how long each takes to pop once it is due.
+  static void pop_probes(TimerPopReceiver& receiver,
+                         int first_index,
+                         const std::vector<uint64_t>& due_ms,
+                         Benchmark::LatencyRecorder& latency)
+  {
+    for (size_t ii = 0; ii < due_ms.size(); ++ii)
+    {
+      if (due_ms[ii] == 0)
+      {
+        continue;
+      }
+
+      advance_clock_to_ms(due_ms[ii] + 500);
+      uint64_t due_us = Benchmark::now_us();
+
+      while ((receiver.pop_time_us(first_index + ii) == 0) &&
+             (Benchmark::now_us() - due_us < 5000000))
+      {
+        usleep(1000);
+      }
+
+      uint64_t pop_us = receiver.pop_time_us(first_index + ii);
+
+      if (pop_us != 0)
+      {
+        latency.record((pop_us > due_us) ? pop_us - due_us : 0);
+      }
+
+      // Spread the probes out over the time the cluster is resynchronising.
+      usleep(100000);
+    }
+  }
+
+  /// Move the clock forward through the timers' due times a second at a time,
+  /// waiting at each step for the timers due by then to pop.
+  static void pop_timers(TimerPopReceiver& receiver, const std::vector<uint64_t>& due_ms)
+  {
+    std::vector<uint64_t> sorted_due_ms;
+
+    for (uint64_t due : due_ms)
+    {
+      if (due != 0)
+      {
+        sorted_due_ms.push_back(due);
+      }
+    }
+
+    if (sorted_due_ms.empty())
+    {
+      return;
+    }
+
+    std::sort(sorted_due_ms.begin(), sorted_due_ms.end());
+    int pops_before = receiver.pops();
+    size_t num_due = 0;
+
+    for (uint64_t step_ms = sorted_due_ms.front();
+         step_ms < sorted_due_ms.back() + 1000;
+         step_ms += 1000)
+    {
+      advance_clock_to_ms(step_ms + 500);
+
+      while ((num_due < sorted_due_ms.size()) && (sorted_due_ms[num_due] <= step_ms + 500))
+      {
+        num_due++;
+      }
+
+      receiver.wait_for_pops(pops_before + (int)num_due, 2000);
+    }
+  }
+};
+
+/// Scale the Chronos cluster up from three nodes to four, then back down,
+/// while it holds a large population of timers. For each operation, reports:
+/// -  How long the nodes take to resynchronise their timers.
+/// -  How many timers are lost or pop more than once.
+/// -  How long timers take to pop while the cluster is resynchronising,
+///    compared to before.
+///
+/// Set BENCHMARK_TIMERS to change the number of timers.
+TEST_F(ChronosScalingBenchmark, Resync)
+{
+  const int num_timers = Benchmark::env_int("BENCHMARK_TIMERS", 10000);
+  const int num_probes = 20;
+
+  for (bool scale_up : {true, false})
+  {
+    std::string name = scale_up ? "scale_up" : "scale_down";
+    SCOPED_TRACE(name);
+
+    // The probe timers used before scaling come first, then those used while
+    // the cluster is resynchronising, then the main population. The main
+    // population is due long after all the probes, and spread over 100s.
+    TimerPopReceiver receiver(CALLBACK_IP, 2 * num_probes + num_timers, 4);
+    ChronosClient client("chronos.site1", CALLBACK_IP);
+    std::vector<uint32_t> baseline_intervals_s;
+    std::vector<uint32_t> resync_intervals_s;
+    std::vector<uint32_t> main_intervals_s;
+
+    for (int ii = 0; ii < num_probes; ++ii)
+    {
+      baseline_intervals_s.push_back(30 + ii);
+      resync_intervals_s.push_back(60 + 2 * ii);
+    }
+
+    for (int ii = 0; ii < num_timers; ++ii)
+    {
+      main_intervals_s.push_back(600 + ii % 100);
+    }
+
+    std::vector<uint64_t> baseline_due_ms = set_timers(client, 0, baseline_intervals_s);
+    std::vector<uint64_t> resync_due_ms = set_timers(client, num_probes, resync_intervals_s);
+    std::vector<uint64_t> main_due_ms = set_timers(client, 2 * num_probes, main_intervals_s);
+
+    Benchmark::LatencyRecorder baseline_latency;
+    pop_probes(receiver, 0, baseline_due_ms, baseline_latency);
+
+    // Change the cluster, and tell the nodes to pick up the change and move
+    // their timers. Chronos handles each signal in the background, so give it
+    // a moment to reload its config before resynchronising.
+    if (scale_up)
+    {
+      std::shared_ptr<ChronosInstance> joining = _site->add_chronos_instance();
+      joining->start_instance();
+      ASSERT_TRUE(joining->wait_for_instance());
+    }
+    else
+    {
+      _site->remove_chronos_instance(_site->get_chronos_instances().back());
+    }
+
+    ASSERT_TRUE(_site->reload_chronos_config());
+    sleep(1);
+
+    uint64_t resync_start_us = Benchmark::now_us();
+    ASSERT_TRUE(_site->resync_chronos());
+
+    Benchmark::LatencyRecorder resync_latency;
+    std::thread probes([&]() {
+      pop_probes(receiver, num_probes, resync_due_ms, resync_latency);
+    });
+
+    uint64_t idle_us = wait_for_chronos_idle(300);
+    probes.join();
+    EXPECT_NE(0u, idle_us);
+
+    ASSERT_TRUE(_site->finish_chronos_scaling());
+    _dns_server->set_a_records("chronos.site1", _site->get_chronos_ips());
+
+    pop_timers(receiver, main_due_ms);
+
+    // Give Chronos a moment to send any duplicate pops.
+    sleep(1);
+
+    int timers = 0;
+    int lost_timers = 0;
+
+    for (size_t ii = 0; ii < main_due_ms.size(); ++ii)
+    {
+      if (main_due_ms[ii] != 0)
+      {
+        timers++;
+        lost_timers += (receiver.pop_time_us(2 * num_probes + ii) == 0) ? 1 : 0;
+      }
+    }
+
+    EXPECT_EQ(0, lost_timers);
+    EXPECT_EQ(0, receiver.duplicate_pops());
+    EXPECT_EQ(0, receiver.unexpected_pops());
+
+    Benchmark::report(name + "_chronos_nodes", (uint64_t)_site->get_chronos_instances().size());
+    Benchmark::report(name + "_timers", (uint64_t)timers);
+
+    if (idle_us > resync_start_us)
+    {
+      Benchmark::report(name + "_resync_ms", (double)(idle_us - resync_start_us) / 1000);
+    }
+
+    Benchmark::report(name + "_lost_timers", (uint64_t)lost_timers);
+    Benchmark::report(name + "_duplicate_pops", (uint64_t)receiver.duplicate_pops());
+    baseline_latency.report(name + "_pop_latency_before");
+    resync_latency.report(name + "_pop_latency_during_resync");
+  }
+}
+
+/// Benchmark fixture for Chronos replicating timers between two sites. The
+/// site 1 nodes reach site 2 through a proxy, which emulates the WAN between
+/// the sites.
+class ChronosGeoRedundancyBenchmark : public BaseChronosTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    BaseChronosTest::SetUpTestCase();
+
+    _deployment_topology = Deployment::build_topology(2);
+    _deployment = std::shared_ptr<Deployment>(new Deployment(2, "tmp", 0, 0, 3));
+    _deployment->start();
+    _site = _deployment->site(1);
+
+    _wan = std::shared_ptr<TcpProxy>(
+      new TcpProxy(WAN_PROXY_IP, 7253, _deployment->site(2)->get_chronos_ips(), 7253));
+    _wan->start();
+
+    // Site 2's domain name resolves to the proxy, so replication from site 1
+    // goes through it. Replication from site 2 back to site 1 goes direct.
+    std::map<std::string, std::vector<std::string>> a_records = _deployment->a_records();
+    a_records["chronos.site2"] = {WAN_PROXY_IP};
+    _dns_server = std::shared_ptr<DnsResponder>(
+      new DnsResponder("127.0.0.1", 5353, a_records));
+    _dns_server->start_instance();
+  }
+
+  static void TearDownTestCase()
+  {
+    _wan.reset();
+    _site.reset();
+    _deployment.reset();
+    BaseChronosTest::TearDownTestCase();
+  }
+
+  virtual void SetUp()
+  {
+    EXPECT_TRUE(_deployment->wait_for_instances());
+  }
+
+  /// The address of the proxy between the sites.
+  static const std::string WAN_PROXY_IP;
+
+  static std::shared_ptr<Deployment> _deployment;
+  static std::shared_ptr<TcpProxy> _wan;
+};
+
+const std::string ChronosGeoRedundancyBenchmark::WAN_PROXY_IP = "127.0.2.100";
+std::shared_ptr<Deployment> ChronosGeoRedundancyBenchmark::_deployment;
+std::shared_ptr<TcpProxy> ChronosGeoRedundancyBenchmark::_wan;
+
+/// Set timers in site 1, and measure how long they take to reach site 2.
+/// Then set a stream of timers, kill site 1's Chronos cluster halfway
+/// through, and check site 2 pops the timers site 1 accepted. This is
+/// repeated with increasing round trip times between the sites. Reports:
+/// -  The replication lag - from a timer being set in site 1 until the
+///    replication request reaches site 2.
+/// -  How late site 2 pops the timers, compared to when they were due.
+/// -  How many accepted timers are lost, and how long before the failure the
+///    earliest of them was set. This is the window in which accepted timers
+///    aren't yet safe from the loss of the site.
+///
+/// Set BENCHMARK_TIMERS to change the number of timers set in each failover.
+TEST_F(ChronosGeoRedundancyBenchmark, Replication)
+{
+  const int num_timers = Benchmark::env_int("BENCHMARK_TIMERS", 10000);
+  const int num_probes = 50;
+  const int num_client_threads = 8;
+  const uint32_t interval_s = 10;
+
+  for (int rtt_ms : {0, 20, 100})
+  {
+    std::string name = "wan_rtt_" + std::to_string(rtt_ms) + "ms";
+    SCOPED_TRACE(name);
+
+    _wan->set_delay_ms(rtt_ms / 2);
+    TimerPopReceiver receiver(CALLBACK_IP, num_probes + num_timers, 4);
+    ChronosClient client("chronos.site1", CALLBACK_IP);
+
+    // Measure the replication lag by setting timers one at a time, and
+    // watching for site 1 sending each on to site 2. These timers are long
+    // enough that they don't pop during the test.
+    Benchmark::LatencyRecorder lag;
+
+    for (int ii = 0; ii < num_probes; ++ii)
+    {
+      uint64_t writes_before = _wan->upstream_writes();
+      uint64_t set_us = Benchmark::now_us();
+      std::string timer_id;
+      HTTPCode rc = client.connection->send_post(timer_id,
+                                                 3600,
+                                                 3600,
+                                                 "/timers",
+                                                 std::to_string(ii),
+                                                 FAKE_TRAIL_ID,
+                                                 std::map<std::string, uint32_t>());
+      EXPECT_EQ(HTTP_OK, rc);
+
+      while ((_wan->upstream_writes() == writes_before) &&
+             (Benchmark::now_us() - set_us < 5000000))
+      {
+        usleep(100);
+      }
+
+      if (_wan->upstream_writes() != writes_before)
+      {
+        lag.record(_wan->last_upstream_write_us() - set_us);
+      }
+
+      // Leave the link idle before the next timer.
+      usleep(20000);
+    }
+
+    // Set a stream of timers, and kill site 1's cluster halfway through.
+    std::vector<uint64_t> set_times_us(num_timers, 0);
+    std::vector<uint64_t> due_times_us(num_timers, 0);
+    std::atomic<int> next_timer(0);
+
+    auto set_timers = [&]() {
+      int ii;
+
+      while ((ii = next_timer++) < num_timers)
+      {
+        std::string timer_id;
+        uint64_t now_us = Benchmark::now_us();
+        HTTPCode rc = client.connection->send_post(timer_id,
+                                                   interval_s,
+                                                   interval_s,
+                                                   "/timers",
+                                                   std::to_string(num_probes + ii),
+                                                   FAKE_TRAIL_ID,
+                                                   std::map<std::string, uint32_t>());
+
+        if (rc == HTTP_OK)
+        {
+          set_times_us[ii] = now_us;
+          due_times_us[ii] = now_us + (uint64_t)interval_s * 1000000;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (int ii = 0; ii < num_client_threads; ++ii)
+    {
+      threads.emplace_back(set_timers);
+    }
+
+    while (next_timer < num_timers / 2)
+    {
+      usleep(1000);
+    }
+
+    uint64_t failure_us = Benchmark::now_us();
+
+    for (const std::shared_ptr<ChronosInstance>& instance : _site->get_chronos_instances())
+    {
+      instance->kill_instance();
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    int accepted = std::count_if(due_times_us.begin(),
+                                 due_times_us.end(),
+                                 [](uint64_t t) { return t != 0; });
+    receiver.wait_for_pops(accepted, (interval_s + 60) * 1000);
+
+    // Give Chronos a moment to send any duplicate pops.
+    sleep(1);
+
+    Benchmark::LatencyRecorder lateness;
+    int lost_timers = 0;
+    uint64_t earliest_lost_us = failure_us;
+
+    for (int ii = 0; ii < num_timers; ++ii)
+    {
+      if (due_times_us[ii] == 0)
+      {
+        continue;
+      }
+
+      uint64_t pop_us = receiver.pop_time_us(num_probes + ii);
+
+      if (pop_us == 0)
+      {
+        lost_timers++;
+        earliest_lost_us = std::min(earliest_lost_us, set_times_us[ii]);
+      }
+      else
+      {
+        lateness.record((pop_us > due_times_us[ii]) ? pop_us - due_times_us[ii] : 0);
+      }
+    }
+
+    EXPECT_EQ(0, receiver.unexpected_pops());
+
+    lag.report(name + "_replication_lag");
+    Benchmark::report(name + "_timers_accepted", (uint64_t)accepted);
+    Benchmark::report(name + "_timers_lost", (uint64_t)lost_timers);
+    Benchmark::report(name + "_unreplicated_window_ms",
+                      (double)(failure_us - earliest_lost_us) / 1000);
+    lateness.report(name + "_site2_pop_lateness");
+    Benchmark::report(name + "_duplicate_pops", (uint64_t)receiver.duplicate_pops());
+
+    // Bring site 1 back for the next run.
+    for (const std::shared_ptr<ChronosInstance>& instance : _site->get_chronos_instances())
+    {
+      instance->start_instance();
+    }
+
+    EXPECT_TRUE(_deployment->wait_for_instances());
+  }
+}
+
+/// Benchmarks the path S4 uses to update timers - ChronosConnection, on
+/// HttpConnection, on HttpClient - through a proxy in front of the Chronos
+/// cluster. The proxy counts the TCP connections the client opens, so the
+/// benchmark can see how well they are reused.
+class ChronosConnectionBenchmark : public BaseChronosTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    BaseChronosTest::SetUpTestCase();
+    create_and_start_site();
+
+    _proxy = std::shared_ptr<TcpProxy>(
+      new TcpProxy(PROXY_IP, 7253, _site->get_chronos_ips(), 7253));
+    _proxy->start();
+    _dns_server->set_a_records(PROXY_DOMAIN, {PROXY_IP});
+  }
+
+  static void TearDownTestCase()
+  {
+    _proxy.reset();
+    BaseChronosTest::TearDownTestCase();
+  }
+
+  /// Set and delete a long timer, as S4 does when a binding is added and
+  /// removed, timing each request.
+  ///
+  /// @return Whether both requests succeeded.
+  static bool set_and_delete_timer(ChronosClient& client,
+                                   int index,
+                                   Benchmark::LatencyRecorder& latency)
+  {
+    std::string timer_id;
+    Benchmark::Stopwatch sw;
+    HTTPCode rc = client.connection->send_post(timer_id,
+                                               3600,
+                                               3600,
+                                               "/timers",
+                                               std::to_string(index),
+                                               FAKE_TRAIL_ID,
+                                               std::map<std::string, uint32_t>());
+    latency.record(sw.elapsed_us());
+
+    if (rc != HTTP_OK)
+    {
+      return false;
+    }
+
+    Benchmark::Stopwatch sw2;
+    rc = client.connection->send_delete(timer_id, FAKE_TRAIL_ID);
+    latency.record(sw2.elapsed_us());
+
+    return (rc == HTTP_OK);
+  }
+
+  /// The domain name that resolves to the proxy, and the proxy's address.
+  static const std::string PROXY_DOMAIN;
+  static const std::string PROXY_IP;
+
+  static std::shared_ptr<TcpProxy> _proxy;
+};
+
+const std::string ChronosConnectionBenchmark::PROXY_DOMAIN = "chronos-proxy.site1";
+const std::string ChronosConnectionBenchmark::PROXY_IP = "127.0.1.200";
+std::shared_ptr<TcpProxy> ChronosConnectionBenchmark::_proxy;
+
+/// Set and delete timers from an increasing number of threads, each starting
+/// at once to emulate a burst of registrations. First the threads share a
+/// single client, as S4 does, so the HTTP connection pool is reused across
+/// bursts. Then each request uses a new client, so every request opens a new
+/// connection. Reports, for each number of threads:
+/// -  The latency of each request.
+/// -  The connection reuse rate - the proportion of requests that didn't
+///    need a new TCP connection.
+/// -  The number of connections opened, and the most open at once.
+/// -  The extra latency of a request that opens a new connection, compared to
+///    one that reuses a pooled connection. This includes the DNS lookup the
+///    new client makes.
+///
+/// Set BENCHMARK_OPS to change the number of timers each thread sets.
+TEST_F(ChronosConnectionBenchmark, Pooling)
+{
+  const int num_timers = Benchmark::env_int("BENCHMARK_OPS", 200);
+  ChronosClient shared_client(PROXY_DOMAIN, CALLBACK_IP);
+
+  for (int num_threads : {1, 2, 4, 8, 16, 32})
+  {
+    double pooled_mean_us = 0;
+
+    for (bool pooled : {true, false})
+    {
+      std::string name = (pooled ? "pooled_" : "unpooled_") +
+                         std::to_string(num_threads) + "_threads";
+      SCOPED_TRACE(name);
+
+      // Unpooled runs open a connection per timer, so keep them shorter.
+      int timers_per_thread = pooled ? num_timers : std::max(num_timers / 10, 1);
+      Benchmark::LatencyRecorder latency;
+      std::atomic<int> failures(0);
+      std::atomic<int> max_open_connections(0);
+      std::atomic<bool> running(true);
+      uint64_t connections_before = _proxy->connections();
+
+      // Sample the open connections while the burst runs.
+      std::thread sampler([&]() {
+        while (running)
+        {
+          int open = _proxy->open_connections();
+          int max = max_open_connections;
+
+          while ((open > max) &&
+                 !max_open_connections.compare_exchange_weak(max, open))
+          {
+          }
+
+          usleep(1000);
+        }
+      });
+
+      Benchmark::Stopwatch sw;
+      std::vector<std::thread> threads;
+
+      for (int tt = 0; tt < num_threads; ++tt)
+      {
+        threads.emplace_back([&, tt]() {
+          for (int ii = 0; ii < timers_per_thread; ++ii)
+          {
+            int index = tt * timers_per_thread + ii;
+            bool ok;
+
+            if (pooled)
+            {
+              ok = set_and_delete_timer(shared_client, index, latency);
+            }
+            else
+            {
+              ChronosClient client(PROXY_DOMAIN, CALLBACK_IP);
+              ok = set_and_delete_timer(client, index, latency);
+            }
+
+            if (!ok)
+            {
+              failures++;
+            }
+          }
+        });
+      }
+
+      for (std::thread& thread : threads)
+      {
+        thread.join();
+      }
+
+      uint64_t elapsed_us = sw.elapsed_us();
+      running = false;
+      sampler.join();
+
+      EXPECT_EQ(0, failures);
+
+      uint64_t requests = latency.count();
+      uint64_t new_connections = _proxy->connections() - connections_before;
+
+      latency.report(name + "_request_latency");
+      Benchmark::report(name + "_requests_per_sec",
+                        (double)requests * 1000000 / elapsed_us);
+      Benchmark::report(name + "_new_connections", new_connections);
+      Benchmark::report(name + "_reuse_rate",
+                        1.0 - (double)std::min(new_connections, requests) / requests);
+      Benchmark::report(name + "_max_open_connections",
+                        (uint64_t)max_open_connections);
+
+      if (pooled)
+      {
+        pooled_mean_us = latency.mean();
+      }
+      else
+      {
+        // Each unpooled timer opens one connection for its two requests.
+        Benchmark::report(name + "_new_connection_cost_us",
+                          2 * (latency.mean() - pooled_mean_us));
+      }
+    }
+  }
+}
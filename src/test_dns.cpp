@@ -10,7 +10,18 @@
 #include "gtest/gtest.h"
 #include "gmock/gmock.h"
 #include "dnscachedresolver.h"
+#include "dnsrrecords.h"
+#include "readmostlydnscachedresolver.h"
+#include "astaire_resolver.h"
+#include "httpresolver.h"
 #include "processinstance.h"
+#include "dnsresponder.h"
+#include "benchmark.h"
+
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include <arpa/inet.h>
 
 class DNSTest : public ::testing::Test
 {
@@ -33,3 +44,687 @@ TEST_F(DNSTest, BasicQuery)
   delete r;
 }
 
+TEST_F(DNSTest, NegativeAnswerCached)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}}, {}, 300);
+  server.start_instance();
+  ReadMostlyDnsCachedResolver* r =
+    new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                    DnsCachedResolver::DEFAULT_TIMEOUT,
+                                    DnsCachedResolver::NO_DNS_FILE,
+                                    5353);
+
+  // The first queries get an NXDOMAIN (for an unknown name) and an empty
+  // answer (for a known name with no records of the type), each with an SOA
+  // record. Repeating them should be answered from the cache, without any
+  // more queries to the server.
+  DnsResult answer = r->dns_query("bad.test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+  answer = r->dns_query("test.query", ns_t_aaaa, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+  int nxdomain_queries = server.query_count("bad.test.query");
+  int nodata_queries = server.query_count("test.query", "AAAA");
+
+  for (int ii = 0; ii < 10; ++ii)
+  {
+    answer = r->dns_query("bad.test.query", ns_t_a, 0);
+    EXPECT_EQ(answer.records().size(), 0);
+    EXPECT_GT(answer.ttl(), 0);
+    EXPECT_LE(answer.ttl(), 300);
+    answer = r->dns_query("test.query", ns_t_aaaa, 0);
+    EXPECT_EQ(answer.records().size(), 0);
+  }
+
+  EXPECT_EQ(nxdomain_queries, server.query_count("bad.test.query"));
+  EXPECT_EQ(nodata_queries, server.query_count("test.query", "AAAA"));
+  EXPECT_EQ(20u, r->negative_hits());
+  delete r;
+}
+
+TEST_F(DNSTest, NegativeAnswerExpiry)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}}, {}, 300);
+  server.set_negative_ttl(2);
+  server.start_instance();
+  ReadMostlyDnsCachedResolver* r =
+    new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                    DnsCachedResolver::DEFAULT_TIMEOUT,
+                                    DnsCachedResolver::NO_DNS_FILE,
+                                    5353);
+
+  // The negative answer is cached for the SOA's TTL. Once that has passed,
+  // the next query goes back to the server - and finds the name if it has
+  // been added in the meantime.
+  DnsResult answer = r->dns_query("new.test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+  answer = r->dns_query("new.test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+  EXPECT_EQ(1u, r->negative_hits());
+
+  server.set_a_records("new.test.query", {"5.6.7.8"});
+  sleep(3);
+  answer = r->dns_query("new.test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 1);
+  delete r;
+}
+
+TEST_F(DNSTest, ReadMostlyQuery)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4", "5.6.7.8"}}}, {}, 300);
+  server.start_instance();
+  DnsCachedResolver* r = new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                                         DnsCachedResolver::DEFAULT_TIMEOUT,
+                                                         DnsCachedResolver::NO_DNS_FILE,
+                                                         5353);
+
+  // The second query is answered from the cache, with the same records.
+  DnsResult answer = r->dns_query("test.query", ns_t_a, 0);
+  ASSERT_EQ(answer.records().size(), 2);
+  answer = r->dns_query("test.query", ns_t_a, 0);
+  ASSERT_EQ(answer.records().size(), 2);
+  EXPECT_LE(answer.ttl(), 300);
+  EXPECT_EQ(1, server.query_count("test.query"));
+  delete r;
+}
+
+TEST_F(DNSTest, ReadMostlyExpiry)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}}, {}, 1);
+  server.start_instance();
+  DnsCachedResolver* r = new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                                         DnsCachedResolver::DEFAULT_TIMEOUT,
+                                                         DnsCachedResolver::NO_DNS_FILE,
+                                                         5353);
+
+  // Once the record's TTL has passed, the next query goes back to the server.
+  DnsResult answer = r->dns_query("test.query", ns_t_a, 0);
+  ASSERT_EQ(answer.records().size(), 1);
+  sleep(2);
+  answer = r->dns_query("test.query", ns_t_a, 0);
+  ASSERT_EQ(answer.records().size(), 1);
+  EXPECT_EQ(2, server.query_count("test.query"));
+  delete r;
+}
+
+TEST_F(DNSTest, ReadMostlyAddToCacheAndClear)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4", "5.6.7.8"}}}, {}, 300);
+  server.start_instance();
+  ReadMostlyDnsCachedResolver* r =
+    new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                    DnsCachedResolver::DEFAULT_TIMEOUT,
+                                    DnsCachedResolver::NO_DNS_FILE,
+                                    5353);
+
+  DnsResult answer = r->dns_query("test.query", ns_t_a, 0);
+  ASSERT_EQ(answer.records().size(), 2);
+
+  // Adding records replaces the copy in the front cache straight away. The
+  // cache takes ownership of the records.
+  struct in_addr addr;
+  inet_pton(AF_INET, "9.10.11.12", &addr);
+  std::vector<DnsRRecord*> records = {new DnsARecord("test.query", 300, addr)};
+  r->add_to_cache("test.query", ns_t_a, records);
+  answer = r->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 1);
+
+  // Clearing the cache sends the next query back to the server.
+  r->clear();
+  answer = r->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 2);
+  EXPECT_EQ(2, server.query_count("test.query"));
+  delete r;
+}
+
+TEST_F(DNSTest, ReadMostlyRefreshAhead)
+{
+  // Use a short TTL so that the record expires several times during the test.
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}}, {}, 2);
+  server.start_instance();
+  ReadMostlyDnsCachedResolver* r =
+    new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                    DnsCachedResolver::DEFAULT_TIMEOUT,
+                                    DnsCachedResolver::NO_DNS_FILE,
+                                    5353,
+                                    1);
+
+  // Query continuously from several threads for a while.
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+  Benchmark::LatencyRecorder latency;
+
+  for (int tt = 0; tt < 4; ++tt)
+  {
+    threads.push_back(std::thread([&]() {
+      Benchmark::Stopwatch test_time;
+
+      while (test_time.elapsed_us() < 7000000)
+      {
+        Benchmark::Stopwatch sw;
+        DnsResult answer = r->dns_query("test.query", ns_t_a, 0);
+        latency.record(sw.elapsed_us());
+
+        if (answer.records().size() != 1)
+        {
+          failures++;
+        }
+
+        usleep(10000);
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  // The threads' first queries are coalesced, so only one query waited for
+  // the server. Every expiry since has been handled by a background refresh.
+  EXPECT_EQ(0, failures.load());
+  EXPECT_EQ(1u, r->misses());
+  EXPECT_GE(r->refreshes(), 2u);
+  EXPECT_GE(server.query_count("test.query"), 3);
+  latency.report("refresh_ahead_query");
+  delete r;
+}
+
+TEST_F(DNSTest, ReadMostlyCoalescesMisses)
+{
+  DnsResponder server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}}, {}, 300);
+  server.set_delay_ms(200);
+  server.start_instance();
+  ReadMostlyDnsCachedResolver* r =
+    new ReadMostlyDnsCachedResolver("127.0.0.201",
+                                    DnsCachedResolver::DEFAULT_TIMEOUT,
+                                    DnsCachedResolver::NO_DNS_FILE,
+                                    5353);
+
+  // Several threads miss on the same record at once. Only one of them should
+  // query the server, and the rest should get its answer.
+  std::atomic<int> failures(0);
+  std::vector<std::thread> threads;
+
+  for (int tt = 0; tt < 8; ++tt)
+  {
+    threads.push_back(std::thread([&]() {
+      if (r->dns_query("test.query", ns_t_a, 0).records().size() != 1)
+      {
+        failures++;
+      }
+    }));
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(0, failures.load());
+  EXPECT_EQ(1u, r->misses());
+  EXPECT_EQ(1, server.query_count("test.query"));
+  delete r;
+}
+
+TEST_F(DNSTest, LiveARecordUpdates)
+{
+  DnsmasqInstance server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}});
+  server.start_instance();
+  server.wait_for_instance();
+  DnsCachedResolver* r = new DnsCachedResolver("127.0.0.201",
+                                               DnsCachedResolver::DEFAULT_TIMEOUT,
+                                               DnsCachedResolver::NO_DNS_FILE,
+                                               5353);
+
+  // Records can be added and removed while dnsmasq is running. The records
+  // have a TTL of 0, so the resolver doesn't cache them. Give dnsmasq a moment
+  // to handle the SIGHUP after each change.
+  ASSERT_TRUE(server.add_a_record("test.query", "5.6.7.8"));
+  usleep(100000);
+  EXPECT_EQ(r->dns_query("test.query", ns_t_a, 0).records().size(), 2);
+
+  ASSERT_TRUE(server.remove_a_record("test.query", "1.2.3.4"));
+  ASSERT_TRUE(server.set_a_records("other.query", {"9.10.11.12"}));
+  usleep(100000);
+  EXPECT_EQ(r->dns_query("test.query", ns_t_a, 0).records().size(), 1);
+  EXPECT_EQ(r->dns_query("other.query", ns_t_a, 0).records().size(), 1);
+
+  ASSERT_TRUE(server.set_a_records("test.query", {}));
+  usleep(100000);
+  EXPECT_EQ(r->dns_query("test.query", ns_t_a, 0).records().size(), 0);
+  delete r;
+}
+
+TEST_F(DNSTest, LiveSrvRecordUpdates)
+{
+  DnsmasqInstance server("127.0.0.201", 5353, {{"test.query", {"1.2.3.4"}}});
+  server.start_instance();
+  server.wait_for_instance();
+  DnsCachedResolver* r = new DnsCachedResolver("127.0.0.201",
+                                               DnsCachedResolver::DEFAULT_TIMEOUT,
+                                               DnsCachedResolver::NO_DNS_FILE,
+                                               5353);
+
+  // Changing SRV records restarts dnsmasq.
+  ASSERT_TRUE(server.set_srv_records("_http._tcp.test.query",
+                                     {{"test.query", 7253, 10, 100}}));
+  EXPECT_EQ(r->dns_query("_http._tcp.test.query", ns_t_srv, 0).records().size(), 1);
+  delete r;
+}
+
+/// Poll until the given function returns true, and return how long that took
+/// in milliseconds, or -1 if it didn't happen within the timeout.
+template <class F> static int64_t wait_until(F fn, int timeout_ms)
+{
+  Benchmark::Stopwatch sw;
+
+  while (sw.elapsed_us() < (uint64_t)timeout_ms * 1000)
+  {
+    if (fn())
+    {
+      return sw.elapsed_us() / 1000;
+    }
+
+    usleep(10000);
+  }
+
+  return -1;
+}
+
+/// Returns whether a list of targets is exactly the given IP.
+static bool targets_are(const std::vector<AddrInfo>& targets, const std::string& ip)
+{
+  return ((targets.size() == 1) && (targets[0].address.to_string() == ip));
+}
+
+/// Move a Rogers domain to a new IP, as when steering traffic away from a
+/// site, and measure how long AstaireResolver takes to follow.
+TEST_F(DNSTest, AstaireResolverFollowsRecordChange)
+{
+  const int ttl = 2;
+  DnsmasqInstance server("127.0.0.201", 5353, {{"rogers.test.query", {"127.0.0.10"}}}, {}, ttl);
+  server.start_instance();
+  server.wait_for_instance();
+  DnsCachedResolver* dns_client = new DnsCachedResolver("127.0.0.201",
+                                                        DnsCachedResolver::DEFAULT_TIMEOUT,
+                                                        DnsCachedResolver::NO_DNS_FILE,
+                                                        5353);
+  AstaireResolver* resolver = new AstaireResolver(dns_client, AF_INET);
+
+  ASSERT_TRUE(targets_are(resolver->resolve("rogers.test.query", 2, 0), "127.0.0.10"));
+
+  ASSERT_TRUE(server.set_a_records("rogers.test.query", {"127.0.0.11"}));
+  int64_t follow_ms = wait_until([&]() {
+    return targets_are(resolver->resolve("rogers.test.query", 2, 0), "127.0.0.11");
+  }, 10000);
+
+  // The resolver should follow as soon as the old record's TTL runs out.
+  EXPECT_NE(-1, follow_ms);
+  EXPECT_LE(follow_ms, (ttl + 1) * 1000);
+  Benchmark::report("astaire_resolver_follow_ms", (uint64_t)follow_ms);
+
+  delete resolver;
+  delete dns_client;
+}
+
+/// Move a Chronos domain to a new IP, and measure how long HttpResolver takes
+/// to follow.
+TEST_F(DNSTest, HttpResolverFollowsRecordChange)
+{
+  const int ttl = 2;
+  DnsmasqInstance server("127.0.0.201", 5353, {{"chronos.test.query", {"127.0.0.10"}}}, {}, ttl);
+  server.start_instance();
+  server.wait_for_instance();
+  DnsCachedResolver* dns_client = new DnsCachedResolver("127.0.0.201",
+                                                        DnsCachedResolver::DEFAULT_TIMEOUT,
+                                                        DnsCachedResolver::NO_DNS_FILE,
+                                                        5353);
+  HttpResolver* resolver = new HttpResolver(dns_client,
+                                            AF_INET,
+                                            HttpResolver::DEFAULT_BLACKLIST_DURATION);
+
+  ASSERT_TRUE(targets_are(resolver->resolve("chronos.test.query", 7253, 2, 0), "127.0.0.10"));
+
+  ASSERT_TRUE(server.set_a_records("chronos.test.query", {"127.0.0.11"}));
+  int64_t follow_ms = wait_until([&]() {
+    return targets_are(resolver->resolve("chronos.test.query", 7253, 2, 0), "127.0.0.11");
+  }, 10000);
+
+  EXPECT_NE(-1, follow_ms);
+  EXPECT_LE(follow_ms, (ttl + 1) * 1000);
+  Benchmark::report("http_resolver_follow_ms", (uint64_t)follow_ms);
+
+  delete resolver;
+  delete dns_client;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// DnsResponderTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Fixture for testing resolvers against the in-process DNS responder.
+class DnsResponderTest : public ::testing::Test
+{
+public:
+  DnsResponderTest() :
+    _server("127.0.0.203",
+            5353,
+            {{"test.query", {"1.2.3.4", "5.6.7.8"}}},
+            {{"_http._tcp.test.query", {{"test.query", 7253, 10, 100}}}})
+  {
+  }
+
+  virtual void SetUp()
+  {
+    ASSERT_TRUE(_server.start_instance());
+    _resolver = new DnsCachedResolver("127.0.0.203",
+                                      DnsCachedResolver::DEFAULT_TIMEOUT,
+                                      DnsCachedResolver::NO_DNS_FILE,
+                                      5353);
+  }
+
+  virtual void TearDown()
+  {
+    delete _resolver; _resolver = NULL;
+    _server.kill_instance();
+  }
+
+  DnsResponder _server;
+  DnsCachedResolver* _resolver;
+};
+
+TEST_F(DnsResponderTest, Query)
+{
+  DnsResult answer = _resolver->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 2);
+  answer = _resolver->dns_query("_http._tcp.test.query", ns_t_srv, 0);
+  EXPECT_EQ(answer.records().size(), 1);
+  answer = _resolver->dns_query("unknown.test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+}
+
+TEST_F(DnsResponderTest, Servfail)
+{
+  _server.inject_fault(DnsResponder::SERVFAIL, 1);
+  DnsResult answer = _resolver->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+}
+
+TEST_F(DnsResponderTest, TruncatedAnswerRetriedOverTcp)
+{
+  // The truncated UDP answer makes the resolver ask again over TCP, which
+  // gets the full answer.
+  _server.inject_fault(DnsResponder::TRUNCATE, 1);
+  DnsResult answer = _resolver->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 2);
+  EXPECT_EQ(2, _server.query_count("test.query"));
+}
+
+TEST_F(DnsResponderTest, DroppedQueryTimesOut)
+{
+  _server.inject_fault(DnsResponder::DROP);
+  Benchmark::Stopwatch sw;
+  DnsResult answer = _resolver->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 0);
+  EXPECT_GE(sw.elapsed_us(), (uint64_t)DnsCachedResolver::DEFAULT_TIMEOUT * 1000);
+}
+
+TEST_F(DnsResponderTest, DelayedAnswer)
+{
+  _server.set_delay_ms(50);
+  Benchmark::Stopwatch sw;
+  DnsResult answer = _resolver->dns_query("test.query", ns_t_a, 0);
+  EXPECT_EQ(answer.records().size(), 2);
+  EXPECT_GE(sw.elapsed_us(), 50000u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// DNS benchmarks start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Benchmark fixture for DnsCachedResolver. Starts a dnsmasq with a few
+/// hundred A records, which is shared by all the benchmarks.
+class DNSBenchmark : public ::testing::Test
+{
+public:
+  static const int NUM_RECORDS = 500;
+
+  /// The number of names that the hit benchmarks query. In production almost
+  /// all queries are for a handful of names (the Rogers, Chronos and S4
+  /// domains), so these are queried from every thread.
+  static const int NUM_HOT_RECORDS = 8;
+
+  static void SetUpTestCase()
+  {
+    std::map<std::string, std::vector<std::string>> a_records;
+
+    for (int ii = 0; ii < NUM_RECORDS; ++ii)
+    {
+      a_records[record_name(ii)] = {"10.0." + std::to_string(ii / 256) + "." +
+                                    std::to_string(ii % 256)};
+    }
+
+    // Give the records a long TTL so that they stay in the cache for the
+    // whole benchmark.
+    _server = new DnsmasqInstance("127.0.0.202", 5353, a_records, {}, 300);
+    _server->start_instance();
+    _server->wait_for_instance();
+  }
+
+  static void TearDownTestCase()
+  {
+    delete _server; _server = NULL;
+  }
+
+  static std::string record_name(int index)
+  {
+    return "host" + std::to_string(index) + ".bench.query";
+  }
+
+  /// Create a resolver pointing at the shared dnsmasq.
+  ///
+  /// @param [in] read_mostly - Whether to create a ReadMostlyDnsCachedResolver
+  ///                           rather than a plain DnsCachedResolver.
+  DnsCachedResolver* new_resolver(bool read_mostly)
+  {
+    if (read_mostly)
+    {
+      return new ReadMostlyDnsCachedResolver("127.0.0.202",
+                                             DnsCachedResolver::DEFAULT_TIMEOUT,
+                                             DnsCachedResolver::NO_DNS_FILE,
+                                             5353);
+    }
+
+    return new DnsCachedResolver("127.0.0.202",
+                                 DnsCachedResolver::DEFAULT_TIMEOUT,
+                                 DnsCachedResolver::NO_DNS_FILE,
+                                 5353);
+  }
+
+  /// Run the given function on the given number of threads at once, passing
+  /// each its thread index. Reports the wall clock time taken, and the number
+  /// of voluntary context switches per query.
+  template <class F> void run_threads(const std::string& name,
+                                      int num_threads,
+                                      uint64_t total_queries,
+                                      F fn)
+  {
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> switches(0);
+    Benchmark::Stopwatch sw;
+
+    for (int tt = 0; tt < num_threads; ++tt)
+    {
+      threads.push_back(std::thread([&, tt]() {
+        uint64_t switches_before = Benchmark::thread_voluntary_switches();
+        fn(tt);
+        switches += Benchmark::thread_voluntary_switches() - switches_before;
+      }));
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    uint64_t elapsed_us = sw.elapsed_us();
+    Benchmark::report(name + "_queries_per_sec",
+                      (double)total_queries * 1000000 / elapsed_us);
+    Benchmark::report(name + "_switches_per_1000_queries",
+                      (double)switches * 1000 / total_queries);
+  }
+
+  static DnsmasqInstance* _server;
+};
+
+DnsmasqInstance* DNSBenchmark::_server = NULL;
+
+static const int BENCHMARK_THREAD_COUNTS[] = {1, 2, 4, 8, 16, 32, 64};
+
+/// Query every record from an empty cache, with the records split between the
+/// threads. Every query is a miss and goes to the DNS server. This is run with
+/// both the plain and read-mostly resolvers.
+TEST_F(DNSBenchmark, Misses)
+{
+  for (bool read_mostly : {false, true})
+  {
+    for (int num_threads : BENCHMARK_THREAD_COUNTS)
+    {
+      std::string name = std::string(read_mostly ? "read_mostly_" : "") +
+                         "dns_miss_threads_" + std::to_string(num_threads);
+      SCOPED_TRACE(name);
+
+      DnsCachedResolver* resolver = new_resolver(read_mostly);
+      Benchmark::LatencyRecorder latency;
+      std::atomic<int> failures(0);
+
+      run_threads(name, num_threads, NUM_RECORDS, [&](int thread_index) {
+        for (int ii = thread_index; ii < NUM_RECORDS; ii += num_threads)
+        {
+          Benchmark::Stopwatch sw;
+          DnsResult answer = resolver->dns_query(record_name(ii), ns_t_a, 0);
+          latency.record(sw.elapsed_us());
+
+          if (answer.records().size() != 1)
+          {
+            failures++;
+          }
+        }
+      });
+
+      EXPECT_EQ(0, failures.load());
+      latency.report(name);
+      delete resolver;
+    }
+  }
+}
+
+/// Repeatedly query a handful of records that are already in the cache, from
+/// every thread at once. This is the pattern seen in production. This is run
+/// with both the plain and read-mostly resolvers, to compare their throughput
+/// at high thread counts.
+///
+/// Set BENCHMARK_OPS to change the number of queries made by each thread.
+TEST_F(DNSBenchmark, Hits)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 10000);
+
+  for (bool read_mostly : {false, true})
+  {
+    for (int num_threads : BENCHMARK_THREAD_COUNTS)
+    {
+      std::string name = std::string(read_mostly ? "read_mostly_" : "") +
+                         "dns_hit_threads_" + std::to_string(num_threads);
+      SCOPED_TRACE(name);
+
+      // Warm the cache.
+      DnsCachedResolver* resolver = new_resolver(read_mostly);
+      std::vector<std::string> names;
+
+      for (int ii = 0; ii < NUM_HOT_RECORDS; ++ii)
+      {
+        names.push_back(record_name(ii));
+        resolver->dns_query(names.back(), ns_t_a, 0);
+      }
+
+      Benchmark::LatencyRecorder latency;
+      std::atomic<int> failures(0);
+
+      run_threads(name,
+                  num_threads,
+                  (uint64_t)num_threads * num_ops,
+                  [&](int thread_index) {
+        // Record into a per-thread recorder, so that recording doesn't add
+        // contention of its own.
+        Benchmark::LatencyRecorder thread_latency;
+
+        for (int ii = 0; ii < num_ops; ++ii)
+        {
+          Benchmark::Stopwatch sw;
+          DnsResult answer =
+            resolver->dns_query(names[(thread_index + ii) % NUM_HOT_RECORDS],
+                                ns_t_a,
+                                0);
+          thread_latency.record(sw.elapsed_us());
+
+          if (answer.records().size() != 1)
+          {
+            failures++;
+          }
+        }
+
+        latency.merge(thread_latency);
+      });
+
+      EXPECT_EQ(0, failures.load());
+      latency.report(name);
+      delete resolver;
+    }
+  }
+}
+
+/// Benchmark fixture for measuring how resolvers handle slow and failing DNS
+/// servers.
+class DnsFaultBenchmark : public DnsResponderTest {};
+
+/// Measure the latency of uncached queries when the DNS server is healthy,
+/// slow, returns errors, truncates its answers or doesn't answer at all.
+TEST_F(DnsFaultBenchmark, QueryLatency)
+{
+  const int num_queries = 20;
+
+  struct Scenario
+  {
+    std::string name;
+    DnsResponder::Fault fault;
+    int delay_ms;
+  };
+
+  std::vector<Scenario> scenarios = {{"healthy", DnsResponder::NONE, 0},
+                                     {"delay_50ms", DnsResponder::NONE, 50},
+                                     {"servfail", DnsResponder::SERVFAIL, 0},
+                                     {"truncate", DnsResponder::TRUNCATE, 0},
+                                     {"drop", DnsResponder::DROP, 0}};
+
+  for (const Scenario& scenario : scenarios)
+  {
+    SCOPED_TRACE(scenario.name);
+    _server.inject_fault(scenario.fault);
+    _server.set_delay_ms(scenario.delay_ms);
+    Benchmark::LatencyRecorder latency;
+
+    for (int ii = 0; ii < num_queries; ++ii)
+    {
+      // The records have a TTL of 0, so every query goes to the server.
+      Benchmark::Stopwatch sw;
+      _resolver->dns_query("test.query", ns_t_a, 0);
+      latency.record(sw.elapsed_us());
+    }
+
+    latency.report("dns_" + scenario.name);
+  }
+}
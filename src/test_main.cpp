@@ -45,7 +45,9 @@
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "log.h"
 #include "fakelogger.h"
+#include "asynclogger.h"
 
 // Calculate our current directory so we can load config files from it.
 static const std::string UT_FILE(__FILE__);
@@ -74,5 +76,29 @@ int main(int argc, char** argv)
   std::srand(seed);
 
   testing::InitGoogleMock(&argc, argv);
-  return RUN_ALL_TESTS();
+
+  // If requested, hand log lines off to a background thread rather than
+  // printing them on the thread that logs them. This stops verbose logging
+  // from dominating the run time of the tests.
+  AsyncLogger* async_logger = NULL;
+  char* async_str = getenv("ASYNC_LOGGING");
+
+  if ((async_str != NULL) && ((*async_str == 'T') || (*async_str == 't')))
+  {
+    async_logger = new AsyncLogger(&LOGGER);
+    Log::setLogger(async_logger);
+  }
+
+  int rc = RUN_ALL_TESTS();
+
+  if (async_logger != NULL)
+  {
+    // Point Log back at the printing logger before deleting the async logger,
+    // so nothing that logs from now on can reach it. The destructor waits for
+    // any lines that were already being written, and passes them on.
+    Log::setLogger(&LOGGER);
+    delete async_logger; async_logger = NULL;
+  }
+
+  return rc;
 }
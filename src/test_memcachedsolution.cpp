@@ -15,11 +15,25 @@
 #include "memcachedstore.h"
 #include "processinstance.h"
 #include "site.h"
+#include "compressingstore.h"
+#include "aorbuilder.h"
+#include "benchmark.h"
+#include "sastracing.h"
+#include "asynclogger.h"
+#include "readmostlydnscachedresolver.h"
+#include "dnsresponder.h"
+#include "deadendserver.h"
+#include "binaryaorserializer.h"
+#include "log.h"
 
 #include <vector>
+#include <algorithm>
+#include <limits>
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <cstring>
+#include <arpa/inet.h>
 #include <thread>
 #include <boost/filesystem.hpp>
 
@@ -56,7 +70,7 @@ public:
   /// cluster_settings file.
   static void TearDownTestCase()
   {
-    _dnsmasq_instance.reset();
+    _dns_server.reset();
     _dbs.reset();
 
     boost::filesystem::remove_all("tmp");
@@ -71,10 +85,7 @@ public:
   /// previous test, and the new test will assume this.
   virtual void SetUp()
   {
-    _dns_client = new DnsCachedResolver("127.0.0.1",
-                                        DnsCachedResolver::DEFAULT_TIMEOUT,
-                                        DnsCachedResolver::NO_DNS_FILE,
-                                        5353);
+    _dns_client = create_dns_client();
     _resolver = new AstaireResolver(_dns_client, AF_INET);
     _store = new TopologyNeutralMemcachedStore("rogers.local", _resolver, true);
 
@@ -93,6 +104,15 @@ public:
     delete _dns_client; _dns_client = NULL;
   }
 
+  /// Create the DNS client that the store's resolver uses.
+  virtual DnsCachedResolver* create_dns_client()
+  {
+    return new DnsCachedResolver("127.0.0.1",
+                                 DnsCachedResolver::DEFAULT_TIMEOUT,
+                                 DnsCachedResolver::NO_DNS_FILE,
+                                 5353);
+  }
+
   /// Helper method for generating a new unique key in the middle of a test.
   void get_new_key()
   {
@@ -113,9 +133,13 @@ public:
 
   static void create_and_start_dns()
   {
-    _dnsmasq_instance = std::shared_ptr<DnsmasqInstance>(
-      new DnsmasqInstance("127.0.0.1", 5353, {{"rogers.local", _dbs->get_rogers_ips()}}));
-    _dnsmasq_instance->start_instance();
+    _dns_server = std::shared_ptr<DnsResponder>(
+      new DnsResponder("127.0.0.1", 5353, {{"rogers.local", _dbs->get_rogers_ips()}}));
+
+    // Let resolvers cache negative answers for the bad domain used by some
+    // tests.
+    _dns_server->set_negative_ttl(300);
+    _dns_server->start_instance();
   }
 
   /// Wait for all existing memcached and Rogers instances to come up by
@@ -128,7 +152,7 @@ public:
       return false;
     }
 
-    if (_dnsmasq_instance && !_dnsmasq_instance->wait_for_instance())
+    if (_dns_server && !_dns_server->wait_for_instance())
     {
       return false;
     }
@@ -184,7 +208,7 @@ public:
 
   /// Use shared pointers for managing the instances so that the memory gets
   /// freed when the vector is cleared.
-  static std::shared_ptr<DnsmasqInstance> _dnsmasq_instance;
+  static std::shared_ptr<DnsResponder> _dns_server;
   static std::shared_ptr<Site> _dbs;
 
   /// Tests that use this fixture use a monotonically incrementing numerical key
@@ -197,7 +221,7 @@ public:
   std::string _key;
 };
 
-std::shared_ptr<DnsmasqInstance> BaseMemcachedSolutionTest::_dnsmasq_instance;
+std::shared_ptr<DnsResponder> BaseMemcachedSolutionTest::_dns_server;
 std::shared_ptr<Site> BaseMemcachedSolutionTest::_dbs;
 
 unsigned int BaseMemcachedSolutionTest::_next_key;
@@ -661,6 +685,791 @@ TEST_F(SimpleMemcachedSolutionTest, DomainAndPort)
   EXPECT_EQ(Store::Status::NOT_FOUND, rc);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+///
+/// ReadMostlyDnsMemcachedSolutionTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Test fixture that resolves Rogers through a ReadMostlyDnsCachedResolver
+/// rather than a plain DnsCachedResolver.
+class ReadMostlyDnsMemcachedSolutionTest : public SimpleMemcachedSolutionTest
+{
+  virtual DnsCachedResolver* create_dns_client()
+  {
+    _read_mostly_dns_client =
+      new ReadMostlyDnsCachedResolver("127.0.0.1",
+                                      DnsCachedResolver::DEFAULT_TIMEOUT,
+                                      DnsCachedResolver::NO_DNS_FILE,
+                                      5353);
+    return _read_mostly_dns_client;
+  }
+
+protected:
+  /// The same object as _dns_client, which owns it.
+  ReadMostlyDnsCachedResolver* _read_mostly_dns_client;
+};
+
+/// Check that once a domain has failed to resolve, further operations on the
+/// store fail straight away from the negative DNS cache rather than querying
+/// DNS again.
+TEST_F(ReadMostlyDnsMemcachedSolutionTest, BadDomainNameFailsFast)
+{
+  delete _store; _store = NULL;
+  _store = new TopologyNeutralMemcachedStore("bad.domain.name", _resolver, true);
+
+  const int num_ops = 100;
+  std::string data_in = "ReadMostlyDnsMemcachedSolutionTest.BadDomainNameFailsFast";
+  Benchmark::LatencyRecorder first_latency;
+  Benchmark::LatencyRecorder cached_latency;
+
+  // The first operation finds that the domain doesn't exist, and the resolver
+  // caches that.
+  Benchmark::Stopwatch first_sw;
+  EXPECT_EQ(Store::Status::ERROR, this->set_data(data_in, 0));
+  first_latency.record(first_sw.elapsed_us());
+  int queries_after_first = _dns_server->query_count("bad.domain.name");
+  EXPECT_GE(queries_after_first, 1);
+  uint64_t negative_hits_before = _read_mostly_dns_client->negative_hits();
+
+  for (int ii = 1; ii < num_ops; ++ii)
+  {
+    Benchmark::Stopwatch sw;
+    Store::Status rc = this->set_data(data_in, 0);
+    cached_latency.record(sw.elapsed_us());
+    EXPECT_EQ(Store::Status::ERROR, rc);
+  }
+
+  // None of the later operations should have reached the DNS server. They
+  // were all failed from the cached negative answer.
+  EXPECT_EQ(queries_after_first, _dns_server->query_count("bad.domain.name"));
+  EXPECT_GE(_read_mostly_dns_client->negative_hits() - negative_hits_before,
+            (uint64_t)(num_ops - 1));
+
+  first_latency.report("bad_domain_first_op");
+  cached_latency.report("bad_domain_cached_op");
+
+  // Failing from the cache involves no network round trip, so should be
+  // very quick.
+  EXPECT_LT(cached_latency.percentile(99), 10000u);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// CompressingMemcachedSolutionTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Test fixture that puts a CompressingStore in front of the
+/// TopologyNeutralMemcachedStore. The tests read and write through the
+/// compressing store, and read the raw values through the underlying store to
+/// check what actually got written to memcached.
+class CompressingMemcachedSolutionTest : public SimpleMemcachedSolutionTest
+{
+public:
+  virtual void SetUp()
+  {
+    SimpleMemcachedSolutionTest::SetUp();
+    _compressing_store = new CompressingStore(_store, COMPRESSION_THRESHOLD);
+  }
+
+  virtual void TearDown()
+  {
+    delete _compressing_store; _compressing_store = NULL;
+    SimpleMemcachedSolutionTest::TearDown();
+  }
+
+  static const size_t COMPRESSION_THRESHOLD = 100;
+  CompressingStore* _compressing_store;
+};
+
+/// Write a large value. It should be compressed in memcached, and read back
+/// unchanged.
+TEST_F(CompressingMemcachedSolutionTest, LargeValueIsCompressed)
+{
+  uint64_t cas = 0;
+  Store::Status rc;
+  AoR* aor = build_aor("sip:kermit@muppets.com", 5, 2);
+  std::string data_in = aor_to_json(aor);
+  delete aor; aor = NULL;
+  std::string data_out;
+  std::string raw_data;
+
+  rc = _compressing_store->set_data(_table, _key, data_in, cas, 60, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  rc = this->get_data(raw_data, cas);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(0, raw_data.compare(0, CompressingStore::MARKER.size(), CompressingStore::MARKER));
+  EXPECT_LT(raw_data.size(), data_in.size());
+
+  rc = _compressing_store->get_data(_table, _key, data_out, cas, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(data_in, data_out);
+}
+
+/// Write a value below the threshold. It should be written as is.
+TEST_F(CompressingMemcachedSolutionTest, SmallValueIsNotCompressed)
+{
+  uint64_t cas = 0;
+  Store::Status rc;
+  std::string data_in = "CompressingMemcachedSolutionTest.SmallValueIsNotCompressed";
+  std::string data_out;
+  std::string raw_data;
+
+  rc = _compressing_store->set_data(_table, _key, data_in, cas, 60, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  rc = this->get_data(raw_data, cas);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(data_in, raw_data);
+
+  rc = _compressing_store->get_data(_table, _key, data_out, cas, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(data_in, data_out);
+}
+
+/// Write a large value without compression (as a node without compression
+/// enabled would). It can still be read through the compressing store.
+TEST_F(CompressingMemcachedSolutionTest, ReadUncompressedValue)
+{
+  uint64_t cas = 0;
+  Store::Status rc;
+  AoR* aor = build_aor("sip:kermit@muppets.com", 5, 2);
+  std::string data_in = aor_to_json(aor);
+  delete aor; aor = NULL;
+  std::string data_out;
+
+  rc = this->set_data(data_in, cas);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  rc = _compressing_store->get_data(_table, _key, data_out, cas, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(data_in, data_out);
+}
+
+/// A compressed value whose header claims it is bigger than the limit is
+/// rejected, rather than trusted enough to allocate a buffer that size.
+TEST_F(CompressingMemcachedSolutionTest, OversizedLengthRejected)
+{
+  std::string encoded = _compressing_store->encode(std::string(1000, 'a'));
+  std::string data_out;
+  ASSERT_EQ(0, encoded.compare(0, CompressingStore::MARKER.size(), CompressingStore::MARKER));
+
+  uint32_t len = htonl(CompressingStore::MAX_DECODED_LEN + 1);
+  memcpy(&encoded[CompressingStore::MARKER.size()], &len, sizeof(len));
+  EXPECT_FALSE(_compressing_store->decode(encoded, data_out));
+
+  len = htonl(0xFFFFFFFF);
+  memcpy(&encoded[CompressingStore::MARKER.size()], &len, sizeof(len));
+  EXPECT_FALSE(_compressing_store->decode(encoded, data_out));
+}
+
+/// Check that CAS semantics are unchanged by compression - a write with the
+/// CAS from a read succeeds, and a second write with the same CAS fails.
+TEST_F(CompressingMemcachedSolutionTest, SetDataContention)
+{
+  uint64_t cas = 0;
+  Store::Status rc;
+  std::string data_in(1000, 'a');
+  std::string data_out;
+
+  rc = _compressing_store->set_data(_table, _key, data_in, cas, 60, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  rc = _compressing_store->get_data(_table, _key, data_out, cas, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  data_in = std::string(1000, 'b');
+  rc = _compressing_store->set_data(_table, _key, data_in, cas, 60, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  rc = _compressing_store->set_data(_table, _key, data_in, cas, 60, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::DATA_CONTENTION, rc);
+
+  rc = _compressing_store->get_data(_table, _key, data_out, cas, DUMMY_TRAIL_ID);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_EQ(data_in, data_out);
+}
+
+/// Benchmark fixture for comparing the store path with and without
+/// compression.
+class MemcachedCompressionBenchmark : public SimpleMemcachedSolutionTest
+{
+public:
+  /// Returns the total number of bytes stored across all memcacheds.
+  uint64_t memcached_bytes()
+  {
+    uint64_t bytes = 0;
+
+    for (const std::shared_ptr<MemcachedInstance>& inst : _dbs->get_memcached_instances())
+    {
+      bytes += inst->get_bytes_used();
+    }
+
+    return bytes;
+  }
+};
+
+/// Write and read back AoRs of various sizes, with and without compression,
+/// and report the bytes stored per AoR, the memcached memory used and the
+/// latency of the sets and gets.
+///
+/// Set BENCHMARK_AORS to change the number of AoRs written for each size.
+TEST_F(MemcachedCompressionBenchmark, AoRSizes)
+{
+  const int num_aors = Benchmark::env_int("BENCHMARK_AORS", 1000);
+
+  for (int num_bindings : {1, 4, 10, 50})
+  {
+    AoR* aor = build_aor("sip:kermit@muppets.com", num_bindings, num_bindings / 2);
+    std::string json = aor_to_json(aor);
+    delete aor; aor = NULL;
+
+    for (bool compress : {false, true})
+    {
+      std::string name = std::to_string(num_bindings) + "_bindings_" +
+                         (compress ? "compressed" : "uncompressed");
+      SCOPED_TRACE(name);
+
+      // Disable compression by setting a threshold that no value can reach.
+      CompressingStore store(_store,
+                             compress ? CompressingStore::DEFAULT_THRESHOLD :
+                                        std::numeric_limits<size_t>::max());
+      Benchmark::LatencyRecorder set_latency;
+      Benchmark::LatencyRecorder get_latency;
+      std::vector<std::string> keys;
+      uint64_t memory_before = memcached_bytes();
+
+      for (int ii = 0; ii < num_aors; ++ii)
+      {
+        this->get_new_key();
+        keys.push_back(_key);
+
+        Benchmark::Stopwatch sw;
+        Store::Status rc = store.set_data(_table, _key, json, 0, 300, DUMMY_TRAIL_ID);
+        set_latency.record(sw.elapsed_us());
+        EXPECT_EQ(Store::Status::OK, rc);
+      }
+
+      for (const std::string& key : keys)
+      {
+        std::string data;
+        uint64_t cas;
+
+        Benchmark::Stopwatch sw;
+        Store::Status rc = store.get_data(_table, key, data, cas, DUMMY_TRAIL_ID);
+        get_latency.record(sw.elapsed_us());
+        EXPECT_EQ(Store::Status::OK, rc);
+        EXPECT_EQ(json.size(), data.size());
+      }
+
+      // Replication to the backup memcached is asynchronous, so give it a
+      // moment to finish before looking at memory usage.
+      usleep(100000);
+      uint64_t memory_after = memcached_bytes();
+
+      Benchmark::report(name + "_json_bytes", (uint64_t)json.size());
+      Benchmark::report(name + "_stored_bytes_per_aor",
+                        (double)store.bytes_stored / num_aors);
+      Benchmark::report(name + "_memcached_bytes_per_aor",
+                        (double)(memory_after - memory_before) / num_aors);
+      set_latency.report(name + "_set");
+      get_latency.report(name + "_get");
+
+      for (const std::string& key : keys)
+      {
+        store.delete_data(_table, key, DUMMY_TRAIL_ID);
+      }
+    }
+  }
+}
+
+/// Benchmark fixture for measuring the cost of SAS logging on the store path.
+class MemcachedSasBenchmark : public SimpleMemcachedSolutionTest {};
+
+/// Run sets and gets with SAS disabled and enabled, and with every operation
+/// traced or only a sample of them. Reports the latency, CPU time and
+/// allocations per operation, and the SAS traffic generated.
+///
+/// Set BENCHMARK_OPS to change the number of operations in each run.
+TEST_F(MemcachedSasBenchmark, StorePath)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 10000);
+  const std::string data_in(500, 'x');
+
+  FakeSasServer sas_server("127.0.0.50");
+  ASSERT_TRUE(sas_server.start());
+
+  for (bool sas_enabled : {false, true})
+  {
+    if (sas_enabled)
+    {
+      ASSERT_TRUE(start_sas_logging(sas_server.ip()));
+    }
+
+    for (int sample_rate : {1, 100})
+    {
+      std::string name = std::string(sas_enabled ? "sas_enabled" : "sas_disabled") +
+                         "_sample_1_in_" + std::to_string(sample_rate);
+      SCOPED_TRACE(name);
+
+      TrailSampler sampler(sample_rate);
+      Benchmark::CostRecorder set_cost;
+      Benchmark::CostRecorder get_cost;
+      uint64_t sas_bytes_before = sas_server.bytes_received();
+
+      for (int ii = 0; ii < num_ops; ++ii)
+      {
+        this->get_new_key();
+        SAS::TrailId trail = sampler.next_trail();
+        Store::Status rc;
+
+        set_cost.measure([&]() {
+          rc = _store->set_data(_table, _key, data_in, 0, 300, trail);
+        });
+        EXPECT_EQ(Store::Status::OK, rc);
+
+        std::string data_out;
+        uint64_t cas;
+        get_cost.measure([&]() {
+          rc = _store->get_data(_table, _key, data_out, cas, trail);
+        });
+        EXPECT_EQ(Store::Status::OK, rc);
+      }
+
+      // The SAS client sends events from a background thread, so give it a
+      // moment to catch up before counting.
+      sleep(1);
+
+      set_cost.report(name + "_set");
+      get_cost.report(name + "_get");
+      Benchmark::report(name + "_sas_bytes_per_op",
+                        (double)(sas_server.bytes_received() - sas_bytes_before) /
+                          (2 * num_ops));
+    }
+
+    if (sas_enabled)
+    {
+      stop_sas_logging();
+    }
+  }
+}
+
+/// Benchmark fixture for comparing synchronous and asynchronous logging.
+///
+/// Logs are written to files in a temporary directory, as the tests' own
+/// logger only prints anything when NOISY is set.
+class MemcachedLoggingBenchmark : public SimpleMemcachedSolutionTest
+{
+  virtual void SetUp()
+  {
+    SimpleMemcachedSolutionTest::SetUp();
+
+    char dir_template[] = "/tmp/fvtest_bench_log_XXXXXX";
+    _log_dir = mkdtemp(dir_template);
+    _file_logger = new Logger(_log_dir, "bench_log");
+    _saved_level = Log::loggingLevel;
+  }
+
+  virtual void TearDown()
+  {
+    Log::setLoggingLevel(_saved_level);
+    delete _file_logger; _file_logger = NULL;
+    boost::filesystem::remove_all(_log_dir);
+
+    SimpleMemcachedSolutionTest::TearDown();
+  }
+
+protected:
+  std::string _log_dir;
+  Logger* _file_logger;
+  int _saved_level;
+};
+
+/// At each log level, and with the logs written synchronously or from a
+/// background thread, measure:
+/// - The latency, CPU time and allocations of store sets and gets.
+/// - The rate at which several threads can write debug logs.
+///
+/// Set BENCHMARK_OPS to change the number of operations in each run.
+TEST_F(MemcachedLoggingBenchmark, LogLevels)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 10000);
+  const int num_threads = 4;
+  const std::string data_in(500, 'x');
+
+  for (bool async : {false, true})
+  {
+    AsyncLogger* async_logger = NULL;
+    Logger* logger = _file_logger;
+
+    if (async)
+    {
+      async_logger = new AsyncLogger(_file_logger);
+      logger = async_logger;
+    }
+
+    Logger* saved_logger = Log::setLogger(logger);
+
+    for (int level = Log::ERROR_LEVEL; level <= Log::DEBUG_LEVEL; ++level)
+    {
+      std::string name = std::string(async ? "async" : "sync") +
+                         "_level_" + std::to_string(level);
+      SCOPED_TRACE(name);
+      Log::setLoggingLevel(level);
+
+      Benchmark::CostRecorder set_cost;
+      Benchmark::CostRecorder get_cost;
+
+      for (int ii = 0; ii < num_ops; ++ii)
+      {
+        this->get_new_key();
+        Store::Status rc;
+
+        set_cost.measure([&]() {
+          rc = _store->set_data(_table, _key, data_in, 0, 300, 0);
+        });
+        EXPECT_EQ(Store::Status::OK, rc);
+
+        std::string data_out;
+        uint64_t cas;
+        get_cost.measure([&]() {
+          rc = _store->get_data(_table, _key, data_out, cas, 0);
+        });
+        EXPECT_EQ(Store::Status::OK, rc);
+      }
+
+      set_cost.report(name + "_set");
+      get_cost.report(name + "_get");
+
+      // Now write logs as fast as possible from several threads. Include the
+      // time taken to flush, so that the asynchronous logger gets no credit
+      // for lines it hasn't written yet.
+      Benchmark::Stopwatch sw;
+      std::vector<std::thread> threads;
+
+      for (int tt = 0; tt < num_threads; ++tt)
+      {
+        threads.push_back(std::thread([num_ops, tt]() {
+          for (int ii = 0; ii < num_ops; ++ii)
+          {
+            TRC_DEBUG("Benchmark log line %d from thread %d", ii, tt);
+          }
+        }));
+      }
+
+      for (std::thread& thread : threads)
+      {
+        thread.join();
+      }
+
+      uint64_t write_us = sw.elapsed_us();
+      logger->flush();
+      uint64_t total_us = sw.elapsed_us();
+
+      Benchmark::report(name + "_log_writer_us", write_us);
+      Benchmark::report(name + "_lines_per_sec",
+                        (double)num_threads * num_ops * 1000000 / total_us);
+    }
+
+    Log::setLogger(saved_logger);
+    delete async_logger; async_logger = NULL;
+  }
+}
+
+/// Benchmark fixture for measuring how AstaireResolver's blacklist handles
+/// failed Rogers instances. There are enough Rogers that the store keeps
+/// working with two of them down.
+class MemcachedBlacklistBenchmark : public BaseMemcachedSolutionTest
+{
+  static void SetUpTestCase()
+  {
+    BaseMemcachedSolutionTest::SetUpTestCase();
+
+    create_and_start_databases(2, 4);
+    create_and_start_dns();
+  }
+};
+
+/// Kill one or more Rogers and keep making requests, with various blacklist
+/// durations. Each dead Rogers is replaced by a DeadEndServer, which counts
+/// each time the store tries to use it. Reports:
+/// -  The number of attempts to use dead Rogers during the first blacklist
+///    period, and in total while they are dead.
+/// -  The latency of requests while Rogers are dead, compared to the latency
+///    beforehand.
+/// -  How long after the Rogers are restarted the store uses them again.
+TEST_F(MemcachedBlacklistBenchmark, RogersFailure)
+{
+  const std::string data_in(500, 'x');
+  const std::vector<std::shared_ptr<RogersInstance>>& rogers = _dbs->get_rogers_instances();
+
+  for (int blacklist_duration : {2, 5})
+  {
+    for (int num_dead : {1, 2})
+    {
+      std::string name = "blacklist_" + std::to_string(blacklist_duration) +
+                         "s_dead_rogers_" + std::to_string(num_dead);
+      SCOPED_TRACE(name);
+
+      // Use a resolver with the blacklist duration under test.
+      delete _store; _store = NULL;
+      delete _resolver; _resolver = NULL;
+      _resolver = new AstaireResolver(_dns_client, AF_INET, blacklist_duration);
+      _store = new TopologyNeutralMemcachedStore("rogers.local", _resolver, true);
+
+      auto timed_request = [&](Benchmark::LatencyRecorder& latency) -> bool {
+        this->get_new_key();
+        Benchmark::Stopwatch sw;
+        Store::Status rc = this->set_data(_key, data_in, 0);
+        latency.record(sw.elapsed_us());
+        return (rc == Store::Status::OK);
+      };
+
+      Benchmark::LatencyRecorder healthy_latency;
+
+      for (int ii = 0; ii < 200; ++ii)
+      {
+        EXPECT_TRUE(timed_request(healthy_latency));
+      }
+
+      // Kill the Rogers, and put dead end servers in their place.
+      std::vector<std::shared_ptr<DeadEndServer>> dead_ends;
+
+      for (int ii = 0; ii < num_dead; ++ii)
+      {
+        EXPECT_TRUE(rogers[ii]->kill_instance());
+        dead_ends.push_back(std::make_shared<DeadEndServer>(rogers[ii]->ip(),
+                                                            rogers[ii]->port()));
+        EXPECT_TRUE(dead_ends.back()->start());
+      }
+
+      // Make requests steadily for a little longer than the blacklist
+      // duration, so we see the dead Rogers being tried again once they come
+      // off the blacklist.
+      uint64_t failure_start_us = Benchmark::now_us();
+      Benchmark::LatencyRecorder failed_latency;
+      int errors = 0;
+
+      while (Benchmark::now_us() - failure_start_us < (blacklist_duration + 2) * 1000000u)
+      {
+        errors += timed_request(failed_latency) ? 0 : 1;
+        usleep(5000);
+      }
+
+      uint64_t first_period_hits = 0;
+      uint64_t total_hits = 0;
+
+      for (std::shared_ptr<DeadEndServer>& dead_end : dead_ends)
+      {
+        total_hits += dead_end->connections();
+        first_period_hits += dead_end->connections() -
+          dead_end->connections_since(failure_start_us + blacklist_duration * 1000000u);
+        dead_end->stop();
+      }
+
+      // Bring the Rogers back, and time how long until the store connects to
+      // all of them again.
+      for (int ii = 0; ii < num_dead; ++ii)
+      {
+        EXPECT_TRUE(rogers[ii]->start_instance());
+        EXPECT_TRUE(rogers[ii]->wait_for_instance());
+      }
+
+      Benchmark::Stopwatch reuse_time;
+      Benchmark::LatencyRecorder recovery_latency;
+      bool reused = false;
+
+      while ((!reused) && (reuse_time.elapsed_us() < (blacklist_duration + 10) * 1000000u))
+      {
+        errors += timed_request(recovery_latency) ? 0 : 1;
+        reused = true;
+
+        for (int ii = 0; ii < num_dead; ++ii)
+        {
+          reused = reused && (rogers[ii]->established_connections() > 0);
+        }
+
+        usleep(5000);
+      }
+
+      EXPECT_TRUE(reused);
+      EXPECT_EQ(0, errors);
+
+      healthy_latency.report(name + "_healthy");
+      failed_latency.report(name + "_failed");
+      Benchmark::report(name + "_added_latency_us",
+                        failed_latency.mean() - healthy_latency.mean());
+      Benchmark::report(name + "_dead_hits_first_blacklist_period", first_period_hits);
+      Benchmark::report(name + "_dead_hits_total", total_hits);
+      Benchmark::report(name + "_reuse_ms", reuse_time.elapsed_us() / 1000);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// BinaryAoRMemcachedSolutionTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Test fixture for writing AoRs to memcached in the binary format.
+class BinaryAoRMemcachedSolutionTest : public SimpleMemcachedSolutionTest
+{
+public:
+  /// Build an AoR that uses every field the serializers write.
+  AoR* build_full_aor(const std::string& aor_id, int num_bindings, int num_subscriptions)
+  {
+    AoR* aor = build_aor(aor_id, num_bindings, num_subscriptions);
+    aor->_timer_id = "0123456789abcdef-1-2";
+    aor->_associated_uris.add_uri(aor_id, false);
+    aor->_associated_uris.add_uri("sip:barred@muppets.com", true);
+    aor->_associated_uris.add_uri("sip:!.*!@muppets.com", false);
+    aor->_associated_uris.add_wildcard_mapping("sip:!.*!@muppets.com",
+                                               "sip:distinct@muppets.com");
+    return aor;
+  }
+
+  BinaryAoRSerializer _serializer;
+};
+
+/// Write AoRs of various sizes in the binary format, and read them back. They
+/// should be smaller than the JSON, and unchanged when read back.
+TEST_F(BinaryAoRMemcachedSolutionTest, RoundTrip)
+{
+  for (int size : {0, 1, 10, 500})
+  {
+    SCOPED_TRACE(size);
+    this->get_new_key();
+
+    AoR* aor = build_full_aor(_key, size, size);
+    std::string json = aor_to_json(aor);
+    std::string data_in = _serializer.serialize_aor(aor);
+    delete aor; aor = NULL;
+    EXPECT_TRUE(BinaryAoRSerializer::is_binary(data_in));
+    EXPECT_LT(data_in.size(), json.size());
+
+    uint64_t cas = 0;
+    Store::Status rc = this->set_data(data_in, cas);
+    EXPECT_EQ(Store::Status::OK, rc);
+
+    std::string data_out;
+    rc = this->get_data(data_out, cas);
+    EXPECT_EQ(Store::Status::OK, rc);
+    EXPECT_EQ(data_in, data_out);
+
+    // Compare the AoRs by converting them to JSON.
+    aor = _serializer.deserialize_aor(_key, data_out);
+    ASSERT_NE((AoR*)NULL, aor);
+    EXPECT_EQ(json, aor_to_json(aor));
+    delete aor; aor = NULL;
+  }
+}
+
+/// Read an AoR written as JSON (as a node without the binary format enabled
+/// would) through the binary serializer.
+TEST_F(BinaryAoRMemcachedSolutionTest, ReadJsonValue)
+{
+  AoR* aor = build_full_aor(_key, 5, 2);
+  std::string json = aor_to_json(aor);
+  delete aor; aor = NULL;
+
+  uint64_t cas = 0;
+  Store::Status rc = this->set_data(json, cas);
+  EXPECT_EQ(Store::Status::OK, rc);
+
+  std::string data_out;
+  rc = this->get_data(data_out, cas);
+  EXPECT_EQ(Store::Status::OK, rc);
+  EXPECT_FALSE(BinaryAoRSerializer::is_binary(data_out));
+
+  aor = _serializer.deserialize_aor(_key, data_out);
+  ASSERT_NE((AoR*)NULL, aor);
+  EXPECT_EQ(json, aor_to_json(aor));
+  delete aor; aor = NULL;
+}
+
+/// Values that are truncated, or that have an unknown version, are rejected
+/// rather than misread.
+TEST_F(BinaryAoRMemcachedSolutionTest, BadValuesRejected)
+{
+  AoR* aor = build_full_aor(_key, 2, 1);
+  std::string data = _serializer.serialize_aor(aor);
+  delete aor; aor = NULL;
+
+  std::string truncated = data.substr(0, data.size() - 1);
+  EXPECT_EQ((AoR*)NULL, _serializer.deserialize_aor(_key, truncated));
+
+  std::string bad_version = data;
+  bad_version[BinaryAoRSerializer::MARKER.size()] = BinaryAoRSerializer::VERSION + 1;
+  EXPECT_EQ((AoR*)NULL, _serializer.deserialize_aor(_key, bad_version));
+}
+
+/// Benchmark fixture for AoR serialization. This doesn't need any databases.
+class AoRSerializationBenchmark : public ::testing::Test {};
+
+/// Serialize and deserialize AoRs with 1 to 500 bindings and subscriptions,
+/// as JSON and in the binary format. Reports the latency, CPU time and
+/// allocations of each, and the size of the output.
+///
+/// Set BENCHMARK_OPS to change the number of operations for AoRs with one
+/// binding. Larger AoRs get proportionally fewer operations.
+TEST_F(AoRSerializationBenchmark, EncodeDecode)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 10000);
+  AstaireAoRStore::JsonSerializerDeserializer json_serializer;
+  BinaryAoRSerializer binary_serializer;
+
+  for (int size : {1, 10, 50, 100, 500})
+  {
+    const std::string impu = "sip:kermit@muppets.com";
+    AoR* aor = build_aor(impu, size, size);
+    std::string json = aor_to_json(aor);
+    int ops = std::max(num_ops / size, 10);
+
+    for (bool binary : {false, true})
+    {
+      std::string name = std::to_string(size) + "_bindings_" +
+                         (binary ? "binary" : "json");
+      SCOPED_TRACE(name);
+
+      Benchmark::CostRecorder encode_cost;
+      Benchmark::CostRecorder decode_cost;
+      std::string data;
+
+      for (int ii = 0; ii < ops; ++ii)
+      {
+        encode_cost.measure([&]() {
+          data = binary ? binary_serializer.serialize_aor(aor) :
+                          json_serializer.serialize_aor(aor);
+        });
+
+        AoR* decoded = NULL;
+        decode_cost.measure([&]() {
+          decoded = binary ? binary_serializer.deserialize_aor(impu, data) :
+                             json_serializer.deserialize_aor(impu, data);
+        });
+
+        ASSERT_NE((AoR*)NULL, decoded);
+        delete decoded; decoded = NULL;
+      }
+
+      // Check that the encoding doesn't lose anything.
+      AoR* decoded = binary_serializer.deserialize_aor(impu, data);
+      ASSERT_NE((AoR*)NULL, decoded);
+      EXPECT_EQ(json, aor_to_json(decoded));
+      delete decoded; decoded = NULL;
+
+      encode_cost.report(name + "_encode");
+      decode_cost.report(name + "_decode");
+      Benchmark::report(name + "_bytes", (uint64_t)data.size());
+    }
+
+    delete aor; aor = NULL;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 ///
 /// MemcachedSolutionFailureTest testcases start here.
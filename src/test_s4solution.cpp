@@ -13,6 +13,7 @@
 
 #include "processinstance.h"
 #include "site.h"
+#include "deployment.h"
 
 #include "httpstack.h"
 #include "httpstack_utils.h"
@@ -21,15 +22,27 @@
 #include "s4.h"
 #include "s4_chronoshandlers.h"
 #include "mock_timer_pop_consumer.h"
+#include "aorbuilder.h"
+#include "benchmark.h"
+#include "sastracing.h"
+#include "dnsresponder.h"
+#include "timingstore.h"
+#include "delayingstore.h"
+#include "parallelremotes4.h"
+#include "controlledclock.h"
 
 #include <vector>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <thread>
 #include <boost/filesystem.hpp>
 #include <stddef.h>
 #include <signal.h>
+#include <atomic>
+#include <curl/curl.h>
 
 SAS::TrailId FAKE_SAS_TRAIL_ID = 0x12345678;
 
@@ -40,6 +53,121 @@ using ::testing::DoAll;
 using ::testing::AtLeast;
 using ::testing::Return;
 
+/// ChronosConnection that records how long each timer operation takes.
+class TimingChronosConnection : public ChronosConnection
+{
+public:
+  TimingChronosConnection(const std::string& callback_host,
+                          HttpConnection* connection) :
+    ChronosConnection(callback_host, connection)
+  {}
+
+  using ChronosConnection::send_put;
+  using ChronosConnection::send_post;
+
+  HTTPCode send_put(std::string& put_identity,
+                    uint32_t timer_interval,
+                    uint32_t repeat_for,
+                    const std::string& callback_uri,
+                    const std::string& opaque_data,
+                    SAS::TrailId trail,
+                    const std::map<std::string, uint32_t>& tags)
+  {
+    Benchmark::Stopwatch sw;
+    HTTPCode rc = ChronosConnection::send_put(put_identity,
+                                              timer_interval,
+                                              repeat_for,
+                                              callback_uri,
+                                              opaque_data,
+                                              trail,
+                                              tags);
+    timer_sets.record(sw.elapsed_us());
+    return rc;
+  }
+
+  HTTPCode send_post(std::string& post_identity,
+                     uint32_t timer_interval,
+                     uint32_t repeat_for,
+                     const std::string& callback_uri,
+                     const std::string& opaque_data,
+                     SAS::TrailId trail,
+                     const std::map<std::string, uint32_t>& tags)
+  {
+    Benchmark::Stopwatch sw;
+    HTTPCode rc = ChronosConnection::send_post(post_identity,
+                                               timer_interval,
+                                               repeat_for,
+                                               callback_uri,
+                                               opaque_data,
+                                               trail,
+                                               tags);
+    timer_sets.record(sw.elapsed_us());
+    return rc;
+  }
+
+  HTTPCode send_delete(const std::string& delete_identity, SAS::TrailId trail)
+  {
+    Benchmark::Stopwatch sw;
+    HTTPCode rc = ChronosConnection::send_delete(delete_identity, trail);
+    timer_deletes.record(sw.elapsed_us());
+    return rc;
+  }
+
+  /// The latencies of setting (creating or updating) and deleting timers.
+  Benchmark::LatencyRecorder timer_sets;
+  Benchmark::LatencyRecorder timer_deletes;
+};
+
+/// HTTP handler that records how long another handler takes to process each
+/// request, and how much memory it allocates. Requests are handled on the HTTP
+/// stack's threads, so the counters are shared between threads.
+class TimingHandler : public HttpStack::HandlerInterface
+{
+public:
+  TimingHandler(HttpStack::HandlerInterface* handler) :
+    allocations(0), allocated_bytes(0), requests(0), _handler(handler)
+  {}
+
+  void process_request(HttpStack::Request& req, SAS::TrailId trail)
+  {
+    uint64_t allocations_before = Benchmark::thread_allocations();
+    uint64_t bytes_before = Benchmark::thread_allocated_bytes();
+    Benchmark::Stopwatch sw;
+
+    _handler->process_request(req, trail);
+
+    uint64_t elapsed_us = sw.elapsed_us();
+    allocations += Benchmark::thread_allocations() - allocations_before;
+    allocated_bytes += Benchmark::thread_allocated_bytes() - bytes_before;
+    ++requests;
+    latency.record(elapsed_us);
+  }
+
+  HttpStack::SasLogger* sas_logger(HttpStack::Request& req)
+  {
+    return _handler->sas_logger(req);
+  }
+
+  /// Discard everything recorded so far.
+  void clear()
+  {
+    latency.clear();
+    allocations = 0;
+    allocated_bytes = 0;
+    requests = 0;
+  }
+
+  /// The latency of each request, and the number of allocations and bytes
+  /// allocated across all the requests.
+  Benchmark::LatencyRecorder latency;
+  std::atomic<uint64_t> allocations;
+  std::atomic<uint64_t> allocated_bytes;
+  std::atomic<uint64_t> requests;
+
+private:
+  HttpStack::HandlerInterface* _handler;
+};
+
 /// Class containing everything needed for an "S4-site".
 ///
 /// As S4 is currently a class rather than a microservice, each client actually
@@ -54,6 +182,57 @@ using ::testing::Return;
 class S4Site
 {
 public:
+  /// Options for how the S4 site is set up.
+  struct Config
+  {
+    int http_threads;
+    bool parallel_replication;
+    ParallelRemoteS4::Wait replication_wait;
+    std::map<std::string, int> wan_delay_ms;
+
+    /// Constructor. By default the HTTP stack has one thread, and S4
+    /// replicates to one remote site after another with no added delay.
+    Config() :
+      http_threads(1),
+      parallel_replication(false),
+      replication_wait(ParallelRemoteS4::Wait::ALL)
+    {}
+
+    /// Set the number of threads the HTTP stack uses to handle timer pops.
+    ///
+    /// @return This config, so that the method can be used with the builder
+    ///         pattern.
+    Config& with_http_threads(int threads)
+    {
+      http_threads = threads;
+      return *this;
+    }
+
+    /// Have S4 replicate to all the remote sites at once.
+    ///
+    /// @param [in] wait - How many remote sites each write waits for.
+    ///
+    /// @return This config, so that the method can be used with the builder
+    ///         pattern.
+    Config& with_parallel_replication(ParallelRemoteS4::Wait wait)
+    {
+      parallel_replication = true;
+      replication_wait = wait;
+      return *this;
+    }
+
+    /// Add a delay to every operation on a remote site's store, to simulate
+    /// the round trip time over the WAN.
+    ///
+    /// @return This config, so that the method can be used with the builder
+    ///         pattern.
+    Config& with_wan_delay(const std::string& remote_site_name, int delay_ms)
+    {
+      wan_delay_ms[remote_site_name] = delay_ms;
+      return *this;
+    }
+  };
+
   /// The local S4 instance. This is the one and only S4 that the tests should
   /// access, so it is a public member (while the other S4 instances are
   /// private).
@@ -62,12 +241,34 @@ public:
   /// A mock object that receives timer pops from S4.
   StrictMock<MockTimerPopConsumer> timer_sink;
 
+  /// Record the time S4 spends in each of the things it uses: the local store,
+  /// the stores used by the remote S4s (i.e. replication to remote sites), and
+  /// Chronos. Benchmarks use these to break down the latency of S4 operations.
+  TimingStore* local_store_timing;
+  std::vector<TimingStore*> remote_store_timing;
+  TimingChronosConnection* chronos_timing;
+
+  /// Record the time S4's handler spends processing each timer pop.
+  TimingHandler* timer_handler_timing;
+
+  /// The simulated WAN link to each remote site's store, by site name. Tests
+  /// may change the delay while S4 is running.
+  std::map<std::string, DelayingStore*> wan_links;
+
+  /// The S4 that replicates to all the remote sites at once, or nullptr if S4
+  /// replicates to them one after another.
+  ParallelRemoteS4* parallel_replication;
+
   /// Constructor
   ///
   /// @param [in] site_name           - The name of the local database site that
   ///                                   this S4 site talks to.
   /// @param [in] deployment_topology - The topology of the entire deployment.
-  S4Site(const std::string& site_name, std::map<std::string, Site::Topology> deployment_topology)
+  /// @param [in] config              - Options for how the site is set up.
+  S4Site(const std::string& site_name,
+         std::map<std::string, Site::Topology> deployment_topology,
+         const Config& config = Config()) :
+    parallel_replication(nullptr)
   {
     // Create a DNS server, http_resolver and astaire_resolver.
     _dns_client = new DnsCachedResolver("127.0.0.1",
@@ -94,9 +295,14 @@ public:
                                             true,
                                             nullptr,
                                             ip_addr));
-        _remote_aor_stores.push_back(new AstaireAoRStore(_remote_stores.back()));
+        int delay_ms = (config.wan_delay_ms.count(item.first) != 0) ?
+                         config.wan_delay_ms.at(item.first) : 0;
+        wan_links[item.first] = new DelayingStore(_remote_stores.back(), delay_ms);
+        remote_store_timing.push_back(new TimingStore(wan_links[item.first]));
+        _remote_aor_stores.push_back(new AstaireAoRStore(remote_store_timing.back()));
         _remote_s4s.push_back(new S4(site_name + "-remote-s4-to-" + item.first,
                                      _remote_aor_stores.back()));
+        _remote_s4s_by_site[item.first] = _remote_s4s.back();
       }
     }
 
@@ -106,7 +312,8 @@ public:
                                                false,
                                                nullptr,
                                                ip_addr);
-    _aor_store = new AstaireAoRStore(_store);
+    local_store_timing = new TimingStore(_store);
+    _aor_store = new AstaireAoRStore(local_store_timing);
     _chronos_http_client = new HttpClient(false,
                                           _http_resolver,
                                           nullptr,
@@ -121,27 +328,38 @@ public:
                                           ip_addr);
     _chronos_http_connection = new HttpConnection(this_site.chronos_domain + ":7253",
                                                   _chronos_http_client);
-    _chronos_connection = new ChronosConnection(ip_addr + ":8088",
-                                                _chronos_http_connection);
+    chronos_timing = new TimingChronosConnection(ip_addr + ":8088",
+                                                 _chronos_http_connection);
+    std::vector<S4*> remote_s4s = _remote_s4s;
+
+    if (config.parallel_replication)
+    {
+      parallel_replication = new ParallelRemoteS4(site_name + "-parallel-remote-s4",
+                                                  _remote_s4s,
+                                                  config.replication_wait);
+      remote_s4s = {parallel_replication};
+    }
+
     s4 = new S4(site_name + "-local-s4",
-                _chronos_connection,
+                chronos_timing,
                 "/timers",
                 _aor_store,
-                _remote_s4s);
+                remote_s4s);
 
     try
     {
       // Create an HTTP stack with no exception handler. This means the tests
       // will crash if they ever hit a signal, but this is probably what we want
       // anyway.
-      _http_stack = new HttpStack(1, nullptr);
+      _http_stack = new HttpStack(config.http_threads, nullptr);
       _http_stack->initialize();
 
       // Register a handler to bind S4 to the HTTP stack.
       _s4_handler_config = new ChronosAoRTimeoutTask::Config(s4);
       _s4_handler = new HttpStackUtils::SpawningHandler<
         ChronosAoRTimeoutTask, ChronosAoRTimeoutTask::Config>(_s4_handler_config);
-      _http_stack->register_handler("^/timers$", _s4_handler);
+      timer_handler_timing = new TimingHandler(_s4_handler);
+      _http_stack->register_handler("^/timers$", timer_handler_timing);
 
       _http_stack->bind_tcp_socket(ip_addr, 8088);
       _http_stack->start(nullptr);
@@ -157,6 +375,35 @@ public:
     s4->register_timer_pop_consumer(&timer_sink);
   }
 
+  /// Read an AoR straight from a remote site's store, without going through
+  /// the local site. Tests use this to check what has been replicated to each
+  /// site.
+  HTTPCode get_from_remote_site(const std::string& remote_site_name,
+                                const std::string& id,
+                                AoR** aor,
+                                uint64_t& version)
+  {
+    return _remote_s4s_by_site.at(remote_site_name)->handle_get(id,
+                                                                aor,
+                                                                version,
+                                                                FAKE_SAS_TRAIL_ID);
+  }
+
+  /// Discard all the timings recorded so far.
+  void clear_timings()
+  {
+    local_store_timing->clear();
+
+    for (TimingStore* s : remote_store_timing)
+    {
+      s->clear();
+    }
+
+    chronos_timing->timer_sets.clear();
+    chronos_timing->timer_deletes.clear();
+    timer_handler_timing->clear();
+  }
+
   /// Destructor.
   virtual ~S4Site()
   {
@@ -177,19 +424,25 @@ public:
       exit(2);
     }
 
-    // Free everything off.
+    // Free everything off. Stop the parallel replication first, as it may still
+    // be writing to the remote S4s.
+    delete parallel_replication; parallel_replication = nullptr;
     for (TopologyNeutralMemcachedStore* s : _remote_stores) { delete s; }
+    for (const std::pair<std::string, DelayingStore*>& item : wan_links) { delete item.second; }
+    for (TimingStore* s : remote_store_timing) { delete s; }
     for (AoRStore* s : _remote_aor_stores) { delete s; }
     for (S4* s : _remote_s4s) { delete s; }
     delete s4; s4 = nullptr;
-    delete _chronos_connection; _chronos_connection = nullptr;
+    delete chronos_timing; chronos_timing = nullptr;
     delete _chronos_http_connection; _chronos_http_connection = nullptr;
     delete _chronos_http_client; _chronos_http_client = nullptr;
     delete _aor_store; _aor_store = nullptr;
+    delete local_store_timing; local_store_timing = nullptr;
     delete _store; _store = nullptr;
     delete _astaire_resolver; _astaire_resolver = nullptr;
     delete _http_resolver; _http_resolver = nullptr;
     delete _dns_client; _dns_client = nullptr;
+    delete timer_handler_timing; timer_handler_timing = nullptr;
     delete _s4_handler; _s4_handler = nullptr;
     delete _s4_handler_config; _s4_handler_config = nullptr;
   }
@@ -203,7 +456,6 @@ private:
   AoRStore* _aor_store;
   HttpClient* _chronos_http_client;
   HttpConnection* _chronos_http_connection;
-  ChronosConnection* _chronos_connection;
   HttpStack* _http_stack;
   HttpStackUtils::SpawningHandler<
     ChronosAoRTimeoutTask, ChronosAoRTimeoutTask::Config>* _s4_handler;
@@ -212,6 +464,7 @@ private:
   std::vector<TopologyNeutralMemcachedStore*> _remote_stores;
   std::vector<AoRStore*> _remote_aor_stores;
   std::vector<S4*> _remote_s4s;
+  std::map<std::string, S4*> _remote_s4s_by_site;
 };
 
 /// Fixture for all S4 solution tests.
@@ -229,21 +482,16 @@ public:
     // need.
     boost::filesystem::create_directory("tmp");
 
-    _deployment_topology.emplace("site1",
-                                 Site::Topology("127.0.1.")
-                                  .with_chronos("chronos.site1")
-                                  .with_rogers("rogers.site1"));
-    _deployment_topology.emplace("site2",
-                                 Site::Topology("127.0.2.")
-                                  .with_chronos("chronos.site2")
-                                  .with_rogers("rogers.site2"));
+    _deployment_topology = Deployment::build_topology(2);
   }
 
   static void TearDownTestCase()
   {
-    _dnsmasq_instance.reset();
+    _dns_server.reset();
     _site1.reset();
     _site2.reset();
+    _deployment.reset();
+    _clock.reset();
 
     boost::filesystem::remove_all("tmp");
 
@@ -266,36 +514,30 @@ public:
     delete _s4_site2; _s4_site2 = nullptr;
   }
 
-  static void create_and_start_sites()
+  /// Creates and starts the sites. The Chronos nodes in all sites follow
+  /// _clock, so that tests can make timers pop without waiting for them.
+  ///
+  /// @param [in] num_sites - The number of sites. This must match
+  ///                         _deployment_topology.
+  static void create_and_start_sites(int num_sites = 2)
   {
-    _site1 = std::shared_ptr<Site>(new Site(1,
-                                            "site1",
-                                            "tmp/site1",
-                                            _deployment_topology,
-                                            2,
-                                            2,
-                                            2));
-    _site1->start();
-    TRC_DEBUG("Started site1");
+    _clock = std::shared_ptr<ControlledClock>(new ControlledClock("tmp/chronos_clock"));
+
+    _deployment = std::shared_ptr<Deployment>(new Deployment(num_sites, "tmp", 2, 2, 2));
+    _deployment->use_controlled_clock(_clock.get());
+    _deployment->start();
 
-    _site2 = std::shared_ptr<Site>(new Site(2,
-                                            "site2",
-                                            "tmp/site2",
-                                            _deployment_topology,
-                                            2,
-                                            2,
-                                            2));
-    _site2->start();
-    TRC_DEBUG("Started site2");
+    _site1 = _deployment->site(1);
+    _site2 = _deployment->site(2);
   }
 
-  /// Creates and starts up a dnsmasq instance to allow S4 to find remote
+  /// Creates and starts up a DNS server to allow S4 to find remote
   /// processes.
   static void create_and_start_dns(const std::map<std::string, std::vector<std::string>>& a_records)
   {
-    _dnsmasq_instance = std::shared_ptr<DnsmasqInstance>(
-      new DnsmasqInstance("127.0.0.1", 5353, a_records));
-    _dnsmasq_instance->start_instance();
+    _dns_server = std::shared_ptr<DnsResponder>(
+      new DnsResponder("127.0.0.1", 5353, a_records));
+    _dns_server->start_instance();
   }
 
   /// Wait for all existing memcached and Rogers instances to come up by
@@ -303,17 +545,12 @@ public:
   /// the instances fail to come up.
   static bool wait_for_instances()
   {
-    if (!_site1->wait_for_instances())
-    {
-      return false;
-    }
-
-    if (!_site2->wait_for_instances())
+    if (!_deployment->wait_for_instances())
     {
       return false;
     }
 
-    if (_dnsmasq_instance && !_dnsmasq_instance->wait_for_instance())
+    if (_dns_server && !_dns_server->wait_for_instance())
     {
       return false;
     }
@@ -326,16 +563,20 @@ public:
 
   /// Use shared pointers for managing the instances so that the memory gets
   /// freed when the vector is cleared.
-  static std::shared_ptr<DnsmasqInstance> _dnsmasq_instance;
+  static std::shared_ptr<DnsResponder> _dns_server;
   static std::map<std::string, Site::Topology> _deployment_topology;
+  static std::shared_ptr<Deployment> _deployment;
   static std::shared_ptr<Site> _site1;
   static std::shared_ptr<Site> _site2;
+  static std::shared_ptr<ControlledClock> _clock;
 };
 
-std::shared_ptr<DnsmasqInstance> BaseS4SolutionTest::_dnsmasq_instance;
+std::shared_ptr<DnsResponder> BaseS4SolutionTest::_dns_server;
 std::map<std::string, Site::Topology> BaseS4SolutionTest::_deployment_topology;
+std::shared_ptr<Deployment> BaseS4SolutionTest::_deployment;
 std::shared_ptr<Site> BaseS4SolutionTest::_site1;
 std::shared_ptr<Site> BaseS4SolutionTest::_site2;
+std::shared_ptr<ControlledClock> BaseS4SolutionTest::_clock;
 
 /// Clear all the memcached and Rogers instances. This calls their
 /// destructors which will kill the underlying processes. Also remove the
@@ -365,15 +606,8 @@ public:
 
     create_and_start_sites();
 
-    // Generate the DNS records for rogers and chronos, and start dnsmasq to
-    // serve these.
-    std::map<std::string, std::vector<std::string>> a_records;
-    a_records[_deployment_topology.at("site1").rogers_domain] = _site1->get_rogers_ips();
-    a_records[_deployment_topology.at("site1").chronos_domain] = _site1->get_chronos_ips();
-    a_records[_deployment_topology.at("site2").rogers_domain] = _site2->get_rogers_ips();
-    a_records[_deployment_topology.at("site2").chronos_domain] = _site2->get_chronos_ips();
-
-    create_and_start_dns(a_records);
+    // Start a DNS server to serve the records for rogers and chronos.
+    create_and_start_dns(_deployment->a_records());
   }
 
   static void TearDownTestCase()
@@ -400,6 +634,7 @@ TEST_F(SimpleS4SolutionTest, TimerTracerBullet)
   // in memcached since S4 adds some time to the expiry time of the records it
   // writes and we don't want to have to sleep at the end of our test.
   uint64_t cas;
+  std::atomic<bool> popped(false);
   EXPECT_CALL(_s4_site1->timer_sink, handle_timer_pop(impu, _))
     .Times(AtLeast(1))  /// @todo figure out why the mock is called more than once under valgrind.
     .WillOnce(
@@ -409,11 +644,24 @@ TEST_F(SimpleS4SolutionTest, TimerTracerBullet)
          }),
          InvokeWithoutArgs([&](){
            _s4_site1->s4->handle_delete(impu, cas, FAKE_SAS_TRAIL_ID);
+         }),
+         InvokeWithoutArgs([&](){
+           popped = true;
          })))
     .WillRepeatedly(Return());
 
-  // Wait for the binding to expire.
-  sleep(5);
+  // Move Chronos's clock on to just after the binding expires, rather than
+  // waiting for it. Stop short of the time Chronos's backup nodes would pop the
+  // timer, so we only get one pop. Allow for the pop taking a little longer in
+  // case S4 sets the timer for slightly after the binding expires.
+  _clock->advance_time_ms(3500);
+
+  for (int ii = 0; (ii < 500) && (!popped); ++ii)
+  {
+    usleep(10000);
+  }
+
+  EXPECT_TRUE(popped);
   delete aor; aor = nullptr;
 
   // Check that the binding has actually gone.
@@ -452,3 +700,834 @@ TEST_F(SimpleS4SolutionTest, TracerBullet)
   delete aor; aor = nullptr;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+///
+/// S4ReplicationTest testcases start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Test fixture that sets up 3 sites, where site 1's S4 replicates to the
+/// other two at once. Site 3 is much further away than site 2.
+class S4ReplicationTest : public BaseS4SolutionTest
+{
+public:
+  static const int SITE2_DELAY_MS = 20;
+  static const int SITE3_DELAY_MS = 500;
+
+  static void SetUpTestCase()
+  {
+    BaseS4SolutionTest::SetUpTestCase();
+
+    _deployment_topology = Deployment::build_topology(3);
+    create_and_start_sites(3);
+    create_and_start_dns(_deployment->a_records());
+  }
+
+  static void TearDownTestCase()
+  {
+    BaseS4SolutionTest::TearDownTestCase();
+  }
+
+  virtual void SetUp()
+  {
+    create_s4_site1(ParallelRemoteS4::Wait::NONE);
+    _s4_site2 = new S4Site("site2", _deployment_topology);
+    _s4_site3 = new S4Site("site3", _deployment_topology);
+
+    // Ensure all our instances are running.
+    EXPECT_TRUE(wait_for_instances());
+  }
+
+  virtual void TearDown()
+  {
+    BaseS4SolutionTest::TearDown();
+    delete _s4_site3; _s4_site3 = nullptr;
+  }
+
+  /// Replace site 1's S4 with one that waits for the given number of remote
+  /// sites.
+  void create_s4_site1(ParallelRemoteS4::Wait wait)
+  {
+    delete _s4_site1; _s4_site1 = nullptr;
+    _s4_site1 = new S4Site("site1",
+                           _deployment_topology,
+                           S4Site::Config()
+                             .with_parallel_replication(wait)
+                             .with_wan_delay("site2", SITE2_DELAY_MS)
+                             .with_wan_delay("site3", SITE3_DELAY_MS));
+  }
+
+  /// Returns the number of bindings a remote site has for an IMPU, or -1 if it
+  /// doesn't have the IMPU.
+  int remote_bindings(const std::string& site_name, const std::string& impu)
+  {
+    AoR* aor = nullptr;
+    uint64_t version;
+    HTTPCode status = _s4_site1->get_from_remote_site(site_name, impu, &aor, version);
+    int bindings = ((status == HTTP_OK) && (aor != nullptr)) ? aor->_bindings.size() : -1;
+    delete aor; aor = nullptr;
+    return bindings;
+  }
+
+  /// Wait up to a minute for a remote site to have the given number of
+  /// bindings for an IMPU - e.g. while a write is retried to a site that has
+  /// come back. This allows for the site's stores being blacklisted for a
+  /// while after it failed.
+  ///
+  /// @return Whether the site has that number of bindings.
+  bool wait_for_remote_bindings(const std::string& site_name,
+                                const std::string& impu,
+                                int expected)
+  {
+    for (int ii = 0; (ii < 600) && (remote_bindings(site_name, impu) != expected); ++ii)
+    {
+      usleep(100000);
+    }
+
+    return (remote_bindings(site_name, impu) == expected);
+  }
+
+  S4Site* _s4_site3;
+};
+
+const int S4ReplicationTest::SITE2_DELAY_MS;
+const int S4ReplicationTest::SITE3_DELAY_MS;
+
+/// Writes that don't wait for any remote site return without waiting for the
+/// WAN, and reach all the sites in the end.
+TEST_F(S4ReplicationTest, FireAndForgetConverges)
+{
+  const std::string impu = "sip:kermit@muppets.com";
+  AoR* aor = build_aor(impu, 2);
+
+  Benchmark::Stopwatch sw;
+  HTTPCode status = _s4_site1->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+  EXPECT_LT(sw.elapsed_us(), (uint64_t)SITE3_DELAY_MS * 1000);
+  EXPECT_EQ(HTTP_OK, status);
+  delete aor; aor = nullptr;
+
+  _s4_site1->parallel_replication->wait_for_idle();
+  EXPECT_EQ(2, remote_bindings("site2", impu));
+  EXPECT_EQ(2, remote_bindings("site3", impu));
+
+  // Deregister, and check the deletion reaches all the sites too.
+  uint64_t version;
+  status = _s4_site1->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+  EXPECT_EQ(HTTP_OK, status);
+  delete aor; aor = nullptr;
+  _s4_site1->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+
+  _s4_site1->parallel_replication->wait_for_idle();
+  EXPECT_EQ(-1, remote_bindings("site2", impu));
+  EXPECT_EQ(-1, remote_bindings("site3", impu));
+}
+
+/// Writes that wait for a quorum only wait for the nearest remote site.
+TEST_F(S4ReplicationTest, QuorumWaitsForNearestSite)
+{
+  create_s4_site1(ParallelRemoteS4::Wait::QUORUM);
+
+  const std::string impu = "sip:kermit@muppets.com";
+  AoR* aor = build_aor(impu, 2);
+
+  Benchmark::Stopwatch sw;
+  HTTPCode status = _s4_site1->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+  EXPECT_LT(sw.elapsed_us(), (uint64_t)SITE3_DELAY_MS * 1000);
+  EXPECT_EQ(HTTP_OK, status);
+  delete aor; aor = nullptr;
+
+  // The write has reached site 2 by the time it returns, and reaches site 3
+  // later.
+  EXPECT_EQ(2, remote_bindings("site2", impu));
+  _s4_site1->parallel_replication->wait_for_idle();
+  EXPECT_EQ(2, remote_bindings("site3", impu));
+
+  uint64_t version;
+  _s4_site1->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+  delete aor; aor = nullptr;
+  _s4_site1->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+  _s4_site1->parallel_replication->wait_for_idle();
+}
+
+/// Writes that wait for a quorum still succeed when a remote site has failed,
+/// and reach the remaining site. The failed site converges with the others
+/// once it comes back, as the write is retried until it gets there.
+TEST_F(S4ReplicationTest, QuorumToleratesRemoteSiteFailure)
+{
+  create_s4_site1(ParallelRemoteS4::Wait::QUORUM);
+  _deployment->site(3)->kill();
+
+  const std::string impu = "sip:kermit@muppets.com";
+  AoR* aor = build_aor(impu, 2);
+  HTTPCode status = _s4_site1->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+  EXPECT_EQ(HTTP_OK, status);
+  delete aor; aor = nullptr;
+
+  // The quorum write has reached site 2 by the time it returns.
+  EXPECT_EQ(2, remote_bindings("site2", impu));
+
+  // Bring site 3 back. The write reaches it without anything else being
+  // written.
+  _deployment->site(3)->start();
+  EXPECT_TRUE(wait_for_instances());
+  EXPECT_TRUE(wait_for_remote_bindings("site3", impu, 2));
+  _s4_site1->parallel_replication->wait_for_idle();
+
+  // Deregister, and check the deletion reaches both sites.
+  uint64_t version;
+  _s4_site1->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+  delete aor; aor = nullptr;
+  _s4_site1->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+  _s4_site1->parallel_replication->wait_for_idle();
+  EXPECT_EQ(-1, remote_bindings("site2", impu));
+  EXPECT_EQ(-1, remote_bindings("site3", impu));
+}
+
+/// Writes that have returned without waiting for the remote sites are lost
+/// from any site they hadn't started replicating to when the local site fails.
+/// The sites converge again once the local site resyncs the AoRs it holds.
+TEST_F(S4ReplicationTest, FireAndForgetLostOnLocalSiteFailure)
+{
+  const std::string impu1 = "sip:kermit@muppets.com";
+  const std::string impu2 = "sip:gonzo@muppets.com";
+
+  // Make two writes straight after each other. The first starts replicating to
+  // both remote sites at once. The second queues behind it, and at site 3 it
+  // is still queued half a second later.
+  AoR* aor = build_aor(impu1, 2);
+  EXPECT_EQ(HTTP_OK, _s4_site1->s4->handle_put(impu1, *aor, FAKE_SAS_TRAIL_ID));
+  delete aor; aor = nullptr;
+  aor = build_aor(impu2, 2);
+  EXPECT_EQ(HTTP_OK, _s4_site1->s4->handle_put(impu2, *aor, FAKE_SAS_TRAIL_ID));
+  delete aor; aor = nullptr;
+
+  // Now lose the local site's replication queue.
+  size_t lost = _s4_site1->parallel_replication->abandon_queued_writes();
+  _s4_site1->parallel_replication->wait_for_idle();
+
+  // The first write was in progress everywhere, so it completes. The second
+  // never reaches site 3. It may or may not have reached site 2, depending on
+  // whether site 2 had finished the first write yet.
+  EXPECT_GE(lost, 1u);
+  EXPECT_EQ(2, remote_bindings("site2", impu1));
+  EXPECT_EQ(2, remote_bindings("site3", impu1));
+  EXPECT_EQ(-1, remote_bindings("site3", impu2));
+
+  // The local site still has the second write, so resyncing it to the remote
+  // sites brings them back in line.
+  uint64_t local_version;
+  ASSERT_EQ(HTTP_OK, _s4_site1->s4->handle_get(impu2, &aor, local_version, FAKE_SAS_TRAIL_ID));
+  EXPECT_EQ(HTTP_OK, _s4_site1->parallel_replication->resync(impu2, *aor, FAKE_SAS_TRAIL_ID));
+  delete aor; aor = nullptr;
+  EXPECT_EQ(2, remote_bindings("site2", impu2));
+  EXPECT_EQ(2, remote_bindings("site3", impu2));
+
+  // Tidy up.
+  for (const std::string& impu : {impu1, impu2})
+  {
+    uint64_t version;
+    _s4_site1->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+    delete aor; aor = nullptr;
+    _s4_site1->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+  }
+
+  _s4_site1->parallel_replication->wait_for_idle();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+///
+/// S4 benchmarks start here.
+///
+////////////////////////////////////////////////////////////////////////////////
+
+/// Benchmark fixture for measuring the cost of SAS logging on the S4 path.
+class S4SasBenchmark : public SimpleS4SolutionTest {};
+
+/// PUT and GET AoRs through S4 with SAS disabled and enabled, and with every
+/// operation traced or only a sample of them. Reports the latency, CPU time and
+/// allocations per operation, and the SAS traffic generated.
+///
+/// Set BENCHMARK_OPS to change the number of operations in each run.
+TEST_F(S4SasBenchmark, S4Path)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 1000);
+
+  FakeSasServer sas_server("127.0.0.50");
+  ASSERT_TRUE(sas_server.start());
+
+  for (bool sas_enabled : {false, true})
+  {
+    if (sas_enabled)
+    {
+      ASSERT_TRUE(start_sas_logging(sas_server.ip()));
+    }
+
+    for (int sample_rate : {1, 100})
+    {
+      std::string name = std::string(sas_enabled ? "sas_enabled" : "sas_disabled") +
+                         "_sample_1_in_" + std::to_string(sample_rate);
+      SCOPED_TRACE(name);
+
+      TrailSampler sampler(sample_rate);
+      Benchmark::CostRecorder put_cost;
+      Benchmark::CostRecorder get_cost;
+      uint64_t sas_bytes_before = sas_server.bytes_received();
+
+      for (int ii = 0; ii < num_ops; ++ii)
+      {
+        std::string impu = "sip:" + name + "-" + std::to_string(ii) + "@muppets.com";
+        SAS::TrailId trail = sampler.next_trail();
+        AoR* aor = build_aor(impu, 2);
+        HTTPCode status;
+
+        put_cost.measure([&]() {
+          status = _s4_site1->s4->handle_put(impu, *aor, trail);
+        });
+        EXPECT_EQ(HTTP_OK, status);
+        delete aor; aor = nullptr;
+
+        uint64_t version;
+        get_cost.measure([&]() {
+          status = _s4_site1->s4->handle_get(impu, &aor, version, trail);
+        });
+        EXPECT_EQ(HTTP_OK, status);
+
+        _s4_site1->s4->handle_delete(impu, version, trail);
+        delete aor; aor = nullptr;
+      }
+
+      // The SAS client sends events from a background thread, so give it a
+      // moment to catch up before counting.
+      sleep(1);
+
+      put_cost.report(name + "_put");
+      get_cost.report(name + "_get");
+      Benchmark::report(name + "_sas_bytes_per_op",
+                        (double)(sas_server.bytes_received() - sas_bytes_before) /
+                          (2 * num_ops));
+    }
+
+    if (sas_enabled)
+    {
+      stop_sas_logging();
+    }
+  }
+}
+
+/// Benchmark fixture for measuring S4 throughput under load.
+class S4LoadBenchmark : public SimpleS4SolutionTest {};
+
+/// Drive a PUT, PATCH, GET and DELETE for each of many IMPUs through site 1's
+/// S4, with increasing numbers of client threads. For each number of threads,
+/// reports:
+/// -  The throughput of S4 operations.
+/// -  The latency of each type of S4 operation.
+/// -  The latency of the operations S4 makes on the local store, on the remote
+///    site's store (i.e. replication) and on Chronos.
+///
+/// Set BENCHMARK_IMPUS to change the number of IMPUs used in each run.
+TEST_F(S4LoadBenchmark, Throughput)
+{
+  const int num_impus = Benchmark::env_int("BENCHMARK_IMPUS", 2000);
+  S4Site* site = _s4_site1;
+
+  for (int num_threads : {1, 2, 4, 8, 16})
+  {
+    std::string name = "threads_" + std::to_string(num_threads);
+    SCOPED_TRACE(name);
+
+    site->clear_timings();
+    Benchmark::LatencyRecorder put_latency;
+    Benchmark::LatencyRecorder patch_latency;
+    Benchmark::LatencyRecorder get_latency;
+    Benchmark::LatencyRecorder delete_latency;
+    std::atomic<int> next_impu(0);
+    std::atomic<int> errors(0);
+
+    // Each thread takes the next IMPU that hasn't been used yet, and runs
+    // through its lifecycle.
+    auto client = [&]() {
+      int ii;
+
+      while ((ii = next_impu++) < num_impus)
+      {
+        std::string impu = "sip:" + name + "-" + std::to_string(ii) + "@muppets.com";
+        Benchmark::Stopwatch sw;
+
+        // Register.
+        AoR* aor = build_aor(impu, 2);
+        sw.restart();
+        HTTPCode status = site->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+        put_latency.record(sw.elapsed_us());
+        errors += (status == HTTP_OK) ? 0 : 1;
+        delete aor; aor = nullptr;
+
+        // Reregister one of the bindings. The binding IDs built by build_aor
+        // are the same each time, so this updates an existing binding.
+        AoR* refresh = build_aor(impu, 1);
+        PatchObject patch;
+        patch._update_bindings = refresh->_bindings;
+        patch._increment_cseq = true;
+        refresh->_bindings.clear();
+        delete refresh; refresh = nullptr;
+
+        sw.restart();
+        status = site->s4->handle_patch(impu, patch, &aor, FAKE_SAS_TRAIL_ID);
+        patch_latency.record(sw.elapsed_us());
+        errors += (status == HTTP_OK) ? 0 : 1;
+        delete aor; aor = nullptr;
+
+        // Read the AoR back, then deregister.
+        uint64_t version;
+        sw.restart();
+        status = site->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+        get_latency.record(sw.elapsed_us());
+        errors += (status == HTTP_OK) ? 0 : 1;
+        delete aor; aor = nullptr;
+
+        sw.restart();
+        site->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+        delete_latency.record(sw.elapsed_us());
+      }
+    };
+
+    Benchmark::Stopwatch run_time;
+    std::vector<std::thread> threads;
+
+    for (int ii = 0; ii < num_threads; ++ii)
+    {
+      threads.emplace_back(client);
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    uint64_t elapsed_us = run_time.elapsed_us();
+    EXPECT_EQ(0, errors.load());
+
+    Benchmark::report(name + "_ops_per_sec",
+                      (double)(4 * num_impus) * 1000000 / elapsed_us);
+    put_latency.report(name + "_put");
+    patch_latency.report(name + "_patch");
+    get_latency.report(name + "_get");
+    delete_latency.report(name + "_delete");
+
+    // Break the latency down into the time spent in each component.
+    Benchmark::LatencyRecorder remote_reads;
+    Benchmark::LatencyRecorder remote_writes;
+
+    for (TimingStore* s : site->remote_store_timing)
+    {
+      remote_reads.merge(s->reads);
+      remote_writes.merge(s->writes);
+    }
+
+    site->local_store_timing->reads.report(name + "_local_store_read");
+    site->local_store_timing->writes.report(name + "_local_store_write");
+    remote_reads.report(name + "_remote_store_read");
+    remote_writes.report(name + "_remote_store_write");
+    site->chronos_timing->timer_sets.report(name + "_chronos_timer_set");
+    site->chronos_timing->timer_deletes.report(name + "_chronos_timer_delete");
+  }
+}
+
+/// Timer pop consumer that does what the subscriber manager does with a pop:
+/// reads the AoR back from S4 to find the bindings that have expired.
+class ReadingTimerPopConsumer : public S4::TimerPopConsumer
+{
+public:
+  ReadingTimerPopConsumer(S4* s4) : pops(0), errors(0), _s4(s4) {}
+
+  void handle_timer_pop(const std::string& aor_id, SAS::TrailId trail)
+  {
+    AoR* aor = nullptr;
+    uint64_t version;
+    HTTPCode status = _s4->handle_get(aor_id, &aor, version, trail);
+    errors += (status == HTTP_OK) ? 0 : 1;
+    ++pops;
+    delete aor; aor = nullptr;
+  }
+
+  /// The number of pops handled, and the number where the AoR couldn't be
+  /// read.
+  std::atomic<int> pops;
+  std::atomic<int> errors;
+
+private:
+  S4* _s4;
+};
+
+/// Benchmark fixture for measuring how S4 handles timer pops from Chronos.
+class S4TimerPopBenchmark : public SimpleS4SolutionTest
+{
+public:
+  /// Replace site 1's S4 with one whose HTTP stack uses the given number of
+  /// threads.
+  void create_s4_site1(int http_threads)
+  {
+    delete _s4_site1; _s4_site1 = nullptr;
+    _s4_site1 = new S4Site("site1",
+                           _deployment_topology,
+                           S4Site::Config().with_http_threads(http_threads));
+  }
+
+  /// Discards the body of HTTP responses.
+  static size_t discard_body(char* ptr, size_t size, size_t nmemb, void* userdata)
+  {
+    return size * nmemb;
+  }
+};
+
+/// Flood site 1's /timers endpoint with timer pops, in the form Chronos sends
+/// them, with increasing numbers of HTTP stack threads. For each number of
+/// threads, reports:
+/// -  The throughput of timer pops.
+/// -  The latency of each pop, as seen by the sender.
+/// -  The latency of S4's spawning handler (which allocates a task for each
+///    request and runs it), and the allocations it makes per request.
+/// -  The latency of the reads S4 makes on the local store while handling them.
+///
+/// When the throughput stops increasing with the number of threads, comparing
+/// the handler latency with the store latency shows whether the time is going
+/// on the request handling itself or on the work it does.
+///
+/// Set BENCHMARK_OPS to change the number of pops sent in each run.
+TEST_F(S4TimerPopBenchmark, Flood)
+{
+  const int num_pops = Benchmark::env_int("BENCHMARK_OPS", 5000);
+  const int num_clients = 16;
+  const int num_impus = 100;
+  const std::string url = _deployment_topology.at("site1").ip_addr_prefix + "1:8088/timers";
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  for (int http_threads : {1, 2, 4, 8, 16})
+  {
+    std::string name = "http_threads_" + std::to_string(http_threads);
+    SCOPED_TRACE(name);
+
+    create_s4_site1(http_threads);
+
+    // Register some IMPUs for the pops to refer to.
+    std::vector<std::string> impus;
+
+    for (int ii = 0; ii < num_impus; ++ii)
+    {
+      impus.push_back("sip:" + name + "-" + std::to_string(ii) + "@muppets.com");
+      AoR* aor = build_aor(impus.back(), 2);
+      EXPECT_EQ(HTTP_OK, _s4_site1->s4->handle_put(impus.back(), *aor, FAKE_SAS_TRAIL_ID));
+      delete aor; aor = nullptr;
+    }
+
+    // Have the pops go to a consumer that does some realistic work rather than
+    // to the mock.
+    ReadingTimerPopConsumer consumer(_s4_site1->s4);
+    _s4_site1->s4->register_timer_pop_consumer(&consumer);
+    _s4_site1->clear_timings();
+
+    Benchmark::LatencyRecorder pop_latency;
+    std::atomic<int> next_pop(0);
+    std::atomic<int> failed_pops(0);
+
+    // Each client sends pops over its own connection, which it keeps open, as
+    // Chronos does.
+    auto client = [&]() {
+      CURL* curl = curl_easy_init();
+      struct curl_slist* headers = curl_slist_append(nullptr,
+                                                     "Content-Type: application/json");
+      curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &S4TimerPopBenchmark::discard_body);
+      curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+      int ii;
+
+      while ((ii = next_pop++) < num_pops)
+      {
+        std::string body = "{\"aor_id\": \"" + impus[ii % num_impus] + "\"}";
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+
+        Benchmark::Stopwatch sw;
+        CURLcode rc = curl_easy_perform(curl);
+        pop_latency.record(sw.elapsed_us());
+
+        long http_rc = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_rc);
+        failed_pops += ((rc == CURLE_OK) && (http_rc == 200)) ? 0 : 1;
+      }
+
+      curl_slist_free_all(headers);
+      curl_easy_cleanup(curl);
+    };
+
+    Benchmark::Stopwatch run_time;
+    std::vector<std::thread> threads;
+
+    for (int ii = 0; ii < num_clients; ++ii)
+    {
+      threads.emplace_back(client);
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    // The consumer may still be finishing the last pops after their responses
+    // have been sent, so wait (for up to 10s) for it to catch up.
+    for (int ii = 0; (ii < 1000) && (consumer.pops.load() < num_pops); ++ii)
+    {
+      usleep(10000);
+    }
+
+    uint64_t elapsed_us = run_time.elapsed_us();
+    EXPECT_EQ(0, failed_pops.load());
+    EXPECT_EQ(num_pops, consumer.pops.load());
+    EXPECT_EQ(0, consumer.errors.load());
+
+    TimingHandler* handler = _s4_site1->timer_handler_timing;
+    uint64_t requests = std::max(handler->requests.load(), (uint64_t)1);
+    Benchmark::report(name + "_pops_per_sec", (double)num_pops * 1000000 / elapsed_us);
+    pop_latency.report(name + "_pop");
+    handler->latency.report(name + "_handler");
+    Benchmark::report(name + "_handler_allocations_per_pop",
+                      (double)handler->allocations / requests);
+    Benchmark::report(name + "_handler_allocated_bytes_per_pop",
+                      (double)handler->allocated_bytes / requests);
+    _s4_site1->local_store_timing->reads.report(name + "_local_store_read");
+
+    // Replace the site, so that its HTTP stack is stopped before the consumer
+    // goes out of scope.
+    create_s4_site1(1);
+  }
+
+  curl_global_cleanup();
+}
+
+/// Benchmark fixture for measuring how S4 scales with the number of sites.
+/// Each run creates its own deployment, so this doesn't create any sites up
+/// front.
+class S4GeoRedundancyBenchmark : public BaseS4SolutionTest
+{
+public:
+  virtual void SetUp() {}
+  virtual void TearDown() {}
+
+  /// Returns the number of bytes the memcached instances in a site have
+  /// received. As all writes reach memcached through Rogers, this measures
+  /// the traffic S4 sends to the site.
+  static uint64_t memcached_bytes_read(const std::shared_ptr<Site>& site)
+  {
+    uint64_t bytes = 0;
+
+    for (const std::shared_ptr<MemcachedInstance>& inst : site->get_memcached_instances())
+    {
+      std::map<std::string, std::string> stats;
+
+      if (inst->get_stats(stats) && (stats.count("bytes_read") != 0))
+      {
+        bytes += strtoull(stats["bytes_read"].c_str(), NULL, 10);
+      }
+    }
+
+    return bytes;
+  }
+};
+
+/// Register IMPUs through site 1's S4 in deployments of 2 to 8 sites. For each
+/// size of deployment, reports:
+/// -  The latency of PUTs, and of the writes to the remote sites' stores.
+/// -  The traffic S4 sends to the local site, and to each remote site, per PUT.
+///
+/// Set BENCHMARK_IMPUS to change the number of IMPUs registered in each run.
+TEST_F(S4GeoRedundancyBenchmark, Replication)
+{
+  const int num_impus = Benchmark::env_int("BENCHMARK_IMPUS", 2000);
+
+  for (int num_sites : {2, 3, 4, 6, 8})
+  {
+    std::string name = "sites_" + std::to_string(num_sites);
+    SCOPED_TRACE(name);
+
+    _deployment = std::shared_ptr<Deployment>(new Deployment(num_sites, "tmp", 1, 1, 1));
+    _deployment->start();
+    create_and_start_dns(_deployment->a_records());
+    ASSERT_TRUE(wait_for_instances());
+
+    std::vector<S4Site*> s4_sites;
+
+    for (int ii = 1; ii <= num_sites; ++ii)
+    {
+      s4_sites.push_back(new S4Site(Deployment::site_name(ii), _deployment->topology()));
+    }
+
+    S4Site* site = s4_sites.front();
+    std::vector<uint64_t> bytes_before;
+
+    for (const std::shared_ptr<Site>& s : _deployment->sites())
+    {
+      bytes_before.push_back(memcached_bytes_read(s));
+    }
+
+    Benchmark::LatencyRecorder put_latency;
+
+    for (int ii = 0; ii < num_impus; ++ii)
+    {
+      std::string impu = "sip:" + name + "-" + std::to_string(ii) + "@muppets.com";
+      AoR* aor = build_aor(impu, 2);
+
+      Benchmark::Stopwatch sw;
+      HTTPCode status = site->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+      put_latency.record(sw.elapsed_us());
+      EXPECT_EQ(HTTP_OK, status);
+      delete aor; aor = nullptr;
+    }
+
+    Benchmark::LatencyRecorder remote_writes;
+
+    for (TimingStore* s : site->remote_store_timing)
+    {
+      remote_writes.merge(s->writes);
+    }
+
+    put_latency.report(name + "_put");
+    remote_writes.report(name + "_remote_store_write");
+
+    // Site 1 is the local site. Report the traffic to the remote sites as an
+    // average, and as a total, since the total is what crosses the WAN.
+    uint64_t local_bytes = memcached_bytes_read(_deployment->site(1)) - bytes_before[0];
+    uint64_t remote_bytes = 0;
+
+    for (int ii = 2; ii <= num_sites; ++ii)
+    {
+      remote_bytes += memcached_bytes_read(_deployment->site(ii)) - bytes_before[ii - 1];
+    }
+
+    Benchmark::report(name + "_local_bytes_per_put", (double)local_bytes / num_impus);
+    Benchmark::report(name + "_remote_bytes_per_put_per_site",
+                      (double)remote_bytes / num_impus / (num_sites - 1));
+    Benchmark::report(name + "_remote_bytes_per_put_total",
+                      (double)remote_bytes / num_impus);
+
+    for (S4Site* s : s4_sites)
+    {
+      delete s;
+    }
+
+    _dns_server.reset();
+    _deployment.reset();
+  }
+}
+
+/// Benchmark fixture for measuring how replication to remote sites over the
+/// WAN affects S4's latency. This sets up the 4 sites of the deployment we
+/// are planning, and site 1's S4 is created separately for each run.
+class S4ReplicationBenchmark : public BaseS4SolutionTest
+{
+public:
+  static void SetUpTestCase()
+  {
+    BaseS4SolutionTest::SetUpTestCase();
+
+    _deployment_topology = Deployment::build_topology(4);
+    create_and_start_sites(4);
+    create_and_start_dns(_deployment->a_records());
+  }
+
+  static void TearDownTestCase()
+  {
+    BaseS4SolutionTest::TearDownTestCase();
+  }
+
+  virtual void SetUp()
+  {
+    _s4_site1 = nullptr;
+    _s4_site2 = nullptr;
+    EXPECT_TRUE(wait_for_instances());
+  }
+};
+
+/// Register and reregister IMPUs through site 1's S4, where the round trip
+/// times to sites 2, 3 and 4 are 10ms, 30ms and 60ms. Compares replicating to
+/// one site after another with replicating to all of them at once, waiting
+/// for all of them, a quorum or none of them. For each, reports the latency
+/// of PUTs and PATCHes.
+///
+/// Set BENCHMARK_IMPUS to change the number of IMPUs registered in each run.
+TEST_F(S4ReplicationBenchmark, WanDelay)
+{
+  const int num_impus = Benchmark::env_int("BENCHMARK_IMPUS", 200);
+
+  std::vector<std::pair<std::string, S4Site::Config>> configs;
+  configs.emplace_back("sequential", S4Site::Config());
+  configs.emplace_back("parallel_all",
+                       S4Site::Config().with_parallel_replication(ParallelRemoteS4::Wait::ALL));
+  configs.emplace_back("parallel_quorum",
+                       S4Site::Config().with_parallel_replication(ParallelRemoteS4::Wait::QUORUM));
+  configs.emplace_back("parallel_none",
+                       S4Site::Config().with_parallel_replication(ParallelRemoteS4::Wait::NONE));
+
+  for (std::pair<std::string, S4Site::Config>& item : configs)
+  {
+    const std::string& name = item.first;
+    SCOPED_TRACE(name);
+
+    S4Site::Config& config = item.second;
+    config.with_wan_delay("site2", 10)
+          .with_wan_delay("site3", 30)
+          .with_wan_delay("site4", 60);
+    _s4_site1 = new S4Site("site1", _deployment_topology, config);
+
+    Benchmark::LatencyRecorder put_latency;
+    Benchmark::LatencyRecorder patch_latency;
+    std::vector<std::string> impus;
+
+    for (int ii = 0; ii < num_impus; ++ii)
+    {
+      impus.push_back("sip:" + name + "-" + std::to_string(ii) + "@muppets.com");
+      const std::string& impu = impus.back();
+
+      AoR* aor = build_aor(impu, 2);
+      Benchmark::Stopwatch sw;
+      HTTPCode status = _s4_site1->s4->handle_put(impu, *aor, FAKE_SAS_TRAIL_ID);
+      put_latency.record(sw.elapsed_us());
+      EXPECT_EQ(HTTP_OK, status);
+      delete aor; aor = nullptr;
+
+      AoR* refresh = build_aor(impu, 1);
+      PatchObject patch;
+      patch._update_bindings = refresh->_bindings;
+      patch._increment_cseq = true;
+      refresh->_bindings.clear();
+      delete refresh; refresh = nullptr;
+
+      sw.restart();
+      status = _s4_site1->s4->handle_patch(impu, patch, &aor, FAKE_SAS_TRAIL_ID);
+      patch_latency.record(sw.elapsed_us());
+      EXPECT_EQ(HTTP_OK, status);
+      delete aor; aor = nullptr;
+    }
+
+    put_latency.report(name + "_put");
+    patch_latency.report(name + "_patch");
+
+    // Tidy up without the WAN delay. Deleting the site waits for any
+    // replication still in progress.
+    for (const std::pair<std::string, DelayingStore*>& link : _s4_site1->wan_links)
+    {
+      link.second->set_delay_ms(0);
+    }
+
+    for (const std::string& impu : impus)
+    {
+      uint64_t version;
+      AoR* aor = nullptr;
+      _s4_site1->s4->handle_get(impu, &aor, version, FAKE_SAS_TRAIL_ID);
+      delete aor; aor = nullptr;
+      _s4_site1->s4->handle_delete(impu, version, FAKE_SAS_TRAIL_ID);
+    }
+
+    delete _s4_site1; _s4_site1 = nullptr;
+  }
+}
@@ -12,9 +12,73 @@
 #endif
 
 #include "test_snmp.h"
+#include "snmpclient.h"
+#include "benchmark.h"
+#include "snmp_percentile_table.h"
+#include "snmp_sharded_counter_table.h"
+#include "snmp_sharded_event_accumulator_table.h"
+#include "snmp_indexed_ip_time_based_counter_table.h"
 #include <string>
+#include <thread>
 
-TEST_F(SNMPTest, ScalarValue)
+/// Runs the SNMP assertions through a single in-process SNMP session, rather
+/// than running snmpget or snmpwalk for each one.
+class InProcessSNMPTest : public SNMPTest
+{
+public:
+  static void TearDownTestCase()
+  {
+    delete _client; _client = NULL;
+    SNMPTest::TearDownTestCase();
+  }
+
+  /// The client is created when it is first used, by which time SNMPTest has
+  /// initialised the net-snmp library.
+  static SnmpClient* client()
+  {
+    if (_client == NULL)
+    {
+      _client = new SnmpClient();
+    }
+
+    return _client;
+  }
+
+  unsigned int snmp_get(const std::string& oid)
+  {
+    return client()->get_uint(oid);
+  }
+
+  std::vector<std::string> snmp_walk(const std::string& oid)
+  {
+    return client()->walk(oid);
+  }
+
+  static SnmpClient* _client;
+};
+
+SnmpClient* InProcessSNMPTest::_client = NULL;
+
+/// Runs the same assertions against each type of counter table, whether it
+/// keeps a single count or counts in per-thread shards.
+template <class T> class CounterTableSNMPTest : public InProcessSNMPTest
+{
+};
+
+typedef ::testing::Types<SNMP::CounterTable,
+                         SNMP::ShardedCounterTable> CounterTableTypes;
+TYPED_TEST_CASE(CounterTableSNMPTest, CounterTableTypes);
+
+/// Runs the same assertions against each type of event accumulator table.
+template <class T> class EventAccumulatorTableSNMPTest : public InProcessSNMPTest
+{
+};
+
+typedef ::testing::Types<SNMP::EventAccumulatorTable,
+                         SNMP::ShardedEventAccumulatorTable> EventAccumulatorTableTypes;
+TYPED_TEST_CASE(EventAccumulatorTableSNMPTest, EventAccumulatorTableTypes);
+
+TEST_F(InProcessSNMPTest, ScalarValue)
 {
   // Create a scalar
   SNMP::U32Scalar scalar("answer", test_oid);
@@ -26,13 +90,13 @@ TEST_F(SNMPTest, ScalarValue)
   ASSERT_EQ(42, snmp_get(".1.2.2.0"));
 }
 
-TEST_F(SNMPTest, TableOrdering)
+TYPED_TEST(EventAccumulatorTableSNMPTest, TableOrdering)
 {
   // Create a table
-  SNMP::EventAccumulatorTable* tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+  TypeParam* tbl = TypeParam::create("latency", this->test_oid);
 
   // Shell out to snmpwalk to find all entries in that table
-  std::vector<std::string> entries = snmp_walk(test_oid);
+  std::vector<std::string> entries = this->snmp_walk(this->test_oid);
 
   // Check that the table has the right number of entries (3 time periods * five
   // entries)
@@ -49,12 +113,12 @@ TEST_F(SNMPTest, TableOrdering)
   delete tbl;
 }
 
-TEST_F(SNMPTest, LatencyCalculations)
+TYPED_TEST(EventAccumulatorTableSNMPTest, LatencyCalculations)
 {
   cwtest_completely_control_time(true);
 
   // Create a table
-  SNMP::EventAccumulatorTable* tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+  TypeParam* tbl = TypeParam::create("latency", this->test_oid);
 
   // Just put one sample in (which should have a variance of 0).
   tbl->accumulate(100);
@@ -63,9 +127,9 @@ TEST_F(SNMPTest, LatencyCalculations)
   cwtest_advance_time_ms(5000);
 
   // Average should be 100
-  ASSERT_EQ(100, snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(100, this->snmp_get(".1.2.2.1.2.1"));
   // Variance should be 0
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.3.1"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.3.1"));
 
   // Now input two samples in this latency period.
   tbl->accumulate(300);
@@ -75,19 +139,19 @@ TEST_F(SNMPTest, LatencyCalculations)
   cwtest_advance_time_ms(5000);
 
   // Average should be 400
-  ASSERT_EQ(400, snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(400, this->snmp_get(".1.2.2.1.2.1"));
   // HWM should be 500
-  ASSERT_EQ(500, snmp_get(".1.2.2.1.4.1"));
+  ASSERT_EQ(500, this->snmp_get(".1.2.2.1.4.1"));
   // LWM should be 300
-  ASSERT_EQ(300, snmp_get(".1.2.2.1.5.1"));
+  ASSERT_EQ(300, this->snmp_get(".1.2.2.1.5.1"));
   // Count should be 2
-  ASSERT_EQ(2, snmp_get(".1.2.2.1.6.1"));
+  ASSERT_EQ(2, this->snmp_get(".1.2.2.1.6.1"));
 
   cwtest_reset_time();
   delete tbl;
 }
 
-TEST_F(SNMPTest, LatencyScopeCalculations)
+TEST_F(InProcessSNMPTest, LatencyScopeCalculations)
 {
   cwtest_completely_control_time(true);
 
@@ -144,6 +208,103 @@ TEST_F(SNMPTest, LatencyScopeCalculations)
   delete tbl;
 }
 
+TEST_F(InProcessSNMPTest, PercentileCalculations)
+{
+  cwtest_completely_control_time(true);
+
+  // Create a table, reporting the default percentiles (50, 90, 99 and 99.9).
+  SNMP::PercentileTable* tbl = SNMP::PercentileTable::create("latency", test_oid);
+
+  // Put in one sample of each value from 1 to 100. This should show up in only
+  // the current 5 minute stats.
+  for (uint32_t sample = 1; sample <= 100; ++sample)
+  {
+    tbl->accumulate(sample);
+  }
+
+  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(100, snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
+  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.3"));
+
+  // Move on five seconds. The "previous five seconds" stats should now reflect
+  // those samples.
+  cwtest_advance_time_ms(5000);
+
+  // Count should be 100
+  ASSERT_EQ(100, snmp_get(".1.2.2.1.2.1"));
+  // Samples of 16 and over share buckets, so the percentiles are reported as
+  // the highest value in their bucket. The median is 50, in bucket 50-51.
+  ASSERT_EQ(51, snmp_get(".1.2.2.1.3.1"));
+  // p90 is 90, in bucket 88-91
+  ASSERT_EQ(91, snmp_get(".1.2.2.1.4.1"));
+  // p99 is 99, in bucket 96-99
+  ASSERT_EQ(99, snmp_get(".1.2.2.1.5.1"));
+  // p99.9 is 100, in bucket 100-103
+  ASSERT_EQ(103, snmp_get(".1.2.2.1.6.1"));
+
+  // Now input samples from 1 to 10, which are counted exactly.
+  for (uint32_t sample = 1; sample <= 10; ++sample)
+  {
+    tbl->accumulate(sample);
+  }
+
+  cwtest_advance_time_ms(5000);
+
+  ASSERT_EQ(10, snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(5, snmp_get(".1.2.2.1.3.1"));
+  ASSERT_EQ(9, snmp_get(".1.2.2.1.4.1"));
+  ASSERT_EQ(10, snmp_get(".1.2.2.1.5.1"));
+  ASSERT_EQ(10, snmp_get(".1.2.2.1.6.1"));
+
+  // The current 5 minutes has all the samples. Values 1 to 10 appear twice,
+  // so the median is 45, in bucket 44-45.
+  ASSERT_EQ(110, snmp_get(".1.2.2.1.2.2"));
+  ASSERT_EQ(45, snmp_get(".1.2.2.1.3.2"));
+
+  // Move on five minutes. The samples move to the previous 5 minutes, and the
+  // other periods are empty.
+  cwtest_advance_time_ms(5 * 60 * 1000);
+
+  ASSERT_EQ(110, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(45, snmp_get(".1.2.2.1.3.3"));
+
+  for (int time_period : {1, 2})
+  {
+    for (int column : {2, 3, 4, 5, 6})
+    {
+      ASSERT_EQ(0, snmp_get(".1.2.2.1." + std::to_string(column) + "." + std::to_string(time_period)));
+    }
+  }
+
+  cwtest_reset_time();
+  delete tbl;
+}
+
+TEST_F(InProcessSNMPTest, PercentileTableColumns)
+{
+  // Create a table reporting just two percentiles.
+  SNMP::PercentileTable* tbl = SNMP::PercentileTable::create("latency", test_oid, {25, 75});
+
+  // Check the table has a count and a column for each percentile, for each of
+  // the three time periods.
+  std::vector<std::string> entries = snmp_walk(test_oid);
+  ASSERT_EQ(9, entries.size());
+  ASSERT_EQ(".1.2.2.1.2.1 = 0", entries[0]);
+  ASSERT_EQ(".1.2.2.1.3.1 = 0", entries[3]);
+  ASSERT_EQ(".1.2.2.1.4.3 = 0", entries[8]);
+
+  for (uint32_t sample = 1; sample <= 8; ++sample)
+  {
+    tbl->accumulate(sample);
+  }
+
+  ASSERT_EQ(8, snmp_get(".1.2.2.1.2.2"));
+  ASSERT_EQ(2, snmp_get(".1.2.2.1.3.2"));
+  ASSERT_EQ(6, snmp_get(".1.2.2.1.4.2"));
+
+  delete tbl;
+}
+
 enum EventStats
 {
   MEAN = 1,
@@ -160,7 +321,7 @@ enum TimeScope
   PREV_5M = 3
 };
 
-TEST_F(SNMPTest, StringBasedEventStats)
+TEST_F(InProcessSNMPTest, StringBasedEventStats)
 {
   cwtest_completely_control_time(true);
 
@@ -270,44 +431,44 @@ TEST_F(SNMPTest, StringBasedEventStats)
   delete tbl;
 }
 
-TEST_F(SNMPTest, CounterTimePeriods)
+TYPED_TEST(CounterTableSNMPTest, CounterTimePeriods)
 {
   cwtest_completely_control_time(true);
   // Create a table indexed by time period
-  SNMP::CounterTable* tbl = SNMP::CounterTable::create("counter", test_oid);
+  TypeParam* tbl = TypeParam::create("counter", this->test_oid);
 
   // At first, all three rows (previous 5s, current 5m, previous 5m) should have a zero value
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.2"));
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.2"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.3"));
 
   // Increment the counter. This should show up in the current-five-minute stats, but nowhere else.
   tbl->increment();
 
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
-  ASSERT_EQ(1, snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(1, this->snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.3"));
 
   // Move on five seconds. The "previous five seconds" stat should now also reflect the increment.
   cwtest_advance_time_ms(5000);
 
-  ASSERT_EQ(1, snmp_get(".1.2.2.1.2.1"));
-  ASSERT_EQ(1, snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(1, this->snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(1, this->snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.3"));
 
   // Move on five more seconds. The "previous five seconds" stat should no longer reflect the increment.
   cwtest_advance_time_ms(5000);
 
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
-  ASSERT_EQ(1, snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(1, this->snmp_get(".1.2.2.1.2.2")); // Current 5 minutes
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.3"));
 
   // Move on five minutes. Only the "previous five minutes" stat should now reflect the increment.
   cwtest_advance_time_ms(300000);
 
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.2"));
-  ASSERT_EQ(1, snmp_get(".1.2.2.1.2.3"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.2"));
+  ASSERT_EQ(1, this->snmp_get(".1.2.2.1.2.3"));
 
   // Increment the counter again and move on ten seconds
   tbl->increment();
@@ -315,13 +476,13 @@ TEST_F(SNMPTest, CounterTimePeriods)
 
   // That increment shouldn't be in the "previous 5 seconds" stat (because it was made 10 seconds
   // ago).
-  ASSERT_EQ(0, snmp_get(".1.2.2.1.2.1"));
+  ASSERT_EQ(0, this->snmp_get(".1.2.2.1.2.1"));
 
   cwtest_reset_time();
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPCountTable)
+TEST_F(InProcessSNMPTest, IPCountTable)
 {
   // Create a table
   SNMP::IPCountTable* tbl = SNMP::IPCountTable::create("ip-counter", test_oid);
@@ -336,7 +497,7 @@ TEST_F(SNMPTest, IPCountTable)
   delete tbl;
 }
 
-TEST_F(SNMPTest, SuccessFailCountTable)
+TEST_F(InProcessSNMPTest, SuccessFailCountTable)
 {
   cwtest_completely_control_time(true);
 
@@ -363,7 +524,7 @@ TEST_F(SNMPTest, SuccessFailCountTable)
   delete tbl;
 }
 
-TEST_F(SNMPTest, SingleCountByNodeTypeTable)
+TEST_F(InProcessSNMPTest, SingleCountByNodeTypeTable)
 {
   cwtest_completely_control_time(true);
 
@@ -404,7 +565,7 @@ TEST_F(SNMPTest, SingleCountByNodeTypeTable)
   delete tbl;
 }
 
-TEST_F(SNMPTest, SuccessFailCountByRequestTypeTable)
+TEST_F(InProcessSNMPTest, SuccessFailCountByRequestTypeTable)
 {
   cwtest_completely_control_time(true);
 
@@ -511,7 +672,7 @@ void jump_to_next_periodstart(uint32_t interval_ms)
   cwtest_advance_time_ms(interval_ms - (ms_since_epoch % interval_ms));
 }
 
-TEST_F(SNMPTest, ContinuousAccumulatorTable)
+TEST_F(InProcessSNMPTest, ContinuousAccumulatorTable)
 {
   cwtest_completely_control_time(true);
 
@@ -589,7 +750,7 @@ TEST_F(SNMPTest, ContinuousAccumulatorTable)
   delete tbl;
 }
 
-TEST_F(SNMPTest, CxCounterTable)
+TEST_F(InProcessSNMPTest, CxCounterTable)
 {
   cwtest_completely_control_time(true);
 
@@ -635,7 +796,7 @@ TEST_F(SNMPTest, CxCounterTable)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableSingleIPZeroCount)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableSingleIPZeroCount)
 {
   cwtest_completely_control_time(true);
 
@@ -661,7 +822,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableSingleIPZeroCount)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableRefcountIP)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableRefcountIP)
 {
   cwtest_completely_control_time(true);
 
@@ -694,7 +855,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableRefcountIP)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableRefcountDeleteIP)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableRefcountDeleteIP)
 {
   cwtest_completely_control_time(true);
 
@@ -724,7 +885,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableRefcountDeleteIP)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableSingleIP)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableSingleIP)
 {
   cwtest_completely_control_time(true);
 
@@ -752,7 +913,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableSingleIP)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableMultipleIPs)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableMultipleIPs)
 {
   cwtest_completely_control_time(true);
 
@@ -794,7 +955,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableMultipleIPs)
   delete tbl;
 }
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableRemoveIP)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableRemoveIP)
 {
   cwtest_completely_control_time(true);
 
@@ -838,7 +999,7 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableRemoveIP)
 }
 
 
-TEST_F(SNMPTest, IPTimeBasedCounterTableAddCountsAgeOut)
+TEST_F(InProcessSNMPTest, IPTimeBasedCounterTableAddCountsAgeOut)
 {
   cwtest_completely_control_time(true);
 
@@ -889,3 +1050,484 @@ TEST_F(SNMPTest, IPTimeBasedCounterTableAddCountsAgeOut)
   cwtest_reset_time();
   delete tbl;
 }
+
+/// Check the in-process client sees exactly what the net-snmp command line
+/// tools do, for both integer and string indexed tables.
+TEST_F(InProcessSNMPTest, MatchesCommandLineTools)
+{
+  cwtest_completely_control_time(true);
+
+  SNMP::TimeAndStringBasedEventTable* tbl = SNMP::TimeAndStringBasedEventTable::create("Latency", test_oid);
+  std::string string1_oid = "16.115.101.114.118.101.114.49.46.100.99.49.46.122.111.110.101";
+  tbl->accumulate("server1.dc1.zone", 100);
+  tbl->accumulate("server1.dc1.zone", 300);
+  tbl->accumulate("server2.dc1.zone", 200);
+  cwtest_advance_time_ms(5000);
+
+  std::vector<std::string> entries = snmp_walk(test_oid);
+  ASSERT_EQ(30, entries.size());
+  EXPECT_EQ(SNMPTest::snmp_walk(test_oid), entries);
+
+  for (int stat : {MEAN, VAR, HWM, LWM, COUNT})
+  {
+    for (int scope : {PREV_5S, CURR_5M, PREV_5M})
+    {
+      std::string oid = time_string_event_oid(test_oid, stat, scope, string1_oid);
+      EXPECT_EQ(SNMPTest::snmp_get(oid), snmp_get(oid));
+    }
+  }
+
+  // An OID that doesn't exist reads the same way too.
+  EXPECT_EQ(SNMPTest::snmp_get(".1.2.2.1.99.1"), snmp_get(".1.2.2.1.99.1"));
+
+  cwtest_reset_time();
+  delete tbl;
+}
+
+/// Check that the hash indexed IP table reads back exactly the same as
+/// IPTimeBasedCounterTable, as IPs are added, counted and removed, and as
+/// their counts age out. The indexed table is registered under a second OID,
+/// so both can be walked at once.
+TEST_F(InProcessSNMPTest, IndexedIPTableMatchesTable)
+{
+  cwtest_completely_control_time(true);
+  const std::string indexed_oid = ".1.2.3";
+
+  SNMP::IPTimeBasedCounterTable* tbl =
+    SNMP::IPTimeBasedCounterTable::create("ip_time_based_counter", test_oid);
+  SNMP::IndexedIPTimeBasedCounterTable* indexed_tbl =
+    SNMP::IndexedIPTimeBasedCounterTable::create("indexed_ip_time_based_counter", indexed_oid);
+
+  auto add_ip = [&](const std::string& ip) { tbl->add_ip(ip); indexed_tbl->add_ip(ip); };
+  auto remove_ip = [&](const std::string& ip) { tbl->remove_ip(ip); indexed_tbl->remove_ip(ip); };
+  auto increment = [&](const std::string& ip) { tbl->increment(ip); indexed_tbl->increment(ip); };
+
+  // Walk a table, and strip the table's OID from each entry, so that tables
+  // under different OIDs can be compared.
+  auto walk = [&](const std::string& oid) {
+    std::vector<std::string> entries = snmp_walk(oid);
+
+    for (std::string& entry : entries)
+    {
+      entry = entry.substr(oid.size());
+    }
+
+    return entries;
+  };
+
+  // One IP with two references, one of which is released, one which is
+  // removed altogether, and one which is counted but never removed.
+  add_ip("192.168.0.1");
+  add_ip("192.168.0.1");
+  increment("192.168.0.1");
+  increment("192.168.0.1");
+  remove_ip("192.168.0.1");
+
+  add_ip("192.168.0.2");
+  increment("192.168.0.2");
+  remove_ip("192.168.0.2");
+
+  add_ip("10.0.0.3");
+  increment("10.0.0.3");
+  increment("10.0.0.3");
+  increment("10.0.0.3");
+
+  // Counts for an IP that isn't tracked are ignored.
+  increment("192.168.0.4");
+
+  std::vector<std::string> entries = walk(indexed_oid);
+  ASSERT_EQ(6, entries.size());
+  EXPECT_EQ(".1.4.1.4.10.0.0.3.2 = 3", entries[1]); // Current 5 minutes
+  EXPECT_EQ(".1.4.1.4.192.168.0.1.2 = 2", entries[4]); // Current 5 minutes
+  EXPECT_EQ(walk(test_oid), entries);
+
+  // Check the counts as they move through the time periods, with some more
+  // counts part way through.
+  for (int step_ms : {5000, 5000, 5 * 60 * 1000 - 5000, 5 * 60 * 1000})
+  {
+    SCOPED_TRACE(step_ms);
+    cwtest_advance_time_ms(step_ms);
+    EXPECT_EQ(walk(test_oid), walk(indexed_oid));
+
+    increment("10.0.0.3");
+    EXPECT_EQ(walk(test_oid), walk(indexed_oid));
+  }
+
+  remove_ip("192.168.0.1");
+  remove_ip("10.0.0.3");
+  EXPECT_EQ(0, snmp_walk(test_oid).size());
+  EXPECT_EQ(0, snmp_walk(indexed_oid).size());
+
+  cwtest_reset_time();
+  delete indexed_tbl;
+  delete tbl;
+}
+
+/// Check that the sharded tables read back exactly the same as the SNMP
+/// tables they replace, when both are given the same samples from many
+/// threads. The sharded tables are registered under a second OID, so both can
+/// be read at once.
+TEST_F(InProcessSNMPTest, ShardedTablesMatchTables)
+{
+  cwtest_completely_control_time(true);
+  const int num_threads = 8;
+  const int samples_per_thread = 1000;
+  const std::string sharded_oid = ".1.2.3";
+
+  SNMP::CounterTable* counter_tbl = SNMP::CounterTable::create("counter", test_oid);
+  SNMP::ShardedCounterTable* sharded_counter_tbl = SNMP::ShardedCounterTable::create("sharded_counter", sharded_oid);
+  std::vector<std::thread> threads;
+
+  for (int tt = 0; tt < num_threads; ++tt)
+  {
+    threads.emplace_back([&]() {
+      for (int ii = 0; ii < samples_per_thread; ++ii)
+      {
+        counter_tbl->increment();
+        sharded_counter_tbl->increment();
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  threads.clear();
+  ASSERT_EQ(num_threads * samples_per_thread, snmp_get(".1.2.3.1.2.2")); // Current 5 minutes
+  ASSERT_EQ(snmp_get(".1.2.2.1.2.2"), snmp_get(".1.2.3.1.2.2"));
+  delete sharded_counter_tbl;
+  delete counter_tbl;
+
+  SNMP::EventAccumulatorTable* accumulator_tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+  SNMP::ShardedEventAccumulatorTable* sharded_accumulator_tbl = SNMP::ShardedEventAccumulatorTable::create("sharded_latency", sharded_oid);
+
+  for (int tt = 0; tt < num_threads; ++tt)
+  {
+    threads.emplace_back([&, tt]() {
+      for (int ii = 0; ii < samples_per_thread; ++ii)
+      {
+        uint32_t sample = 100 + (ii * 7 + tt * 13) % 500;
+        accumulator_tbl->accumulate(sample);
+        sharded_accumulator_tbl->accumulate(sample);
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  // Check the current five minutes, then move on five seconds, so the samples
+  // are in the previous five seconds row, and check that too.
+  ASSERT_EQ(num_threads * samples_per_thread, snmp_get(".1.2.3.1.6.2"));
+
+  for (int column : {2, 3, 4, 5, 6})
+  {
+    std::string row = "1." + std::to_string(column) + ".2";
+    ASSERT_EQ(snmp_get(test_oid + "." + row), snmp_get(sharded_oid + "." + row));
+  }
+
+  cwtest_advance_time_ms(5000);
+
+  for (int column : {2, 3, 4, 5, 6})
+  {
+    std::string row = "1." + std::to_string(column) + ".1";
+    ASSERT_EQ(snmp_get(test_oid + "." + row), snmp_get(sharded_oid + "." + row));
+  }
+
+  // The current five minutes carries on, but the previous five seconds starts
+  // from scratch.
+  cwtest_advance_time_ms(5000);
+  ASSERT_EQ(0, snmp_get(".1.2.3.1.6.1"));
+  ASSERT_EQ(num_threads * samples_per_thread, snmp_get(".1.2.3.1.6.2"));
+
+  cwtest_reset_time();
+  delete sharded_accumulator_tbl;
+  delete accumulator_tbl;
+}
+
+class SNMPQueryBenchmark : public InProcessSNMPTest
+{
+};
+
+/// Compare the cost of reading statistics through the in-process client with
+/// running the net-snmp command line tools. Reports the latency of:
+/// -  Getting a single value, each way.
+/// -  Walking a table of 15 values, each way.
+///
+/// Set BENCHMARK_OPS to change the number of gets and walks made each way.
+TEST_F(SNMPQueryBenchmark, GetAndWalk)
+{
+  const int num_ops = Benchmark::env_int("BENCHMARK_OPS", 200);
+  SNMP::EventAccumulatorTable* tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+  tbl->accumulate(100);
+
+  Benchmark::LatencyRecorder tools_get;
+  Benchmark::LatencyRecorder tools_walk;
+  Benchmark::LatencyRecorder client_get;
+  Benchmark::LatencyRecorder client_walk;
+
+  for (int ii = 0; ii < num_ops; ++ii)
+  {
+    Benchmark::Stopwatch sw;
+    SNMPTest::snmp_get(".1.2.2.1.6.2");
+    tools_get.record(sw.elapsed_us());
+
+    Benchmark::Stopwatch sw2;
+    SNMPTest::snmp_walk(test_oid);
+    tools_walk.record(sw2.elapsed_us());
+
+    Benchmark::Stopwatch sw3;
+    snmp_get(".1.2.2.1.6.2");
+    client_get.record(sw3.elapsed_us());
+
+    Benchmark::Stopwatch sw4;
+    snmp_walk(test_oid);
+    client_walk.record(sw4.elapsed_us());
+  }
+
+  EXPECT_EQ(1, snmp_get(".1.2.2.1.6.2"));
+
+  tools_get.report("tools_get");
+  tools_walk.report("tools_walk");
+  client_get.report("client_get");
+  client_walk.report("client_walk");
+  Benchmark::report("get_speedup", tools_get.mean() / client_get.mean());
+  Benchmark::report("walk_speedup", tools_walk.mean() / client_walk.mean());
+
+  delete tbl;
+}
+
+class SNMPContentionBenchmark : public InProcessSNMPTest
+{
+public:
+  /// Run an operation the given number of times on each of a number of
+  /// threads at once, and report its cost.
+  template <class F> static void run(const std::string& name,
+                                     int num_threads,
+                                     int ops_per_thread,
+                                     F fn)
+  {
+    std::vector<std::thread> threads;
+    Benchmark::Stopwatch sw;
+
+    for (int tt = 0; tt < num_threads; ++tt)
+    {
+      threads.emplace_back([&]() {
+        for (int ii = 0; ii < ops_per_thread; ++ii)
+        {
+          fn(ii);
+        }
+      });
+    }
+
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+
+    uint64_t elapsed_us = sw.elapsed_us();
+    uint64_t ops = (uint64_t)num_threads * ops_per_thread;
+
+    Benchmark::report(name + "_ops_per_sec", (double)ops * 1000000 / elapsed_us);
+    Benchmark::report(name + "_thread_ns_per_op",
+                      (double)elapsed_us * 1000 / ops_per_thread);
+  }
+};
+
+/// Increment counters and accumulate samples from an increasing number of
+/// threads at once, using both the SNMP tables and the sharded tables.
+/// Reports, for each number of threads and each type of statistic:
+/// -  The total rate of updates.
+/// -  The wall clock time each thread takes per update. This stays flat as
+///    threads are added if updates don't contend.
+///
+/// Set BENCHMARK_OPS to change the number of updates made by each thread.
+TEST_F(SNMPContentionBenchmark, Increment)
+{
+  const int ops_per_thread = Benchmark::env_int("BENCHMARK_OPS", 100000);
+
+  for (int num_threads : {1, 2, 4, 8, 16, 32, 64})
+  {
+    std::string suffix = "_" + std::to_string(num_threads) + "_threads";
+    SCOPED_TRACE(suffix);
+
+    SNMP::CounterTable* counter_tbl = SNMP::CounterTable::create("counter", test_oid);
+    run("counter_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      counter_tbl->increment();
+    });
+    delete counter_tbl;
+
+    SNMP::ShardedCounterTable* sharded_counter_tbl = SNMP::ShardedCounterTable::create("counter", test_oid);
+    run("sharded_counter_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      sharded_counter_tbl->increment();
+    });
+    delete sharded_counter_tbl;
+
+    SNMP::EventAccumulatorTable* accumulator_tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+    run("accumulator_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      accumulator_tbl->accumulate(100 + ii % 500);
+    });
+    delete accumulator_tbl;
+
+    SNMP::ShardedEventAccumulatorTable* sharded_accumulator_tbl = SNMP::ShardedEventAccumulatorTable::create("latency", test_oid);
+    run("sharded_accumulator_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      sharded_accumulator_tbl->accumulate(100 + ii % 500);
+    });
+    delete sharded_accumulator_tbl;
+  }
+}
+
+/// Accumulate latencies into a percentile table from an increasing number of
+/// threads, compared with an event accumulator table, and read the
+/// percentiles back over SNMP. Reports:
+/// -  The rate and per-thread cost of accumulating into each type of table.
+/// -  The latency of walking the percentile table, which works out the
+///    percentiles from its histograms.
+///
+/// Set BENCHMARK_OPS to change the number of samples added by each thread.
+TEST_F(SNMPContentionBenchmark, Percentiles)
+{
+  const int ops_per_thread = Benchmark::env_int("BENCHMARK_OPS", 100000);
+
+  for (int num_threads : {1, 4, 16, 64})
+  {
+    std::string suffix = "_" + std::to_string(num_threads) + "_threads";
+    SCOPED_TRACE(suffix);
+
+    SNMP::EventAccumulatorTable* accumulator_tbl = SNMP::EventAccumulatorTable::create("latency", test_oid);
+    run("accumulator_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      accumulator_tbl->accumulate(100 + ii % 5000);
+    });
+    delete accumulator_tbl;
+
+    SNMP::PercentileTable* percentile_tbl = SNMP::PercentileTable::create("latency", test_oid);
+    run("percentile_table" + suffix, num_threads, ops_per_thread, [&](int ii) {
+      percentile_tbl->accumulate(100 + ii % 5000);
+    });
+
+    Benchmark::LatencyRecorder walk_latency;
+
+    for (int ii = 0; ii < 100; ++ii)
+    {
+      Benchmark::Stopwatch sw;
+      EXPECT_EQ(15, snmp_walk(test_oid).size());
+      walk_latency.record(sw.elapsed_us());
+    }
+
+    walk_latency.report("percentile_table_walk" + suffix);
+    delete percentile_tbl;
+  }
+}
+
+class SNMPIPCounterBenchmark : public InProcessSNMPTest
+{
+public:
+  /// Track many IPs, count events for them from one thread and then from
+  /// many, walk the table, and remove the IPs again. Both types of table have
+  /// the same interface, so this works for both.
+  ///
+  /// The memory for each IP is the bytes this thread allocated and didn't
+  /// free while adding the IPs, from the allocation counters (so it is only
+  /// reported under `make bench`). Unlike the process's resident memory, this
+  /// isn't affected by memory freed by earlier tables but kept by malloc.
+  template <class T> void measure(const std::string& name,
+                                  T& tbl,
+                                  const std::vector<std::string>& ips)
+  {
+    const int num_ips = ips.size();
+    uint64_t allocated_before = Benchmark::thread_allocated_bytes();
+    uint64_t freed_before = Benchmark::thread_freed_bytes();
+    Benchmark::Stopwatch sw;
+
+    for (const std::string& ip : ips)
+    {
+      tbl.add_ip(ip);
+    }
+
+    uint64_t add_us = sw.elapsed_us();
+    uint64_t allocated = Benchmark::thread_allocated_bytes() - allocated_before;
+    uint64_t freed = Benchmark::thread_freed_bytes() - freed_before;
+
+    Benchmark::report(name + "_add_ip_ns", (double)add_us * 1000 / num_ips);
+    Benchmark::report(name + "_bytes_per_ip",
+                      ((double)allocated - (double)freed) / num_ips);
+
+    for (int num_threads : {1, 8})
+    {
+      std::vector<std::thread> threads;
+      sw.restart();
+
+      for (int tt = 0; tt < num_threads; ++tt)
+      {
+        threads.emplace_back([&, tt]() {
+          // Step through the IPs in a scattered order.
+          for (int ii = 0; ii < num_ips; ++ii)
+          {
+            tbl.increment(ips[((uint64_t)ii * 7919 + tt) % num_ips]);
+          }
+        });
+      }
+
+      for (std::thread& thread : threads)
+      {
+        thread.join();
+      }
+
+      uint64_t increment_us = sw.elapsed_us();
+      std::string prefix = name + "_" + std::to_string(num_threads) + "_threads";
+      Benchmark::report(prefix + "_increment_thread_ns",
+                        (double)increment_us * 1000 / num_ips);
+      Benchmark::report(prefix + "_increments_per_sec",
+                        (double)num_threads * num_ips * 1000000 / increment_us);
+    }
+
+    sw.restart();
+    std::vector<std::string> entries = snmp_walk(test_oid);
+    Benchmark::report(name + "_walk_ms", (double)sw.elapsed_us() / 1000);
+    EXPECT_EQ(3 * ips.size(), entries.size());
+
+    sw.restart();
+
+    for (const std::string& ip : ips)
+    {
+      tbl.remove_ip(ip);
+    }
+
+    Benchmark::report(name + "_remove_ip_ns", (double)sw.elapsed_us() * 1000 / num_ips);
+  }
+};
+
+/// Track a large number of peer IPs, in both IPTimeBasedCounterTable and the
+/// hash indexed IndexedIPTimeBasedCounterTable. Reports, for each:
+/// -  The cost of adding, counting for, and removing each IP. Counting is
+///    measured from one thread, and from eight at once.
+/// -  The memory allocated for each IP.
+/// -  The time taken to walk the table over SNMP.
+///
+/// Set BENCHMARK_IPS to change the number of IPs.
+TEST_F(SNMPIPCounterBenchmark, ManyIPs)
+{
+  const int num_ips = Benchmark::env_int("BENCHMARK_IPS", 100000);
+  std::vector<std::string> ips;
+
+  for (int ii = 0; ii < num_ips; ++ii)
+  {
+    ips.push_back("10." + std::to_string((ii >> 16) & 0xff) + "." +
+                  std::to_string((ii >> 8) & 0xff) + "." +
+                  std::to_string(ii & 0xff));
+  }
+
+  SNMP::IPTimeBasedCounterTable* tbl =
+    SNMP::IPTimeBasedCounterTable::create("ip_time_based_counter", test_oid);
+  measure("table", *tbl, ips);
+  delete tbl;
+
+  SNMP::IndexedIPTimeBasedCounterTable* indexed_tbl =
+    SNMP::IndexedIPTimeBasedCounterTable::create("indexed_ip_time_based_counter", test_oid);
+  measure("indexed_table", *indexed_tbl, ips);
+  delete indexed_tbl;
+}
@@ -0,0 +1,201 @@
+/**
+ * @file timeshim.cpp Library that lets tests control the time seen by the
+ * processes they spawn.
+ *
+ * This is built as a shared library of its own, not into the test binary. See
+ * timeshim.h for how it is used.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include <dlfcn.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "timeshim.h"
+
+static const int64_t NS_PER_SEC = 1000000000;
+
+typedef int (*clock_gettime_fn)(clockid_t, struct timespec*);
+typedef int (*gettimeofday_fn)(struct timeval*, void*);
+typedef time_t (*time_fn)(time_t*);
+typedef int (*pthread_cond_timedwait_fn)(pthread_cond_t*,
+                                         pthread_mutex_t*,
+                                         const struct timespec*);
+typedef int (*clock_nanosleep_fn)(clockid_t,
+                                  int,
+                                  const struct timespec*,
+                                  struct timespec*);
+
+static clock_gettime_fn real_clock_gettime;
+static gettimeofday_fn real_gettimeofday;
+static time_fn real_time;
+static pthread_cond_timedwait_fn real_pthread_cond_timedwait;
+static clock_nanosleep_fn real_clock_nanosleep;
+
+/// The shared state, or NULL if the shim isn't being controlled.
+static TimeShim::State* state = NULL;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/// Look up the real functions and map the state file. This runs when the
+/// library is loaded, or earlier if another library's constructor reads the
+/// time first.
+static void time_shim_init()
+{
+  real_clock_gettime = (clock_gettime_fn)dlsym(RTLD_NEXT, "clock_gettime");
+  real_gettimeofday = (gettimeofday_fn)dlsym(RTLD_NEXT, "gettimeofday");
+  real_time = (time_fn)dlsym(RTLD_NEXT, "time");
+  real_clock_nanosleep = (clock_nanosleep_fn)dlsym(RTLD_NEXT, "clock_nanosleep");
+
+  // pthread_cond_timedwait has two versions, and dlsym doesn't always pick
+  // the one that matches pthread_cond_init.
+  real_pthread_cond_timedwait =
+    (pthread_cond_timedwait_fn)dlvsym(RTLD_NEXT, "pthread_cond_timedwait", "GLIBC_2.3.2");
+
+  if (real_pthread_cond_timedwait == NULL)
+  {
+    real_pthread_cond_timedwait =
+      (pthread_cond_timedwait_fn)dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+  }
+
+  const char* file = getenv(TimeShim::FILE_ENV_VAR);
+
+  if (file != NULL)
+  {
+    int fd = open(file, O_RDWR);
+
+    if (fd >= 0)
+    {
+      void* mem = mmap(NULL,
+                       sizeof(TimeShim::State),
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED,
+                       fd,
+                       0);
+      close(fd);
+
+      if (mem != MAP_FAILED)
+      {
+        state = (TimeShim::State*)mem;
+      }
+    }
+  }
+}
+
+__attribute__((constructor))
+static void time_shim_load()
+{
+  pthread_once(&init_once, time_shim_init);
+}
+
+static int64_t offset_ns()
+{
+  return (state != NULL) ? state->offset_ns.load() : 0;
+}
+
+static void add_ns(struct timespec* ts, int64_t ns)
+{
+  int64_t total_ns = ts->tv_sec * NS_PER_SEC + ts->tv_nsec + ns;
+  ts->tv_sec = total_ns / NS_PER_SEC;
+  ts->tv_nsec = total_ns % NS_PER_SEC;
+}
+
+/// Whether a clock is one the shim should move. Clocks that measure CPU time
+/// aren't affected.
+static bool is_shifted_clock(clockid_t clk_id)
+{
+  return ((clk_id == CLOCK_REALTIME) ||
+          (clk_id == CLOCK_REALTIME_COARSE) ||
+          (clk_id == CLOCK_MONOTONIC) ||
+          (clk_id == CLOCK_MONOTONIC_COARSE) ||
+          (clk_id == CLOCK_MONOTONIC_RAW) ||
+          (clk_id == CLOCK_BOOTTIME));
+}
+
+extern "C" int clock_gettime(clockid_t clk_id, struct timespec* tp)
+{
+  pthread_once(&init_once, time_shim_init);
+
+  int rc = real_clock_gettime(clk_id, tp);
+
+  if ((rc == 0) && (is_shifted_clock(clk_id)))
+  {
+    add_ns(tp, offset_ns());
+  }
+
+  return rc;
+}
+
+extern "C" int gettimeofday(struct timeval* tv, void* tz)
+{
+  pthread_once(&init_once, time_shim_init);
+
+  int rc = real_gettimeofday(tv, tz);
+
+  if ((rc == 0) && (tv != NULL))
+  {
+    int64_t total_us = tv->tv_sec * 1000000 + tv->tv_usec + offset_ns() / 1000;
+    tv->tv_sec = total_us / 1000000;
+    tv->tv_usec = total_us % 1000000;
+  }
+
+  return rc;
+}
+
+extern "C" time_t time(time_t* t)
+{
+  pthread_once(&init_once, time_shim_init);
+
+  time_t now = real_time(NULL) + offset_ns() / NS_PER_SEC;
+
+  if (t != NULL)
+  {
+    *t = now;
+  }
+
+  return now;
+}
+
+/// The process works out the deadline to wait until from the clock it sees,
+/// but the kernel compares it to the real clock. Move the deadline back by the
+/// offset so the wait ends at the right time. (This assumes the condition
+/// uses one of the clocks the shim moves, which is true of every condition
+/// that is waited on with a deadline.)
+extern "C" int pthread_cond_timedwait(pthread_cond_t* cond,
+                                      pthread_mutex_t* mutex,
+                                      const struct timespec* abstime)
+{
+  pthread_once(&init_once, time_shim_init);
+
+  struct timespec real_abstime = *abstime;
+  add_ns(&real_abstime, -offset_ns());
+  return real_pthread_cond_timedwait(cond, mutex, &real_abstime);
+}
+
+extern "C" int clock_nanosleep(clockid_t clk_id,
+                               int flags,
+                               const struct timespec* request,
+                               struct timespec* remain)
+{
+  pthread_once(&init_once, time_shim_init);
+
+  if ((flags & TIMER_ABSTIME) && (is_shifted_clock(clk_id)))
+  {
+    struct timespec real_request = *request;
+    add_ns(&real_request, -offset_ns());
+    return real_clock_nanosleep(clk_id, flags, &real_request, remain);
+  }
+
+  return real_clock_nanosleep(clk_id, flags, request, remain);
+}
@@ -0,0 +1,41 @@
+/**
+ * @file timeshim.h Interface between the time shim library and the tests that
+ * control it.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TIMESHIM_H__
+#define TIMESHIM_H__
+
+#include <atomic>
+#include <stdint.h>
+
+/// The time shim is a library that is preloaded (with LD_PRELOAD) into
+/// processes the tests spawn, so that the tests can control the time those
+/// processes see. It adds an offset to every clock the process reads, and
+/// takes the offset away from the deadlines the process waits for.
+///
+/// The offset is stored in a small file that the shim and the test both map
+/// into memory, so the test can change it while the process is running.
+namespace TimeShim
+{
+  /// The environment variable that holds the path of the state file. If this
+  /// isn't set, the shim has no effect.
+  static const char* const FILE_ENV_VAR = "CWTEST_TIME_SHIM_FILE";
+
+  /// The contents of the state file.
+  struct State
+  {
+    /// The number of nanoseconds to add to the time. This is only ever
+    /// increased, so the clocks never go backwards.
+    std::atomic<int64_t> offset_ns;
+  };
+}
+
+#endif
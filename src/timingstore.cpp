@@ -0,0 +1,71 @@
+/**
+ * @file timingstore.cpp Store that records how long each operation on another
+ * store takes.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#include "timingstore.h"
+
+Store::Status TimingStore::get_data(const std::string& table,
+                                    const std::string& key,
+                                    std::string& data,
+                                    uint64_t& cas,
+                                    SAS::TrailId trail)
+{
+  Benchmark::Stopwatch sw;
+  Store::Status status = _store->get_data(table, key, data, cas, trail);
+  reads.record(sw.elapsed_us());
+  return status;
+}
+
+
+Store::Status TimingStore::set_data(const std::string& table,
+                                    const std::string& key,
+                                    const std::string& data,
+                                    uint64_t cas,
+                                    int expiry,
+                                    SAS::TrailId trail)
+{
+  Benchmark::Stopwatch sw;
+  Store::Status status = _store->set_data(table, key, data, cas, expiry, trail);
+  writes.record(sw.elapsed_us());
+  return status;
+}
+
+
+Store::Status TimingStore::set_data_without_cas(const std::string& table,
+                                                const std::string& key,
+                                                const std::string& data,
+                                                int expiry,
+                                                SAS::TrailId trail)
+{
+  Benchmark::Stopwatch sw;
+  Store::Status status = _store->set_data_without_cas(table, key, data, expiry, trail);
+  writes.record(sw.elapsed_us());
+  return status;
+}
+
+
+Store::Status TimingStore::delete_data(const std::string& table,
+                                       const std::string& key,
+                                       SAS::TrailId trail)
+{
+  Benchmark::Stopwatch sw;
+  Store::Status status = _store->delete_data(table, key, trail);
+  deletes.record(sw.elapsed_us());
+  return status;
+}
+
+
+void TimingStore::clear()
+{
+  reads.clear();
+  writes.clear();
+  deletes.clear();
+}
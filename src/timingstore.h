@@ -0,0 +1,72 @@
+/**
+ * @file timingstore.h Store that records how long each operation on another
+ * store takes.
+ *
+ * Copyright (C) Metaswitch Networks 2018
+ * If license terms are provided to you in a COPYING file in the root directory
+ * of the source code repository by which you are accessing this code, then
+ * the license outlined in that COPYING file applies to your use.
+ * Otherwise no rights are granted except for those provided to you by
+ * Metaswitch Networks in a separate written agreement.
+ */
+
+#ifndef TIMINGSTORE_H__
+#define TIMINGSTORE_H__
+
+#include <string>
+
+#include "store.h"
+#include "benchmark.h"
+
+/// Store that sits in front of another store and records the latency of every
+/// operation passed through to it. Benchmarks use this to break the latency of
+/// a higher level operation (such as an S4 PUT) down into the time spent in
+/// each of the stores it uses.
+class TimingStore : public Store
+{
+public:
+  /// Constructor.
+  ///
+  /// @param [in] store - The underlying store. This is not owned by the timing
+  ///                     store.
+  TimingStore(Store* store) : _store(store) {}
+  virtual ~TimingStore() {}
+
+  Store::Status get_data(const std::string& table,
+                         const std::string& key,
+                         std::string& data,
+                         uint64_t& cas,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data(const std::string& table,
+                         const std::string& key,
+                         const std::string& data,
+                         uint64_t cas,
+                         int expiry,
+                         SAS::TrailId trail = 0);
+
+  Store::Status set_data_without_cas(const std::string& table,
+                                     const std::string& key,
+                                     const std::string& data,
+                                     int expiry,
+                                     SAS::TrailId trail = 0);
+
+  Store::Status delete_data(const std::string& table,
+                            const std::string& key,
+                            SAS::TrailId trail = 0);
+
+  bool has_servers() { return _store->has_servers(); }
+
+  /// Discard all the samples recorded so far.
+  void clear();
+
+  /// The latencies of reads, writes (with or without CAS) and deletes.
+  Benchmark::LatencyRecorder reads;
+  Benchmark::LatencyRecorder writes;
+  Benchmark::LatencyRecorder deletes;
+
+private:
+  Store* _store;
+};
+
+#endif